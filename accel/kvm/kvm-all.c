@@ -37,6 +37,7 @@
 #include "exec/ram_addr.h"
 #include "qemu/event_notifier.h"
 #include "qemu/main-loop.h"
+#include "qemu/lockable.h"
 #include "trace.h"
 #include "hw/irq.h"
 #include "qapi/visitor.h"
@@ -314,6 +315,32 @@ err:
     return ret;
 }
 
+static struct KVMDirtyRingReaper *kvm_dirty_ring_reaper_of(KVMState *s,
+                                                            CPUState *cpu)
+{
+    return &s->reapers[cpu->cpu_index % s->kvm_dirty_ring_reapers];
+}
+
+static void kvm_dirty_ring_reaper_add_vcpu(KVMState *s, CPUState *cpu)
+{
+    struct KVMDirtyRingReaper *r = kvm_dirty_ring_reaper_of(s, cpu);
+
+    QEMU_LOCK_GUARD(&r->lock);
+    g_ptr_array_add(r->vcpus, cpu);
+}
+
+/*
+ * Once this returns, the reaper owning @cpu is not walking its dirty ring
+ * and will not look at it again, so the ring can be unmapped.
+ */
+static void kvm_dirty_ring_reaper_del_vcpu(KVMState *s, CPUState *cpu)
+{
+    struct KVMDirtyRingReaper *r = kvm_dirty_ring_reaper_of(s, cpu);
+
+    QEMU_LOCK_GUARD(&r->lock);
+    g_ptr_array_remove(r->vcpus, cpu);
+}
+
 static int do_kvm_destroy_vcpu(CPUState *cpu)
 {
     KVMState *s = kvm_state;
@@ -341,10 +368,12 @@ static int do_kvm_destroy_vcpu(CPUState *cpu)
     }
 
     if (cpu->kvm_dirty_gfns) {
+        kvm_dirty_ring_reaper_del_vcpu(s, cpu);
         ret = munmap(cpu->kvm_dirty_gfns, s->kvm_dirty_ring_bytes);
         if (ret < 0) {
             goto err;
         }
+        cpu->kvm_dirty_gfns = NULL;
     }
 
     vcpu = g_malloc0(sizeof(*vcpu));
@@ -435,6 +464,7 @@ int kvm_init_vcpu(CPUState *cpu, Error **errp)
             ret = -errno;
             goto err;
         }
+        kvm_dirty_ring_reaper_add_vcpu(s, cpu);
     }
 
     ret = kvm_arch_init_vcpu(cpu);
@@ -683,13 +713,14 @@ static uint32_t kvm_dirty_ring_reap_one(KVMState *s, CPUState *cpu)
     /*
      * It's possible that we race with vcpu creation code where the vcpu is
      * put onto the vcpus list but not yet initialized the dirty ring
-     * structures.  If so, skip it.
+     * structures, or with vcpu destruction code that has already unmapped
+     * the ring.  If so, skip it.
      */
-    if (!cpu->created) {
+    if (!cpu->created || !dirty_gfns) {
         return 0;
     }
 
-    assert(dirty_gfns && ring_size);
+    assert(ring_size);
     trace_kvm_dirty_ring_reap_vcpu(cpu->cpu_index);
 
     while (true) {
@@ -707,6 +738,12 @@ static uint32_t kvm_dirty_ring_reap_one(KVMState *s, CPUState *cpu)
     cpu->kvm_fetch_index = fetch;
     cpu->dirty_pages += count;
 
+    /* Read locklessly by query-stats */
+    qatomic_set(&cpu->kvm_dirty_ring_fill, count);
+    if (count > cpu->kvm_dirty_ring_fill_peak) {
+        qatomic_set(&cpu->kvm_dirty_ring_fill_peak, count);
+    }
+
     return count;
 }
 
@@ -741,6 +778,44 @@ static uint64_t kvm_dirty_ring_reap_locked(KVMState *s, CPUState* cpu)
     return total;
 }
 
+/*
+ * Reap the rings of the vCPUs owned by reaper @r.  This does not need the
+ * BQL: the vCPUs cannot go away while @r->lock is held, and the rings are
+ * still walked and reset under kvm_slots_lock() for the same reasons as
+ * in kvm_dirty_ring_reap().
+ */
+static uint64_t kvm_dirty_ring_reap_shard(KVMState *s,
+                                          struct KVMDirtyRingReaper *r)
+{
+    uint64_t total = 0;
+    int64_t stamp;
+    guint i;
+    int ret;
+
+    QEMU_LOCK_GUARD(&r->lock);
+    kvm_slots_lock();
+    stamp = get_clock();
+
+    for (i = 0; i < r->vcpus->len; i++) {
+        total += kvm_dirty_ring_reap_one(s, g_ptr_array_index(r->vcpus, i));
+    }
+
+    if (total) {
+        ret = kvm_vm_ioctl(s, KVM_RESET_DIRTY_RINGS);
+        assert(ret == total);
+    }
+
+    stamp = get_clock() - stamp;
+    kvm_slots_unlock();
+
+    if (total) {
+        trace_kvm_dirty_ring_reap_shard((int)(r - s->reapers), total,
+                                        stamp / 1000);
+    }
+
+    return total;
+}
+
 /*
  * Currently for simplicity, we must hold BQL before calling this.  We can
  * consider to drop the BQL if we're clear with all the race conditions.
@@ -1368,8 +1443,8 @@ static void kvm_set_phys_mem(KVMMemoryListener *kml,
 
 static void *kvm_dirty_ring_reaper_thread(void *data)
 {
-    KVMState *s = data;
-    struct KVMDirtyRingReaper *r = &s->reaper;
+    struct KVMDirtyRingReaper *r = data;
+    KVMState *s = kvm_state;
 
     rcu_register_thread();
 
@@ -1391,9 +1466,13 @@ static void *kvm_dirty_ring_reaper_thread(void *data)
         trace_kvm_dirty_ring_reaper("wakeup");
         r->reaper_state = KVM_DIRTY_RING_REAPER_REAPING;
 
-        qemu_mutex_lock_iothread();
-        kvm_dirty_ring_reap(s, NULL);
-        qemu_mutex_unlock_iothread();
+        if (s->kvm_dirty_ring_reapers > 1) {
+            kvm_dirty_ring_reap_shard(s, r);
+        } else {
+            qemu_mutex_lock_iothread();
+            kvm_dirty_ring_reap(s, NULL);
+            qemu_mutex_unlock_iothread();
+        }
 
         r->reaper_iteration++;
     }
@@ -1407,11 +1486,24 @@ static void *kvm_dirty_ring_reaper_thread(void *data)
 
 static void kvm_dirty_ring_reaper_init(KVMState *s)
 {
-    struct KVMDirtyRingReaper *r = &s->reaper;
+    struct KVMDirtyRingReaper *r;
+    uint32_t i;
+
+    s->reapers = g_new0(struct KVMDirtyRingReaper, s->kvm_dirty_ring_reapers);
+
+    for (i = 0; i < s->kvm_dirty_ring_reapers; i++) {
+        g_autofree char *name = NULL;
+
+        r = &s->reapers[i];
+        qemu_mutex_init(&r->lock);
+        r->vcpus = g_ptr_array_new();
 
-    qemu_thread_create(&r->reaper_thr, "kvm-reaper",
-                       kvm_dirty_ring_reaper_thread,
-                       s, QEMU_THREAD_JOINABLE);
+        name = s->kvm_dirty_ring_reapers > 1 ?
+            g_strdup_printf("kvm-reaper-%u", i) : g_strdup("kvm-reaper");
+        qemu_thread_create(&r->reaper_thr, name,
+                           kvm_dirty_ring_reaper_thread,
+                           r, QEMU_THREAD_JOINABLE);
+    }
 }
 
 static int kvm_dirty_ring_init(KVMState *s)
@@ -2927,19 +3019,32 @@ int kvm_cpu_exec(CPUState *cpu)
              * still full.  Got kicked by KVM_RESET_DIRTY_RINGS.
              */
             trace_kvm_dirty_ring_full(cpu->cpu_index);
-            qemu_mutex_lock_iothread();
-            /*
-             * We throttle vCPU by making it sleep once it exit from kernel
-             * due to dirty ring full. In the dirtylimit scenario, reaping
-             * all vCPUs after a single vCPU dirty ring get full result in
-             * the miss of sleep, so just reap the ring-fulled vCPU.
-             */
-            if (dirtylimit_in_service()) {
-                kvm_dirty_ring_reap(kvm_state, cpu);
+            if (kvm_state->kvm_dirty_ring_reapers > 1 &&
+                !dirtylimit_in_service()) {
+                /*
+                 * With sharded reapers only collect the shard of this
+                 * vCPU, so that one full ring does not stall every other
+                 * vCPU on the BQL.
+                 */
+                kvm_dirty_ring_reap_shard(kvm_state,
+                                          kvm_dirty_ring_reaper_of(kvm_state,
+                                                                   cpu));
             } else {
-                kvm_dirty_ring_reap(kvm_state, NULL);
+                qemu_mutex_lock_iothread();
+                /*
+                 * We throttle vCPU by making it sleep once it exit from
+                 * kernel due to dirty ring full. In the dirtylimit scenario,
+                 * reaping all vCPUs after a single vCPU dirty ring get full
+                 * result in the miss of sleep, so just reap the ring-fulled
+                 * vCPU.
+                 */
+                if (dirtylimit_in_service()) {
+                    kvm_dirty_ring_reap(kvm_state, cpu);
+                } else {
+                    kvm_dirty_ring_reap(kvm_state, NULL);
+                }
+                qemu_mutex_unlock_iothread();
             }
-            qemu_mutex_unlock_iothread();
             dirtylimit_vcpu_execute(cpu);
             ret = 0;
             break;
@@ -3585,6 +3690,39 @@ static void kvm_set_dirty_ring_size(Object *obj, Visitor *v,
     s->kvm_dirty_ring_size = value;
 }
 
+static void kvm_get_dirty_ring_reapers(Object *obj, Visitor *v,
+                                       const char *name, void *opaque,
+                                       Error **errp)
+{
+    KVMState *s = KVM_STATE(obj);
+    uint32_t value = s->kvm_dirty_ring_reapers;
+
+    visit_type_uint32(v, name, &value, errp);
+}
+
+static void kvm_set_dirty_ring_reapers(Object *obj, Visitor *v,
+                                       const char *name, void *opaque,
+                                       Error **errp)
+{
+    KVMState *s = KVM_STATE(obj);
+    uint32_t value;
+
+    if (s->fd != -1) {
+        error_setg(errp, "Cannot set properties after the accelerator has been initialized");
+        return;
+    }
+
+    if (!visit_type_uint32(v, name, &value, errp)) {
+        return;
+    }
+    if (!value) {
+        error_setg(errp, "dirty-ring-reapers must be at least 1.");
+        return;
+    }
+
+    s->kvm_dirty_ring_reapers = value;
+}
+
 static void kvm_accel_instance_init(Object *obj)
 {
     KVMState *s = KVM_STATE(obj);
@@ -3597,6 +3735,7 @@ static void kvm_accel_instance_init(Object *obj)
     /* KVM dirty ring is by default off */
     s->kvm_dirty_ring_size = 0;
     s->kvm_dirty_ring_with_bitmap = false;
+    s->kvm_dirty_ring_reapers = 1;
     s->kvm_eager_split_size = 0;
     s->notify_vmexit = NOTIFY_VMEXIT_OPTION_RUN;
     s->notify_window = 0;
@@ -3643,6 +3782,12 @@ static void kvm_accel_class_init(ObjectClass *oc, void *data)
     object_class_property_set_description(oc, "dirty-ring-size",
         "Size of KVM dirty page ring buffer (default: 0, i.e. use bitmap)");
 
+    object_class_property_add(oc, "dirty-ring-reapers", "uint32",
+        kvm_get_dirty_ring_reapers, kvm_set_dirty_ring_reapers,
+        NULL, NULL);
+    object_class_property_set_description(oc, "dirty-ring-reapers",
+        "Number of threads collecting the KVM dirty rings (default: 1)");
+
     kvm_arch_accel_class_init(oc);
 }
 
@@ -3811,6 +3956,43 @@ exit:
     return list;
 }
 
+/*
+ * Dirty ring occupancy is tracked by QEMU while reaping, so it is not part
+ * of the binary stats KVM exposes for the vCPU; add it by hand.
+ */
+static StatsList *add_dirty_ring_stat(const char *name, uint64_t value,
+                                      strList *names, StatsList *stats_list)
+{
+    Stats *stats;
+
+    if (!apply_str_list_filter(name, names)) {
+        return stats_list;
+    }
+
+    stats = g_new0(Stats, 1);
+    stats->name = g_strdup(name);
+    stats->value = g_new0(StatsValue, 1);
+    stats->value->u.scalar = value;
+    stats->value->type = QTYPE_QNUM;
+
+    QAPI_LIST_PREPEND(stats_list, stats);
+    return stats_list;
+}
+
+static StatsSchemaValueList *add_dirty_ring_schema(const char *name,
+                                                   StatsType type,
+                                                   StatsSchemaValueList *list)
+{
+    StatsSchemaValue *value = g_new0(StatsSchemaValue, 1);
+
+    value->name = g_strdup(name);
+    value->type = type;
+    value->exponent = 0;
+
+    QAPI_LIST_PREPEND(list, value);
+    return list;
+}
+
 /* Cached stats descriptors */
 typedef struct StatsDescriptors {
     const char *ident; /* cache key, currently the StatsTarget */
@@ -3927,6 +4109,16 @@ static void query_stats(StatsResultList **result, StatsTarget target,
         stats_list = add_kvmstat_entry(pdesc, stats, stats_list, errp);
     }
 
+    if (target == STATS_TARGET_VCPU && kvm_state->kvm_dirty_ring_size) {
+        uint32_t fill = qatomic_read(&cpu->kvm_dirty_ring_fill);
+        uint32_t peak = qatomic_read(&cpu->kvm_dirty_ring_fill_peak);
+
+        stats_list = add_dirty_ring_stat("dirty_ring_fill", fill,
+                                         names, stats_list);
+        stats_list = add_dirty_ring_stat("dirty_ring_fill_peak", peak,
+                                         names, stats_list);
+    }
+
     if (!stats_list) {
         return;
     }
@@ -3971,6 +4163,13 @@ static void query_stats_schema(StatsSchemaList **result, StatsTarget target,
         stats_list = add_kvmschema_entry(pdesc, stats_list, errp);
     }
 
+    if (target == STATS_TARGET_VCPU && kvm_state->kvm_dirty_ring_size) {
+        stats_list = add_dirty_ring_schema("dirty_ring_fill",
+                                           STATS_TYPE_INSTANT, stats_list);
+        stats_list = add_dirty_ring_schema("dirty_ring_fill_peak",
+                                           STATS_TYPE_PEAK, stats_list);
+    }
+
     add_stats_schema(result, STATS_PROVIDER_KVM, target, stats_list);
 }
 
@@ -428,6 +428,7 @@ BlockDriverState *bdrv_new(void)
 
     qemu_co_mutex_init(&bs->bsc_modify_lock);
     bs->block_status_cache = g_new0(BdrvBlockStatusCache, 1);
+    qemu_mutex_init(&bs->extent_cache.lock);
 
     for (i = 0; i < bdrv_drain_all_count; i++) {
         bdrv_drained_begin(bs);
@@ -1423,6 +1424,8 @@ static void GRAPH_WRLOCK bdrv_child_cb_attach(BdrvChild *child)
     BlockDriverState *bs = child->opaque;
 
     assert_bdrv_graph_writable();
+    /* Cached results may point to the node that this child replaces */
+    bdrv_extent_cache_clear(bs);
     QLIST_INSERT_HEAD(&bs->children, child, next);
     if (bs->drv->is_filter || (child->role & BDRV_CHILD_FILTERED)) {
         /*
@@ -1469,6 +1472,7 @@ static void GRAPH_WRLOCK bdrv_child_cb_detach(BdrvChild *child)
     }
 
     assert_bdrv_graph_writable();
+    bdrv_extent_cache_clear(bs);
     QLIST_REMOVE(child, next);
     if (child == bs->backing) {
         assert(child != bs->file);
@@ -5022,6 +5026,7 @@ static void GRAPH_UNLOCKED bdrv_reopen_commit(BDRVReopenState *reopen_state)
     if (drv->bdrv_reopen_commit) {
         drv->bdrv_reopen_commit(reopen_state);
     }
+    bdrv_extent_cache_clear(bs);
 
     GRAPH_RDLOCK_GUARD_MAINLOOP();
 
@@ -5114,6 +5119,7 @@ static void bdrv_close(BlockDriverState *bs)
     bs->full_open_options = NULL;
     g_free(bs->block_status_cache);
     bs->block_status_cache = NULL;
+    bdrv_extent_cache_clear(bs);
 
     bdrv_release_named_dirty_bitmaps(bs);
     assert(QLIST_EMPTY(&bs->dirty_bitmaps));
@@ -5501,6 +5507,7 @@ static void bdrv_delete(BlockDriverState *bs)
     bdrv_close(bs);
 
     qemu_mutex_destroy(&bs->reqs_lock);
+    qemu_mutex_destroy(&bs->extent_cache.lock);
 
     g_free(bs);
 }
@@ -5590,6 +5597,8 @@ fail:
 int coroutine_fn bdrv_co_check(BlockDriverState *bs,
                                BdrvCheckResult *res, BdrvCheckMode fix)
 {
+    int ret;
+
     IO_CODE();
     assert_bdrv_graph_readable();
     if (bs->drv == NULL) {
@@ -5600,7 +5609,12 @@ int coroutine_fn bdrv_co_check(BlockDriverState *bs,
     }
 
     memset(res, 0, sizeof(*res));
-    return bs->drv->bdrv_co_check(bs, res, fix);
+    ret = bs->drv->bdrv_co_check(bs, res, fix);
+    if (fix) {
+        /* Repairs may have changed the mapping of clusters */
+        bdrv_extent_cache_clear(bs);
+    }
+    return ret;
 }
 
 /*
@@ -6859,6 +6873,9 @@ int coroutine_fn bdrv_co_invalidate_cache(BlockDriverState *bs, Error **errp)
     assert(!(bs->open_flags & BDRV_O_INACTIVE));
     assert_bdrv_graph_readable();
 
+    /* Another process may have changed the image while it was inactive */
+    bdrv_extent_cache_clear(bs);
+
     if (bs->drv->bdrv_co_invalidate_cache) {
         bs->drv->bdrv_co_invalidate_cache(bs, &local_err);
         if (local_err) {
@@ -6928,6 +6945,7 @@ static int GRAPH_RDLOCK bdrv_inactivate_recurse(BlockDriverState *bs)
     assert(!(bs->open_flags & BDRV_O_INACTIVE));
 
     /* Inactivate this node */
+    bdrv_extent_cache_clear(bs);
     if (bs->drv->bdrv_inactivate) {
         ret = bs->drv->bdrv_inactivate(bs);
         if (ret < 0) {
@@ -7672,6 +7690,8 @@ int bdrv_amend_options(BlockDriverState *bs, QemuOpts *opts,
                        bool force,
                        Error **errp)
 {
+    int ret;
+
     GLOBAL_STATE_CODE();
     if (!bs->drv) {
         error_setg(errp, "Node is ejected");
@@ -7682,8 +7702,10 @@ int bdrv_amend_options(BlockDriverState *bs, QemuOpts *opts,
                    bs->drv->format_name);
         return -ENOTSUP;
     }
-    return bs->drv->bdrv_amend_options(bs, opts, status_cb,
-                                       cb_opaque, force, errp);
+    ret = bs->drv->bdrv_amend_options(bs, opts, status_cb,
+                                      cb_opaque, force, errp);
+    bdrv_extent_cache_clear(bs);
+    return ret;
 }
 
 /*
@@ -8135,6 +8157,7 @@ int bdrv_make_empty(BdrvChild *c, Error **errp)
     }
 
     ret = drv->bdrv_make_empty(c->bs);
+    bdrv_extent_cache_clear(c->bs);
     if (ret < 0) {
         error_setg_errno(errp, -ret, "Failed to empty %s",
                          c->bs->filename);
@@ -8379,3 +8402,232 @@ void bdrv_bsc_fill(BlockDriverState *bs, int64_t offset, int64_t bytes)
         g_free_rcu(old_bsc, rcu);
     }
 }
+
+/* Cached results beyond this number are dropped all at once */
+#define BDRV_EXTENT_CACHE_MAX 4096
+
+typedef struct BdrvExtentCacheEntry {
+    IntervalTreeNode node;
+    int status;
+    bool want_zero;
+    int64_t map;
+    BlockDriverState *file;
+} BdrvExtentCacheEntry;
+
+static void bdrv_extent_cache_remove_locked(BdrvExtentCache *ec,
+                                            BdrvExtentCacheEntry *e)
+{
+    interval_tree_remove(&e->node, &ec->extents);
+    ec->nb_extents--;
+    g_free(e);
+}
+
+static void bdrv_extent_cache_clear_locked(BdrvExtentCache *ec)
+{
+    IntervalTreeNode *node;
+
+    while ((node = interval_tree_iter_first(&ec->extents, 0, UINT64_MAX))) {
+        bdrv_extent_cache_remove_locked(ec,
+            container_of(node, BdrvExtentCacheEntry, node));
+    }
+    assert(ec->nb_extents == 0);
+}
+
+/* Remove all entries that overlap [start, last] */
+static void bdrv_extent_cache_remove_range_locked(BdrvExtentCache *ec,
+                                                  uint64_t start,
+                                                  uint64_t last)
+{
+    IntervalTreeNode *node, *next;
+
+    node = interval_tree_iter_first(&ec->extents, start, last);
+    while (node) {
+        next = interval_tree_iter_next(node, start, last);
+        bdrv_extent_cache_remove_locked(ec,
+            container_of(node, BdrvExtentCacheEntry, node));
+        node = next;
+    }
+}
+
+/**
+ * See block_int.h for this function's documentation.
+ */
+bool bdrv_extent_cache_enabled(BlockDriverState *bs)
+{
+    /*
+     * Only format drivers with backing files, which are what block status
+     * queries walk through.  Their result depends only on their own
+     * metadata, which is changed by writes through the node.  Protocol
+     * nodes use the block-status cache above instead.
+     */
+    return bs->drv && bs->drv->supports_backing &&
+           bs->drv->bdrv_co_block_status;
+}
+
+/**
+ * See block_int.h for this function's documentation.
+ */
+int bdrv_extent_cache_lookup(BlockDriverState *bs, bool want_zero,
+                             int64_t offset, int64_t *pnum, int64_t *map,
+                             BlockDriverState **file)
+{
+    BdrvExtentCache *ec = &bs->extent_cache;
+    IntervalTreeNode *node;
+    BdrvExtentCacheEntry *e;
+    IO_CODE();
+
+    QEMU_LOCK_GUARD(&ec->lock);
+
+    node = interval_tree_iter_first(&ec->extents, offset, offset);
+    e = node ? container_of(node, BdrvExtentCacheEntry, node) : NULL;
+    if (!e || (want_zero && !e->want_zero)) {
+        ec->misses++;
+        return -ENOENT;
+    }
+
+    ec->hits++;
+    *pnum = e->node.last + 1 - offset;
+    *map = e->map;
+    if (e->status & BDRV_BLOCK_OFFSET_VALID) {
+        *map += offset - e->node.start;
+    }
+    *file = e->file;
+    return e->status;
+}
+
+/**
+ * See block_int.h for this function's documentation.
+ */
+uint64_t bdrv_extent_cache_gen(BlockDriverState *bs)
+{
+    IO_CODE();
+    QEMU_LOCK_GUARD(&bs->extent_cache.lock);
+    return bs->extent_cache.gen;
+}
+
+/**
+ * See block_int.h for this function's documentation.
+ */
+void bdrv_extent_cache_set_granularity(BlockDriverState *bs, int granularity)
+{
+    IO_CODE();
+    assert(granularity > 0);
+    QEMU_LOCK_GUARD(&bs->extent_cache.lock);
+    qatomic_set(&bs->extent_cache.granularity, granularity);
+}
+
+/**
+ * See block_int.h for this function's documentation.
+ */
+void bdrv_extent_cache_fill(BlockDriverState *bs, uint64_t gen,
+                            bool want_zero, int64_t offset, int64_t bytes,
+                            int status, int64_t map, BlockDriverState *file)
+{
+    BdrvExtentCache *ec = &bs->extent_cache;
+    BdrvExtentCacheEntry *e, *prev;
+    IntervalTreeNode *node;
+    uint64_t start = offset;
+    uint64_t last = offset + bytes - 1;
+    IO_CODE();
+
+    assert(bytes > 0);
+    QEMU_LOCK_GUARD(&ec->lock);
+    assert(ec->granularity);
+
+    if (ec->gen != gen) {
+        return;
+    }
+
+    /* Concurrent queries may have cached the same range already */
+    bdrv_extent_cache_remove_range_locked(ec, start, last);
+
+    /* Merge with the previous extent if it has the same status */
+    if (start > 0) {
+        node = interval_tree_iter_first(&ec->extents, start - 1, start - 1);
+        prev = node ? container_of(node, BdrvExtentCacheEntry, node) : NULL;
+        if (prev && prev->status == status && prev->file == file &&
+            prev->want_zero == want_zero &&
+            (!(status & BDRV_BLOCK_OFFSET_VALID) ||
+             prev->map + (start - prev->node.start) == map))
+        {
+            start = prev->node.start;
+            map = prev->map;
+            bdrv_extent_cache_remove_locked(ec, prev);
+        }
+    }
+
+    if (ec->nb_extents >= BDRV_EXTENT_CACHE_MAX) {
+        bdrv_extent_cache_clear_locked(ec);
+    }
+
+    e = g_new(BdrvExtentCacheEntry, 1);
+    *e = (BdrvExtentCacheEntry) {
+        .node.start = start,
+        .node.last = last,
+        .status = status,
+        .want_zero = want_zero,
+        .map = map,
+        .file = file,
+    };
+    interval_tree_insert(&e->node, &ec->extents);
+    ec->nb_extents++;
+}
+
+/**
+ * See block_int.h for this function's documentation.
+ */
+void bdrv_extent_cache_invalidate(BlockDriverState *bs,
+                                  int64_t offset, int64_t bytes)
+{
+    BdrvExtentCache *ec = &bs->extent_cache;
+    IO_CODE();
+
+    if (!bdrv_extent_cache_enabled(bs)) {
+        return;
+    }
+
+    QEMU_LOCK_GUARD(&ec->lock);
+    ec->gen++;
+    if (bytes && ec->granularity) {
+        uint64_t start = QEMU_ALIGN_DOWN(offset, ec->granularity);
+        uint64_t end = QEMU_ALIGN_UP(offset + bytes, ec->granularity);
+
+        bdrv_extent_cache_remove_range_locked(ec, start, end - 1);
+    }
+}
+
+/**
+ * See block_int.h for this function's documentation.
+ */
+void bdrv_extent_cache_clear(BlockDriverState *bs)
+{
+    BdrvExtentCache *ec = &bs->extent_cache;
+    IO_CODE();
+
+    QEMU_LOCK_GUARD(&ec->lock);
+    ec->gen++;
+    bdrv_extent_cache_clear_locked(ec);
+}
+
+/**
+ * See block_int.h for this function's documentation.
+ */
+BlockStatusCacheStats *bdrv_extent_cache_query_stats(BlockDriverState *bs)
+{
+    BdrvExtentCache *ec = &bs->extent_cache;
+    BlockStatusCacheStats *stats;
+
+    if (!bdrv_extent_cache_enabled(bs)) {
+        return NULL;
+    }
+
+    stats = g_new(BlockStatusCacheStats, 1);
+
+    QEMU_LOCK_GUARD(&ec->lock);
+    *stats = (BlockStatusCacheStats) {
+        .hits = ec->hits,
+        .misses = ec->misses,
+        .extents = ec->nb_extents,
+    };
+    return stats;
+}
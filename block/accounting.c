@@ -27,13 +27,38 @@
 #include "block/accounting.h"
 #include "block/block_int.h"
 #include "qemu/timer.h"
+#include "qemu/coroutine-tls.h"
 #include "sysemu/qtest.h"
 
 static QEMUClockType clock_type = QEMU_CLOCK_REALTIME;
 static const int qtest_latency_ns = NANOSECONDS_PER_SECOND / 1000;
 
+/* Threads are assigned shards round robin, 0 means not assigned yet */
+static unsigned block_acct_next_shard;
+QEMU_DEFINE_STATIC_CO_TLS(unsigned, block_acct_shard_index)
+
+static BlockAcctShard *block_acct_shard(BlockAcctStats *stats)
+{
+    unsigned index = get_block_acct_shard_index();
+
+    if (!index) {
+        index = qatomic_fetch_inc(&block_acct_next_shard) %
+                BLOCK_ACCT_SHARDS + 1;
+        set_block_acct_shard_index(index);
+    }
+    return &stats->shards[index - 1];
+}
+
 void block_acct_init(BlockAcctStats *stats)
 {
+    int i;
+
+    stats->shards = qemu_memalign(BLOCK_ACCT_SHARD_ALIGN,
+                                  sizeof(BlockAcctShard) * BLOCK_ACCT_SHARDS);
+    memset(stats->shards, 0, sizeof(BlockAcctShard) * BLOCK_ACCT_SHARDS);
+    for (i = 0; i < BLOCK_ACCT_SHARDS; i++) {
+        qemu_spin_init(&stats->shards[i].lock);
+    }
     qemu_mutex_init(&stats->lock);
     if (qtest_enabled()) {
         clock_type = QEMU_CLOCK_VIRTUAL;
@@ -68,9 +93,17 @@ void block_acct_setup(BlockAcctStats *stats, enum OnOffAuto account_invalid,
 void block_acct_cleanup(BlockAcctStats *stats)
 {
     BlockAcctTimedStats *s, *next;
+    int i;
+
     QSLIST_FOREACH_SAFE(s, &stats->intervals, entries, next) {
         g_free(s);
     }
+    block_latency_histograms_clear(stats);
+    for (i = 0; i < BLOCK_ACCT_SHARDS; i++) {
+        qemu_spin_destroy(&stats->shards[i].lock);
+    }
+    qemu_vfree(stats->shards);
+    stats->shards = NULL;
     qemu_mutex_destroy(&stats->lock);
 }
 
@@ -156,14 +189,35 @@ static void block_latency_histogram_account(BlockLatencyHistogram *hist,
     hist->bins[pos - hist->boundaries + 1]++;
 }
 
+/*
+ * Replace the histogram of @type in @shard with @new_hist and free the old
+ * one.  @shard takes ownership of the arrays, @new_hist is cleared.
+ */
+static void block_latency_histogram_swap(BlockAcctShard *shard,
+                                         enum BlockAcctType type,
+                                         BlockLatencyHistogram *new_hist)
+{
+    BlockLatencyHistogram old_hist;
+
+    qemu_spin_lock(&shard->lock);
+    old_hist = shard->latency_histogram[type];
+    shard->latency_histogram[type] = *new_hist;
+    qemu_spin_unlock(&shard->lock);
+
+    g_free(old_hist.bins);
+    g_free(old_hist.boundaries);
+    memset(new_hist, 0, sizeof(*new_hist));
+}
+
 int block_latency_histogram_set(BlockAcctStats *stats, enum BlockAcctType type,
                                 uint64List *boundaries)
 {
-    BlockLatencyHistogram *hist = &stats->latency_histogram[type];
+    BlockLatencyHistogram hist;
     uint64List *entry;
     uint64_t *ptr;
     uint64_t prev = 0;
     int new_nbins = 1;
+    int i;
 
     for (entry = boundaries; entry; entry = entry->next) {
         if (entry->value <= prev) {
@@ -173,30 +227,68 @@ int block_latency_histogram_set(BlockAcctStats *stats, enum BlockAcctType type,
         prev = entry->value;
     }
 
-    hist->nbins = new_nbins;
-    g_free(hist->boundaries);
-    hist->boundaries = g_new(uint64_t, hist->nbins - 1);
-    for (entry = boundaries, ptr = hist->boundaries; entry;
-         entry = entry->next, ptr++)
-    {
-        *ptr = entry->value;
-    }
+    /* Every shard gets its own copy, so that it never has to look elsewhere */
+    for (i = 0; i < BLOCK_ACCT_SHARDS; i++) {
+        hist.nbins = new_nbins;
+        hist.boundaries = g_new(uint64_t, hist.nbins - 1);
+        for (entry = boundaries, ptr = hist.boundaries; entry;
+             entry = entry->next, ptr++)
+        {
+            *ptr = entry->value;
+        }
+        hist.bins = g_new0(uint64_t, hist.nbins);
 
-    g_free(hist->bins);
-    hist->bins = g_new0(uint64_t, hist->nbins);
+        block_latency_histogram_swap(&stats->shards[i], type, &hist);
+    }
 
     return 0;
 }
 
+/*
+ * Sum up the histogram of @type over all shards into @hist.  Returns false
+ * if the histogram is disabled.  Otherwise the caller must free the
+ * boundaries and bins of @hist.
+ */
+bool block_latency_histogram_get(BlockAcctStats *stats, enum BlockAcctType type,
+                                 BlockLatencyHistogram *hist)
+{
+    int i, j;
+
+    memset(hist, 0, sizeof(*hist));
+
+    for (i = 0; i < BLOCK_ACCT_SHARDS; i++) {
+        BlockAcctShard *shard = &stats->shards[i];
+        BlockLatencyHistogram *shard_hist = &shard->latency_histogram[type];
+
+        qemu_spin_lock(&shard->lock);
+        if (shard_hist->bins) {
+            if (!hist->bins) {
+                hist->nbins = shard_hist->nbins;
+                hist->boundaries = g_memdup2(shard_hist->boundaries,
+                                             sizeof(uint64_t) *
+                                             (hist->nbins - 1));
+                hist->bins = g_new0(uint64_t, hist->nbins);
+            }
+            assert(shard_hist->nbins == hist->nbins);
+            for (j = 0; j < hist->nbins; j++) {
+                hist->bins[j] += shard_hist->bins[j];
+            }
+        }
+        qemu_spin_unlock(&shard->lock);
+    }
+
+    return hist->bins != NULL;
+}
+
 void block_latency_histograms_clear(BlockAcctStats *stats)
 {
-    int i;
+    BlockLatencyHistogram hist = { 0 };
+    int i, j;
 
-    for (i = 0; i < BLOCK_MAX_IOTYPE; i++) {
-        BlockLatencyHistogram *hist = &stats->latency_histogram[i];
-        g_free(hist->bins);
-        g_free(hist->boundaries);
-        memset(hist, 0, sizeof(*hist));
+    for (i = 0; i < BLOCK_ACCT_SHARDS; i++) {
+        for (j = 0; j < BLOCK_MAX_IOTYPE; j++) {
+            block_latency_histogram_swap(&stats->shards[i], j, &hist);
+        }
     }
 }
 
@@ -204,6 +296,8 @@ static void block_account_one_io(BlockAcctStats *stats, BlockAcctCookie *cookie,
                                  bool failed)
 {
     BlockAcctTimedStats *s;
+    BlockAcctShard *shard;
+    BlockAcctCounters *counters;
     int64_t time_ns = qemu_clock_get_ns(clock_type);
     int64_t latency_ns = time_ns - cookie->start_time_ns;
 
@@ -217,21 +311,33 @@ static void block_account_one_io(BlockAcctStats *stats, BlockAcctCookie *cookie,
         return;
     }
 
-    WITH_QEMU_LOCK_GUARD(&stats->lock) {
-        if (failed) {
-            stats->failed_ops[cookie->type]++;
-        } else {
-            stats->nr_bytes[cookie->type] += cookie->bytes;
-            stats->nr_ops[cookie->type]++;
-        }
+    shard = block_acct_shard(stats);
+    counters = &shard->counters;
 
-        block_latency_histogram_account(&stats->latency_histogram[cookie->type],
-                                        latency_ns);
+    qemu_spin_lock(&shard->lock);
+    if (failed) {
+        counters->failed_ops[cookie->type]++;
+    } else {
+        counters->nr_bytes[cookie->type] += cookie->bytes;
+        counters->nr_ops[cookie->type]++;
+    }
+
+    block_latency_histogram_account(&shard->latency_histogram[cookie->type],
+                                    latency_ns);
 
-        if (!failed || stats->account_failed) {
-            stats->total_time_ns[cookie->type] += latency_ns;
-            stats->last_access_time_ns = time_ns;
+    if (!failed || stats->account_failed) {
+        counters->total_time_ns[cookie->type] += latency_ns;
+        counters->last_access_time_ns = time_ns;
+    }
+    qemu_spin_unlock(&shard->lock);
 
+    /*
+     * Intervals are only added while the BlockBackend is set up, before any
+     * request is accounted, so the list can be checked without the lock.
+     */
+    if ((!failed || stats->account_failed) &&
+        !QSLIST_EMPTY(&stats->intervals)) {
+        WITH_QEMU_LOCK_GUARD(&stats->lock) {
             QSLIST_FOREACH(s, &stats->intervals, entries) {
                 timed_average_account(&s->latency[cookie->type], latency_ns);
             }
@@ -253,34 +359,68 @@ void block_acct_failed(BlockAcctStats *stats, BlockAcctCookie *cookie)
 
 void block_acct_invalid(BlockAcctStats *stats, enum BlockAcctType type)
 {
+    BlockAcctShard *shard = block_acct_shard(stats);
+
     assert(type < BLOCK_MAX_IOTYPE);
 
     /* block_account_one_io() updates total_time_ns[], but this one does
      * not.  The reason is that invalid requests are accounted during their
      * submission, therefore there's no actual I/O involved.
      */
-    qemu_mutex_lock(&stats->lock);
-    stats->invalid_ops[type]++;
+    qemu_spin_lock(&shard->lock);
+    shard->counters.invalid_ops[type]++;
 
     if (stats->account_invalid) {
-        stats->last_access_time_ns = qemu_clock_get_ns(clock_type);
+        shard->counters.last_access_time_ns = qemu_clock_get_ns(clock_type);
     }
-    qemu_mutex_unlock(&stats->lock);
+    qemu_spin_unlock(&shard->lock);
 }
 
 void block_acct_merge_done(BlockAcctStats *stats, enum BlockAcctType type,
                       int num_requests)
 {
+    BlockAcctShard *shard = block_acct_shard(stats);
+
     assert(type < BLOCK_MAX_IOTYPE);
 
-    qemu_mutex_lock(&stats->lock);
-    stats->merged[type] += num_requests;
-    qemu_mutex_unlock(&stats->lock);
+    qemu_spin_lock(&shard->lock);
+    shard->counters.merged[type] += num_requests;
+    qemu_spin_unlock(&shard->lock);
+}
+
+/* Sum up the counters of all shards */
+void block_acct_get_counters(BlockAcctStats *stats,
+                             BlockAcctCounters *counters)
+{
+    int i, j;
+
+    memset(counters, 0, sizeof(*counters));
+
+    for (i = 0; i < BLOCK_ACCT_SHARDS; i++) {
+        BlockAcctShard *shard = &stats->shards[i];
+        BlockAcctCounters *c = &shard->counters;
+
+        qemu_spin_lock(&shard->lock);
+        for (j = 0; j < BLOCK_MAX_IOTYPE; j++) {
+            counters->nr_bytes[j] += c->nr_bytes[j];
+            counters->nr_ops[j] += c->nr_ops[j];
+            counters->invalid_ops[j] += c->invalid_ops[j];
+            counters->failed_ops[j] += c->failed_ops[j];
+            counters->total_time_ns[j] += c->total_time_ns[j];
+            counters->merged[j] += c->merged[j];
+        }
+        counters->last_access_time_ns = MAX(counters->last_access_time_ns,
+                                            c->last_access_time_ns);
+        qemu_spin_unlock(&shard->lock);
+    }
 }
 
 int64_t block_acct_idle_time_ns(BlockAcctStats *stats)
 {
-    return qemu_clock_get_ns(clock_type) - stats->last_access_time_ns;
+    BlockAcctCounters counters;
+
+    block_acct_get_counters(stats, &counters);
+    return qemu_clock_get_ns(clock_type) - counters.last_access_time_ns;
 }
 
 double block_acct_queue_depth(BlockAcctTimedStats *stats,
@@ -50,6 +50,7 @@ static int coroutine_fn blockdev_amend_run(Job *job, Error **errp)
 
     job_progress_set_remaining(&s->common, 1);
     ret = s->bs->drv->bdrv_co_amend(s->bs, s->opts, s->force, errp);
+    bdrv_extent_cache_clear(s->bs);
     job_progress_update(&s->common, 1);
     qapi_free_BlockdevAmendOptions(s->opts);
     return ret;
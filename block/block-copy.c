@@ -36,6 +36,12 @@
 #define BLOCK_COPY_SLICE_TIME 100000000ULL /* ns */
 #define BLOCK_COPY_CLUSTER_SIZE_DEFAULT (1 << 16)
 
+/* Runtime tuning of adaptive block_copy_async() calls */
+#define BLOCK_COPY_ADAPT_INTERVAL_NS (500 * SCALE_MS)
+#define BLOCK_COPY_ADAPT_MIN_OPS 16
+#define BLOCK_COPY_ADAPT_START_WORKERS 8
+#define BLOCK_COPY_ADAPT_TOLERANCE 0.05
+
 typedef enum {
     COPY_READ_WRITE_CLUSTER,
     COPY_READ_WRITE,
@@ -53,6 +59,7 @@ typedef struct BlockCopyCallState {
     int64_t bytes;
     int max_workers;
     int64_t max_chunk;
+    bool adaptive;
     bool ignore_ratelimit;
     BlockCopyAsyncCallbackFunc cb;
     void *cb_opaque;
@@ -112,6 +119,53 @@ static int64_t task_end(BlockCopyTask *task)
     return task->req.offset + task->req.bytes;
 }
 
+/*
+ * Parameters of the background copy, i.e. the block_copy_async() call.
+ *
+ * If the call is adaptive, the chunk size and the number of workers are
+ * tuned while it runs.  Every BLOCK_COPY_ADAPT_INTERVAL_NS the throughput of
+ * the last interval is compared to the one before, which tells whether the
+ * last step is kept or undone, and then one of the two knobs is doubled or
+ * halved.  The knobs take turns.  Growing a knob is only kept if it paid off
+ * in throughput, shrinking it is kept unless it cost throughput.
+ *
+ * Growing is not even tried for a knob that is not the bottleneck: the
+ * latency of the completed requests tells how many of them were in flight
+ * on average, and their size how much of the chunk size they used.  With
+ * fragmented data or a slow main loop neither is close to the limit.
+ */
+typedef struct BlockCopyTuning {
+    /*
+     * Values last used by the call.  Set with qatomic_set() under lock,
+     * block_copy_get_tuning() reads them without it.
+     */
+    int chunk_size;
+    int workers;
+    bool copy_offload;
+
+    /* The remaining fields are only used by adaptive calls */
+    int64_t chunk;
+    int64_t max_chunk;
+    int max_workers;
+
+    /* Measurements of the current interval */
+    int64_t interval_start;
+    int64_t bytes;
+    int64_t ops;
+    int64_t busy_ns;
+    bool throttled;
+
+    /* Throughput of the last interval that was kept, 0 if none */
+    double last_bps;
+    /* The step that was taken after that interval */
+    bool stepped;
+    bool step_workers;
+    bool step_grew;
+    /* Direction of the next step for each knob */
+    bool grow_chunk;
+    bool grow_workers;
+} BlockCopyTuning;
+
 typedef struct BlockCopyState {
     /*
      * BdrvChild objects are not owned or managed by block-copy. They are
@@ -139,6 +193,7 @@ typedef struct BlockCopyState {
     BlockCopyMethod method;
     BlockReqList reqs;
     QLIST_HEAD(, BlockCopyCallState) calls;
+    BlockCopyTuning tuning;
     /*
      * skip_unallocated:
      *
@@ -192,7 +247,20 @@ block_copy_task_create(BlockCopyState *s, BlockCopyCallState *call_state,
     int64_t max_chunk;
 
     QEMU_LOCK_GUARD(&s->lock);
-    max_chunk = MIN_NON_ZERO(block_copy_chunk_size(s), call_state->max_chunk);
+    max_chunk = block_copy_chunk_size(s);
+    if (call_state->adaptive && s->method != COPY_READ_WRITE_CLUSTER &&
+        s->method != COPY_RANGE_SMALL)
+    {
+        /* Untested copy_range keeps its small chunks, see above */
+        max_chunk = s->tuning.chunk;
+    }
+    max_chunk = MIN_NON_ZERO(max_chunk, call_state->max_chunk);
+    if (call_state->co) {
+        qatomic_set(&s->tuning.chunk_size, max_chunk);
+        qatomic_set(&s->tuning.copy_offload,
+                    s->method == COPY_RANGE_SMALL ||
+                    s->method == COPY_RANGE_FULL);
+    }
     if (!bdrv_dirty_bitmap_next_dirty_area(s->copy_bitmap,
                                            offset, offset + bytes,
                                            max_chunk, &offset, &bytes))
@@ -564,6 +632,7 @@ static coroutine_fn int block_copy_task_entry(AioTask *task)
     BlockCopyState *s = t->s;
     bool error_is_read = false;
     BlockCopyMethod method = t->method;
+    int64_t start_ns = qemu_clock_get_ns(QEMU_CLOCK_REALTIME);
     int ret;
 
     WITH_GRAPH_RDLOCK_GUARD() {
@@ -584,6 +653,16 @@ static coroutine_fn int block_copy_task_entry(AioTask *task)
         } else if (s->progress) {
             progress_work_done(s->progress, t->req.bytes);
         }
+
+        /* Zero writes say nothing about the speed of copying data */
+        if (ret >= 0 && t->call_state->adaptive &&
+            t->method != COPY_WRITE_ZEROES)
+        {
+            s->tuning.bytes += t->req.bytes;
+            s->tuning.ops++;
+            s->tuning.busy_ns += qemu_clock_get_ns(QEMU_CLOCK_REALTIME) -
+                                 start_ns;
+        }
     }
     co_put_to_shres(s->mem, t->req.bytes);
     block_copy_task_end(t, ret);
@@ -708,6 +787,140 @@ int64_t coroutine_fn block_copy_reset_unallocated(BlockCopyState *s,
     return ret;
 }
 
+static void block_copy_tuning_reset_interval(BlockCopyTuning *t, int64_t now)
+{
+    t->interval_start = now;
+    t->bytes = 0;
+    t->ops = 0;
+    t->busy_ns = 0;
+    t->throttled = false;
+}
+
+/* Called with lock held, when a block_copy_async() call starts */
+static void block_copy_tuning_start(BlockCopyState *s,
+                                    BlockCopyCallState *call_state)
+{
+    BlockCopyTuning *t = &s->tuning;
+
+    if (!call_state->adaptive) {
+        qatomic_set(&t->workers, call_state->max_workers);
+        return;
+    }
+
+    t->max_workers = call_state->max_workers;
+    t->max_chunk = MIN(MAX(s->cluster_size, BLOCK_COPY_MAX_COPY_RANGE),
+                       s->max_transfer);
+    t->max_chunk = MAX(MIN_NON_ZERO(t->max_chunk, call_state->max_chunk),
+                       s->cluster_size);
+
+    if (!t->chunk) {
+        /* Calls after a pause or an error continue where the last one was */
+        t->chunk = block_copy_chunk_size(s);
+        qatomic_set(&t->workers, BLOCK_COPY_ADAPT_START_WORKERS);
+        t->grow_chunk = true;
+        t->grow_workers = true;
+    }
+    t->chunk = MIN(t->chunk, t->max_chunk);
+    qatomic_set(&t->workers, MIN(t->workers, t->max_workers));
+
+    block_copy_tuning_reset_interval(t, qemu_clock_get_ns(QEMU_CLOCK_REALTIME));
+    t->last_bps = 0;
+    t->stepped = false;
+}
+
+/*
+ * Called with lock held.  Double or halve the number of workers or the chunk
+ * size.  Returns false if it already was at its bound.
+ */
+static bool block_copy_tuning_step(BlockCopyState *s, bool workers, bool grow)
+{
+    BlockCopyTuning *t = &s->tuning;
+
+    if (workers) {
+        int old = t->workers;
+
+        qatomic_set(&t->workers, grow ? MIN(old * 2LL, t->max_workers)
+                                      : MAX(old / 2, 1));
+        return t->workers != old;
+    } else {
+        int64_t old = t->chunk;
+
+        t->chunk = grow ? MIN(old * 2, t->max_chunk)
+                        : MAX(QEMU_ALIGN_DOWN(old / 2, s->cluster_size),
+                              s->cluster_size);
+        return t->chunk != old;
+    }
+}
+
+/*
+ * Called with lock held, between two tasks of an adaptive call.  Once an
+ * interval is over, judge the last step and take the next one.
+ */
+static void block_copy_adapt(BlockCopyState *s)
+{
+    BlockCopyTuning *t = &s->tuning;
+    int64_t now = qemu_clock_get_ns(QEMU_CLOCK_REALTIME);
+    int64_t elapsed = now - t->interval_start;
+    double bps, busy, op_size;
+    bool throttled, workers, grow;
+
+    if (elapsed < BLOCK_COPY_ADAPT_INTERVAL_NS ||
+        t->ops < BLOCK_COPY_ADAPT_MIN_OPS)
+    {
+        return;
+    }
+
+    bps = t->bytes * 1e9 / elapsed;
+    /* Little's law: average number of requests in flight */
+    busy = (double)t->busy_ns / elapsed;
+    op_size = (double)t->bytes / t->ops;
+    throttled = t->throttled;
+    block_copy_tuning_reset_interval(t, now);
+
+    if (throttled) {
+        /* The throughput only shows the speed limit, start over */
+        t->last_bps = 0;
+        t->stepped = false;
+        return;
+    }
+
+    if (!t->stepped) {
+        t->last_bps = bps;
+    } else if (t->step_grew ?
+               bps > t->last_bps * (1 + BLOCK_COPY_ADAPT_TOLERANCE) :
+               bps >= t->last_bps * (1 - BLOCK_COPY_ADAPT_TOLERANCE))
+    {
+        t->last_bps = bps;
+    } else {
+        block_copy_tuning_step(s, t->step_workers, !t->step_grew);
+        if (t->step_workers) {
+            t->grow_workers = !t->step_grew;
+        } else {
+            t->grow_chunk = !t->step_grew;
+        }
+    }
+
+    workers = !t->step_workers;
+    grow = workers ? t->grow_workers : t->grow_chunk;
+    if (grow && (workers ? busy < t->workers / 2.0
+                         : op_size < t->chunk / 2.0))
+    {
+        /* This knob is not what limits the copy */
+        t->stepped = false;
+    } else {
+        t->stepped = block_copy_tuning_step(s, workers, grow);
+        if (!t->stepped && workers) {
+            t->grow_workers = !grow;
+        } else if (!t->stepped) {
+            t->grow_chunk = !grow;
+        }
+    }
+    t->step_workers = workers;
+    t->step_grew = grow;
+
+    trace_block_copy_adapt(s, bps, t->chunk, t->workers);
+}
+
 /*
  * block_copy_dirty_clusters
  *
@@ -742,6 +955,16 @@ block_copy_dirty_clusters(BlockCopyCallState *call_state)
         BlockCopyTask *task;
         int64_t status_bytes;
 
+        if (call_state->adaptive) {
+            WITH_QEMU_LOCK_GUARD(&s->lock) {
+                block_copy_adapt(s);
+            }
+            if (aio) {
+                aio_task_pool_set_max_busy_tasks(aio,
+                        qatomic_read(&s->tuning.workers));
+            }
+        }
+
         task = block_copy_task_create(s, call_state, offset, bytes);
         if (!task) {
             /* No more dirty bits in the bitmap */
@@ -778,6 +1001,11 @@ block_copy_dirty_clusters(BlockCopyCallState *call_state)
             if (ns > 0) {
                 block_copy_task_end(task, -EAGAIN);
                 g_free(task);
+                if (call_state->adaptive) {
+                    WITH_QEMU_LOCK_GUARD(&s->lock) {
+                        s->tuning.throttled = true;
+                    }
+                }
                 qemu_co_sleep_ns_wakeable(&call_state->sleep,
                                           QEMU_CLOCK_REALTIME, ns);
                 continue;
@@ -794,7 +1022,9 @@ block_copy_dirty_clusters(BlockCopyCallState *call_state)
         bytes = end - offset;
 
         if (!aio && bytes) {
-            aio = aio_task_pool_new(call_state->max_workers);
+            aio = aio_task_pool_new(call_state->adaptive ?
+                                    qatomic_read(&s->tuning.workers) :
+                                    call_state->max_workers);
         }
 
         ret = block_copy_task_run(aio, task);
@@ -846,6 +1076,9 @@ block_copy_common(BlockCopyCallState *call_state)
 
     qemu_co_mutex_lock(&s->lock);
     QLIST_INSERT_HEAD(&s->calls, call_state, list);
+    if (call_state->co) {
+        block_copy_tuning_start(s, call_state);
+    }
     qemu_co_mutex_unlock(&s->lock);
 
     do {
@@ -944,6 +1177,7 @@ int coroutine_fn block_copy(BlockCopyState *s, int64_t start, int64_t bytes,
 BlockCopyCallState *block_copy_async(BlockCopyState *s,
                                      int64_t offset, int64_t bytes,
                                      int max_workers, int64_t max_chunk,
+                                     bool adaptive,
                                      BlockCopyAsyncCallbackFunc cb,
                                      void *cb_opaque)
 {
@@ -955,6 +1189,7 @@ BlockCopyCallState *block_copy_async(BlockCopyState *s,
         .bytes = bytes,
         .max_workers = max_workers,
         .max_chunk = max_chunk,
+        .adaptive = adaptive,
         .cb = cb,
         .cb_opaque = cb_opaque,
 
@@ -1034,6 +1269,14 @@ void block_copy_set_skip_unallocated(BlockCopyState *s, bool skip)
     qatomic_set(&s->skip_unallocated, skip);
 }
 
+void block_copy_get_tuning(BlockCopyState *s, int64_t *chunk_size,
+                           int *workers, bool *copy_offload)
+{
+    *chunk_size = qatomic_read(&s->tuning.chunk_size);
+    *workers = qatomic_read(&s->tuning.workers);
+    *copy_offload = qatomic_read(&s->tuning.copy_offload);
+}
+
 void block_copy_set_speed(BlockCopyState *s, uint64_t speed)
 {
     ratelimit_set_speed(&s->rate_limit, speed, BLOCK_COPY_SLICE_TIME);
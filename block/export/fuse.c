@@ -19,7 +19,9 @@
 #define FUSE_USE_VERSION 31
 
 #include "qemu/osdep.h"
+#include "qemu/coroutine.h"
 #include "qemu/memalign.h"
+#include "qemu/units.h"
 #include "block/aio.h"
 #include "block/block_int-common.h"
 #include "block/export.h"
@@ -29,6 +31,7 @@
 #include "qapi/qapi-commands-block.h"
 #include "qemu/main-loop.h"
 #include "sysemu/block-backend.h"
+#include "sysemu/iothread.h"
 
 #include <fuse.h>
 #include <fuse_lowlevel.h>
@@ -44,14 +47,50 @@
 /* Prevent overly long bounce buffer allocations */
 #define FUSE_MAX_BOUNCE_BYTES (MIN(BDRV_REQUEST_MAX_BYTES, 64 * 1024 * 1024))
 
+/*
+ * Reported as st_blksize, so that tools like cp or dd that go by it
+ * submit requests large enough to amortize the round trip to the kernel
+ */
+#define FUSE_OPT_IO_BYTES (1 * MiB)
+
+/*
+ * Number of background requests (readahead and asynchronous direct I/O)
+ * that the kernel keeps in flight; its default of 12 is too low to keep
+ * several queues busy
+ */
+#define FUSE_MAX_BG_REQUESTS 64
+
+
+/*
+ * A thread that reads requests from the FUSE device.  All queues of an
+ * export wait on the same, non-blocking session fd; each request is
+ * received by one of them and processed in its AioContext.
+ */
+typedef struct FuseQueue {
+    struct FuseExport *exp;
+    /* From @iothreads, NULL to use the export's AioContext */
+    IOThread *iothread;
+    struct fuse_buf fuse_buf;
+    bool fd_handler_set_up;
+} FuseQueue;
 
 typedef struct FuseExport {
     BlockExport common;
 
     struct fuse_session *fuse_session;
-    struct fuse_buf fuse_buf;
+    FuseQueue *queues;
+    size_t nr_queues;
     unsigned int in_flight; /* atomic */
-    bool mounted, fd_handler_set_up;
+    /*
+     * Set while drained.  A queue in another thread may already be running
+     * read_from_fuse_export() when its handler is detached; it checks this
+     * after counting itself in @in_flight.
+     */
+    bool quiesced; /* atomic */
+    bool mounted;
+
+    /* Serializes growing the export for writes beyond the EOF */
+    CoMutex grow_lock;
 
     char *mountpoint;
     bool writable;
@@ -79,14 +118,58 @@ static void read_from_fuse_export(void *opaque);
 static bool is_regular_file(const char *path, Error **errp);
 
 
+static AioContext *fuse_queue_aio_context(FuseQueue *q)
+{
+    return q->iothread ? iothread_get_aio_context(q->iothread)
+                       : q->exp->common.ctx;
+}
+
+/**
+ * Start reading requests from the FUSE device in all queues.
+ */
+static void fuse_attach_queues(FuseExport *exp)
+{
+    size_t i;
+
+    for (i = 0; i < exp->nr_queues; i++) {
+        FuseQueue *q = &exp->queues[i];
+
+        aio_set_fd_handler(fuse_queue_aio_context(q),
+                           fuse_session_fd(exp->fuse_session),
+                           read_from_fuse_export, NULL, NULL, NULL, q);
+        q->fd_handler_set_up = true;
+    }
+}
+
+/**
+ * Stop reading requests from the FUSE device.  Requests that have already
+ * been received are still counted in exp->in_flight.
+ */
+static void fuse_detach_queues(FuseExport *exp)
+{
+    size_t i;
+
+    for (i = 0; i < exp->nr_queues; i++) {
+        FuseQueue *q = &exp->queues[i];
+
+        if (q->fd_handler_set_up) {
+            aio_set_fd_handler(fuse_queue_aio_context(q),
+                               fuse_session_fd(exp->fuse_session),
+                               NULL, NULL, NULL, NULL, NULL);
+            q->fd_handler_set_up = false;
+        }
+    }
+}
+
 static void fuse_export_drained_begin(void *opaque)
 {
     FuseExport *exp = opaque;
 
-    aio_set_fd_handler(exp->common.ctx,
-                       fuse_session_fd(exp->fuse_session),
-                       NULL, NULL, NULL, NULL, NULL);
-    exp->fd_handler_set_up = false;
+    /* Pairs with the barrier in fuse_inc_in_flight() */
+    qatomic_set(&exp->quiesced, true);
+    smp_mb();
+
+    fuse_detach_queues(exp);
 }
 
 static void fuse_export_drained_end(void *opaque)
@@ -96,10 +179,8 @@ static void fuse_export_drained_end(void *opaque)
     /* Refresh AioContext in case it changed */
     exp->common.ctx = blk_get_aio_context(exp->common.blk);
 
-    aio_set_fd_handler(exp->common.ctx,
-                       fuse_session_fd(exp->fuse_session),
-                       read_from_fuse_export, NULL, NULL, NULL, exp);
-    exp->fd_handler_set_up = true;
+    qatomic_set(&exp->quiesced, false);
+    fuse_attach_queues(exp);
 }
 
 static bool fuse_export_drained_poll(void *opaque)
@@ -115,6 +196,50 @@ static const BlockDevOps fuse_export_blk_dev_ops = {
     .drained_poll  = fuse_export_drained_poll,
 };
 
+/**
+ * Create one queue per IOThread in @iothreads, or a single queue in the
+ * export's AioContext if the list is empty.
+ */
+static bool fuse_export_init_queues(FuseExport *exp, strList *iothreads,
+                                    Error **errp)
+{
+    strList *node, *prev;
+    size_t nr_queues = 0;
+    size_t i;
+
+    for (node = iothreads; node; node = node->next) {
+        if (!iothread_by_id(node->value)) {
+            error_setg(errp, "IOThread '%s' not found", node->value);
+            return false;
+        }
+
+        /* Queues in the same AioContext would replace each other's handler */
+        for (prev = iothreads; prev != node; prev = prev->next) {
+            if (!strcmp(prev->value, node->value)) {
+                error_setg(errp, "Duplicate IOThread name '%s' in iothreads",
+                           node->value);
+                return false;
+            }
+        }
+
+        nr_queues++;
+    }
+
+    exp->queues = g_new0(FuseQueue, MAX(nr_queues, 1));
+    exp->nr_queues = MAX(nr_queues, 1);
+    exp->queues[0].exp = exp;
+
+    for (i = 0, node = iothreads; node; i++, node = node->next) {
+        exp->queues[i].exp = exp;
+        exp->queues[i].iothread = iothread_by_id(node->value);
+
+        /* Released in fuse_export_delete() */
+        object_ref(OBJECT(exp->queues[i].iothread));
+    }
+
+    return true;
+}
+
 static int fuse_export_create(BlockExport *blk_exp,
                               BlockExportOptions *blk_exp_args,
                               Error **errp)
@@ -138,6 +263,8 @@ static int fuse_export_create(BlockExport *blk_exp,
         }
     }
 
+    qemu_co_mutex_init(&exp->grow_lock);
+
     blk_set_dev_ops(exp->common.blk, &fuse_export_blk_dev_ops, exp);
 
     /*
@@ -175,6 +302,11 @@ static int fuse_export_create(BlockExport *blk_exp,
         goto fail;
     }
 
+    if (!fuse_export_init_queues(exp, args->iothreads, errp)) {
+        ret = -EINVAL;
+        goto fail;
+    }
+
     exp->mountpoint = g_strdup(args->mountpoint);
     exp->writable = blk_exp_args->writable;
     exp->growable = args->growable;
@@ -269,10 +401,19 @@ static int setup_fuse_export(FuseExport *exp, const char *mountpoint,
 
     g_hash_table_insert(exports, g_strdup(mountpoint), NULL);
 
-    aio_set_fd_handler(exp->common.ctx,
-                       fuse_session_fd(exp->fuse_session),
-                       read_from_fuse_export, NULL, NULL, NULL, exp);
-    exp->fd_handler_set_up = true;
+    /*
+     * Every queue polls the session fd, but only one of them receives a
+     * given request.  The others must get EAGAIN instead of blocking their
+     * thread in read().
+     */
+    if (!g_unix_set_fd_nonblocking(fuse_session_fd(exp->fuse_session),
+                                   true, NULL)) {
+        ret = -errno;
+        error_setg_errno(errp, -ret, "Failed to make FUSE fd non-blocking");
+        goto fail;
+    }
+
+    fuse_attach_queues(exp);
 
     return 0;
 
@@ -281,34 +422,106 @@ fail:
     return ret;
 }
 
+/**
+ * Count a request as in flight, so that draining waits for it.
+ */
+static void fuse_inc_in_flight(FuseExport *exp)
+{
+    blk_exp_ref(&exp->common);
+    qatomic_inc(&exp->in_flight);
+    /* Pairs with the barrier in fuse_export_drained_begin() */
+    smp_mb__after_rmw();
+}
+
+static void fuse_dec_in_flight(FuseExport *exp)
+{
+    if (qatomic_fetch_dec(&exp->in_flight) == 1) {
+        aio_wait_kick(); /* wake AIO_WAIT_WHILE() */
+    }
+
+    blk_exp_unref(&exp->common);
+}
+
+/*
+ * A received request that libfuse parses and dispatches in a coroutine, so
+ * that the request handlers can use the coroutine block layer functions in
+ * any AioContext
+ */
+typedef struct FuseProcessBuf {
+    FuseQueue *q;
+    struct fuse_buf buf;
+    /* Whether the coroutine has yielded and owns buf.mem */
+    bool owns_mem;
+    bool done;
+} FuseProcessBuf;
+
+static void coroutine_fn fuse_co_process_buf(void *opaque)
+{
+    FuseProcessBuf *p = opaque;
+    FuseExport *exp = p->q->exp;
+
+    fuse_session_process_buf(exp->fuse_session, &p->buf);
+
+    if (p->owns_mem) {
+        free(p->buf.mem);
+        g_free(p);
+    } else {
+        p->done = true;
+    }
+
+    fuse_dec_in_flight(exp);
+}
+
 /**
  * Callback to be invoked when the FUSE session FD can be read from.
  * (This is basically the FUSE event loop.)
  */
 static void read_from_fuse_export(void *opaque)
 {
-    FuseExport *exp = opaque;
+    FuseQueue *q = opaque;
+    FuseExport *exp = q->exp;
+    FuseProcessBuf *p;
     int ret;
 
-    blk_exp_ref(&exp->common);
+    fuse_inc_in_flight(exp);
 
-    qatomic_inc(&exp->in_flight);
+    /*
+     * Either drained_poll sees the request counted in exp->in_flight, or we
+     * see that the export is drained and leave the request to be received
+     * when the queues are attached again.
+     */
+    if (qatomic_read(&exp->quiesced)) {
+        fuse_dec_in_flight(exp);
+        return;
+    }
 
     do {
-        ret = fuse_session_receive_buf(exp->fuse_session, &exp->fuse_buf);
+        ret = fuse_session_receive_buf(exp->fuse_session, &q->fuse_buf);
     } while (ret == -EINTR);
     if (ret < 0) {
-        goto out;
+        /* -EAGAIN means that another queue has received the request */
+        fuse_dec_in_flight(exp);
+        return;
     }
 
-    fuse_session_process_buf(exp->fuse_session, &exp->fuse_buf);
+    p = g_new(FuseProcessBuf, 1);
+    *p = (FuseProcessBuf) {
+        .q   = q,
+        .buf = q->fuse_buf,
+    };
+    qemu_coroutine_enter(qemu_coroutine_create(fuse_co_process_buf, p));
 
-out:
-    if (qatomic_fetch_dec(&exp->in_flight) == 1) {
-        aio_wait_kick(); /* wake AIO_WAIT_WHILE() */
+    /*
+     * Reads, writes and flushes are handed over to coroutines of their own
+     * without yielding, but other requests may still be using the buffer.
+     * Let libfuse allocate a new one for the next request then.
+     */
+    if (p->done) {
+        g_free(p);
+    } else {
+        p->owns_mem = true;
+        q->fuse_buf.mem = NULL;
     }
-
-    blk_exp_unref(&exp->common);
 }
 
 static void fuse_export_shutdown(BlockExport *blk_exp)
@@ -317,13 +530,7 @@ static void fuse_export_shutdown(BlockExport *blk_exp)
 
     if (exp->fuse_session) {
         fuse_session_exit(exp->fuse_session);
-
-        if (exp->fd_handler_set_up) {
-            aio_set_fd_handler(exp->common.ctx,
-                               fuse_session_fd(exp->fuse_session),
-                               NULL, NULL, NULL, NULL, NULL);
-            exp->fd_handler_set_up = false;
-        }
+        fuse_detach_queues(exp);
     }
 
     if (exp->mountpoint) {
@@ -338,6 +545,7 @@ static void fuse_export_shutdown(BlockExport *blk_exp)
 static void fuse_export_delete(BlockExport *blk_exp)
 {
     FuseExport *exp = container_of(blk_exp, FuseExport, common);
+    size_t i;
 
     if (exp->fuse_session) {
         if (exp->mounted) {
@@ -347,7 +555,13 @@ static void fuse_export_delete(BlockExport *blk_exp)
         fuse_session_destroy(exp->fuse_session);
     }
 
-    free(exp->fuse_buf.mem);
+    for (i = 0; i < exp->nr_queues; i++) {
+        free(exp->queues[i].fuse_buf.mem);
+        if (exp->queues[i].iothread) {
+            object_unref(OBJECT(exp->queues[i].iothread));
+        }
+    }
+    g_free(exp->queues);
     g_free(exp->mountpoint);
 }
 
@@ -389,6 +603,19 @@ static void fuse_init(void *userdata, struct fuse_conn_info *conn)
     conn->max_read = FUSE_MAX_BOUNCE_BYTES;
 
     conn->max_write = MIN_NON_ZERO(BDRV_REQUEST_MAX_BYTES, conn->max_write);
+
+    /*
+     * Let libfuse splice write data from the device into a pipe instead of
+     * reading it into the queue's buffer.  fuse_write_buf() needs a copy of
+     * the data that outlives the next request anyway, and this way the data
+     * is copied only once, from the pipe into that buffer.
+     */
+    if (conn->capable & FUSE_CAP_SPLICE_READ) {
+        conn->want |= FUSE_CAP_SPLICE_READ;
+    }
+
+    conn->max_background = FUSE_MAX_BG_REQUESTS;
+    conn->congestion_threshold = FUSE_MAX_BG_REQUESTS * 3 / 4;
 }
 
 /**
@@ -403,21 +630,24 @@ static void fuse_lookup(fuse_req_t req, fuse_ino_t parent, const char *name)
 /**
  * Let clients get file attributes (i.e., stat() the file).
  */
-static void fuse_getattr(fuse_req_t req, fuse_ino_t inode,
-                         struct fuse_file_info *fi)
+static void coroutine_fn fuse_getattr(fuse_req_t req, fuse_ino_t inode,
+                                      struct fuse_file_info *fi)
 {
     struct stat statbuf;
     int64_t length, allocated_blocks;
     time_t now = time(NULL);
     FuseExport *exp = fuse_req_userdata(req);
 
-    length = blk_getlength(exp->common.blk);
+    length = blk_co_getlength(exp->common.blk);
     if (length < 0) {
         fuse_reply_err(req, -length);
         return;
     }
 
-    allocated_blocks = bdrv_get_allocated_file_size(blk_bs(exp->common.blk));
+    WITH_GRAPH_RDLOCK_GUARD() {
+        allocated_blocks =
+            bdrv_co_get_allocated_file_size(blk_bs(exp->common.blk));
+    }
     if (allocated_blocks <= 0) {
         allocated_blocks = DIV_ROUND_UP(length, 512);
     } else {
@@ -431,7 +661,8 @@ static void fuse_getattr(fuse_req_t req, fuse_ino_t inode,
         .st_uid     = exp->st_uid,
         .st_gid     = exp->st_gid,
         .st_size    = length,
-        .st_blksize = blk_bs(exp->common.blk)->bl.request_alignment,
+        .st_blksize = MAX(blk_bs(exp->common.blk)->bl.request_alignment,
+                          FUSE_OPT_IO_BYTES),
         .st_blocks  = allocated_blocks,
         .st_atime   = now,
         .st_mtime   = now,
@@ -441,8 +672,9 @@ static void fuse_getattr(fuse_req_t req, fuse_ino_t inode,
     fuse_reply_attr(req, &statbuf, 1.);
 }
 
-static int fuse_do_truncate(const FuseExport *exp, int64_t size,
-                            bool req_zero_write, PreallocMode prealloc)
+static int coroutine_fn fuse_do_truncate(const FuseExport *exp, int64_t size,
+                                         bool req_zero_write,
+                                         PreallocMode prealloc)
 {
     uint64_t blk_perm, blk_shared_perm;
     BdrvRequestFlags truncate_flags = 0;
@@ -472,8 +704,8 @@ static int fuse_do_truncate(const FuseExport *exp, int64_t size,
         }
     }
 
-    ret = blk_truncate(exp->common.blk, size, true, prealloc,
-                       truncate_flags, NULL);
+    ret = blk_co_truncate(exp->common.blk, size, true, prealloc,
+                          truncate_flags, NULL);
 
     if (add_resize_perm) {
         /* Must succeed, because we are only giving up the RESIZE permission */
@@ -493,8 +725,9 @@ static int fuse_do_truncate(const FuseExport *exp, int64_t size,
  * without allow_other cannot be given a different UID or GID, and
  * they cannot be given non-owner access.
  */
-static void fuse_setattr(fuse_req_t req, fuse_ino_t inode, struct stat *statbuf,
-                         int to_set, struct fuse_file_info *fi)
+static void coroutine_fn fuse_setattr(fuse_req_t req, fuse_ino_t inode,
+                                      struct stat *statbuf, int to_set,
+                                      struct fuse_file_info *fi)
 {
     FuseExport *exp = fuse_req_userdata(req);
     int supported_attrs;
@@ -538,7 +771,10 @@ static void fuse_setattr(fuse_req_t req, fuse_ino_t inode, struct stat *statbuf,
             return;
         }
 
+        /* Serialize with writes that grow the export */
+        qemu_co_mutex_lock(&exp->grow_lock);
         ret = fuse_do_truncate(exp, statbuf->st_size, true, PREALLOC_MODE_OFF);
+        qemu_co_mutex_unlock(&exp->grow_lock);
         if (ret < 0) {
             fuse_reply_err(req, -ret);
             return;
@@ -570,6 +806,100 @@ static void fuse_open(fuse_req_t req, fuse_ino_t inode,
     fuse_reply_open(req, fi);
 }
 
+/*
+ * State of a read, write or flush request that is processed in a coroutine,
+ * so that a queue can receive further requests while it waits for I/O
+ */
+typedef struct FuseRequest {
+    FuseExport *exp;
+    fuse_req_t req;
+    off_t offset;
+    size_t size;
+    void *buf;
+} FuseRequest;
+
+/**
+ * Run @entry for @r in a new coroutine in the current AioContext.  The
+ * request counts as in flight until fuse_request_done() is called.
+ */
+static void fuse_request_start(FuseRequest *r, CoroutineEntry *entry)
+{
+    fuse_inc_in_flight(r->exp);
+    qemu_coroutine_enter(qemu_coroutine_create(entry, r));
+}
+
+static void fuse_request_done(FuseRequest *r)
+{
+    FuseExport *exp = r->exp;
+
+    qemu_vfree(r->buf);
+    g_free(r);
+
+    fuse_dec_in_flight(exp);
+}
+
+/**
+ * Clients will expect short reads and writes at EOF, so we have to limit
+ * offset+size to the image length.  Growable exports are grown instead for
+ * writes.
+ */
+static int coroutine_fn fuse_co_clamp_to_eof(FuseRequest *r, bool grow)
+{
+    FuseExport *exp = r->exp;
+    int64_t length;
+    int ret;
+
+    length = blk_co_getlength(exp->common.blk);
+    if (length < 0) {
+        return length;
+    }
+
+    if (r->offset + r->size <= length) {
+        return 0;
+    }
+
+    if (!grow) {
+        r->size = r->offset < length ? length - r->offset : 0;
+        return 0;
+    }
+
+    /*
+     * Writes in other queues may grow the export concurrently.  Check the
+     * length again under the lock, so that the export never shrinks.
+     */
+    qemu_co_mutex_lock(&exp->grow_lock);
+    length = blk_co_getlength(exp->common.blk);
+    if (length < 0) {
+        ret = length;
+    } else if (r->offset + r->size > length) {
+        ret = fuse_do_truncate(exp, r->offset + r->size, true,
+                               PREALLOC_MODE_OFF);
+    } else {
+        ret = 0;
+    }
+    qemu_co_mutex_unlock(&exp->grow_lock);
+
+    return ret;
+}
+
+static void coroutine_fn fuse_co_read(void *opaque)
+{
+    FuseRequest *r = opaque;
+    int ret;
+
+    ret = fuse_co_clamp_to_eof(r, false);
+    if (ret >= 0) {
+        ret = blk_co_pread(r->exp->common.blk, r->offset, r->size, r->buf, 0);
+    }
+    if (ret >= 0) {
+        fuse_reply_buf(r->req, r->buf, r->size);
+    } else {
+        fuse_reply_err(r->req, -ret);
+    }
+
+    fuse_request_done(r);
+}
+
 /**
  * Handle client reads from the exported image.
  */
@@ -577,9 +907,8 @@ static void fuse_read(fuse_req_t req, fuse_ino_t inode,
                       size_t size, off_t offset, struct fuse_file_info *fi)
 {
     FuseExport *exp = fuse_req_userdata(req);
-    int64_t length;
+    FuseRequest *r;
     void *buf;
-    int ret;
 
     /* Limited by max_read, should not happen */
     if (size > FUSE_MAX_BOUNCE_BYTES) {
@@ -587,45 +916,56 @@ static void fuse_read(fuse_req_t req, fuse_ino_t inode,
         return;
     }
 
-    /**
-     * Clients will expect short reads at EOF, so we have to limit
-     * offset+size to the image length.
-     */
-    length = blk_getlength(exp->common.blk);
-    if (length < 0) {
-        fuse_reply_err(req, -length);
-        return;
-    }
-
-    if (offset + size > length) {
-        size = length - offset;
-    }
-
     buf = qemu_try_blockalign(blk_bs(exp->common.blk), size);
     if (!buf) {
         fuse_reply_err(req, ENOMEM);
         return;
     }
 
-    ret = blk_pread(exp->common.blk, offset, size, buf, 0);
+    r = g_new(FuseRequest, 1);
+    *r = (FuseRequest) {
+        .exp    = exp,
+        .req    = req,
+        .offset = offset,
+        .size   = size,
+        .buf    = buf,
+    };
+    fuse_request_start(r, fuse_co_read);
+}
+
+static void coroutine_fn fuse_co_write(void *opaque)
+{
+    FuseRequest *r = opaque;
+    int ret;
+
+    ret = fuse_co_clamp_to_eof(r, r->exp->growable);
     if (ret >= 0) {
-        fuse_reply_buf(req, buf, size);
+        ret = blk_co_pwrite(r->exp->common.blk, r->offset, r->size, r->buf, 0);
+    }
+    if (ret >= 0) {
+        fuse_reply_write(r->req, r->size);
     } else {
-        fuse_reply_err(req, -ret);
+        fuse_reply_err(r->req, -ret);
     }
 
-    qemu_vfree(buf);
+    fuse_request_done(r);
 }
 
 /**
- * Handle client writes to the exported image.
+ * Handle client writes to the exported image.  The data may still be in
+ * the splice pipe of the current thread, which the next request reuses, so
+ * it is copied into a bounce buffer before the write is submitted.
  */
-static void fuse_write(fuse_req_t req, fuse_ino_t inode, const char *buf,
-                       size_t size, off_t offset, struct fuse_file_info *fi)
+static void fuse_write_buf(fuse_req_t req, fuse_ino_t inode,
+                           struct fuse_bufvec *bufv, off_t offset,
+                           struct fuse_file_info *fi)
 {
     FuseExport *exp = fuse_req_userdata(req);
-    int64_t length;
-    int ret;
+    size_t size = fuse_buf_size(bufv);
+    struct fuse_bufvec dst = FUSE_BUFVEC_INIT(size);
+    FuseRequest *r;
+    ssize_t copied;
+    void *buf;
 
     /* Limited by max_write, should not happen */
     if (size > BDRV_REQUEST_MAX_BYTES) {
@@ -638,56 +978,45 @@ static void fuse_write(fuse_req_t req, fuse_ino_t inode, const char *buf,
         return;
     }
 
-    /**
-     * Clients will expect short writes at EOF, so we have to limit
-     * offset+size to the image length.
-     */
-    length = blk_getlength(exp->common.blk);
-    if (length < 0) {
-        fuse_reply_err(req, -length);
+    buf = qemu_try_blockalign(blk_bs(exp->common.blk), size);
+    if (!buf) {
+        fuse_reply_err(req, ENOMEM);
         return;
     }
 
-    if (offset + size > length) {
-        if (exp->growable) {
-            ret = fuse_do_truncate(exp, offset + size, true, PREALLOC_MODE_OFF);
-            if (ret < 0) {
-                fuse_reply_err(req, -ret);
-                return;
-            }
-        } else {
-            size = length - offset;
-        }
+    /* Consume all data, even what lies beyond the EOF */
+    dst.buf[0].mem = buf;
+    copied = fuse_buf_copy(&dst, bufv, 0);
+    if (copied != size) {
+        fuse_reply_err(req, copied < 0 ? -copied : EIO);
+        qemu_vfree(buf);
+        return;
     }
 
-    ret = blk_pwrite(exp->common.blk, offset, size, buf, 0);
-    if (ret >= 0) {
-        fuse_reply_write(req, size);
-    } else {
-        fuse_reply_err(req, -ret);
-    }
+    r = g_new(FuseRequest, 1);
+    *r = (FuseRequest) {
+        .exp    = exp,
+        .req    = req,
+        .offset = offset,
+        .size   = size,
+        .buf    = buf,
+    };
+    fuse_request_start(r, fuse_co_write);
 }
 
-/**
- * Let clients perform various fallocate() operations.
+/*
+ * Carry out a fallocate() request.  Must be called with exp->grow_lock held,
+ * because it checks the length of the export before resizing it.
  */
-static void fuse_fallocate(fuse_req_t req, fuse_ino_t inode, int mode,
-                           off_t offset, off_t length,
-                           struct fuse_file_info *fi)
+static int coroutine_fn fuse_do_fallocate(FuseExport *exp, int mode,
+                                          off_t offset, off_t length)
 {
-    FuseExport *exp = fuse_req_userdata(req);
     int64_t blk_len;
     int ret;
 
-    if (!exp->writable) {
-        fuse_reply_err(req, EACCES);
-        return;
-    }
-
-    blk_len = blk_getlength(exp->common.blk);
+    blk_len = blk_co_getlength(exp->common.blk);
     if (blk_len < 0) {
-        fuse_reply_err(req, -blk_len);
-        return;
+        return blk_len;
     }
 
 #ifdef CONFIG_FALLOCATE_PUNCH_HOLE
@@ -699,16 +1028,14 @@ static void fuse_fallocate(fuse_req_t req, fuse_ino_t inode, int mode,
     if (!mode) {
         /* We can only fallocate at the EOF with a truncate */
         if (offset < blk_len) {
-            fuse_reply_err(req, EOPNOTSUPP);
-            return;
+            return -EOPNOTSUPP;
         }
 
         if (offset > blk_len) {
             /* No preallocation needed here */
             ret = fuse_do_truncate(exp, offset, true, PREALLOC_MODE_OFF);
             if (ret < 0) {
-                fuse_reply_err(req, -ret);
-                return;
+                return ret;
             }
         }
 
@@ -718,15 +1045,15 @@ static void fuse_fallocate(fuse_req_t req, fuse_ino_t inode, int mode,
 #ifdef CONFIG_FALLOCATE_PUNCH_HOLE
     else if (mode & FALLOC_FL_PUNCH_HOLE) {
         if (!(mode & FALLOC_FL_KEEP_SIZE)) {
-            fuse_reply_err(req, EINVAL);
-            return;
+            return -EINVAL;
         }
 
         do {
             int size = MIN(length, BDRV_REQUEST_MAX_BYTES);
 
-            ret = blk_pwrite_zeroes(exp->common.blk, offset, size,
-                                    BDRV_REQ_MAY_UNMAP | BDRV_REQ_NO_FALLBACK);
+            ret = blk_co_pwrite_zeroes(exp->common.blk, offset, size,
+                                       BDRV_REQ_MAY_UNMAP |
+                                       BDRV_REQ_NO_FALLBACK);
             if (ret == -ENOTSUP) {
                 /*
                  * fallocate() specifies to return EOPNOTSUPP for unsupported
@@ -747,16 +1074,15 @@ static void fuse_fallocate(fuse_req_t req, fuse_ino_t inode, int mode,
             ret = fuse_do_truncate(exp, offset + length, false,
                                    PREALLOC_MODE_OFF);
             if (ret < 0) {
-                fuse_reply_err(req, -ret);
-                return;
+                return ret;
             }
         }
 
         do {
             int size = MIN(length, BDRV_REQUEST_MAX_BYTES);
 
-            ret = blk_pwrite_zeroes(exp->common.blk,
-                                    offset, size, 0);
+            ret = blk_co_pwrite_zeroes(exp->common.blk,
+                                       offset, size, 0);
             offset += size;
             length -= size;
         } while (ret == 0 && length > 0);
@@ -766,20 +1092,54 @@ static void fuse_fallocate(fuse_req_t req, fuse_ino_t inode, int mode,
         ret = -EOPNOTSUPP;
     }
 
+    return ret;
+}
+
+/**
+ * Let clients perform various fallocate() operations.
+ */
+static void coroutine_fn fuse_fallocate(fuse_req_t req, fuse_ino_t inode,
+                                        int mode, off_t offset, off_t length,
+                                        struct fuse_file_info *fi)
+{
+    FuseExport *exp = fuse_req_userdata(req);
+    int ret;
+
+    if (!exp->writable) {
+        fuse_reply_err(req, EACCES);
+        return;
+    }
+
+    /* Writes in other queues must not grow the export meanwhile */
+    qemu_co_mutex_lock(&exp->grow_lock);
+    ret = fuse_do_fallocate(exp, mode, offset, length);
+    qemu_co_mutex_unlock(&exp->grow_lock);
+
     fuse_reply_err(req, ret < 0 ? -ret : 0);
 }
 
+static void coroutine_fn fuse_co_flush(void *opaque)
+{
+    FuseRequest *r = opaque;
+    int ret;
+
+    ret = blk_co_flush(r->exp->common.blk);
+    fuse_reply_err(r->req, ret < 0 ? -ret : 0);
+
+    fuse_request_done(r);
+}
+
 /**
  * Let clients fsync the exported image.
  */
 static void fuse_fsync(fuse_req_t req, fuse_ino_t inode, int datasync,
                        struct fuse_file_info *fi)
 {
-    FuseExport *exp = fuse_req_userdata(req);
-    int ret;
+    FuseRequest *r = g_new0(FuseRequest, 1);
 
-    ret = blk_flush(exp->common.blk);
-    fuse_reply_err(req, ret < 0 ? -ret : 0);
+    r->exp = fuse_req_userdata(req);
+    r->req = req;
+    fuse_request_start(r, fuse_co_flush);
 }
 
 /**
@@ -796,8 +1156,9 @@ static void fuse_flush(fuse_req_t req, fuse_ino_t inode,
 /**
  * Let clients inquire allocation status.
  */
-static void fuse_lseek(fuse_req_t req, fuse_ino_t inode, off_t offset,
-                       int whence, struct fuse_file_info *fi)
+static void coroutine_fn fuse_lseek(fuse_req_t req, fuse_ino_t inode,
+                                    off_t offset, int whence,
+                                    struct fuse_file_info *fi)
 {
     FuseExport *exp = fuse_req_userdata(req);
 
@@ -810,8 +1171,11 @@ static void fuse_lseek(fuse_req_t req, fuse_ino_t inode, off_t offset,
         int64_t pnum;
         int ret;
 
-        ret = bdrv_block_status_above(blk_bs(exp->common.blk), NULL,
-                                      offset, INT64_MAX, &pnum, NULL, NULL);
+        WITH_GRAPH_RDLOCK_GUARD() {
+            ret = bdrv_co_block_status_above(blk_bs(exp->common.blk), NULL,
+                                             offset, INT64_MAX, &pnum,
+                                             NULL, NULL);
+        }
         if (ret < 0) {
             fuse_reply_err(req, -ret);
             return;
@@ -829,7 +1193,7 @@ static void fuse_lseek(fuse_req_t req, fuse_ino_t inode, off_t offset,
              * and @blk_len (the client-visible EOF).
              */
 
-            blk_len = blk_getlength(exp->common.blk);
+            blk_len = blk_co_getlength(exp->common.blk);
             if (blk_len < 0) {
                 fuse_reply_err(req, -blk_len);
                 return;
@@ -866,6 +1230,11 @@ static void fuse_lseek(fuse_req_t req, fuse_ino_t inode, off_t offset,
 }
 #endif
 
+/*
+ * All callbacks run in fuse_co_process_buf().  Reads, writes and flushes
+ * continue in a coroutine of their own, so that the queue can receive the
+ * next request while they wait for I/O.
+ */
 static const struct fuse_lowlevel_ops fuse_ops = {
     .init       = fuse_init,
     .lookup     = fuse_lookup,
@@ -873,7 +1242,7 @@ static const struct fuse_lowlevel_ops fuse_ops = {
     .setattr    = fuse_setattr,
     .open       = fuse_open,
     .read       = fuse_read,
-    .write      = fuse_write,
+    .write_buf  = fuse_write_buf,
     .fallocate  = fuse_fallocate,
     .flush      = fuse_flush,
     .fsync      = fuse_fsync,
@@ -10,6 +10,7 @@
  * later.  See the COPYING file in the top-level directory.
  */
 #include "qemu/osdep.h"
+#include "qemu/bitmap.h"
 #include "qemu/error-report.h"
 #include "block/block.h"
 #include "subprojects/libvhost-user/libvhost-user.h" /* only for the type definitions */
@@ -18,6 +19,7 @@
 #include "vhost-user-blk-server.h"
 #include "qapi/error.h"
 #include "qom/object_interfaces.h"
+#include "sysemu/iothread.h"
 #include "util/block-helpers.h"
 #include "virtio-blk-handler.h"
 
@@ -38,6 +40,11 @@ typedef struct {
     VirtioBlkHandler handler;
     QIOChannelSocket *sioc;
     struct virtio_blk_config blkcfg;
+
+    /* From iothread-vq-mapping, NULL if all queues are in export.ctx */
+    AioContext **queue_ctx;
+    IOThread **iothreads;
+    size_t nr_iothreads;
 } VuBlkExport;
 
 static void vu_blk_req_complete(VuBlkReq *req, size_t in_len)
@@ -79,6 +86,7 @@ static void coroutine_fn vu_blk_virtio_process_req(void *opaque)
     vhost_user_server_dec_in_flight(server);
 }
 
+/* Runs in the AioContext of the virtqueue */
 static void vu_blk_process_vq(VuDev *vu_dev, int idx)
 {
     VuServer *server = container_of(vu_dev, VuServer, vu_dev);
@@ -314,6 +322,115 @@ static const BlockDevOps vu_blk_dev_ops = {
     .resize_cb = vu_blk_exp_resize,
 };
 
+/*
+ * Check the iothread-vq-mapping list in the same way as the virtio-blk device
+ * does and generate the vq:AioContext mapping from it.
+ */
+static bool vu_blk_apply_vq_mapping(VuBlkExport *vexp,
+                                    IOThreadVirtQueueMappingList *list,
+                                    uint16_t num_queues, Error **errp)
+{
+    g_autofree unsigned long *vqs = bitmap_new(num_queues);
+    g_autoptr(GHashTable) names = g_hash_table_new(g_str_hash, g_str_equal);
+    IOThreadVirtQueueMappingList *node;
+    size_t nr_iothreads = 0;
+    size_t i;
+
+    for (node = list; node; node = node->next) {
+        const char *name = node->value->iothread;
+        uint16List *vq;
+
+        if (!iothread_by_id(name)) {
+            error_setg(errp, "IOThread \"%s\" object does not exist", name);
+            return false;
+        }
+
+        if (!g_hash_table_add(names, (gpointer)name)) {
+            error_setg(errp,
+                       "duplicate IOThread name \"%s\" in iothread-vq-mapping",
+                       name);
+            return false;
+        }
+
+        if (!!node->value->vqs != !!list->value->vqs) {
+            error_setg(errp, "either all items in iothread-vq-mapping "
+                             "must have vqs or none of them must have it");
+            return false;
+        }
+
+        for (vq = node->value->vqs; vq; vq = vq->next) {
+            if (vq->value >= num_queues) {
+                error_setg(errp, "vq index %u for IOThread \"%s\" must be "
+                           "less than num-queues %u in iothread-vq-mapping",
+                           vq->value, name, num_queues);
+                return false;
+            }
+
+            if (test_and_set_bit(vq->value, vqs)) {
+                error_setg(errp, "cannot assign vq %u to IOThread \"%s\" "
+                           "because it is already assigned", vq->value, name);
+                return false;
+            }
+        }
+
+        nr_iothreads++;
+    }
+
+    if (list->value->vqs) {
+        for (i = 0; i < num_queues; i++) {
+            if (!test_bit(i, vqs)) {
+                error_setg(errp, "missing vq %zu IOThread assignment in "
+                           "iothread-vq-mapping", i);
+                return false;
+            }
+        }
+    }
+
+    vexp->queue_ctx = g_new0(AioContext *, num_queues);
+    vexp->iothreads = g_new0(IOThread *, nr_iothreads);
+    vexp->nr_iothreads = nr_iothreads;
+
+    for (i = 0, node = list; node; i++, node = node->next) {
+        IOThread *iothread = iothread_by_id(node->value->iothread);
+        AioContext *ctx = iothread_get_aio_context(iothread);
+
+        /* Released in vu_blk_put_iothreads() */
+        object_ref(OBJECT(iothread));
+        vexp->iothreads[i] = iothread;
+
+        if (node->value->vqs) {
+            uint16List *vq;
+
+            for (vq = node->value->vqs; vq; vq = vq->next) {
+                vexp->queue_ctx[vq->value] = ctx;
+            }
+        } else {
+            size_t j;
+
+            /* Round-robin vq:IOThread assignment */
+            for (j = i; j < num_queues; j += nr_iothreads) {
+                vexp->queue_ctx[j] = ctx;
+            }
+        }
+    }
+
+    return true;
+}
+
+static void vu_blk_put_iothreads(VuBlkExport *vexp)
+{
+    size_t i;
+
+    for (i = 0; i < vexp->nr_iothreads; i++) {
+        object_unref(OBJECT(vexp->iothreads[i]));
+    }
+    g_free(vexp->iothreads);
+    g_free(vexp->queue_ctx);
+    vexp->iothreads = NULL;
+    vexp->queue_ctx = NULL;
+    vexp->nr_iothreads = 0;
+}
+
 static int vu_blk_exp_create(BlockExport *exp, BlockExportOptions *opts,
                              Error **errp)
 {
@@ -344,6 +461,15 @@ static int vu_blk_exp_create(BlockExport *exp, BlockExportOptions *opts,
         error_setg(errp, "num-queues must be greater than 0");
         return -EINVAL;
     }
+
+    /* Without a mapping, all virtqueues run in the export's AioContext */
+    if (vu_opts->iothread_vq_mapping &&
+        !vu_blk_apply_vq_mapping(vexp, vu_opts->iothread_vq_mapping,
+                                 num_queues, errp)) {
+        vu_blk_put_iothreads(vexp);
+        return -EINVAL;
+    }
+
     vexp->handler.blk = exp->blk;
     vexp->handler.serial = g_strdup("vhost_user_blk");
     vexp->handler.logical_block_size = logical_block_size;
@@ -358,10 +484,12 @@ static int vu_blk_exp_create(BlockExport *exp, BlockExportOptions *opts,
     blk_set_dev_ops(exp->blk, &vu_blk_dev_ops, vexp);
 
     if (!vhost_user_server_start(&vexp->vu_server, vu_opts->addr, exp->ctx,
-                                 num_queues, &vu_blk_iface, errp)) {
+                                 num_queues, vexp->queue_ctx, &vu_blk_iface,
+                                 errp)) {
         blk_remove_aio_context_notifier(exp->blk, blk_aio_attached,
                                         blk_aio_detach, vexp);
         g_free(vexp->handler.serial);
+        vu_blk_put_iothreads(vexp);
         return -EADDRNOTAVAIL;
     }
 
@@ -375,6 +503,7 @@ static void vu_blk_exp_delete(BlockExport *exp)
     blk_remove_aio_context_notifier(exp->blk, blk_aio_attached, blk_aio_detach,
                                     vexp);
     g_free(vexp->handler.serial);
+    vu_blk_put_iothreads(vexp);
 }
 
 const BlockExportDriver blk_exp_vhost_user_blk = {
@@ -50,8 +50,9 @@ virtio_blk_sect_range_ok(BlockBackend *blk, uint32_t block_size,
 }
 
 static int coroutine_fn
-virtio_blk_discard_write_zeroes(VirtioBlkHandler *handler, struct iovec *iov,
-                                uint32_t iovcnt, uint32_t type)
+virtio_blk_discard_write_zeroes(const VirtioBlkHandler *handler,
+                                struct iovec *iov, uint32_t iovcnt,
+                                uint32_t type)
 {
     BlockBackend *blk = handler->blk;
     struct virtio_blk_discard_write_zeroes desc;
@@ -129,7 +130,7 @@ virtio_blk_discard_write_zeroes(VirtioBlkHandler *handler, struct iovec *iov,
     return VIRTIO_BLK_S_IOERR;
 }
 
-int coroutine_fn virtio_blk_process_req(VirtioBlkHandler *handler,
+int coroutine_fn virtio_blk_process_req(const VirtioBlkHandler *handler,
                                         struct iovec *in_iov,
                                         struct iovec *out_iov,
                                         unsigned int in_num,
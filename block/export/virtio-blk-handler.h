@@ -21,6 +21,11 @@
 #define VIRTIO_BLK_MAX_DISCARD_SECTORS 32768
 #define VIRTIO_BLK_MAX_WRITE_ZEROES_SECTORS 32768
 
+/*
+ * Not modified after the export has been created, so the virtqueues of an
+ * export can process requests in several threads without locking.  All
+ * per-request state lives on the stack of virtio_blk_process_req().
+ */
 typedef struct {
     BlockBackend *blk;
     char *serial;
@@ -28,7 +33,7 @@ typedef struct {
     bool writable;
 } VirtioBlkHandler;
 
-int coroutine_fn virtio_blk_process_req(VirtioBlkHandler *handler,
+int coroutine_fn virtio_blk_process_req(const VirtioBlkHandler *handler,
                                         struct iovec *in_iov,
                                         struct iovec *out_iov,
                                         unsigned int in_num,
@@ -35,6 +35,9 @@
 #include "trace.h"
 #include "block/thread-pool.h"
 #include "qemu/iov.h"
+#include "qemu/rcu.h"
+#include "qemu/defer-call.h"
+#include "qemu/range.h"
 #include "block/raw-aio.h"
 #include "qapi/qmp/qdict.h"
 #include "qapi/qmp/qstring.h"
@@ -124,6 +127,16 @@
 #define O_DIRECT O_DSYNC
 #endif
 
+#ifdef CONFIG_LINUX_IO_URING
+/* Buffers registered with bdrv_register_buf(), see raw_register_buf() */
+typedef struct RawRegisteredBufs {
+    struct rcu_head rcu;
+    unsigned int gen;
+    unsigned int nr;
+    struct iovec iov[];
+} RawRegisteredBufs;
+#endif
+
 #define FTYPE_FILE   0
 #define FTYPE_CD     1
 
@@ -134,6 +147,30 @@
 #define RAW_LOCK_PERM_BASE             100
 #define RAW_LOCK_SHARED_BASE           200
 
+/* Upper limit for the length of merged discard and write zeroes requests */
+#define RAW_ZERO_BATCH_MAX_BYTES       (1 * GiB)
+
+/*
+ * Discard or write zeroes requests with adjacent or overlapping ranges that
+ * are submitted in the same defer_call_begin()/defer_call_end() section and
+ * are merged into a single request, see raw_co_zero_range().
+ */
+typedef struct RawZeroBatch {
+    struct BDRVRawState *s;
+    int type;                   /* QEMU_AIO_DISCARD or QEMU_AIO_WRITE_ZEROES */
+    BdrvRequestFlags flags;
+
+    /* Protected by s->zero_batch_lock */
+    int64_t offset;
+    int64_t bytes;
+    bool closed;                /* no more requests can join */
+    bool done;                  /* the merged request has completed */
+    int ret;
+    unsigned int refcnt;
+    CoQueue queue;              /* waits for closed (first request) or done */
+    QLIST_ENTRY(RawZeroBatch) next;
+} RawZeroBatch;
+
 typedef struct BDRVRawState {
     int fd;
     bool use_lock;
@@ -152,6 +189,37 @@ typedef struct BDRVRawState {
 
     uint64_t aio_max_batch;
 
+#ifdef CONFIG_LINUX_IO_URING
+    /*
+     * With any of the io-uring-* options, requests from the event loop thread
+     * of the node's AioContext go to a ring of the node's own instead of the
+     * ring shared by the AioContext.  See raw_get_luring().  The request
+     * paths clear these when the kernel refuses a feature, so they are
+     * accessed atomically.
+     */
+    unsigned int luring_flags;
+    bool luring_fixed_buffers;
+    LuringState *luring;
+
+    /* Written under the BQL, read under RCU */
+    RawRegisteredBufs *luring_bufs;
+
+    /* Generation of luring_bufs that is registered with s->luring */
+    unsigned int luring_bufs_synced;
+
+    /*
+     * Cleared by the request paths if fallocate() fails with io_uring, but
+     * works in threads, so it is accessed atomically
+     */
+    bool luring_fallocate;
+#endif
+
+    /* Merge adjacent discard and write zeroes requests */
+    bool coalesce_zeroes;
+    QemuMutex zero_batch_lock;
+    QLIST_HEAD(, RawZeroBatch) zero_batches; /* batches that can be joined */
+    unsigned int zero_batches_nr;            /* read without the lock */
+
     int perm_change_fd;
     int perm_change_flags;
     BDRVReopenState *reopen_state;
@@ -170,6 +238,8 @@ typedef struct BDRVRawState {
         uint64_t discard_nb_ok;
         uint64_t discard_nb_failed;
         uint64_t discard_bytes_ok;
+        uint64_t discard_nb_merged;
+        uint64_t write_zeroes_nb_merged;
     } stats;
 
     PRManager *pr_mgr;
@@ -560,6 +630,44 @@ static QemuOptsList raw_runtime_opts = {
             .type = QEMU_OPT_NUMBER,
             .help = "AIO max batch size (0 = auto handled by AIO backend, default: 0)",
         },
+#ifdef CONFIG_LINUX_IO_URING
+        {
+            .name = "io-uring-sqpoll",
+            .type = QEMU_OPT_BOOL,
+            .help = "poll the io_uring submission queue from a kernel thread "
+                    "(default: off)",
+        },
+        {
+            .name = "io-uring-coop-taskrun",
+            .type = QEMU_OPT_BOOL,
+            .help = "run io_uring completion work only when entering the "
+                    "kernel (default: off)",
+        },
+        {
+            .name = "io-uring-single-issuer",
+            .type = QEMU_OPT_BOOL,
+            .help = "let the io_uring kernel code assume a single submitter "
+                    "thread (default: off)",
+        },
+        {
+            .name = "io-uring-iopoll",
+            .type = QEMU_OPT_BOOL,
+            .help = "busy poll for io_uring completions, requires "
+                    "cache.direct=on (default: off)",
+        },
+        {
+            .name = "io-uring-fixed-buffers",
+            .type = QEMU_OPT_BOOL,
+            .help = "register guest RAM as io_uring fixed buffers "
+                    "(default: off)",
+        },
+#endif
+        {
+            .name = "coalesce-zeroes",
+            .type = QEMU_OPT_BOOL,
+            .help = "merge adjacent discard and write zeroes requests "
+                    "(default: on)",
+        },
         {
             .name = "locking",
             .type = QEMU_OPT_STRING,
@@ -641,6 +749,32 @@ static int raw_open_common(BlockDriverState *bs, QDict *options,
 
     s->aio_max_batch = qemu_opt_get_number(opts, "aio-max-batch", 0);
 
+#ifdef CONFIG_LINUX_IO_URING
+    if (qemu_opt_get_bool(opts, "io-uring-sqpoll", false)) {
+        s->luring_flags |= LURING_SQPOLL;
+    }
+    if (qemu_opt_get_bool(opts, "io-uring-coop-taskrun", false)) {
+        s->luring_flags |= LURING_COOP_TASKRUN;
+    }
+    if (qemu_opt_get_bool(opts, "io-uring-single-issuer", false)) {
+        s->luring_flags |= LURING_SINGLE_ISSUER;
+    }
+    if (qemu_opt_get_bool(opts, "io-uring-iopoll", false)) {
+        s->luring_flags |= LURING_IOPOLL;
+    }
+    s->luring_fixed_buffers = qemu_opt_get_bool(opts, "io-uring-fixed-buffers",
+                                                false);
+    if ((s->luring_flags || s->luring_fixed_buffers) &&
+        !s->use_linux_io_uring) {
+        error_setg(errp, "io-uring-* options require aio=io_uring");
+        ret = -EINVAL;
+        goto fail;
+    }
+    qatomic_set(&s->luring_fallocate, true);
+#endif
+
+    s->coalesce_zeroes = qemu_opt_get_bool(opts, "coalesce-zeroes", true);
+
     locking = qapi_enum_parse(&OnOffAuto_lookup,
                               qemu_opt_get(opts, "locking"),
                               ON_OFF_AUTO_AUTO, &local_err);
@@ -736,6 +870,16 @@ static int raw_open_common(BlockDriverState *bs, QDict *options,
     }
 #endif /* !defined(CONFIG_LINUX_IO_URING) */
 
+#ifdef CONFIG_LINUX_IO_URING
+    if ((qatomic_read(&s->luring_flags) & LURING_IOPOLL) &&
+        !(s->open_flags & O_DIRECT)) {
+        error_setg(errp, "io-uring-iopoll=on was specified, but it requires "
+                         "cache.direct=on, which was not specified.");
+        ret = -EINVAL;
+        goto fail;
+    }
+#endif
+
     s->has_discard = true;
     s->has_write_zeroes = true;
 
@@ -805,6 +949,9 @@ static int raw_open_common(BlockDriverState *bs, QDict *options,
         /* When extending regular files, we get zeros from the OS */
         bs->supported_truncate_flags = BDRV_REQ_ZERO_WRITE;
     }
+
+    qemu_mutex_init(&s->zero_batch_lock);
+    QLIST_INIT(&s->zero_batches);
     ret = 0;
 fail:
     if (ret < 0 && s->fd != -1) {
@@ -2452,6 +2599,232 @@ static inline bool raw_check_linux_io_uring(BDRVRawState *s)
 }
 #endif
 
+#ifdef CONFIG_LINUX_IO_URING
+/*
+ * Returns the node's private ring if the current request should use it, or
+ * NULL for the shared ring of the current AioContext.
+ *
+ * The private ring is created lazily in the event loop thread of the node's
+ * AioContext and only used from there: io-uring-single-issuer rings refuse
+ * submissions from other threads, and registering buffers is subject to the
+ * same rule.  Requests from vCPU threads holding the BQL go to the shared
+ * ring instead.
+ */
+static LuringState *raw_get_luring(BlockDriverState *bs)
+{
+    BDRVRawState *s = bs->opaque;
+    AioContext *ctx = bdrv_get_aio_context(bs);
+    LuringState *luring;
+    unsigned int flags = qatomic_read(&s->luring_flags);
+    Error *local_err = NULL;
+
+    if (!flags && !qatomic_read(&s->luring_fixed_buffers)) {
+        return NULL;
+    }
+    if (!in_aio_context_event_loop(ctx)) {
+        return NULL;
+    }
+
+    luring = qatomic_read(&s->luring);
+    if (!luring) {
+        luring = luring_init_private(s->fd, flags, &local_err);
+        if (!luring) {
+            error_reportf_err(local_err, "Unable to set up io_uring ring for "
+                              "%s, falling back to the shared ring: ",
+                              bs->filename);
+            qatomic_set(&s->luring_flags, 0);
+            qatomic_set(&s->luring_fixed_buffers, false);
+            return NULL;
+        }
+        luring_attach_aio_context(luring, ctx);
+        s->luring_bufs_synced = 0;
+        qatomic_set(&s->luring, luring);
+    }
+
+    if (qatomic_read(&s->luring_fixed_buffers)) {
+        RawRegisteredBufs *bufs;
+        g_autofree struct iovec *iov = NULL;
+        unsigned int nr = 0;
+        unsigned int gen = 0;
+        int ret;
+
+        /* Pinning the pages can take a while, don't hold up RCU for that */
+        WITH_RCU_READ_LOCK_GUARD() {
+            bufs = qatomic_rcu_read(&s->luring_bufs);
+            if (!bufs || bufs->gen == s->luring_bufs_synced) {
+                return luring;
+            }
+            nr = bufs->nr;
+            iov = g_memdup2(bufs->iov, nr * sizeof(iov[0]));
+            gen = bufs->gen;
+        }
+
+        ret = luring_register_buffers(luring, iov, nr);
+        if (ret == -EBUSY) {
+            /* Requests still use the old buffers, retry with the next one */
+            return luring;
+        }
+        s->luring_bufs_synced = gen;
+        if (ret < 0) {
+            warn_report("Failed to register io_uring fixed buffers for %s: %s",
+                        bs->filename, strerror(-ret));
+            qatomic_set(&s->luring_fixed_buffers, false);
+        }
+    }
+
+    return luring;
+}
+
+/*
+ * The ring is freed in its AioContext after the requests that were already
+ * submitted to it have completed.  The next request creates a new one.
+ */
+static void raw_drop_luring(BDRVRawState *s)
+{
+    LuringState *luring = qatomic_xchg(&s->luring, NULL);
+
+    if (luring) {
+        luring_retire(luring);
+    }
+}
+
+static int coroutine_fn raw_co_luring_submit(BlockDriverState *bs,
+                                            uint64_t offset,
+                                            QEMUIOVector *qiov, int type)
+{
+    BDRVRawState *s = bs->opaque;
+    LuringState *luring;
+    int ret;
+
+    /* IOPOLL rings only take reads and writes */
+    if (type == QEMU_AIO_FLUSH &&
+        (qatomic_read(&s->luring_flags) & LURING_IOPOLL)) {
+        return luring_co_submit(bs, s->fd, offset, qiov, type);
+    }
+
+    luring = raw_get_luring(bs);
+    if (!luring) {
+        return luring_co_submit(bs, s->fd, offset, qiov, type);
+    }
+
+    ret = luring_co_submit_private(luring, bs, offset, qiov, type);
+    if (ret == -EOPNOTSUPP &&
+        (qatomic_read(&s->luring_flags) & LURING_IOPOLL)) {
+        /* The file system can't poll, or O_DIRECT was dropped on reopen */
+        warn_report("Polled I/O is not supported for %s, disabling "
+                    "io-uring-iopoll", bs->filename);
+        qatomic_and(&s->luring_flags, ~LURING_IOPOLL);
+        raw_drop_luring(s);
+        return raw_co_luring_submit(bs, offset, qiov, type);
+    }
+    return ret;
+}
+
+#ifdef CONFIG_FALLOCATE_PUNCH_HOLE
+/*
+ * Tries the fallocate() call that the thread pool handlers for discard and
+ * write zeroes requests on regular files start with.  The caller falls back
+ * to the thread pool on errors.
+ */
+static int coroutine_fn raw_co_luring_fallocate(BlockDriverState *bs,
+                                               int type,
+                                               BdrvRequestFlags flags,
+                                               uint64_t offset, uint64_t bytes)
+{
+    BDRVRawState *s = bs->opaque;
+    LuringState *luring = NULL;
+    int mode;
+
+    if (type == QEMU_AIO_DISCARD) {
+        if (!s->has_discard) {
+            return -ENOTSUP;
+        }
+        mode = FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE;
+    } else if (flags & BDRV_REQ_MAY_UNMAP) {
+        mode = FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE;
+    } else {
+#ifdef CONFIG_FALLOCATE_ZERO_RANGE
+        if (!s->has_write_zeroes) {
+            return -ENOTSUP;
+        }
+        mode = FALLOC_FL_ZERO_RANGE;
+#else
+        return -ENOTSUP;
+#endif
+    }
+
+    /* IOPOLL rings only take reads and writes */
+    if (!(qatomic_read(&s->luring_flags) & LURING_IOPOLL)) {
+        luring = raw_get_luring(bs);
+    }
+    return luring_co_fallocate(luring, bs, s->fd, type, mode, offset, bytes);
+}
+#endif
+
+static bool raw_register_buf(BlockDriverState *bs, void *host, size_t size,
+                             Error **errp)
+{
+    BDRVRawState *s = bs->opaque;
+    RawRegisteredBufs *old = s->luring_bufs;
+    RawRegisteredBufs *new;
+    unsigned int nr = old ? old->nr : 0;
+
+    if (!qatomic_read(&s->luring_fixed_buffers)) {
+        return true;
+    }
+
+    new = g_malloc(sizeof(*new) + (nr + 1) * sizeof(new->iov[0]));
+    new->gen = old ? old->gen + 1 : 1;
+    new->nr = nr + 1;
+    if (nr) {
+        memcpy(new->iov, old->iov, nr * sizeof(new->iov[0]));
+    }
+    new->iov[nr] = (struct iovec) { .iov_base = host, .iov_len = size };
+
+    qatomic_rcu_set(&s->luring_bufs, new);
+    if (old) {
+        g_free_rcu(old, rcu);
+    }
+    return true;
+}
+
+static void raw_unregister_buf(BlockDriverState *bs, void *host, size_t size)
+{
+    BDRVRawState *s = bs->opaque;
+    RawRegisteredBufs *old = s->luring_bufs;
+    RawRegisteredBufs *new;
+    unsigned int i, j;
+
+    if (!old) {
+        return;
+    }
+
+    /*
+     * The ring still holds the pages until its event loop thread picks up the
+     * new generation.  Requests are not matched against the old buffers once
+     * the new generation is seen, even if it can only be registered after
+     * the requests that use the old buffers are done, so memory that is
+     * reused at the same address can't be confused with the old buffer.
+     */
+    new = g_malloc(sizeof(*new) + old->nr * sizeof(new->iov[0]));
+    new->gen = old->gen + 1;
+    for (i = 0, j = 0; i < old->nr; i++) {
+        if (old->iov[i].iov_base != host || old->iov[i].iov_len != size) {
+            new->iov[j++] = old->iov[i];
+        }
+    }
+    new->nr = j;
+
+    qatomic_rcu_set(&s->luring_bufs, new);
+    g_free_rcu(old, rcu);
+}
+
+static void raw_detach_aio_context(BlockDriverState *bs)
+{
+    raw_drop_luring(bs->opaque);
+}
+#endif
+
 #ifdef CONFIG_LINUX_AIO
 static inline bool raw_check_linux_aio(BDRVRawState *s)
 {
@@ -2473,6 +2846,72 @@ static inline bool raw_check_linux_aio(BDRVRawState *s)
 }
 #endif
 
+/* Called with s->zero_batch_lock held */
+static void raw_zero_batch_unref(RawZeroBatch *b)
+{
+    if (--b->refcnt == 0) {
+        g_free(b);
+    }
+}
+
+/*
+ * Stops other requests from joining @b and lets its first request submit it.
+ * Called with s->zero_batch_lock held, which may be temporarily released.
+ */
+static void raw_zero_batch_close_locked(BDRVRawState *s, RawZeroBatch *b)
+{
+    if (b->closed) {
+        return;
+    }
+    b->closed = true;
+    QLIST_REMOVE(b, next);
+    qatomic_set(&s->zero_batches_nr, s->zero_batches_nr - 1);
+    qemu_co_enter_all(&b->queue, &s->zero_batch_lock);
+}
+
+/* defer_call() callback, runs at the end of the section that opened @b */
+static void raw_zero_batch_close(void *opaque)
+{
+    RawZeroBatch *b = opaque;
+    BDRVRawState *s = b->s;
+
+    qemu_mutex_lock(&s->zero_batch_lock);
+    raw_zero_batch_close_locked(s, b);
+    raw_zero_batch_unref(b);
+    qemu_mutex_unlock(&s->zero_batch_lock);
+}
+
+/*
+ * Submits the batches that overlap with @offset/@bytes and waits for them to
+ * complete.  Used before writes so that they can't be overtaken by a discard
+ * or write zeroes request that was issued earlier, but is still waiting for
+ * more requests to merge.
+ */
+static void coroutine_fn raw_zero_batch_flush(BDRVRawState *s, uint64_t offset,
+                                              uint64_t bytes)
+{
+    RawZeroBatch *b;
+
+    if (!qatomic_read(&s->zero_batches_nr)) {
+        return;
+    }
+
+    qemu_mutex_lock(&s->zero_batch_lock);
+retry:
+    QLIST_FOREACH(b, &s->zero_batches, next) {
+        if (ranges_overlap(b->offset, b->bytes, offset, bytes)) {
+            b->refcnt++;
+            raw_zero_batch_close_locked(s, b);
+            while (!b->done) {
+                qemu_co_queue_wait(&b->queue, &s->zero_batch_lock);
+            }
+            raw_zero_batch_unref(b);
+            goto retry;
+        }
+    }
+    qemu_mutex_unlock(&s->zero_batch_lock);
+}
+
 static int coroutine_fn raw_co_prw(BlockDriverState *bs, int64_t *offset_ptr,
                                    uint64_t bytes, QEMUIOVector *qiov, int type)
 {
@@ -2483,6 +2922,9 @@ static int coroutine_fn raw_co_prw(BlockDriverState *bs, int64_t *offset_ptr,
 
     if (fd_open(bs) < 0)
         return -EIO;
+    if (type == QEMU_AIO_WRITE) {
+        raw_zero_batch_flush(s, offset, bytes);
+    }
 #if defined(CONFIG_BLKZONED)
     if ((type & (QEMU_AIO_WRITE | QEMU_AIO_ZONE_APPEND)) &&
         bs->bl.zoned != BLK_Z_NONE) {
@@ -2505,7 +2947,7 @@ static int coroutine_fn raw_co_prw(BlockDriverState *bs, int64_t *offset_ptr,
 #ifdef CONFIG_LINUX_IO_URING
     } else if (raw_check_linux_io_uring(s)) {
         assert(qiov->size == bytes);
-        ret = luring_co_submit(bs, s->fd, offset, qiov, type);
+        ret = raw_co_luring_submit(bs, offset, qiov, type);
         goto out;
 #endif
 #ifdef CONFIG_LINUX_AIO
@@ -2597,7 +3039,7 @@ static int coroutine_fn raw_co_flush_to_disk(BlockDriverState *bs)
 
 #ifdef CONFIG_LINUX_IO_URING
     if (raw_check_linux_io_uring(s)) {
-        return luring_co_submit(bs, s->fd, 0, NULL, QEMU_AIO_FLUSH);
+        return raw_co_luring_submit(bs, 0, NULL, QEMU_AIO_FLUSH);
     }
 #endif
     return raw_thread_pool_submit(handle_aiocb_flush, &acb);
@@ -2607,6 +3049,16 @@ static void raw_close(BlockDriverState *bs)
 {
     BDRVRawState *s = bs->opaque;
 
+    /* Batches only exist while requests are in flight */
+    assert(QLIST_EMPTY(&s->zero_batches));
+    qemu_mutex_destroy(&s->zero_batch_lock);
+
+#ifdef CONFIG_LINUX_IO_URING
+    raw_drop_luring(s);
+    g_free(s->luring_bufs);
+    s->luring_bufs = NULL;
+#endif
+
     if (s->fd >= 0) {
 #if defined(CONFIG_BLKZONED)
         g_free(bs->wps);
@@ -3536,18 +3988,35 @@ static int coroutine_fn raw_co_zone_append(BlockDriverState *bs,
 }
 #endif
 
-static coroutine_fn int
-raw_do_pdiscard(BlockDriverState *bs, int64_t offset, int64_t bytes,
-                bool blkdev)
+/*
+ * Issues a single discard (@type is QEMU_AIO_DISCARD) or write zeroes
+ * (QEMU_AIO_WRITE_ZEROES) request, which may be the result of merging several
+ * requests.
+ */
+static int coroutine_fn
+raw_co_zero_range_submit(BlockDriverState *bs, int type, int64_t offset,
+                         int64_t bytes, BdrvRequestFlags flags, bool blkdev)
 {
     BDRVRawState *s = bs->opaque;
     RawPosixAIOData acb;
+    ThreadPoolFunc *handler;
     int ret;
+#if defined(CONFIG_LINUX_IO_URING) && defined(CONFIG_FALLOCATE_PUNCH_HOLE)
+    int luring_ret = 0;
+
+    if (!blkdev && qatomic_read(&s->luring_fallocate) &&
+        raw_check_linux_io_uring(s)) {
+        luring_ret = raw_co_luring_fallocate(bs, type, flags, offset, bytes);
+        if (luring_ret == 0) {
+            return 0;
+        }
+    }
+#endif
 
     acb = (RawPosixAIOData) {
         .bs             = bs,
         .aio_fildes     = s->fd,
-        .aio_type       = QEMU_AIO_DISCARD,
+        .aio_type       = type,
         .aio_offset     = offset,
         .aio_nbytes     = bytes,
     };
@@ -3556,7 +4025,135 @@ raw_do_pdiscard(BlockDriverState *bs, int64_t offset, int64_t bytes,
         acb.aio_type |= QEMU_AIO_BLKDEV;
     }
 
-    ret = raw_thread_pool_submit(handle_aiocb_discard, &acb);
+    if (type == QEMU_AIO_DISCARD) {
+        handler = handle_aiocb_discard;
+    } else {
+        if (flags & BDRV_REQ_NO_FALLBACK) {
+            acb.aio_type |= QEMU_AIO_NO_FALLBACK;
+        }
+        if (flags & BDRV_REQ_MAY_UNMAP) {
+            acb.aio_type |= QEMU_AIO_DISCARD;
+            handler = handle_aiocb_write_zeroes_unmap;
+        } else {
+            handler = handle_aiocb_write_zeroes;
+        }
+    }
+
+    ret = raw_thread_pool_submit(handler, &acb);
+
+#if defined(CONFIG_LINUX_IO_URING) && defined(CONFIG_FALLOCATE_PUNCH_HOLE)
+    if (luring_ret < 0 && luring_ret != -ENOTSUP && ret == 0) {
+        /*
+         * Either the kernel can't fallocate() through io_uring (before Linux
+         * 5.6) or the file system needs the fallbacks of the thread pool
+         * handler.  Don't try again in both cases.
+         */
+        qatomic_set(&s->luring_fallocate, false);
+    }
+#endif
+    return ret;
+}
+
+/*
+ * Issues a discard or write zeroes request, merging it with other requests of
+ * the same kind whose ranges are adjacent or overlap if they are submitted in
+ * the same defer_call_begin()/defer_call_end() section.  Device emulation
+ * opens such a section while it processes a batch of guest requests, so
+ * nothing is delayed for longer than that.  Outside of a section, the request
+ * is submitted immediately.
+ */
+static int coroutine_fn
+raw_co_zero_range(BlockDriverState *bs, int type, int64_t offset,
+                  int64_t bytes, BdrvRequestFlags flags, bool blkdev)
+{
+    BDRVRawState *s = bs->opaque;
+    RawZeroBatch *b;
+    int64_t max_bytes;
+    int ret;
+
+    if (!s->coalesce_zeroes) {
+        return raw_co_zero_range_submit(bs, type, offset, bytes, flags,
+                                        blkdev);
+    }
+
+    max_bytes = type == QEMU_AIO_DISCARD ? bs->bl.max_pdiscard
+                                         : bs->bl.max_pwrite_zeroes;
+    max_bytes = MIN_NON_ZERO(max_bytes, RAW_ZERO_BATCH_MAX_BYTES);
+    flags &= BDRV_REQ_MAY_UNMAP | BDRV_REQ_NO_FALLBACK;
+
+    qemu_mutex_lock(&s->zero_batch_lock);
+    QLIST_FOREACH(b, &s->zero_batches, next) {
+        int64_t start = MIN(b->offset, offset);
+        int64_t end = MAX(b->offset + b->bytes, offset + bytes);
+
+        if (b->type != type || b->flags != flags ||
+            offset > b->offset + b->bytes || b->offset > offset + bytes ||
+            end - start > max_bytes) {
+            continue;
+        }
+
+        b->offset = start;
+        b->bytes = end - start;
+        b->refcnt++;
+        if (type == QEMU_AIO_DISCARD) {
+            s->stats.discard_nb_merged++;
+        } else {
+            s->stats.write_zeroes_nb_merged++;
+        }
+
+        while (!b->done) {
+            qemu_co_queue_wait(&b->queue, &s->zero_batch_lock);
+        }
+        ret = b->ret;
+        raw_zero_batch_unref(b);
+        qemu_mutex_unlock(&s->zero_batch_lock);
+        return ret;
+    }
+
+    b = g_new(RawZeroBatch, 1);
+    *b = (RawZeroBatch) {
+        .s      = s,
+        .type   = type,
+        .flags  = flags,
+        .offset = offset,
+        .bytes  = bytes,
+        .refcnt = 2, /* this request and raw_zero_batch_close() */
+    };
+    qemu_co_queue_init(&b->queue);
+    QLIST_INSERT_HEAD(&s->zero_batches, b, next);
+    qatomic_set(&s->zero_batches_nr, s->zero_batches_nr + 1);
+    qemu_mutex_unlock(&s->zero_batch_lock);
+
+    defer_call(raw_zero_batch_close, b);
+
+    qemu_mutex_lock(&s->zero_batch_lock);
+    while (!b->closed) {
+        qemu_co_queue_wait(&b->queue, &s->zero_batch_lock);
+    }
+    offset = b->offset;
+    bytes = b->bytes;
+    qemu_mutex_unlock(&s->zero_batch_lock);
+
+    ret = raw_co_zero_range_submit(bs, type, offset, bytes, flags, blkdev);
+
+    qemu_mutex_lock(&s->zero_batch_lock);
+    b->ret = ret;
+    b->done = true;
+    qemu_co_queue_restart_all(&b->queue);
+    raw_zero_batch_unref(b);
+    qemu_mutex_unlock(&s->zero_batch_lock);
+
+    return ret;
+}
+
+static coroutine_fn int
+raw_do_pdiscard(BlockDriverState *bs, int64_t offset, int64_t bytes,
+                bool blkdev)
+{
+    BDRVRawState *s = bs->opaque;
+    int ret;
+
+    ret = raw_co_zero_range(bs, QEMU_AIO_DISCARD, offset, bytes, 0, blkdev);
     raw_account_discard(s, bytes, ret);
     return ret;
 }
@@ -3571,10 +4168,6 @@ static int coroutine_fn
 raw_do_pwrite_zeroes(BlockDriverState *bs, int64_t offset, int64_t bytes,
                      BdrvRequestFlags flags, bool blkdev)
 {
-    BDRVRawState *s = bs->opaque;
-    RawPosixAIOData acb;
-    ThreadPoolFunc *handler;
-
 #ifdef CONFIG_FALLOCATE
     if (offset + bytes > bs->total_sectors * BDRV_SECTOR_SIZE) {
         BdrvTrackedRequest *req;
@@ -3606,32 +4199,15 @@ raw_do_pwrite_zeroes(BlockDriverState *bs, int64_t offset, int64_t bytes,
         bdrv_check_request(req->offset, req->bytes, &error_abort);
 
         bdrv_make_request_serialising(req, bs->bl.request_alignment);
-    }
-#endif
 
-    acb = (RawPosixAIOData) {
-        .bs             = bs,
-        .aio_fildes     = s->fd,
-        .aio_type       = QEMU_AIO_WRITE_ZEROES,
-        .aio_offset     = offset,
-        .aio_nbytes     = bytes,
-    };
-
-    if (blkdev) {
-        acb.aio_type |= QEMU_AIO_BLKDEV;
-    }
-    if (flags & BDRV_REQ_NO_FALLBACK) {
-        acb.aio_type |= QEMU_AIO_NO_FALLBACK;
-    }
-
-    if (flags & BDRV_REQ_MAY_UNMAP) {
-        acb.aio_type |= QEMU_AIO_DISCARD;
-        handler = handle_aiocb_write_zeroes_unmap;
-    } else {
-        handler = handle_aiocb_write_zeroes;
+        /* Don't keep the serialising request waiting for others to merge */
+        return raw_co_zero_range_submit(bs, QEMU_AIO_WRITE_ZEROES, offset,
+                                        bytes, flags, blkdev);
     }
+#endif
 
-    return raw_thread_pool_submit(handler, &acb);
+    return raw_co_zero_range(bs, QEMU_AIO_WRITE_ZEROES, offset, bytes, flags,
+                             blkdev);
 }
 
 static int coroutine_fn raw_co_pwrite_zeroes(
@@ -3682,6 +4258,8 @@ static BlockStatsSpecificFile get_blockstats_specific_file(BlockDriverState *bs)
         .discard_nb_ok = s->stats.discard_nb_ok,
         .discard_nb_failed = s->stats.discard_nb_failed,
         .discard_bytes_ok = s->stats.discard_bytes_ok,
+        .discard_nb_merged = s->stats.discard_nb_merged,
+        .write_zeroes_nb_merged = s->stats.write_zeroes_nb_merged,
     };
 }
 
@@ -3802,6 +4380,10 @@ static void raw_set_perm(BlockDriverState *bs, uint64_t perm, uint64_t shared)
     /* For reopen, we have already switched to the new fd (.bdrv_set_perm is
      * called after .bdrv_reopen_commit) */
     if (s->perm_change_fd && s->fd != s->perm_change_fd) {
+#ifdef CONFIG_LINUX_IO_URING
+        /* The private ring has the old file registered */
+        raw_drop_luring(s);
+#endif
         qemu_close(s->fd);
         s->fd = s->perm_change_fd;
         s->open_flags = s->perm_change_flags;
@@ -3911,6 +4493,12 @@ BlockDriver bdrv_file = {
     .bdrv_abort_perm_update = raw_abort_perm_update,
     .create_opts = &raw_create_opts,
     .mutable_opts = mutable_opts,
+
+#ifdef CONFIG_LINUX_IO_URING
+    .bdrv_detach_aio_context = raw_detach_aio_context,
+    .bdrv_register_buf      = raw_register_buf,
+    .bdrv_unregister_buf    = raw_unregister_buf,
+#endif
 };
 
 /***********************************************/
@@ -4281,6 +4869,12 @@ static BlockDriver bdrv_host_device = {
     .bdrv_probe_blocksizes = hdev_probe_blocksizes,
     .bdrv_probe_geometry = hdev_probe_geometry,
 
+#ifdef CONFIG_LINUX_IO_URING
+    .bdrv_detach_aio_context = raw_detach_aio_context,
+    .bdrv_register_buf      = raw_register_buf,
+    .bdrv_unregister_buf    = raw_unregister_buf,
+#endif
+
     /* generic scsi device */
 #ifdef __linux__
     .bdrv_co_ioctl          = hdev_co_ioctl,
@@ -4413,6 +5007,12 @@ static BlockDriver bdrv_host_cdrom = {
     .bdrv_co_eject          = cdrom_co_eject,
     .bdrv_co_lock_medium    = cdrom_co_lock_medium,
 
+#ifdef CONFIG_LINUX_IO_URING
+    .bdrv_detach_aio_context = raw_detach_aio_context,
+    .bdrv_register_buf      = raw_register_buf,
+    .bdrv_unregister_buf    = raw_unregister_buf,
+#endif
+
     /* generic scsi device */
     .bdrv_co_ioctl      = hdev_co_ioctl,
 };
@@ -1279,6 +1279,7 @@ bdrv_co_do_copy_on_readv(BdrvChild *child, int64_t offset, int64_t bytes,
                                           &local_qiov, 0,
                                           BDRV_REQ_WRITE_UNCHANGED);
             }
+            bdrv_extent_cache_invalidate(bs, align_offset, pnum);
 
             if (ret < 0) {
                 /* It might be okay to ignore write errors for guest
@@ -2010,6 +2011,13 @@ bdrv_co_write_req_finish(BdrvChild *child, int64_t offset, int64_t bytes,
 
     qatomic_inc(&bs->write_gen);
 
+    /* Even a failed request may have changed the allocation status */
+    if (req->type == BDRV_TRACKED_TRUNCATE) {
+        bdrv_extent_cache_clear(bs);
+    } else {
+        bdrv_extent_cache_invalidate(bs, offset, bytes);
+    }
+
     /*
      * Discard cannot extend the image, but in error handling cases, such as
      * when reverting a qcow2 cluster allocation, the discarded range can pass
@@ -2347,6 +2355,22 @@ int bdrv_flush_all(void)
     return result;
 }
 
+/*
+ * Writes through a format node can change the metadata of whole clusters,
+ * so the extent cache drops results in units of the cluster size.
+ */
+static void coroutine_fn GRAPH_RDLOCK
+bdrv_co_extent_cache_init(BlockDriverState *bs)
+{
+    BlockDriverInfo bdi;
+    int granularity = bs->bl.request_alignment;
+
+    if (bdrv_co_get_info(bs, &bdi) == 0 && bdi.cluster_size > 0) {
+        granularity = MAX(granularity, bdi.cluster_size);
+    }
+    bdrv_extent_cache_set_granularity(bs, granularity);
+}
+
 /*
  * Returns the allocation status of the specified sectors.
  * Drivers not implementing the functionality are assumed to not support
@@ -2463,6 +2487,31 @@ bdrv_co_do_block_status(BlockDriverState *bs, bool want_zero,
             ret = BDRV_BLOCK_DATA | BDRV_BLOCK_OFFSET_VALID;
             local_file = bs;
             local_map = aligned_offset;
+        } else if (bdrv_extent_cache_enabled(bs)) {
+            /*
+             * Format drivers with backing files are queried for every layer
+             * when walking a backing chain, so remember what they reported.
+             * The result only depends on the metadata of the node, and
+             * writes through the node drop the affected part of the cache.
+             */
+            ret = bdrv_extent_cache_lookup(bs, want_zero, aligned_offset,
+                                           pnum, &local_map, &local_file);
+            if (ret == -ENOENT) {
+                uint64_t gen = bdrv_extent_cache_gen(bs);
+
+                if (!qatomic_read(&bs->extent_cache.granularity)) {
+                    bdrv_co_extent_cache_init(bs);
+                }
+                ret = bs->drv->bdrv_co_block_status(bs, want_zero,
+                                                    aligned_offset,
+                                                    aligned_bytes, pnum,
+                                                    &local_map, &local_file);
+                if (ret >= 0) {
+                    bdrv_extent_cache_fill(bs, gen, want_zero, aligned_offset,
+                                           *pnum, ret, local_map,
+                                           local_file);
+                }
+            }
         } else {
             ret = bs->drv->bdrv_co_block_status(bs, want_zero, aligned_offset,
                                                 aligned_bytes, pnum, &local_map,
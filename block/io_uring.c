@@ -10,8 +10,10 @@
  */
 #include "qemu/osdep.h"
 #include <liburing.h>
+#include <sys/syscall.h>
 #include "block/aio.h"
 #include "qemu/queue.h"
+#include "qemu/units.h"
 #include "block/block.h"
 #include "block/raw-aio.h"
 #include "qemu/coroutine.h"
@@ -26,14 +28,23 @@
 /* io_uring ring size */
 #define MAX_ENTRIES 128
 
+/* The kernel refuses to register buffers larger than this */
+#define MAX_FIXED_BUF_SIZE (1 * GiB)
+
 typedef struct LuringAIOCB {
     Coroutine *co;
     struct io_uring_sqe sqeq;
     ssize_t ret;
     QEMUIOVector *qiov;
     bool is_read;
+    /* Whether the request uses a registered buffer */
+    bool fixed_buf;
     QSIMPLEQ_ENTRY(LuringAIOCB) next;
 
+    /* Discard and write zeroes requests have no qiov, but a length */
+    int fallocate_mode;
+    uint64_t fallocate_len;
+
     /*
      * Buffered reads may require resubmission, see
      * luring_resubmit_short_read().
@@ -58,6 +69,21 @@ typedef struct LuringState {
     LuringQueue io_q;
 
     QEMUBH *completion_bh;
+
+    /* Rings from luring_init_private() have their file registered at index 0 */
+    bool fixed_file;
+
+    /* IORING_SETUP_IOPOLL ring, and whether it currently busy polls */
+    bool iopoll;
+    bool busy_polling;
+
+    /* Registered buffers, sorted by address */
+    struct iovec *bufs;
+    unsigned int nr_bufs;
+    /* Set when new buffers are waiting to be registered */
+    bool bufs_stale;
+    /* Number of queued or in flight requests that use a registered buffer */
+    unsigned int fixed_buf_reqs;
 } LuringState;
 
 /**
@@ -102,12 +128,55 @@ static void luring_resubmit_short_read(LuringState *s, LuringAIOCB *luringcb,
 
     /* Update sqe */
     luringcb->sqeq.off += nread;
-    luringcb->sqeq.addr = (__u64)(uintptr_t)luringcb->resubmit_qiov.iov;
-    luringcb->sqeq.len = luringcb->resubmit_qiov.niov;
+    if (luringcb->sqeq.opcode == IORING_OP_READ_FIXED) {
+        /* Still within the same registered buffer */
+        luringcb->sqeq.addr += nread;
+        luringcb->sqeq.len -= nread;
+    } else {
+        luringcb->sqeq.addr = (__u64)(uintptr_t)luringcb->resubmit_qiov.iov;
+        luringcb->sqeq.len = luringcb->resubmit_qiov.niov;
+    }
 
     luring_resubmit(s, luringcb);
 }
 
+/**
+ * luring_iopoll:
+ *
+ * IOPOLL rings don't raise an interrupt when a request completes.  The
+ * completion is only posted to the completion queue when somebody polls the
+ * device through io_uring_enter(IORING_ENTER_GETEVENTS).
+ */
+static void luring_iopoll(LuringState *s)
+{
+    if (s->iopoll && s->io_q.in_flight && !io_uring_cq_ready(&s->ring)) {
+        syscall(__NR_io_uring_enter, s->ring.ring_fd, 0, 0,
+                IORING_ENTER_GETEVENTS, NULL, 0);
+    }
+}
+
+/**
+ * luring_update_busy_poll:
+ *
+ * Keep the AioContext busy polling while an IOPOLL ring has requests
+ * outstanding, since nothing would wake it up otherwise.
+ */
+static void luring_update_busy_poll(LuringState *s)
+{
+    bool busy = s->iopoll && (s->io_q.in_flight || s->io_q.in_queue);
+
+    if (busy == s->busy_polling) {
+        return;
+    }
+
+    s->busy_polling = busy;
+    if (busy) {
+        aio_context_busy_poll_begin(s->aio_context);
+    } else {
+        aio_context_busy_poll_end(s->aio_context);
+    }
+}
+
 /**
  * luring_process_completions:
  * @s: AIO state
@@ -145,6 +214,8 @@ static void luring_process_completions(LuringState *s)
      */
     qemu_bh_schedule(s->completion_bh);
 
+    luring_iopoll(s);
+
     while (io_uring_peek_cqe(&s->ring, &cqes) == 0) {
         LuringAIOCB *luringcb;
         int ret;
@@ -168,7 +239,8 @@ static void luring_process_completions(LuringState *s)
         if (ret < 0) {
             /*
              * Only writev/readv/fsync requests on regular files or host block
-             * devices are submitted. Therefore -EAGAIN is not expected but it's
+             * devices and fallocate requests on regular files are submitted.
+             * Therefore -EAGAIN is not expected but it's
              * known to happen sometimes with Linux SCSI. Submit again and hope
              * the request completes successfully.
              *
@@ -208,6 +280,9 @@ static void luring_process_completions(LuringState *s)
 end:
         luringcb->ret = ret;
         qemu_iovec_destroy(&luringcb->resubmit_qiov);
+        if (luringcb->fixed_buf) {
+            s->fixed_buf_reqs--;
+        }
 
         /*
          * If the coroutine is already entered it must be in ioq_submit()
@@ -222,6 +297,7 @@ end:
     }
 
     qemu_bh_cancel(s->completion_bh);
+    luring_update_busy_poll(s);
 
     defer_call_end();
 }
@@ -259,6 +335,7 @@ static int ioq_submit(LuringState *s)
         s->io_q.in_queue  -= ret;
     }
     s->io_q.blocked = (s->io_q.in_queue > 0);
+    luring_update_busy_poll(s);
 
     if (s->io_q.in_flight) {
         /*
@@ -295,6 +372,7 @@ static bool qemu_luring_poll_cb(void *opaque)
 {
     LuringState *s = opaque;
 
+    luring_iopoll(s);
     return io_uring_cq_ready(&s->ring);
 }
 
@@ -323,9 +401,38 @@ static void luring_deferred_fn(void *opaque)
     }
 }
 
+/**
+ * luring_find_fixed_buf:
+ *
+ * Returns the index of the registered buffer that contains @iov, or -1 if
+ * there is none.
+ */
+static int luring_find_fixed_buf(LuringState *s, const struct iovec *iov)
+{
+    uintptr_t start = (uintptr_t)iov->iov_base;
+    unsigned int lo = 0;
+    unsigned int hi = s->nr_bufs;
+
+    while (lo < hi) {
+        unsigned int mid = lo + (hi - lo) / 2;
+        uintptr_t base = (uintptr_t)s->bufs[mid].iov_base;
+
+        if (start < base) {
+            hi = mid;
+        } else if (start - base >= s->bufs[mid].iov_len) {
+            lo = mid + 1;
+        } else if (iov->iov_len <= s->bufs[mid].iov_len - (start - base)) {
+            return mid;
+        } else {
+            return -1;
+        }
+    }
+    return -1;
+}
+
 /**
  * luring_do_submit:
- * @fd: file descriptor for I/O
+ * @fd: file descriptor for I/O, or index 0 for rings with a registered file
  * @luringcb: AIO control block
  * @s: AIO state
  * @offset: offset for request
@@ -339,9 +446,26 @@ static int luring_do_submit(int fd, LuringAIOCB *luringcb, LuringState *s,
 {
     int ret;
     struct io_uring_sqe *sqes = &luringcb->sqeq;
+    int buf_index = -1;
+
+    if (s->nr_bufs && !s->bufs_stale &&
+        (type == QEMU_AIO_WRITE || type == QEMU_AIO_READ) &&
+        luringcb->qiov->niov == 1) {
+        buf_index = luring_find_fixed_buf(s, &luringcb->qiov->iov[0]);
+        if (buf_index >= 0) {
+            luringcb->fixed_buf = true;
+            s->fixed_buf_reqs++;
+        }
+    }
 
     switch (type) {
     case QEMU_AIO_WRITE:
+        if (buf_index >= 0) {
+            io_uring_prep_write_fixed(sqes, fd, luringcb->qiov->iov[0].iov_base,
+                                      luringcb->qiov->iov[0].iov_len, offset,
+                                      buf_index);
+            break;
+        }
         io_uring_prep_writev(sqes, fd, luringcb->qiov->iov,
                              luringcb->qiov->niov, offset);
         break;
@@ -350,17 +474,31 @@ static int luring_do_submit(int fd, LuringAIOCB *luringcb, LuringState *s,
                              luringcb->qiov->niov, offset);
         break;
     case QEMU_AIO_READ:
+        if (buf_index >= 0) {
+            io_uring_prep_read_fixed(sqes, fd, luringcb->qiov->iov[0].iov_base,
+                                     luringcb->qiov->iov[0].iov_len, offset,
+                                     buf_index);
+            break;
+        }
         io_uring_prep_readv(sqes, fd, luringcb->qiov->iov,
                             luringcb->qiov->niov, offset);
         break;
     case QEMU_AIO_FLUSH:
         io_uring_prep_fsync(sqes, fd, IORING_FSYNC_DATASYNC);
         break;
+    case QEMU_AIO_DISCARD:
+    case QEMU_AIO_WRITE_ZEROES:
+        io_uring_prep_fallocate(sqes, fd, luringcb->fallocate_mode, offset,
+                                luringcb->fallocate_len);
+        break;
     default:
         fprintf(stderr, "%s: invalid AIO request type, aborting 0x%x.\n",
                         __func__, type);
         abort();
     }
+    if (s->fixed_file) {
+        sqes->flags |= IOSQE_FIXED_FILE;
+    }
     io_uring_sqe_set_data(sqes, luringcb);
 
     QSIMPLEQ_INSERT_TAIL(&s->io_q.submit_queue, luringcb, next);
@@ -379,34 +517,84 @@ static int luring_do_submit(int fd, LuringAIOCB *luringcb, LuringState *s,
     return 0;
 }
 
-int coroutine_fn luring_co_submit(BlockDriverState *bs, int fd, uint64_t offset,
-                                  QEMUIOVector *qiov, int type)
+/*
+ * Submits @luringcb, which the caller has filled in apart from the fields
+ * that are set here, and waits for its completion
+ */
+static int coroutine_fn luring_co_do_submit(LuringState *s,
+                                            BlockDriverState *bs, int fd,
+                                            uint64_t offset, int type,
+                                            LuringAIOCB *luringcb)
 {
     int ret;
-    AioContext *ctx = qemu_get_current_aio_context();
-    LuringState *s = aio_get_linux_io_uring(ctx);
-    LuringAIOCB luringcb = {
-        .co         = qemu_coroutine_self(),
-        .ret        = -EINPROGRESS,
-        .qiov       = qiov,
-        .is_read    = (type == QEMU_AIO_READ),
-    };
-    trace_luring_co_submit(bs, s, &luringcb, fd, offset, qiov ? qiov->size : 0,
+
+    luringcb->co = qemu_coroutine_self();
+    luringcb->ret = -EINPROGRESS;
+    luringcb->is_read = (type == QEMU_AIO_READ);
+
+    trace_luring_co_submit(bs, s, luringcb, fd, offset,
+                           luringcb->qiov ? luringcb->qiov->size
+                                          : luringcb->fallocate_len,
                            type);
-    ret = luring_do_submit(fd, &luringcb, s, offset, type);
+    ret = luring_do_submit(fd, luringcb, s, offset, type);
 
     if (ret < 0) {
         return ret;
     }
 
-    if (luringcb.ret == -EINPROGRESS) {
+    if (luringcb->ret == -EINPROGRESS) {
         qemu_coroutine_yield();
     }
-    return luringcb.ret;
+    return luringcb->ret;
+}
+
+int coroutine_fn luring_co_submit(BlockDriverState *bs, int fd, uint64_t offset,
+                                  QEMUIOVector *qiov, int type)
+{
+    AioContext *ctx = qemu_get_current_aio_context();
+    LuringState *s = aio_get_linux_io_uring(ctx);
+    LuringAIOCB luringcb = { .qiov = qiov };
+
+    return luring_co_do_submit(s, bs, fd, offset, type, &luringcb);
+}
+
+int coroutine_fn luring_co_submit_private(LuringState *s, BlockDriverState *bs,
+                                          uint64_t offset, QEMUIOVector *qiov,
+                                          int type)
+{
+    LuringAIOCB luringcb = { .qiov = qiov };
+
+    assert(s->fixed_file);
+    assert(s->aio_context == qemu_get_current_aio_context());
+
+    return luring_co_do_submit(s, bs, 0, offset, type, &luringcb);
+}
+
+int coroutine_fn luring_co_fallocate(LuringState *s, BlockDriverState *bs,
+                                     int fd, int type, int mode,
+                                     uint64_t offset, uint64_t len)
+{
+    LuringAIOCB luringcb = {
+        .fallocate_mode = mode,
+        .fallocate_len  = len,
+    };
+
+    assert(type == QEMU_AIO_DISCARD || type == QEMU_AIO_WRITE_ZEROES);
+
+    if (s) {
+        assert(s->fixed_file);
+        assert(s->aio_context == qemu_get_current_aio_context());
+        fd = 0;
+    } else {
+        s = aio_get_linux_io_uring(qemu_get_current_aio_context());
+    }
+
+    return luring_co_do_submit(s, bs, fd, offset, type, &luringcb);
 }
 
 void luring_detach_aio_context(LuringState *s, AioContext *old_context)
 {
+    assert(!s->busy_polling);
     aio_set_fd_handler(old_context, s->ring.ring_fd,
                        NULL, NULL, NULL, NULL, s);
     qemu_bh_delete(s->completion_bh);
@@ -442,9 +630,158 @@ LuringState *luring_init(Error **errp)
 
 }
 
+LuringState *luring_init_private(int fd, unsigned int flags, Error **errp)
+{
+    int rc;
+    unsigned int setup_flags = 0;
+    LuringState *s;
+
+    if (flags & LURING_SQPOLL) {
+        setup_flags |= IORING_SETUP_SQPOLL;
+    }
+    if (flags & LURING_COOP_TASKRUN) {
+#ifdef IORING_SETUP_COOP_TASKRUN
+        setup_flags |= IORING_SETUP_COOP_TASKRUN;
+#else
+        error_setg(errp, "io_uring cooperative task running is not supported "
+                   "in this build");
+        return NULL;
+#endif
+    }
+    if (flags & LURING_IOPOLL) {
+        setup_flags |= IORING_SETUP_IOPOLL;
+    }
+    if (flags & LURING_SINGLE_ISSUER) {
+#ifdef IORING_SETUP_SINGLE_ISSUER
+        setup_flags |= IORING_SETUP_SINGLE_ISSUER;
+#else
+        error_setg(errp, "io_uring single issuer rings are not supported "
+                   "in this build");
+        return NULL;
+#endif
+    }
+
+    s = g_new0(LuringState, 1);
+    trace_luring_init_state(s, sizeof(*s));
+
+    rc = io_uring_queue_init(MAX_ENTRIES, &s->ring, setup_flags);
+    if (rc < 0) {
+        error_setg_errno(errp, -rc, "failed to init linux io_uring ring");
+        g_free(s);
+        return NULL;
+    }
+
+    /*
+     * A registered file saves the fget()/fput() pair on every request, and
+     * older kernels only accept registered files for SQPOLL rings.
+     */
+    rc = io_uring_register_files(&s->ring, &fd, 1);
+    if (rc < 0) {
+        error_setg_errno(errp, -rc, "failed to register file with io_uring");
+        io_uring_queue_exit(&s->ring);
+        g_free(s);
+        return NULL;
+    }
+    s->fixed_file = true;
+    s->iopoll = flags & LURING_IOPOLL;
+
+    ioq_init(&s->io_q);
+    return s;
+}
+
+static int luring_iovec_cmp(const void *a, const void *b)
+{
+    const struct iovec *iov_a = a;
+    const struct iovec *iov_b = b;
+    uintptr_t base_a = (uintptr_t)iov_a->iov_base;
+    uintptr_t base_b = (uintptr_t)iov_b->iov_base;
+
+    return base_a < base_b ? -1 : base_a > base_b;
+}
+
+int luring_register_buffers(LuringState *s, const struct iovec *iov,
+                            unsigned int nr)
+{
+    g_autoptr(GArray) bufs = NULL;
+    unsigned int i;
+    int ret;
+
+    if (s->fixed_buf_reqs) {
+        /*
+         * Prepared SQEs refer to the registered buffers by index.  Stop
+         * using the buffers for new requests, so that the ones that still
+         * use them can finish and the caller can try again.
+         */
+        s->bufs_stale = true;
+        return -EBUSY;
+    }
+    s->bufs_stale = false;
+
+    bufs = g_array_new(false, false, sizeof(struct iovec));
+    if (s->nr_bufs) {
+        io_uring_unregister_buffers(&s->ring);
+        g_free(s->bufs);
+        s->bufs = NULL;
+        s->nr_bufs = 0;
+    }
+
+    for (i = 0; i < nr; i++) {
+        uint8_t *base = iov[i].iov_base;
+        size_t len = iov[i].iov_len;
+
+        while (len) {
+            struct iovec chunk = {
+                .iov_base = base,
+                .iov_len = MIN(len, MAX_FIXED_BUF_SIZE),
+            };
+
+            g_array_append_val(bufs, chunk);
+            base += chunk.iov_len;
+            len -= chunk.iov_len;
+        }
+    }
+
+    if (!bufs->len) {
+        trace_luring_register_buffers(s, 0, 0);
+        return 0;
+    }
+
+    g_array_sort(bufs, luring_iovec_cmp);
+    ret = io_uring_register_buffers(&s->ring, (struct iovec *)bufs->data,
+                                    bufs->len);
+    trace_luring_register_buffers(s, bufs->len, ret);
+    if (ret < 0) {
+        return ret;
+    }
+
+    s->nr_bufs = bufs->len;
+    s->bufs = (struct iovec *)g_array_free(g_steal_pointer(&bufs), false);
+    return 0;
+}
+
 void luring_cleanup(LuringState *s)
 {
     io_uring_queue_exit(&s->ring);
     trace_luring_cleanup_state(s);
+    g_free(s->bufs);
     g_free(s);
 }
+
+static void luring_retire_bh(void *opaque)
+{
+    LuringState *s = opaque;
+
+    /* Requests that were queued before the ring was retired finish first */
+    if (s->io_q.in_queue || s->io_q.in_flight) {
+        aio_bh_schedule_oneshot(s->aio_context, luring_retire_bh, s);
+        return;
+    }
+
+    luring_detach_aio_context(s, s->aio_context);
+    luring_cleanup(s);
+}
+
+void luring_retire(LuringState *s)
+{
+    aio_bh_schedule_oneshot(s->aio_context, luring_retire_bh, s);
+}
@@ -71,6 +71,8 @@ typedef struct MirrorBlockJob {
     bool should_complete;
     int64_t granularity;
     size_t buf_size;
+    /* MAX_IN_FLIGHT for each worker IOThread of the job, at least one */
+    unsigned max_in_flight;
     int64_t bdev_length;
     unsigned long *cow_bitmap;
     BdrvDirtyBitmap *dirty_bitmap;
@@ -335,6 +337,31 @@ mirror_wait_for_free_in_flight_slot(MirrorBlockJob *s)
     abort();
 }
 
+/*
+ * Move the coroutine of an operation to the next worker IOThread of the job,
+ * if it has any.  Return the AioContext that mirror_co_leave_worker() must
+ * move back to before the operation touches any state of the job again.
+ */
+static AioContext * coroutine_fn mirror_co_enter_worker(MirrorBlockJob *s)
+{
+    AioContext *job_ctx = qemu_get_current_aio_context();
+    AioContext *worker_ctx = block_job_next_worker_ctx(&s->common);
+
+    if (!worker_ctx) {
+        return NULL;
+    }
+
+    aio_co_reschedule_self(worker_ctx);
+    return job_ctx;
+}
+
+static void coroutine_fn mirror_co_leave_worker(AioContext *job_ctx)
+{
+    if (job_ctx) {
+        aio_co_reschedule_self(job_ctx);
+    }
+}
+
 /* Perform a mirror copy operation.
  *
  * *op->bytes_handled is set to the number of bytes copied after and
@@ -347,8 +374,9 @@ static void coroutine_fn mirror_co_read(void *opaque)
 {
     MirrorOp *op = opaque;
     MirrorBlockJob *s = op->s;
+    AioContext *job_ctx;
     int nb_chunks;
-    uint64_t ret;
+    int ret;
     uint64_t max_bytes;
 
     max_bytes = s->granularity * s->max_iov;
@@ -397,16 +425,30 @@ static void coroutine_fn mirror_co_read(void *opaque)
     op->is_in_flight = true;
     trace_mirror_one_iteration(s, op->offset, op->bytes);
 
+    job_ctx = mirror_co_enter_worker(s);
     WITH_GRAPH_RDLOCK_GUARD() {
         ret = bdrv_co_preadv(s->mirror_top_bs->backing, op->offset, op->bytes,
                              &op->qiov, 0);
     }
+    if (job_ctx && ret >= 0) {
+        /*
+         * Write from the worker as well, only the bookkeeping has to be done
+         * in the AioContext of the job
+         */
+        ret = blk_co_pwritev(s->target, op->offset, op->qiov.size,
+                             &op->qiov, 0);
+        mirror_co_leave_worker(job_ctx);
+        mirror_write_complete(op, ret);
+        return;
+    }
+    mirror_co_leave_worker(job_ctx);
     mirror_read_complete(op, ret);
 }
 
 static void coroutine_fn mirror_co_zero(void *opaque)
 {
     MirrorOp *op = opaque;
+    AioContext *job_ctx;
     int ret;
 
     op->s->in_flight++;
@@ -414,14 +456,17 @@ static void coroutine_fn mirror_co_zero(void *opaque)
     *op->bytes_handled = op->bytes;
     op->is_in_flight = true;
 
+    job_ctx = mirror_co_enter_worker(op->s);
     ret = blk_co_pwrite_zeroes(op->s->target, op->offset, op->bytes,
                                op->s->unmap ? BDRV_REQ_MAY_UNMAP : 0);
+    mirror_co_leave_worker(job_ctx);
     mirror_write_complete(op, ret);
 }
 
 static void coroutine_fn mirror_co_discard(void *opaque)
 {
     MirrorOp *op = opaque;
+    AioContext *job_ctx;
     int ret;
 
     op->s->in_flight++;
@@ -429,7 +474,9 @@ static void coroutine_fn mirror_co_discard(void *opaque)
     *op->bytes_handled = op->bytes;
     op->is_in_flight = true;
 
+    job_ctx = mirror_co_enter_worker(op->s);
     ret = blk_co_pdiscard(op->s->target, op->offset, op->bytes);
+    mirror_co_leave_worker(job_ctx);
     mirror_write_complete(op, ret);
 }
 
@@ -487,7 +534,7 @@ static void coroutine_fn GRAPH_RDLOCK mirror_iteration(MirrorBlockJob *s)
     /* At least the first dirty chunk is mirrored in one iteration. */
     int nb_chunks = 1;
     bool write_zeroes_ok = bdrv_can_write_zeroes_with_unmap(blk_bs(s->target));
-    int max_io_bytes = MAX(s->buf_size / MAX_IN_FLIGHT, MAX_IO_BYTES);
+    int max_io_bytes = MAX(s->buf_size / s->max_in_flight, MAX_IO_BYTES);
 
     bdrv_dirty_bitmap_lock(s->dirty_bitmap);
     offset = bdrv_dirty_iter_next(s->dbi);
@@ -595,7 +642,7 @@ static void coroutine_fn GRAPH_RDLOCK mirror_iteration(MirrorBlockJob *s)
             }
         }
 
-        while (s->in_flight >= MAX_IN_FLIGHT) {
+        while (s->in_flight >= s->max_in_flight) {
             trace_mirror_yield_in_flight(s, offset, s->in_flight);
             mirror_wait_for_free_in_flight_slot(s);
         }
@@ -857,7 +904,7 @@ static int coroutine_fn GRAPH_UNLOCKED mirror_dirty_init(MirrorBlockJob *s)
                 return 0;
             }
 
-            if (s->in_flight >= MAX_IN_FLIGHT) {
+            if (s->in_flight >= s->max_in_flight) {
                 trace_mirror_yield(s, UINT64_MAX, s->buf_free_count,
                                    s->in_flight);
                 mirror_wait_for_free_in_flight_slot(s);
@@ -1060,7 +1107,7 @@ static int coroutine_fn mirror_run(Job *job, Error **errp)
         }
         if (delta < BLOCK_JOB_SLICE_TIME &&
             iostatus == BLOCK_DEVICE_IO_STATUS_OK) {
-            if (s->in_flight >= MAX_IN_FLIGHT || s->buf_free_count == 0 ||
+            if (s->in_flight >= s->max_in_flight || s->buf_free_count == 0 ||
                 (cnt == 0 && s->in_flight > 0)) {
                 trace_mirror_yield(s, cnt, s->buf_free_count, s->in_flight);
                 mirror_wait_for_free_in_flight_slot(s);
@@ -1715,7 +1762,7 @@ static BlockJob *mirror_start_job(
                              bool is_none_mode, BlockDriverState *base,
                              bool auto_complete, const char *filter_node_name,
                              bool is_mirror, MirrorCopyMode copy_mode,
-                             Error **errp)
+                             strList *worker_iothreads, Error **errp)
 {
     MirrorBlockJob *s;
     MirrorBDSOpaque *bs_opaque;
@@ -1737,10 +1784,6 @@ static BlockJob *mirror_start_job(
         return NULL;
     }
 
-    if (buf_size == 0) {
-        buf_size = DEFAULT_MIRROR_BUF_SIZE;
-    }
-
     bdrv_graph_rdlock_main_loop();
     if (bdrv_skip_filters(bs) == bdrv_skip_filters(target)) {
         error_setg(errp, "Can't mirror node into itself");
@@ -1799,6 +1842,10 @@ static BlockJob *mirror_start_job(
 
     s->mirror_top_bs = mirror_top_bs;
 
+    if (!block_job_set_worker_iothreads(&s->common, worker_iothreads, errp)) {
+        goto fail;
+    }
+
     /* No resize for the target either; while the mirror is still running, a
      * consistent read isn't necessarily possible. We could possibly allow
      * writes and graph modifications, though it would likely defeat the
@@ -1876,6 +1923,10 @@ static BlockJob *mirror_start_job(
     s->base = base;
     s->base_overlay = bdrv_find_overlay(bs, base);
     s->granularity = granularity;
+    s->max_in_flight = MAX_IN_FLIGHT * MAX(s->common.nb_workers, 1);
+    if (buf_size == 0) {
+        buf_size = DEFAULT_MIRROR_BUF_SIZE * MAX(s->common.nb_workers, 1);
+    }
     s->buf_size = ROUND_UP(buf_size, granularity);
     s->unmap = unmap;
     if (auto_complete) {
@@ -2004,7 +2055,8 @@ void mirror_start(const char *job_id, BlockDriverState *bs,
                   BlockdevOnError on_source_error,
                   BlockdevOnError on_target_error,
                   bool unmap, const char *filter_node_name,
-                  MirrorCopyMode copy_mode, Error **errp)
+                  MirrorCopyMode copy_mode, strList *worker_iothreads,
+                  Error **errp)
 {
     bool is_none_mode;
     BlockDriverState *base;
@@ -2027,7 +2079,8 @@ void mirror_start(const char *job_id, BlockDriverState *bs,
                      speed, granularity, buf_size, backing_mode, zero_target,
                      on_source_error, on_target_error, unmap, NULL, NULL,
                      &mirror_job_driver, is_none_mode, base, false,
-                     filter_node_name, true, copy_mode, errp);
+                     filter_node_name, true, copy_mode, worker_iothreads,
+                     errp);
 }
 
 BlockJob *commit_active_start(const char *job_id, BlockDriverState *bs,
@@ -2056,7 +2109,7 @@ BlockJob *commit_active_start(const char *job_id, BlockDriverState *bs,
                      on_error, on_error, true, cb, opaque,
                      &commit_active_job_driver, false, base, auto_complete,
                      filter_node_name, false, MIRROR_COPY_MODE_BACKGROUND,
-                     errp);
+                     NULL, errp);
     if (!job) {
         goto error_restore_flags;
     }
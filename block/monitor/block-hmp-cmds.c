@@ -498,7 +498,7 @@ void hmp_block_stream(Monitor *mon, const QDict *qdict)
 
     qmp_block_stream(device, device, base, NULL, NULL, NULL,
                      qdict_haskey(qdict, "speed"), speed,
-                     true, BLOCKDEV_ON_ERROR_REPORT, NULL,
+                     true, BLOCKDEV_ON_ERROR_REPORT, NULL, NULL,
                      false, false, false, false, &error);
 
     hmp_handle_error(mon, error);
@@ -1052,10 +1052,12 @@ static int GRAPH_RDLOCK qcow_make_empty(BlockDriverState *bs)
 /* XXX: put compressed sectors first, then all the cluster aligned
    tables to avoid losing bytes in alignment */
 static int coroutine_fn GRAPH_RDLOCK
-qcow_co_pwritev_compressed(BlockDriverState *bs, int64_t offset, int64_t bytes,
-                           QEMUIOVector *qiov)
+qcow_co_pwritev_compressed_cluster(BlockDriverState *bs, int64_t offset,
+                                   int64_t bytes, QEMUIOVector *qiov,
+                                   size_t qiov_offset)
 {
     BDRVQcowState *s = bs->opaque;
+    QEMUIOVector local_qiov;
     z_stream strm;
     int ret, out_len;
     uint8_t *buf, *out_buf;
@@ -1072,7 +1074,7 @@ qcow_co_pwritev_compressed(BlockDriverState *bs, int64_t offset, int64_t bytes,
         /* Zero-pad last write if image size is not cluster aligned */
         memset(buf + bytes, 0, s->cluster_size - bytes);
     }
-    qemu_iovec_to_buf(qiov, 0, buf, qiov->size);
+    qemu_iovec_to_buf(qiov, qiov_offset, buf, bytes);
 
     out_buf = g_malloc(s->cluster_size);
 
@@ -1103,7 +1105,8 @@ qcow_co_pwritev_compressed(BlockDriverState *bs, int64_t offset, int64_t bytes,
 
     if (ret != Z_STREAM_END || out_len >= s->cluster_size) {
         /* could not compress: write normal cluster */
-        ret = qcow_co_pwritev(bs, offset, bytes, qiov, 0);
+        qemu_iovec_init_buf(&local_qiov, buf, bytes);
+        ret = qcow_co_pwritev(bs, offset, bytes, &local_qiov, 0);
         if (ret < 0) {
             goto fail;
         }
@@ -1134,6 +1137,28 @@ fail:
     return ret;
 }
 
+static int coroutine_fn GRAPH_RDLOCK
+qcow_co_pwritev_compressed(BlockDriverState *bs, int64_t offset, int64_t bytes,
+                           QEMUIOVector *qiov)
+{
+    BDRVQcowState *s = bs->opaque;
+    size_t qiov_offset = 0;
+    int ret;
+
+    /* Requests with several clusters compress them one by one */
+    do {
+        int64_t chunk = MIN(bytes, s->cluster_size);
+
+        ret = qcow_co_pwritev_compressed_cluster(bs, offset, chunk, qiov,
+                                                 qiov_offset);
+        offset += chunk;
+        qiov_offset += chunk;
+        bytes -= chunk;
+    } while (ret == 0 && bytes);
+
+    return ret;
+}
+
 static int coroutine_fn
 qcow_co_get_info(BlockDriverState *bs, BlockDriverInfo *bdi)
 {
@@ -24,6 +24,7 @@
 
 #include "qemu/osdep.h"
 #include "block/block-io.h"
+#include "qemu/host-utils.h"
 #include "qemu/memalign.h"
 #include "qcow2.h"
 #include "trace.h"
@@ -32,18 +33,30 @@ typedef struct Qcow2CachedTable {
     int64_t  offset;
     uint64_t lru_counter;
     int      ref;
+    int      hash_next;     /* Next entry in the same hash bucket, or -1 */
     bool     dirty;
+    bool     referenced;    /* Used since the clock hand last passed by */
+    bool     prefetched;    /* Loaded ahead of time and not used yet */
 } Qcow2CachedTable;
 
 struct Qcow2Cache {
     Qcow2CachedTable       *entries;
+    int                    *buckets; /* First entry of each hash chain */
+    unsigned                bucket_mask;
     struct Qcow2Cache      *depends;
     int                     size;
     int                     table_size;
+    int                     clock_hand;
     bool                    depends_on_flush;
     void                   *table_array;
     uint64_t                lru_counter;
     uint64_t                cache_clean_lru_counter;
+    uint64_t                hits;
+    uint64_t                misses;
+    uint64_t                evictions;
+    uint64_t                prefetches;
+    uint64_t                prefetch_hits;
+    uint64_t                prefetch_wasted;
 };
 
 static inline void *qcow2_cache_get_table_addr(Qcow2Cache *c, int table)
@@ -59,6 +72,54 @@ static inline int qcow2_cache_get_table_idx(Qcow2Cache *c, void *table)
     return idx;
 }
 
+static inline unsigned qcow2_cache_hash(Qcow2Cache *c, uint64_t offset)
+{
+    uint64_t table = offset / c->table_size;
+
+    return (table * 0x9e3779b97f4a7c15ULL) >> 32 & c->bucket_mask;
+}
+
+/* Returns the index of the entry caching @offset, or -1 */
+static int qcow2_cache_lookup(Qcow2Cache *c, uint64_t offset)
+{
+    int i;
+
+    for (i = c->buckets[qcow2_cache_hash(c, offset)]; i != -1;
+         i = c->entries[i].hash_next) {
+        if (c->entries[i].offset == offset) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+/*
+ * Change the offset cached by entry @i, keeping the hash index up to date.
+ * An offset of 0 marks the entry as unused.
+ */
+static void qcow2_cache_set_offset(Qcow2Cache *c, int i, int64_t offset)
+{
+    Qcow2CachedTable *t = &c->entries[i];
+    int *p;
+
+    if (t->offset) {
+        for (p = &c->buckets[qcow2_cache_hash(c, t->offset)]; *p != i;
+             p = &c->entries[*p].hash_next) {
+            assert(*p != -1);
+        }
+        *p = t->hash_next;
+        t->hash_next = -1;
+    }
+
+    t->offset = offset;
+
+    if (offset) {
+        p = &c->buckets[qcow2_cache_hash(c, offset)];
+        t->hash_next = *p;
+        *p = i;
+    }
+}
+
 static inline const char *qcow2_cache_get_name(BDRVQcow2State *s, Qcow2Cache *c)
 {
     if (c == s->refcount_block_cache) {
@@ -86,6 +147,15 @@ static void qcow2_cache_table_release(Qcow2Cache *c, int i, int num_tables)
 #endif
 }
 
+/* Forget that entry @i was prefetched, counting it as wasted if unused */
+static void qcow2_cache_drop_prefetched(Qcow2Cache *c, int i)
+{
+    if (c->entries[i].prefetched) {
+        c->entries[i].prefetched = false;
+        c->prefetch_wasted++;
+    }
+}
+
 static inline bool can_clean_entry(Qcow2Cache *c, int i)
 {
     Qcow2CachedTable *t = &c->entries[i];
@@ -106,7 +176,8 @@ void qcow2_cache_clean_unused(Qcow2Cache *c)
 
         /* And count how many we can clean in a row */
         while (i < c->size && can_clean_entry(c, i)) {
-            c->entries[i].offset = 0;
+            qcow2_cache_drop_prefetched(c, i);
+            qcow2_cache_set_offset(c, i, 0);
             c->entries[i].lru_counter = 0;
             i++;
             to_clean++;
@@ -125,24 +196,38 @@ Qcow2Cache *qcow2_cache_create(BlockDriverState *bs, int num_tables,
 {
     BDRVQcow2State *s = bs->opaque;
     Qcow2Cache *c;
+    unsigned nb_buckets;
+    int i;
 
     assert(num_tables > 0);
     assert(is_power_of_2(table_size));
     assert(table_size >= (1 << MIN_CLUSTER_BITS));
     assert(table_size <= s->cluster_size);
 
+    nb_buckets = pow2ceil(num_tables);
+
     c = g_new0(Qcow2Cache, 1);
     c->size = num_tables;
     c->table_size = table_size;
+    c->bucket_mask = nb_buckets - 1;
     c->entries = g_try_new0(Qcow2CachedTable, num_tables);
+    c->buckets = g_try_new(int, nb_buckets);
     c->table_array = qemu_try_blockalign(bs->file->bs,
                                          (size_t) num_tables * c->table_size);
 
-    if (!c->entries || !c->table_array) {
+    if (!c->entries || !c->buckets || !c->table_array) {
         qemu_vfree(c->table_array);
+        g_free(c->buckets);
         g_free(c->entries);
         g_free(c);
-        c = NULL;
+        return NULL;
+    }
+
+    for (i = 0; i < num_tables; i++) {
+        c->entries[i].hash_next = -1;
+    }
+    for (i = 0; i < nb_buckets; i++) {
+        c->buckets[i] = -1;
     }
 
     return c;
@@ -157,6 +242,7 @@ int qcow2_cache_destroy(Qcow2Cache *c)
     }
 
     qemu_vfree(c->table_array);
+    g_free(c->buckets);
     g_free(c->entries);
     g_free(c);
 
@@ -309,8 +395,10 @@ int qcow2_cache_empty(BlockDriverState *bs, Qcow2Cache *c)
 
     for (i = 0; i < c->size; i++) {
         assert(c->entries[i].ref == 0);
-        c->entries[i].offset = 0;
+        qcow2_cache_drop_prefetched(c, i);
+        qcow2_cache_set_offset(c, i, 0);
         c->entries[i].lru_counter = 0;
+        c->entries[i].referenced = false;
     }
 
     qcow2_cache_table_release(c, 0, c->size);
@@ -320,16 +408,42 @@ int qcow2_cache_empty(BlockDriverState *bs, Qcow2Cache *c)
     return 0;
 }
 
+/*
+ * Pick an unused entry to replace with the CLOCK algorithm: entries that
+ * were used since the hand last passed by get a second chance.  Returns
+ * -1 if all entries are in use.
+ */
+static int qcow2_cache_find_victim(Qcow2Cache *c)
+{
+    int n;
+
+    for (n = 0; n < 2 * c->size; n++) {
+        Qcow2CachedTable *t = &c->entries[c->clock_hand];
+        int i = c->clock_hand;
+
+        if (++c->clock_hand == c->size) {
+            c->clock_hand = 0;
+        }
+        if (t->ref) {
+            continue;
+        }
+        if (t->offset && t->referenced) {
+            t->referenced = false;
+            continue;
+        }
+        return i;
+    }
+
+    return -1;
+}
+
 static int GRAPH_RDLOCK
 qcow2_cache_do_get(BlockDriverState *bs, Qcow2Cache *c, uint64_t offset,
-                   void **table, bool read_from_disk)
+                   void **table, bool read_from_disk, bool prefetch)
 {
     BDRVQcow2State *s = bs->opaque;
     int i;
     int ret;
-    int lookup_index;
-    uint64_t min_lru_counter = UINT64_MAX;
-    int min_lru_index = -1;
 
     assert(offset != 0);
 
@@ -344,29 +458,34 @@ qcow2_cache_do_get(BlockDriverState *bs, Qcow2Cache *c, uint64_t offset,
     }
 
     /* Check if the table is already cached */
-    i = lookup_index = (offset / c->table_size * 4) % c->size;
-    do {
-        const Qcow2CachedTable *t = &c->entries[i];
-        if (t->offset == offset) {
-            goto found;
+    i = qcow2_cache_lookup(c, offset);
+    if (i != -1) {
+        if (prefetch) {
+            /* Nothing to do, and this is not a real use of the table */
+            *table = NULL;
+            return 0;
         }
-        if (t->ref == 0 && t->lru_counter < min_lru_counter) {
-            min_lru_counter = t->lru_counter;
-            min_lru_index = i;
+        c->hits++;
+        if (c->entries[i].prefetched) {
+            c->entries[i].prefetched = false;
+            c->prefetch_hits++;
         }
-        if (++i == c->size) {
-            i = 0;
-        }
-    } while (i != lookup_index);
+        goto found;
+    }
 
-    if (min_lru_index == -1) {
+    if (prefetch) {
+        c->prefetches++;
+    } else {
+        c->misses++;
+    }
+    i = qcow2_cache_find_victim(c);
+    if (i == -1) {
         /* This can't happen in current synchronous code, but leave the check
          * here as a reminder for whoever starts using AIO with the cache */
         abort();
     }
 
     /* Cache miss: write a table back and replace it */
-    i = min_lru_index;
     trace_qcow2_cache_get_replace_entry(qemu_coroutine_self(),
                                         c == s->l2_table_cache, i);
 
@@ -377,7 +496,11 @@ qcow2_cache_do_get(BlockDriverState *bs, Qcow2Cache *c, uint64_t offset,
 
     trace_qcow2_cache_get_read(qemu_coroutine_self(),
                                c == s->l2_table_cache, i);
-    c->entries[i].offset = 0;
+    if (c->entries[i].offset) {
+        c->evictions++;
+    }
+    qcow2_cache_drop_prefetched(c, i);
+    qcow2_cache_set_offset(c, i, 0);
     if (read_from_disk) {
         if (c == s->l2_table_cache) {
             BLKDBG_EVENT(bs->file, BLKDBG_L2_LOAD);
@@ -390,11 +513,13 @@ qcow2_cache_do_get(BlockDriverState *bs, Qcow2Cache *c, uint64_t offset,
         }
     }
 
-    c->entries[i].offset = offset;
+    qcow2_cache_set_offset(c, i, offset);
+    c->entries[i].prefetched = prefetch;
 
     /* And return the right table */
 found:
     c->entries[i].ref++;
+    c->entries[i].referenced = true;
     *table = qcow2_cache_get_table_addr(c, i);
 
     trace_qcow2_cache_get_done(qemu_coroutine_self(),
@@ -406,13 +531,29 @@ found:
 int qcow2_cache_get(BlockDriverState *bs, Qcow2Cache *c, uint64_t offset,
     void **table)
 {
-    return qcow2_cache_do_get(bs, c, offset, table, true);
+    return qcow2_cache_do_get(bs, c, offset, table, true, false);
 }
 
 int qcow2_cache_get_empty(BlockDriverState *bs, Qcow2Cache *c, uint64_t offset,
     void **table)
 {
-    return qcow2_cache_do_get(bs, c, offset, table, false);
+    return qcow2_cache_do_get(bs, c, offset, table, false, false);
+}
+
+/*
+ * Load the table at @offset into the cache if it is not there yet, in the
+ * expectation that it will be needed soon
+ */
+int qcow2_cache_prefetch(BlockDriverState *bs, Qcow2Cache *c, uint64_t offset)
+{
+    void *table;
+    int ret;
+
+    ret = qcow2_cache_do_get(bs, c, offset, &table, true, true);
+    if (ret == 0 && table) {
+        qcow2_cache_put(c, &table);
+    }
+    return ret;
 }
 
 void qcow2_cache_put(Qcow2Cache *c, void **table)
@@ -438,14 +579,9 @@ void qcow2_cache_entry_mark_dirty(Qcow2Cache *c, void *table)
 
 void *qcow2_cache_is_table_offset(Qcow2Cache *c, uint64_t offset)
 {
-    int i;
+    int i = qcow2_cache_lookup(c, offset);
 
-    for (i = 0; i < c->size; i++) {
-        if (c->entries[i].offset == offset) {
-            return qcow2_cache_get_table_addr(c, i);
-        }
-    }
-    return NULL;
+    return i == -1 ? NULL : qcow2_cache_get_table_addr(c, i);
 }
 
 void qcow2_cache_discard(Qcow2Cache *c, void *table)
@@ -454,9 +590,26 @@ void qcow2_cache_discard(Qcow2Cache *c, void *table)
 
     assert(c->entries[i].ref == 0);
 
-    c->entries[i].offset = 0;
+    qcow2_cache_set_offset(c, i, 0);
     c->entries[i].lru_counter = 0;
     c->entries[i].dirty = false;
+    c->entries[i].referenced = false;
+    c->entries[i].prefetched = false;
 
     qcow2_cache_table_release(c, i, 1);
 }
+
+Qcow2CacheStats *qcow2_cache_get_stats(Qcow2Cache *c)
+{
+    Qcow2CacheStats *stats = g_new0(Qcow2CacheStats, 1);
+
+    if (c) {
+        stats->hits = c->hits;
+        stats->misses = c->misses;
+        stats->evictions = c->evictions;
+        stats->prefetches = c->prefetches;
+        stats->prefetch_hits = c->prefetch_hits;
+        stats->prefetch_wasted = c->prefetch_wasted;
+    }
+    return stats;
+}
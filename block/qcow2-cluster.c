@@ -62,6 +62,7 @@ int coroutine_fn qcow2_shrink_l1_table(BlockDriverState *bs,
     }
 
     BLKDBG_CO_EVENT(bs->file, BLKDBG_L1_SHRINK_FREE_L2_CLUSTERS);
+    qcow2_mapping_changed(s);
     for (i = s->l1_size - 1; i > new_l1_size - 1; i--) {
         if ((s->l1_table[i] & L1E_OFFSET_MASK) == 0) {
             continue;
@@ -219,6 +220,36 @@ l2_load(BlockDriverState *bs, uint64_t offset,
                            (void **)l2_slice);
 }
 
+/*
+ * Loads the L2 slice for the guest @offset into the L2 cache ahead of time,
+ * if there is one.
+ *
+ * Returns 0 on success, -errno in error cases.
+ */
+int coroutine_fn qcow2_prefetch_l2_slice(BlockDriverState *bs, uint64_t offset)
+{
+    BDRVQcow2State *s = bs->opaque;
+    uint64_t l1_index = offset_to_l1_index(s, offset);
+    uint64_t l2_offset;
+    int start_of_slice;
+
+    if (l1_index >= s->l1_size) {
+        return 0;
+    }
+
+    /* Invalid entries are reported when the slice is actually needed */
+    l2_offset = s->l1_table[l1_index] & L1E_OFFSET_MASK;
+    if (!l2_offset || offset_into_cluster(s, l2_offset)) {
+        return 0;
+    }
+
+    start_of_slice = l2_entry_size(s) *
+        (offset_to_l2_index(s, offset) - offset_to_l2_slice_index(s, offset));
+
+    return qcow2_cache_prefetch(bs, s->l2_table_cache,
+                                l2_offset + start_of_slice);
+}
+
 /*
  * Writes an L1 entry to disk (note that depending on the alignment
  * requirements this function may write more that just one entry in
@@ -357,6 +388,7 @@ static int GRAPH_RDLOCK l2_allocate(BlockDriverState *bs, int l1_index)
 
     /* update the L1 entry */
     trace_qcow2_l2_allocate_write_l1(bs, l1_index);
+    qcow2_mapping_changed(s);
     s->l1_table[l1_index] = l2_offset | QCOW_OFLAG_COPIED;
     ret = qcow2_write_l1_entry(bs, l1_index);
     if (ret < 0) {
@@ -562,6 +594,176 @@ do_perform_cow_write(BlockDriverState *bs, uint64_t cluster_offset,
     return 0;
 }
 
+void qcow2_fast_path_init(BDRVQcow2State *s)
+{
+    s->fast_path = g_new0(Qcow2FastPathEntry *, QCOW2_FAST_PATH_SLOTS);
+}
+
+/*
+ * Only called when no requests are in flight, so there can be no readers
+ * left that could see the entries.
+ */
+void qcow2_fast_path_free(BDRVQcow2State *s)
+{
+    int i;
+
+    if (!s->fast_path) {
+        return;
+    }
+    for (i = 0; i < QCOW2_FAST_PATH_SLOTS; i++) {
+        g_free(s->fast_path[i]);
+    }
+    g_free(s->fast_path);
+    s->fast_path = NULL;
+}
+
+static Qcow2FastPathEntry *fast_path_lookup(BDRVQcow2State *s,
+                                            uint64_t guest_cluster,
+                                            unsigned long gen, bool write)
+{
+    Qcow2FastPathEntry *e;
+
+    e = qatomic_rcu_read(&s->fast_path[guest_cluster % QCOW2_FAST_PATH_SLOTS]);
+    if (!e || e->guest_cluster != guest_cluster || e->gen != gen ||
+        (write && !e->writable)) {
+        return NULL;
+    }
+    return e;
+}
+
+/*
+ * Look up the host offset of @offset without taking s->lock.  Succeeds only
+ * if the mapping of its cluster was recorded with qcow2_fast_path_put() and
+ * no L1 or L2 entry has changed since; if @write is true, the cluster must
+ * also be writable in place (i.e. have QCOW_OFLAG_COPIED set).
+ *
+ * On success, *bytes is capped to the end of the run of following clusters
+ * that are recorded as contiguous in the image file, *host_offset is set and
+ * true is returned.
+ */
+bool qcow2_fast_path_get(BDRVQcow2State *s, uint64_t offset,
+                         unsigned int *bytes, bool write,
+                         uint64_t *host_offset)
+{
+    uint64_t guest_cluster = offset >> s->cluster_bits;
+    unsigned int offset_in_cluster = offset_into_cluster(s, offset);
+    uint64_t avail = s->cluster_size - offset_in_cluster;
+    Qcow2FastPathEntry *e, *next;
+    unsigned long gen;
+
+    if (!s->fast_path) {
+        return false;
+    }
+
+    WITH_RCU_READ_LOCK_GUARD() {
+        gen = qatomic_read(&s->mapping_gen);
+        e = fast_path_lookup(s, guest_cluster, gen, write);
+        if (!e) {
+            return false;
+        }
+        *host_offset = e->host_offset + offset_in_cluster;
+
+        while (avail < *bytes) {
+            next = fast_path_lookup(s, ++guest_cluster, gen, write);
+            if (!next ||
+                next->host_offset != e->host_offset + s->cluster_size) {
+                break;
+            }
+            e = next;
+            avail += s->cluster_size;
+        }
+    }
+
+    *bytes = MIN(*bytes, avail);
+    stat64_add(&s->fast_path_hits, 1);
+    return true;
+}
+
+/*
+ * Drop the lock-free lookups of the @nb_clusters clusters starting at guest
+ * offset @offset.  Must be called with s->lock held before their L2 entries
+ * change.
+ */
+void qcow2_fast_path_invalidate(BDRVQcow2State *s, uint64_t offset,
+                                uint64_t nb_clusters)
+{
+    uint64_t guest_cluster = offset >> s->cluster_bits;
+    Qcow2FastPathEntry *e;
+    uint64_t i;
+
+    if (!s->fast_path) {
+        return;
+    }
+    if (nb_clusters >= QCOW2_FAST_PATH_SLOTS) {
+        qcow2_mapping_changed(s);
+        return;
+    }
+
+    for (i = 0; i < nb_clusters; i++) {
+        Qcow2FastPathEntry **slot =
+            &s->fast_path[(guest_cluster + i) % QCOW2_FAST_PATH_SLOTS];
+
+        /* Entries are only replaced with s->lock held, so this cannot race */
+        e = *slot;
+        if (e && e->guest_cluster == guest_cluster + i) {
+            qatomic_set(slot, NULL);
+            g_free_rcu(e, rcu);
+        }
+    }
+}
+
+/*
+ * Record that the clusters touched by @offset and @bytes are normal, fully
+ * allocated clusters that are contiguous in the image file, starting at
+ * @host_offset.  Must be called with s->lock held, without dropping it
+ * since the mapping was looked up, so that qcow2_fast_path_invalidate()
+ * cannot miss the new entries.
+ *
+ * Writable mappings let writes skip qcow2_pre_write_overlap_check(), so they
+ * are only recorded if the whole clusters pass the metadata overlap check.
+ * Metadata can only move into a cluster after it has been freed, which
+ * happens only after its L2 entry has changed, so the result of the check
+ * stays valid as long as the entry does.
+ */
+void qcow2_fast_path_put(BlockDriverState *bs, uint64_t offset,
+                         uint64_t bytes, uint64_t host_offset, bool writable)
+{
+    BDRVQcow2State *s = bs->opaque;
+    uint64_t guest_cluster = offset >> s->cluster_bits;
+    uint64_t nb_clusters = size_to_clusters(s, offset_into_cluster(s, offset) +
+                                               bytes);
+    Qcow2FastPathEntry *e, *old;
+    uint64_t i;
+
+    if (!s->fast_path || has_subclusters(s)) {
+        return;
+    }
+
+    nb_clusters = MIN(nb_clusters, QCOW2_FAST_PATH_MAX_RUN);
+    host_offset = start_of_cluster(s, host_offset);
+
+    if (writable && !has_data_file(bs) &&
+        qcow2_check_metadata_overlap(bs, 0, host_offset,
+                                     nb_clusters << s->cluster_bits) != 0) {
+        return;
+    }
+
+    for (i = 0; i < nb_clusters; i++) {
+        e = g_new(Qcow2FastPathEntry, 1);
+        *e = (Qcow2FastPathEntry) {
+            .guest_cluster  = guest_cluster + i,
+            .host_offset    = host_offset + (i << s->cluster_bits),
+            .gen            = s->mapping_gen,
+            .writable       = writable,
+        };
+
+        old = qatomic_xchg(
+            &s->fast_path[(guest_cluster + i) % QCOW2_FAST_PATH_SLOTS], e);
+        if (old) {
+            g_free_rcu(old, rcu);
+        }
+    }
+}
 
 /*
  * get_host_offset
@@ -873,6 +1075,7 @@ qcow2_alloc_compressed_cluster_offset(BlockDriverState *bs, uint64_t offset,
     /* compressed clusters never have the copied flag */
 
     BLKDBG_CO_EVENT(bs->file, BLKDBG_L2_UPDATE_COMPRESSED);
+    qcow2_fast_path_invalidate(s, offset, 1);
     qcow2_cache_entry_mark_dirty(s->l2_table_cache, l2_slice);
     set_l2_entry(s, l2_slice, l2_index, cluster_offset);
     if (has_subclusters(s)) {
@@ -1061,6 +1264,7 @@ int coroutine_fn qcow2_alloc_cluster_link_l2(BlockDriverState *bs,
     if (ret < 0) {
         goto err;
     }
+    qcow2_fast_path_invalidate(s, m->offset, m->nb_clusters);
     qcow2_cache_entry_mark_dirty(s->l2_table_cache, l2_slice);
 
     assert(l2_index + m->nb_clusters <= s->l2_slice_size);
@@ -1619,7 +1823,9 @@ do_alloc_cluster_offset(BlockDriverState *bs, uint64_t guest_offset,
 
     /* Allocate new clusters */
     trace_qcow2_cluster_alloc_phys(qemu_coroutine_self());
-    if (*host_offset == INV_OFFSET) {
+    if (s->alloc_extent_size) {
+        return qcow2_alloc_reserved_clusters(bs, host_offset, nb_clusters);
+    } else if (*host_offset == INV_OFFSET) {
         int64_t cluster_offset =
             qcow2_alloc_clusters(bs, *nb_clusters * s->cluster_size);
         if (cluster_offset < 0) {
@@ -1916,6 +2122,7 @@ discard_in_l2_slice(BlockDriverState *bs, uint64_t offset, uint64_t nb_clusters,
     /* Limit nb_clusters to one L2 slice */
     nb_clusters = MIN(nb_clusters, s->l2_slice_size - l2_index);
     assert(nb_clusters <= INT_MAX);
+    qcow2_fast_path_invalidate(s, offset, nb_clusters);
 
     for (i = 0; i < nb_clusters; i++) {
         uint64_t old_l2_entry = get_l2_entry(s, l2_slice, l2_index + i);
@@ -2055,6 +2262,7 @@ zero_in_l2_slice(BlockDriverState *bs, uint64_t offset,
     /* Limit nb_clusters to one L2 slice */
     nb_clusters = MIN(nb_clusters, s->l2_slice_size - l2_index);
     assert(nb_clusters <= INT_MAX);
+    qcow2_fast_path_invalidate(s, offset, nb_clusters);
 
     for (i = 0; i < nb_clusters; i++) {
         uint64_t old_l2_entry = get_l2_entry(s, l2_slice, l2_index + i);
@@ -2262,6 +2470,9 @@ expand_zero_clusters_in_l1(BlockDriverState *bs, uint64_t *l1_table,
     /* qcow2_downgrade() is not allowed in images with subclusters */
     assert(!has_subclusters(s));
 
+    /* Zero clusters may be allocated in any L2 table */
+    qcow2_mapping_changed(s);
+
     slice_size2 = s->l2_slice_size * l2_entry_size(s);
     n_slices = s->cluster_size / slice_size2;
 
@@ -878,6 +878,14 @@ update_refcount(BlockDriverState *bs, int64_t offset, int64_t length,
         if (decrease) {
             refcount -= addend;
         } else {
+            /*
+             * Sharing a cluster that is in use makes it read-only, which
+             * writable fast path entries cannot see.  Free clusters that are
+             * being allocated are not referenced by any entry.
+             */
+            if (refcount != 0) {
+                qcow2_mapping_changed(s);
+            }
             refcount += addend;
         }
         if (refcount == 0 && cluster_index < s->free_cluster_index) {
@@ -901,6 +909,8 @@ update_refcount(BlockDriverState *bs, int64_t offset, int64_t length,
                 qcow2_cache_discard(s->l2_table_cache, table);
             }
 
+            qcow2_decompressed_cache_discard(bs, cluster_offset);
+
             if (s->discard_passthrough[type]) {
                 update_refcount_discard(bs, cluster_offset, s->cluster_size);
             }
@@ -1065,6 +1075,96 @@ int64_t coroutine_fn qcow2_alloc_clusters_at(BlockDriverState *bs, uint64_t offs
     return i;
 }
 
+/*
+ * Allocates up to *nb_clusters data clusters from the reservation pool.
+ *
+ * The pool is refilled with an extent of alloc-extent-size bytes whenever it
+ * runs empty, so the refcounts of a whole extent are updated at once instead
+ * of once per allocating write. Until they are used, the clusters in the pool
+ * look leaked in the image; qcow2_release_reserved_clusters() frees them.
+ *
+ * If *host_offset is not INV_OFFSET, the clusters must start there, and
+ * *nb_clusters is set to 0 if that is impossible. On success, *host_offset
+ * and *nb_clusters describe the allocated clusters, which may be fewer than
+ * requested.
+ *
+ * Returns 0 on success and -errno on failure.
+ */
+int coroutine_fn
+qcow2_alloc_reserved_clusters(BlockDriverState *bs, uint64_t *host_offset,
+                              uint64_t *nb_clusters)
+{
+    BDRVQcow2State *s = bs->opaque;
+    uint64_t extent_clusters = s->alloc_extent_size >> s->cluster_bits;
+    uint64_t n;
+
+    assert(extent_clusters > 0);
+
+    if (s->reserved_clusters == 0) {
+        int64_t ret;
+
+        if (*host_offset == INV_OFFSET) {
+            extent_clusters = MAX(extent_clusters, *nb_clusters);
+            ret = qcow2_alloc_clusters(bs, extent_clusters << s->cluster_bits);
+            if (ret < 0) {
+                return ret;
+            }
+            s->reserved_offset = ret;
+        } else {
+            ret = qcow2_alloc_clusters_at(bs, *host_offset, extent_clusters);
+            if (ret < 0) {
+                return ret;
+            }
+            s->reserved_offset = *host_offset;
+            extent_clusters = ret;
+        }
+        s->reserved_clusters = extent_clusters;
+        trace_qcow2_reserve_clusters(bs, s->reserved_offset,
+                                     s->reserved_clusters);
+
+        /* The L2 updates of the callers must not overtake the refcounts */
+        qcow2_cache_set_dependency(bs, s->l2_table_cache,
+                                   s->refcount_block_cache);
+    } else if (*host_offset != INV_OFFSET &&
+               *host_offset != s->reserved_offset)
+    {
+        *nb_clusters = 0;
+        return 0;
+    }
+
+    n = MIN(*nb_clusters, s->reserved_clusters);
+    *host_offset = s->reserved_offset;
+    *nb_clusters = n;
+    s->reserved_offset += n << s->cluster_bits;
+    s->reserved_clusters -= n;
+
+    return 0;
+}
+
+/*
+ * Drops the refcounts of all clusters that are still in the reservation pool.
+ * Must be called before anything that needs the refcounts to match the
+ * cluster references, such as closing or checking the image.
+ */
+int qcow2_release_reserved_clusters(BlockDriverState *bs)
+{
+    BDRVQcow2State *s = bs->opaque;
+    int ret;
+
+    if (s->reserved_clusters == 0) {
+        return 0;
+    }
+
+    trace_qcow2_release_reserved_clusters(bs, s->reserved_offset,
+                                          s->reserved_clusters);
+    ret = update_refcount(bs, s->reserved_offset,
+                          s->reserved_clusters << s->cluster_bits, 1, true,
+                          QCOW2_DISCARD_NEVER);
+    s->reserved_clusters = 0;
+
+    return ret;
+}
+
 /* only used to allocate compressed sectors. We try to allocate
    contiguous sectors. size must be <= cluster_size */
 int64_t coroutine_fn GRAPH_RDLOCK qcow2_alloc_bytes(BlockDriverState *bs, int size)
@@ -1387,6 +1487,7 @@ int qcow2_update_snapshot_refcount(BlockDriverState *bs,
                             qcow2_cache_set_dependency(bs, s->l2_table_cache,
                                                        s->refcount_block_cache);
                         }
+                        qcow2_mapping_changed(s);
                         set_l2_entry(s, l2_slice, j, entry);
                         qcow2_cache_entry_mark_dirty(s->l2_table_cache,
                                                      l2_slice);
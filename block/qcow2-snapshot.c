@@ -873,6 +873,7 @@ int qcow2_snapshot_goto(BlockDriverState *bs, const char *snapshot_id)
      * Now update the in-memory L1 table to be in sync with the on-disk one. We
      * need to do this even if updating refcounts failed.
      */
+    qcow2_mapping_changed(s);
     for(i = 0;i < s->l1_size; i++) {
         s->l1_table[i] = be64_to_cpu(sn_l1_table[i]);
     }
@@ -1062,6 +1063,7 @@ int qcow2_snapshot_load_tmp(BlockDriverState *bs,
     }
 
     /* Switch the L1 table */
+    qcow2_mapping_changed(s);
     qemu_vfree(s->l1_table);
 
     s->l1_size = sn->l1_size;
@@ -608,12 +608,24 @@ static int coroutine_fn GRAPH_RDLOCK
 qcow2_co_check_locked(BlockDriverState *bs, BdrvCheckResult *result,
                       BdrvCheckMode fix)
 {
+    BDRVQcow2State *s = bs->opaque;
     BdrvCheckResult snapshot_res = {};
     BdrvCheckResult refcount_res = {};
     int ret;
 
     memset(result, 0, sizeof(*result));
 
+    if (fix) {
+        /* Repairs may rewrite L1 and L2 entries behind our back */
+        qcow2_mapping_changed(s);
+    }
+
+    /* Reserved clusters would be reported as leaks */
+    ret = qcow2_release_reserved_clusters(bs);
+    if (ret < 0) {
+        return ret;
+    }
+
     ret = qcow2_check_read_snapshot_table(bs, &snapshot_res, fix);
     if (ret < 0) {
         qcow2_add_check_result(result, &snapshot_res, false);
@@ -701,6 +713,9 @@ static const char *const mutable_opts[] = {
     QCOW2_OPT_L2_CACHE_ENTRY_SIZE,
     QCOW2_OPT_REFCOUNT_CACHE_SIZE,
     QCOW2_OPT_CACHE_CLEAN_INTERVAL,
+    QCOW2_OPT_ALLOC_EXTENT_SIZE,
+    QCOW2_OPT_L2_PREFETCH_SLICES,
+    QCOW2_OPT_DECOMPRESSED_CACHE_SIZE,
     NULL
 };
 
@@ -817,6 +832,24 @@ static QemuOptsList qcow2_runtime_opts = {
             .type = QEMU_OPT_NUMBER,
             .help = "Clean unused cache entries after this time (in seconds)",
         },
+        {
+            .name = QCOW2_OPT_ALLOC_EXTENT_SIZE,
+            .type = QEMU_OPT_SIZE,
+            .help = "Reserve space for new data clusters in extents of this "
+                    "size (0 = allocate per request)",
+        },
+        {
+            .name = QCOW2_OPT_L2_PREFETCH_SLICES,
+            .type = QEMU_OPT_NUMBER,
+            .help = "Number of L2 slices to load ahead of sequential reads "
+                    "(0 = disabled)",
+        },
+        {
+            .name = QCOW2_OPT_DECOMPRESSED_CACHE_SIZE,
+            .type = QEMU_OPT_SIZE,
+            .help = "Maximum size of recently read compressed clusters to "
+                    "keep in decompressed form (0 = disabled)",
+        },
         BLOCK_CRYPTO_OPT_DEF_KEY_SECRET("encrypt.",
             "ID of secret providing qcow2 AES key or LUKS passphrase"),
         { /* end of list */ }
@@ -970,6 +1003,97 @@ static bool read_cache_sizes(BlockDriverState *bs, QemuOpts *opts,
     return true;
 }
 
+/*
+ * Drop all decompressed clusters and make room for @nb_entries new ones.
+ * Must not be called while compressed clusters are being read.
+ */
+static void qcow2_decompressed_cache_resize(BDRVQcow2State *s,
+                                            unsigned nb_entries)
+{
+    unsigned i;
+
+    for (i = 0; i < s->nb_decompressed; i++) {
+        assert(!s->decompressed[i].loading);
+        qemu_vfree(s->decompressed[i].data);
+    }
+    g_free(s->decompressed);
+    g_clear_pointer(&s->decompressed_index, g_hash_table_destroy);
+    QTAILQ_INIT(&s->decompressed_lru);
+
+    s->decompressed = nb_entries ?
+        g_new0(Qcow2DecompressedCluster, nb_entries) : NULL;
+    s->nb_decompressed = nb_entries;
+    if (nb_entries) {
+        s->decompressed_index = g_hash_table_new(g_int64_hash, g_int64_equal);
+    }
+    for (i = 0; i < nb_entries; i++) {
+        QTAILQ_INSERT_TAIL(&s->decompressed_lru, &s->decompressed[i],
+                           next_lru);
+    }
+}
+
+/*
+ * Change the cluster cached in slot @c to @l2_entry, or mark the slot as
+ * unused if @l2_entry is 0.  Called with decompressed_lock held.  Slots are
+ * only ever assigned clusters that are not cached yet, so every descriptor
+ * is in the index at most once.
+ */
+static void qcow2_decompressed_cache_set(BDRVQcow2State *s,
+                                         Qcow2DecompressedCluster *c,
+                                         uint64_t l2_entry)
+{
+    bool added;
+
+    if (c->l2_entry) {
+        g_hash_table_remove(s->decompressed_index, &c->l2_entry);
+    }
+    c->l2_entry = l2_entry;
+    if (l2_entry) {
+        /* The key lives in the slot */
+        added = g_hash_table_insert(s->decompressed_index, &c->l2_entry, c);
+        assert(added);
+    }
+}
+
+/*
+ * Forget all decompressed clusters whose compressed data starts in the host
+ * cluster at @cluster_offset.  Called when the host cluster is freed, before
+ * it can be reused for other compressed data with the same descriptor.
+ */
+void qcow2_decompressed_cache_discard(BlockDriverState *bs,
+                                      uint64_t cluster_offset)
+{
+    BDRVQcow2State *s = bs->opaque;
+    unsigned i;
+
+    if (!s->nb_decompressed) {
+        return;
+    }
+
+    qemu_mutex_lock(&s->decompressed_lock);
+    for (i = 0; i < s->nb_decompressed; i++) {
+        Qcow2DecompressedCluster *c = &s->decompressed[i];
+        uint64_t coffset = c->l2_entry & s->cluster_offset_mask;
+
+        if (c->l2_entry && start_of_cluster(s, coffset) == cluster_offset) {
+            /* A request that is still loading it will not insert it */
+            qcow2_decompressed_cache_set(s, c, 0);
+        }
+    }
+    qemu_mutex_unlock(&s->decompressed_lock);
+}
+
+static void qcow2_decompressed_cache_clear(BDRVQcow2State *s)
+{
+    unsigned i;
+
+    qemu_mutex_lock(&s->decompressed_lock);
+    for (i = 0; i < s->nb_decompressed; i++) {
+        qcow2_decompressed_cache_set(s, &s->decompressed[i], 0);
+    }
+    qemu_mutex_unlock(&s->decompressed_lock);
+}
+
 typedef struct Qcow2ReopenState {
     Qcow2Cache *l2_table_cache;
     Qcow2Cache *refcount_block_cache;
@@ -979,6 +1103,9 @@ typedef struct Qcow2ReopenState {
     bool discard_passthrough[QCOW2_DISCARD_MAX];
     bool discard_no_unref;
     uint64_t cache_clean_interval;
+    uint64_t alloc_extent_size;
+    uint64_t l2_prefetch_slices;
+    unsigned nb_decompressed;
     QCryptoBlockOpenOptions *crypto_opts; /* Disk encryption runtime options */
 } Qcow2ReopenState;
 
@@ -991,6 +1118,7 @@ qcow2_update_options_prepare(BlockDriverState *bs, Qcow2ReopenState *r,
     const char *opt_overlap_check, *opt_overlap_check_template;
     int overlap_check_template = 0;
     uint64_t l2_cache_size, l2_cache_entry_size, refcount_cache_size;
+    uint64_t decompressed_cache_size;
     int i;
     const char *encryptfmt;
     QDict *encryptopts = NULL;
@@ -1079,6 +1207,40 @@ qcow2_update_options_prepare(BlockDriverState *bs, Qcow2ReopenState *r,
         goto fail;
     }
 
+    r->alloc_extent_size =
+        qemu_opt_get_size(opts, QCOW2_OPT_ALLOC_EXTENT_SIZE, 0);
+    if (r->alloc_extent_size > QCOW2_MAX_ALLOC_EXTENT_SIZE) {
+        error_setg(errp, QCOW2_OPT_ALLOC_EXTENT_SIZE " must not exceed %"
+                   PRIu64 " bytes", (uint64_t) QCOW2_MAX_ALLOC_EXTENT_SIZE);
+        ret = -EINVAL;
+        goto fail;
+    }
+    r->alloc_extent_size = ROUND_UP(r->alloc_extent_size, s->cluster_size);
+
+    /* Prefetched slices must not push out the ones that are in use */
+    r->l2_prefetch_slices =
+        qemu_opt_get_number(opts, QCOW2_OPT_L2_PREFETCH_SLICES, 0);
+    if (r->l2_prefetch_slices >= l2_cache_size) {
+        error_setg(errp, QCOW2_OPT_L2_PREFETCH_SLICES " must be smaller than "
+                   "the number of L2 cache entries (%" PRIu64 ")",
+                   l2_cache_size);
+        ret = -EINVAL;
+        goto fail;
+    }
+
+    decompressed_cache_size =
+        qemu_opt_get_size(opts, QCOW2_OPT_DECOMPRESSED_CACHE_SIZE,
+                          DEFAULT_DECOMPRESSED_CACHE_SIZE);
+    if (decompressed_cache_size > QCOW2_MAX_DECOMPRESSED_CACHE_SIZE) {
+        error_setg(errp, QCOW2_OPT_DECOMPRESSED_CACHE_SIZE " must not exceed %"
+                   PRIu64 " bytes",
+                   (uint64_t) QCOW2_MAX_DECOMPRESSED_CACHE_SIZE);
+        ret = -EINVAL;
+        goto fail;
+    }
+    r->nb_decompressed = DIV_ROUND_UP(decompressed_cache_size,
+                                      s->cluster_size);
+
     /* lazy-refcounts; flush if going from enabled to disabled */
     r->use_lazy_refcounts = qemu_opt_get_bool(opts, QCOW2_OPT_LAZY_REFCOUNTS,
         (s->compatible_features & QCOW2_COMPAT_LAZY_REFCOUNTS));
@@ -1239,6 +1401,14 @@ static void qcow2_update_options_commit(BlockDriverState *bs,
 
     s->discard_no_unref = r->discard_no_unref;
 
+    /* A pool left over from before is still released on close */
+    s->alloc_extent_size = r->alloc_extent_size;
+    s->l2_prefetch_slices = r->l2_prefetch_slices;
+
+    if (s->nb_decompressed != r->nb_decompressed) {
+        qcow2_decompressed_cache_resize(s, r->nb_decompressed);
+    }
+
     if (s->cache_clean_interval != r->cache_clean_interval) {
         cache_clean_timer_del(bs);
         s->cache_clean_interval = r->cache_clean_interval;
@@ -1328,6 +1498,9 @@ qcow2_do_open(BlockDriverState *bs, QDict *options, int flags,
     uint64_t l1_vm_state_index;
     bool update_header = false;
 
+    qemu_mutex_init(&s->decompressed_lock);
+    qemu_co_queue_init(&s->decompressed_queue);
+
     ret = bdrv_co_pread(bs->file, 0, sizeof(header), &header, 0);
     if (ret < 0) {
         error_setg_errno(errp, -ret, "Could not read qcow2 header");
@@ -1612,6 +1785,9 @@ qcow2_do_open(BlockDriverState *bs, QDict *options, int flags,
         }
     }
 
+    qcow2_fast_path_init(s);
+    qemu_spin_init(&s->l2_prefetch_spin);
+
     /* Parse driver-specific options */
     ret = qcow2_update_options(bs, options, flags, errp);
     if (ret < 0) {
@@ -1892,6 +2068,9 @@ qcow2_do_open(BlockDriverState *bs, QDict *options, int flags,
     qemu_vfree(s->l1_table);
     /* else pre-write overlap checks in cache_destroy may crash */
     s->l1_table = NULL;
+    qcow2_fast_path_free(s);
+    qcow2_decompressed_cache_resize(s, 0);
+    qemu_mutex_destroy(&s->decompressed_lock);
     cache_clean_timer_del(bs);
     if (s->l2_table_cache) {
         qcow2_cache_destroy(s->l2_table_cache);
@@ -2369,6 +2548,100 @@ static int coroutine_fn GRAPH_RDLOCK qcow2_co_preadv_task_entry(AioTask *task)
                                 t->qiov, t->qiov_offset);
 }
 
+/* Number of back-to-back reads after which a stream counts as sequential */
+#define QCOW2_SEQ_READS_MIN 4
+
+typedef struct Qcow2L2PrefetchCo {
+    BlockDriverState *bs;
+    uint64_t offset;
+    uint64_t end;
+} Qcow2L2PrefetchCo;
+
+static void coroutine_fn qcow2_l2_prefetch_entry(void *opaque)
+{
+    Qcow2L2PrefetchCo *p = opaque;
+    BlockDriverState *bs = p->bs;
+    BDRVQcow2State *s = bs->opaque;
+    uint64_t slice_bytes = (uint64_t) s->l2_slice_size << s->cluster_bits;
+    uint64_t offset;
+    int ret;
+
+    bdrv_graph_co_rdlock();
+    for (offset = p->offset; offset < p->end; offset += slice_bytes) {
+        /* Drop the lock in between so that requests can overtake us */
+        qemu_co_mutex_lock(&s->lock);
+        ret = qcow2_prefetch_l2_slice(bs, offset);
+        qemu_co_mutex_unlock(&s->lock);
+        if (ret < 0) {
+            break;
+        }
+    }
+    bdrv_graph_co_rdunlock();
+
+    qemu_spin_lock(&s->l2_prefetch_spin);
+    s->l2_prefetch_busy = false;
+    qemu_spin_unlock(&s->l2_prefetch_spin);
+
+    bdrv_dec_in_flight(bs);
+    g_free(p);
+}
+
+/*
+ * Detect sequential reads and keep the next l2-prefetch-slices L2 slices
+ * ahead of them loaded in the background, so that the stream does not stall
+ * on a synchronous metadata read every time it crosses a slice boundary.
+ */
+static void coroutine_fn
+qcow2_l2_prefetch(BlockDriverState *bs, uint64_t offset, uint64_t bytes)
+{
+    BDRVQcow2State *s = bs->opaque;
+    uint64_t slice_bytes, start, end;
+    Qcow2L2PrefetchCo *p;
+    Coroutine *co;
+
+    if (!s->l2_prefetch_slices) {
+        return;
+    }
+
+    /* The slice that the request itself ends in is loaded anyway */
+    slice_bytes = (uint64_t) s->l2_slice_size << s->cluster_bits;
+    start = ROUND_UP(offset + bytes, slice_bytes);
+    end = MIN(start + s->l2_prefetch_slices * slice_bytes,
+              bs->total_sectors * BDRV_SECTOR_SIZE);
+
+    qemu_spin_lock(&s->l2_prefetch_spin);
+    if (s->seq_read_end == offset) {
+        s->seq_reads++;
+    } else {
+        /* A new stream may start below the old prefetch window */
+        s->seq_reads = 0;
+        s->l2_prefetch_end = 0;
+    }
+    s->seq_read_end = offset + bytes;
+
+    start = MAX(start, s->l2_prefetch_end);
+    if (s->seq_reads < QCOW2_SEQ_READS_MIN || start >= end ||
+        s->l2_prefetch_busy) {
+        qemu_spin_unlock(&s->l2_prefetch_spin);
+        return;
+    }
+    s->l2_prefetch_busy = true;
+    s->l2_prefetch_end = end;
+    qemu_spin_unlock(&s->l2_prefetch_spin);
+
+    p = g_new(Qcow2L2PrefetchCo, 1);
+    *p = (Qcow2L2PrefetchCo) {
+        .bs     = bs,
+        .offset = start,
+        .end    = end,
+    };
+
+    /* Drained sections wait for the prefetch to complete */
+    bdrv_inc_in_flight(bs);
+    co = qemu_coroutine_create(qcow2_l2_prefetch_entry, p);
+    aio_co_enter(bdrv_get_aio_context(bs), co);
+}
+
 static int coroutine_fn GRAPH_RDLOCK
 qcow2_co_preadv_part(BlockDriverState *bs, int64_t offset, int64_t bytes,
                      QEMUIOVector *qiov, size_t qiov_offset,
@@ -2381,17 +2654,26 @@ qcow2_co_preadv_part(BlockDriverState *bs, int64_t offset, int64_t bytes,
     QCow2SubclusterType type;
     AioTaskPool *aio = NULL;
 
+    qcow2_l2_prefetch(bs, offset, bytes);
+
     while (bytes != 0 && aio_task_pool_status(aio) == 0) {
         /* prepare next request */
         cur_bytes = MIN(bytes, INT_MAX);
         if (s->crypto) {
             cur_bytes = MIN(cur_bytes,
                             QCOW_MAX_CRYPT_CLUSTERS * s->cluster_size);
+        } else if (qcow2_fast_path_get(s, offset, &cur_bytes, false,
+                                       &host_offset)) {
+            type = QCOW2_SUBCLUSTER_NORMAL;
+            goto add_task;
         }
 
         qemu_co_mutex_lock(&s->lock);
         ret = qcow2_get_host_offset(bs, offset, &cur_bytes,
                                     &host_offset, &type);
+        if (ret == 0 && type == QCOW2_SUBCLUSTER_NORMAL && !s->crypto) {
+            qcow2_fast_path_put(bs, offset, cur_bytes, host_offset, false);
+        }
         qemu_co_mutex_unlock(&s->lock);
         if (ret < 0) {
             goto out;
@@ -2404,6 +2686,7 @@ qcow2_co_preadv_part(BlockDriverState *bs, int64_t offset, int64_t bytes,
         {
             qemu_iovec_memset(qiov, qiov_offset, 0, cur_bytes);
         } else {
+add_task:
             if (!aio && cur_bytes != bytes) {
                 aio = aio_task_pool_new(QCOW2_MAX_WORKERS);
             }
@@ -2627,18 +2910,27 @@ int qcow2_co_pwritev_task(BlockDriverState *bs, uint64_t host_offset,
         }
     }
 
+    /* Rewrites of allocated clusters have no metadata to update */
+    if (!l2meta) {
+        goto out;
+    }
+
     qemu_co_mutex_lock(&s->lock);
 
     ret = qcow2_handle_l2meta(bs, &l2meta, true);
     goto out_locked;
 
 out_unlocked:
+    if (!l2meta) {
+        goto out;
+    }
     qemu_co_mutex_lock(&s->lock);
 
 out_locked:
     qcow2_handle_l2meta(bs, &l2meta, false);
     qemu_co_mutex_unlock(&s->lock);
 
+out:
     qemu_vfree(crypt_buf);
 
     return ret;
@@ -2685,6 +2977,13 @@ qcow2_co_pwritev_part(BlockDriverState *bs, int64_t offset, int64_t bytes,
             cur_bytes = MIN(cur_bytes,
                             QCOW_MAX_CRYPT_CLUSTERS * s->cluster_size
                             - offset_in_cluster);
+        } else if (qcow2_fast_path_get(s, offset, &cur_bytes, true,
+                                       &host_offset)) {
+            /*
+             * qcow2_fast_path_put() only records writable mappings that
+             * passed the overlap check, see there
+             */
+            goto add_task;
         }
 
         qemu_co_mutex_lock(&s->lock);
@@ -2701,8 +3000,14 @@ qcow2_co_pwritev_part(BlockDriverState *bs, int64_t offset, int64_t bytes,
             goto out_locked;
         }
 
+        /* Without l2meta, the clusters were allocated and writable already */
+        if (!l2meta && !bs->encrypted) {
+            qcow2_fast_path_put(bs, offset, cur_bytes, host_offset, true);
+        }
+
         qemu_co_mutex_unlock(&s->lock);
 
+add_task:
         if (!aio && cur_bytes != bytes) {
             aio = aio_task_pool_new(QCOW2_MAX_WORKERS);
         }
@@ -2711,7 +3016,7 @@ qcow2_co_pwritev_part(BlockDriverState *bs, int64_t offset, int64_t bytes,
                              cur_bytes, qiov, qiov_offset, l2meta);
         l2meta = NULL; /* l2meta is consumed by qcow2_co_pwritev_task() */
         if (ret < 0) {
-            goto fail_nometa;
+            goto out_nometa;
         }
 
         bytes -= cur_bytes;
@@ -2720,15 +3025,14 @@ qcow2_co_pwritev_part(BlockDriverState *bs, int64_t offset, int64_t bytes,
         trace_qcow2_writev_done_part(qemu_coroutine_self(), cur_bytes);
     }
     ret = 0;
-
-    qemu_co_mutex_lock(&s->lock);
+    goto out_nometa;
 
 out_locked:
     qcow2_handle_l2meta(bs, &l2meta, false);
 
     qemu_co_mutex_unlock(&s->lock);
 
-fail_nometa:
+out_nometa:
     if (aio) {
         aio_task_pool_wait_all(aio);
         if (ret == 0) {
@@ -2756,6 +3060,13 @@ static int GRAPH_RDLOCK qcow2_inactivate(BlockDriverState *bs)
                           bdrv_get_device_or_node_name(bs));
     }
 
+    ret = qcow2_release_reserved_clusters(bs);
+    if (ret) {
+        result = ret;
+        error_report("Failed to release reserved clusters: %s",
+                     strerror(-ret));
+    }
+
     ret = qcow2_cache_flush(bs, s->l2_table_cache);
     if (ret) {
         result = ret;
@@ -2784,6 +3095,9 @@ qcow2_do_close(BlockDriverState *bs, bool close_data_file)
     qemu_vfree(s->l1_table);
     /* else pre-write overlap checks in cache_destroy may crash */
     s->l1_table = NULL;
+    qcow2_fast_path_free(s);
+    qcow2_decompressed_cache_resize(s, 0);
+    qemu_mutex_destroy(&s->decompressed_lock);
 
     if (!(s->flags & BDRV_O_INACTIVE)) {
         qcow2_inactivate(bs);
@@ -4333,6 +4647,13 @@ qcow2_co_truncate(BlockDriverState *bs, int64_t offset, bool exact,
             goto fail;
         }
 
+        /* Reserved clusters would keep the image file from shrinking */
+        ret = qcow2_release_reserved_clusters(bs);
+        if (ret < 0) {
+            error_setg_errno(errp, -ret, "Failed to release reserved clusters");
+            goto fail;
+        }
+
         ret = qcow2_cluster_discard(bs, ROUND_UP(offset, s->cluster_size),
                                     old_length - ROUND_UP(offset,
                                                           s->cluster_size),
@@ -4802,19 +5123,15 @@ qcow2_co_pwritev_compressed_part(BlockDriverState *bs,
     return ret;
 }
 
+/* Read and decompress the compressed cluster described by @l2_entry */
 static int coroutine_fn GRAPH_RDLOCK
-qcow2_co_preadv_compressed(BlockDriverState *bs,
-                           uint64_t l2_entry,
-                           uint64_t offset,
-                           uint64_t bytes,
-                           QEMUIOVector *qiov,
-                           size_t qiov_offset)
+qcow2_co_read_compressed_cluster(BlockDriverState *bs, uint64_t l2_entry,
+                                 uint8_t *out_buf)
 {
     BDRVQcow2State *s = bs->opaque;
     int ret = 0, csize;
     uint64_t coffset;
-    uint8_t *buf, *out_buf;
-    int offset_in_cluster = offset_into_cluster(s, offset);
+    uint8_t *buf;
 
     qcow2_parse_compressed_l2_entry(bs, l2_entry, &coffset, &csize);
 
@@ -4823,8 +5140,6 @@ qcow2_co_preadv_compressed(BlockDriverState *bs,
         return -ENOMEM;
     }
 
-    out_buf = qemu_blockalign(bs, s->cluster_size);
-
     BLKDBG_CO_EVENT(bs->file, BLKDBG_READ_COMPRESSED);
     ret = bdrv_co_pread(bs->file, coffset, csize, buf, 0);
     if (ret < 0) {
@@ -4836,11 +5151,112 @@ qcow2_co_preadv_compressed(BlockDriverState *bs,
         goto fail;
     }
 
-    qemu_iovec_from_buf(qiov, qiov_offset, out_buf + offset_in_cluster, bytes);
-
 fail:
-    qemu_vfree(out_buf);
     g_free(buf);
+    return ret;
+}
+
+/*
+ * Find a slot for a cluster that is not cached yet, evicting the least
+ * recently used one, and mark it as loading.  Returns NULL if all slots are
+ * being loaded.
+ */
+static Qcow2DecompressedCluster *
+qcow2_decompressed_cache_evict(BDRVQcow2State *s)
+{
+    Qcow2DecompressedCluster *victim = QTAILQ_FIRST(&s->decompressed_lru);
+
+    if (victim) {
+        QTAILQ_REMOVE(&s->decompressed_lru, victim, next_lru);
+        victim->loading = true;
+    }
+    return victim;
+}
+
+static Qcow2DecompressedCluster *
+qcow2_decompressed_cache_find(BDRVQcow2State *s, uint64_t l2_entry)
+{
+    return g_hash_table_lookup(s->decompressed_index, &l2_entry);
+}
+
+/*
+ * Reads that are smaller than a cluster would otherwise decompress the same
+ * cluster again and again, so keep the most recently used clusters in
+ * decompressed form.  Requests for a cluster that is being loaded wait for
+ * it instead of decompressing it in parallel.
+ */
+static int coroutine_fn GRAPH_RDLOCK
+qcow2_co_preadv_compressed(BlockDriverState *bs,
+                           uint64_t l2_entry,
+                           uint64_t offset,
+                           uint64_t bytes,
+                           QEMUIOVector *qiov,
+                           size_t qiov_offset)
+{
+    BDRVQcow2State *s = bs->opaque;
+    Qcow2DecompressedCluster *c = NULL;
+    uint8_t *out_buf;
+    int offset_in_cluster = offset_into_cluster(s, offset);
+    int ret;
+
+    if (s->nb_decompressed) {
+        qemu_mutex_lock(&s->decompressed_lock);
+        c = qcow2_decompressed_cache_find(s, l2_entry);
+        while (c && c->loading) {
+            qemu_co_queue_wait(&s->decompressed_queue, &s->decompressed_lock);
+            c = qcow2_decompressed_cache_find(s, l2_entry);
+        }
+
+        if (c) {
+            QTAILQ_REMOVE(&s->decompressed_lru, c, next_lru);
+            QTAILQ_INSERT_TAIL(&s->decompressed_lru, c, next_lru);
+            qemu_iovec_from_buf(qiov, qiov_offset,
+                                c->data + offset_in_cluster, bytes);
+            qemu_mutex_unlock(&s->decompressed_lock);
+            stat64_add(&s->decompressed_hits, 1);
+            return 0;
+        }
+
+        c = qcow2_decompressed_cache_evict(s);
+        if (c) {
+            qcow2_decompressed_cache_set(s, c, l2_entry);
+            if (!c->data) {
+                c->data = qemu_blockalign(bs, s->cluster_size);
+            }
+        }
+        qemu_mutex_unlock(&s->decompressed_lock);
+        stat64_add(&s->decompressed_misses, 1);
+    }
+
+    if (!c) {
+        out_buf = qemu_blockalign(bs, s->cluster_size);
+        ret = qcow2_co_read_compressed_cluster(bs, l2_entry, out_buf);
+        if (ret == 0) {
+            qemu_iovec_from_buf(qiov, qiov_offset, out_buf + offset_in_cluster,
+                                bytes);
+        }
+        qemu_vfree(out_buf);
+        return ret;
+    }
+
+    /* The slot is ours until loading is cleared */
+    ret = qcow2_co_read_compressed_cluster(bs, l2_entry, c->data);
+    if (ret == 0) {
+        qemu_iovec_from_buf(qiov, qiov_offset, c->data + offset_in_cluster,
+                            bytes);
+    }
+
+    qemu_mutex_lock(&s->decompressed_lock);
+    c->loading = false;
+    if (ret < 0 || c->l2_entry != l2_entry) {
+        /* Failed, or the cluster was freed in the meantime; reuse it first */
+        qcow2_decompressed_cache_set(s, c, 0);
+        QTAILQ_INSERT_HEAD(&s->decompressed_lru, c, next_lru);
+    } else {
+        QTAILQ_INSERT_TAIL(&s->decompressed_lru, c, next_lru);
+    }
+    qemu_co_queue_restart_all(&s->decompressed_queue);
+    qemu_mutex_unlock(&s->decompressed_lock);
 
     return ret;
 }
@@ -4859,6 +5275,15 @@ static int GRAPH_RDLOCK make_completely_empty(BlockDriverState *bs)
         uint32_t reftable_clusters;
     } QEMU_PACKED l1_ofs_rt_ofs_cls;
 
+    /*
+     * The refcount structures are rebuilt below, so the clusters in the
+     * reservation pool must not be handed out afterwards
+     */
+    ret = qcow2_release_reserved_clusters(bs);
+    if (ret < 0) {
+        goto fail;
+    }
+
     ret = qcow2_cache_empty(bs, s->l2_table_cache);
     if (ret < 0) {
         goto fail;
@@ -4889,6 +5314,8 @@ static int GRAPH_RDLOCK make_completely_empty(BlockDriverState *bs)
         goto fail_broken_refcounts;
     }
     memset(s->l1_table, 0, l1_size2);
+    qcow2_mapping_changed(s);
+    qcow2_decompressed_cache_clear(s);
 
     BLKDBG_EVENT(bs->file, BLKDBG_EMPTY_IMAGE_PREPARE);
 
@@ -5231,6 +5658,23 @@ qcow2_co_get_info(BlockDriverState *bs, BlockDriverInfo *bdi)
     return 0;
 }
 
+static BlockStatsSpecific *qcow2_get_specific_stats(BlockDriverState *bs)
+{
+    BDRVQcow2State *s = bs->opaque;
+    BlockStatsSpecific *stats = g_new0(BlockStatsSpecific, 1);
+
+    stats->driver = BLOCKDEV_DRIVER_QCOW2;
+    stats->u.qcow2.l2_cache = qcow2_cache_get_stats(s->l2_table_cache);
+    stats->u.qcow2.refcount_cache =
+        qcow2_cache_get_stats(s->refcount_block_cache);
+    stats->u.qcow2.fast_path_hits = stat64_get(&s->fast_path_hits);
+    stats->u.qcow2.decompressed_cache_hits = stat64_get(&s->decompressed_hits);
+    stats->u.qcow2.decompressed_cache_misses =
+        stat64_get(&s->decompressed_misses);
+
+    return stats;
+}
+
 static ImageInfoSpecific * GRAPH_RDLOCK
 qcow2_get_specific_info(BlockDriverState *bs, Error **errp)
 {
@@ -6160,6 +6604,7 @@ BlockDriver bdrv_qcow2 = {
     .bdrv_measure                       = qcow2_measure,
     .bdrv_co_get_info                   = qcow2_co_get_info,
     .bdrv_get_specific_info             = qcow2_get_specific_info,
+    .bdrv_get_specific_stats            = qcow2_get_specific_stats,
 
     .bdrv_co_save_vmstate               = qcow2_co_save_vmstate,
     .bdrv_co_load_vmstate               = qcow2_co_load_vmstate,
@@ -27,6 +27,8 @@
 
 #include "crypto/block.h"
 #include "qemu/coroutine.h"
+#include "qemu/rcu.h"
+#include "qemu/stats64.h"
 #include "qemu/units.h"
 #include "block/block_int.h"
 
@@ -126,6 +128,12 @@
 #define DEFAULT_CACHE_CLEAN_INTERVAL 0
 #endif
 
+/* Largest extent that alloc-extent-size can reserve at once */
+#define QCOW2_MAX_ALLOC_EXTENT_SIZE (1 * GiB)
+
+#define DEFAULT_DECOMPRESSED_CACHE_SIZE (1 * MiB)
+#define QCOW2_MAX_DECOMPRESSED_CACHE_SIZE (1 * GiB)
+
 #define DEFAULT_CLUSTER_SIZE 65536
 
 #define QCOW2_OPT_DATA_FILE "data-file"
@@ -150,6 +158,9 @@
 #define QCOW2_OPT_L2_CACHE_ENTRY_SIZE "l2-cache-entry-size"
 #define QCOW2_OPT_REFCOUNT_CACHE_SIZE "refcount-cache-size"
 #define QCOW2_OPT_CACHE_CLEAN_INTERVAL "cache-clean-interval"
+#define QCOW2_OPT_ALLOC_EXTENT_SIZE "alloc-extent-size"
+#define QCOW2_OPT_L2_PREFETCH_SLICES "l2-prefetch-slices"
+#define QCOW2_OPT_DECOMPRESSED_CACHE_SIZE "decompressed-cache-size"
 
 typedef struct QCowHeader {
     uint32_t magic;
@@ -324,6 +335,32 @@ typedef struct Qcow2BitmapHeaderExt {
 
 #define QCOW2_MAX_THREADS 4
 
+/*
+ * Mapping of one allocated, uncompressed guest cluster to its host
+ * cluster, used to serve requests without taking s->lock.  Entries are
+ * immutable and freed with RCU.
+ */
+typedef struct Qcow2FastPathEntry {
+    struct rcu_head rcu;
+    uint64_t guest_cluster;     /* Guest offset >> cluster_bits */
+    uint64_t host_offset;       /* Host offset of the cluster */
+    unsigned long gen;          /* Value of mapping_gen when recorded */
+    bool writable;              /* QCOW_OFLAG_COPIED was set */
+} Qcow2FastPathEntry;
+
+#define QCOW2_FAST_PATH_SLOTS 16384
+
+/* Maximum number of clusters recorded by one qcow2_fast_path_put() */
+#define QCOW2_FAST_PATH_MAX_RUN 64
+
+/* A compressed cluster in decompressed form */
+typedef struct Qcow2DecompressedCluster {
+    uint64_t l2_entry;          /* Compressed cluster descriptor, 0 if unused */
+    bool loading;               /* Still being read, @data is not valid yet */
+    uint8_t *data;              /* cluster_size bytes, allocated on first use */
+    QTAILQ_ENTRY(Qcow2DecompressedCluster) next_lru; /* Only if !loading */
+} Qcow2DecompressedCluster;
+
 typedef struct BDRVQcow2State {
     int cluster_bits;
     int cluster_size;
@@ -422,6 +459,47 @@ typedef struct BDRVQcow2State {
      * is to convert the image with the desired compression type set.
      */
     Qcow2CompressionType compression_type;
+
+    /*
+     * Lock-free lookups of allocated clusters, see qcow2_fast_path_get().
+     * Changing the L2 entries of some clusters drops only their entries,
+     * see qcow2_fast_path_invalidate().  Changes that can affect any
+     * cluster (L1 entries, snapshots, repairs) increment mapping_gen
+     * instead, which invalidates all entries at once.
+     */
+    Qcow2FastPathEntry **fast_path;
+    unsigned long mapping_gen;
+    Stat64 fast_path_hits;
+
+    /*
+     * Data clusters whose refcount is already 1, but that are not referenced
+     * by any L2 entry yet, see qcow2_alloc_reserved_clusters()
+     */
+    uint64_t alloc_extent_size;
+    uint64_t reserved_offset;
+    uint64_t reserved_clusters;
+
+    /* Sequential read detection for L2 prefetching, see qcow2_l2_prefetch() */
+    unsigned l2_prefetch_slices;
+    QemuSpin l2_prefetch_spin; /* Protects the fields below */
+    uint64_t seq_read_end;
+    unsigned seq_reads;
+    uint64_t l2_prefetch_end;
+    bool l2_prefetch_busy;
+
+    /*
+     * Recently read compressed clusters, so that small reads from the same
+     * cluster do not decompress it again, see qcow2_co_preadv_compressed()
+     */
+    QemuMutex decompressed_lock; /* Protects the fields below */
+    CoQueue decompressed_queue;  /* Requests waiting for a loading cluster */
+    Qcow2DecompressedCluster *decompressed;
+    unsigned nb_decompressed;
+    GHashTable *decompressed_index; /* l2_entry -> Qcow2DecompressedCluster */
+    /* Slots that are not being loaded, least recently used first */
+    QTAILQ_HEAD(, Qcow2DecompressedCluster) decompressed_lru;
+    Stat64 decompressed_hits;
+    Stat64 decompressed_misses;
 } BDRVQcow2State;
 
 typedef struct Qcow2COWRegion {
@@ -626,6 +704,16 @@ static inline uint64_t get_l2_bitmap(BDRVQcow2State *s, uint64_t *l2_slice,
     }
 }
 
+/*
+ * Invalidate all lock-free cluster lookups.  Must be called with s->lock
+ * held before changing the mapping or writability of clusters that are not
+ * known individually; use qcow2_fast_path_invalidate() for known clusters.
+ */
+static inline void qcow2_mapping_changed(BDRVQcow2State *s)
+{
+    qatomic_inc(&s->mapping_gen);
+}
+
 static inline void set_l2_entry(BDRVQcow2State *s, uint64_t *l2_slice,
                                 int idx, uint64_t entry)
 {
@@ -848,6 +936,9 @@ int qcow2_validate_table(BlockDriverState *bs, uint64_t offset,
                          int64_t max_size_bytes, const char *table_name,
                          Error **errp);
 
+void qcow2_decompressed_cache_discard(BlockDriverState *bs,
+                                      uint64_t cluster_offset);
+
 /* qcow2-refcount.c functions */
 int coroutine_fn GRAPH_RDLOCK qcow2_refcount_init(BlockDriverState *bs);
 void qcow2_refcount_close(BlockDriverState *bs);
@@ -874,6 +965,10 @@ qcow2_alloc_clusters_at(BlockDriverState *bs, uint64_t offset,
                         int64_t nb_clusters);
 
 int64_t coroutine_fn GRAPH_RDLOCK qcow2_alloc_bytes(BlockDriverState *bs, int size);
+int coroutine_fn GRAPH_RDLOCK
+qcow2_alloc_reserved_clusters(BlockDriverState *bs, uint64_t *host_offset,
+                              uint64_t *nb_clusters);
+int GRAPH_RDLOCK qcow2_release_reserved_clusters(BlockDriverState *bs);
 void GRAPH_RDLOCK qcow2_free_clusters(BlockDriverState *bs,
                                       int64_t offset, int64_t size,
                                       enum qcow2_discard_type type);
@@ -927,6 +1022,20 @@ int GRAPH_RDLOCK qcow2_write_l1_entry(BlockDriverState *bs, int l1_index);
 int qcow2_encrypt_sectors(BDRVQcow2State *s, int64_t sector_num,
                           uint8_t *buf, int nb_sectors, bool enc, Error **errp);
 
+void qcow2_fast_path_init(BDRVQcow2State *s);
+void qcow2_fast_path_free(BDRVQcow2State *s);
+bool qcow2_fast_path_get(BDRVQcow2State *s, uint64_t offset,
+                         unsigned int *bytes, bool write,
+                         uint64_t *host_offset);
+void qcow2_fast_path_invalidate(BDRVQcow2State *s, uint64_t offset,
+                                uint64_t nb_clusters);
+void GRAPH_RDLOCK
+qcow2_fast_path_put(BlockDriverState *bs, uint64_t offset, uint64_t bytes,
+                    uint64_t host_offset, bool writable);
+
+int coroutine_fn GRAPH_RDLOCK
+qcow2_prefetch_l2_slice(BlockDriverState *bs, uint64_t offset);
+
 int GRAPH_RDLOCK
 qcow2_get_host_offset(BlockDriverState *bs, uint64_t offset,
                       unsigned int *bytes, uint64_t *host_offset,
@@ -1018,9 +1127,13 @@ int GRAPH_RDLOCK
 qcow2_cache_get_empty(BlockDriverState *bs, Qcow2Cache *c, uint64_t offset,
                       void **table);
 
+int GRAPH_RDLOCK
+qcow2_cache_prefetch(BlockDriverState *bs, Qcow2Cache *c, uint64_t offset);
+
 void qcow2_cache_put(Qcow2Cache *c, void **table);
 void *qcow2_cache_is_table_offset(Qcow2Cache *c, uint64_t offset);
 void qcow2_cache_discard(Qcow2Cache *c, void *table);
+Qcow2CacheStats *qcow2_cache_get_stats(Qcow2Cache *c);
 
 /* qcow2-bitmap.c functions */
 int coroutine_fn GRAPH_RDLOCK
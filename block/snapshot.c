@@ -256,6 +256,7 @@ int bdrv_snapshot_goto(BlockDriverState *bs,
 
     if (drv->bdrv_snapshot_goto) {
         ret = drv->bdrv_snapshot_goto(bs, snapshot_id);
+        bdrv_extent_cache_clear(bs);
         if (ret < 0) {
             error_setg_errno(errp, -ret, "Failed to load snapshot");
         }
@@ -299,6 +300,7 @@ int bdrv_snapshot_goto(BlockDriverState *bs,
         ret = bdrv_snapshot_goto(fallback_bs, snapshot_id, errp);
         open_ret = drv->bdrv_open(bs, options, bs->open_flags, &local_err);
         qobject_unref(options);
+        bdrv_extent_cache_clear(bs);
         if (open_ret < 0) {
             bdrv_unref(fallback_bs);
             bs->drv = NULL;
@@ -380,6 +382,7 @@ int bdrv_snapshot_delete(BlockDriverState *bs,
                    drv->format_name, bdrv_get_device_name(bs));
         ret = -ENOTSUP;
     }
+    bdrv_extent_cache_clear(bs);
 
     bdrv_drained_end(bs);
     return ret;
@@ -28,8 +28,13 @@ enum {
      * that populating contiguous regions of the image is efficient.
      */
     STREAM_CHUNK = 512 * 1024, /* in bytes */
+
+    /* Copy-on-read requests in flight per worker IOThread */
+    STREAM_WORKER_IN_FLIGHT = 4,
 };
 
+typedef struct StreamOp StreamOp;
+
 typedef struct StreamBlockJob {
     BlockJob common;
     BlockBackend *blk;
@@ -40,8 +45,27 @@ typedef struct StreamBlockJob {
     BlockdevOnError on_error;
     char *backing_file_str;
     bool bs_read_only;
+
+    /*
+     * With worker IOThreads, chunks are copied by StreamOps in parallel.
+     * Only accessed in the AioContext of the job.
+     */
+    unsigned in_flight;
+    unsigned max_in_flight;
+    CoQueue in_flight_queue;
+    /* Operations that failed, to be handled by the job coroutine */
+    QSIMPLEQ_HEAD(, StreamOp) failed_ops;
 } StreamBlockJob;
 
+struct StreamOp {
+    StreamBlockJob *s;
+    int64_t offset;
+    int64_t bytes;
+    /* Error of the last attempt, or 0 if it should be retried */
+    int ret;
+    QSIMPLEQ_ENTRY(StreamOp) next;
+};
+
 static int coroutine_fn stream_populate(BlockBackend *blk,
                                         int64_t offset, uint64_t bytes)
 {
@@ -146,6 +170,175 @@ static void stream_clean(Job *job)
     g_free(s->backing_file_str);
 }
 
+/*
+ * Find out whether the chunk at @offset needs to be copied into the top
+ * image.  Set *n to the number of bytes for which the answer is the same.
+ */
+static int coroutine_fn stream_check_chunk(StreamBlockJob *s,
+                                           BlockDriverState *unfiltered_bs,
+                                           int64_t offset, int64_t len,
+                                           int64_t *n, bool *copy)
+{
+    int ret;
+
+    *copy = false;
+
+    WITH_GRAPH_RDLOCK_GUARD() {
+        ret = bdrv_co_is_allocated(unfiltered_bs, offset, STREAM_CHUNK, n);
+        if (ret == 1) {
+            /* Allocated in the top, no need to copy.  */
+        } else if (ret >= 0) {
+            /*
+             * Copy if allocated in the intermediate images.  Limit to the
+             * known-unallocated area [offset, offset+n*BDRV_SECTOR_SIZE).
+             */
+            ret = bdrv_co_is_allocated_above(bdrv_cow_bs(unfiltered_bs),
+                                             s->base_overlay, true,
+                                             offset, *n, n);
+            /* Finish early if end of backing file has been reached */
+            if (ret == 0 && *n == 0) {
+                *n = len - offset;
+            }
+
+            *copy = (ret > 0);
+        }
+    }
+    trace_stream_one_iteration(s, offset, *n, ret);
+    return ret;
+}
+
+/* Copy one chunk in a worker IOThread */
+static void coroutine_fn stream_co_populate(void *opaque)
+{
+    StreamOp *op = opaque;
+    StreamBlockJob *s = op->s;
+    AioContext *job_ctx = qemu_get_current_aio_context();
+
+    aio_co_reschedule_self(block_job_next_worker_ctx(&s->common));
+    op->ret = stream_populate(s->blk, op->offset, op->bytes);
+    aio_co_reschedule_self(job_ctx);
+
+    if (op->ret < 0) {
+        QSIMPLEQ_INSERT_TAIL(&s->failed_ops, op, next);
+    } else {
+        job_progress_update(&s->common.job, op->bytes);
+        g_free(op);
+    }
+
+    s->in_flight--;
+    qemu_co_queue_next(&s->in_flight_queue);
+}
+
+static void coroutine_fn stream_start_op(StreamOp *op)
+{
+    op->s->in_flight++;
+    qemu_coroutine_enter(qemu_coroutine_create(stream_co_populate, op));
+}
+
+/*
+ * Like the loop in stream_run(), but hand the chunks that need to be copied
+ * to worker IOThreads and go on with the next chunk while they are copied.
+ * Failed chunks are passed back to the job coroutine, so that errors are
+ * handled the same way as without workers.
+ */
+static int coroutine_fn stream_run_workers(StreamBlockJob *s,
+                                           BlockDriverState *unfiltered_bs,
+                                           int64_t len)
+{
+    StreamOp *op;
+    int64_t offset = 0;
+    int error = 0;
+
+    while (offset < len || s->in_flight || !QSIMPLEQ_EMPTY(&s->failed_ops)) {
+        int64_t n = 0;
+        bool copy;
+        int ret;
+
+        block_job_ratelimit_sleep(&s->common);
+        if (job_is_cancelled(&s->common.job)) {
+            break;
+        }
+
+        op = QSIMPLEQ_FIRST(&s->failed_ops);
+        if (op && op->ret < 0) {
+            BlockErrorAction action =
+                block_job_error_action(&s->common, s->on_error, true, -op->ret);
+            if (action == BLOCK_ERROR_ACTION_STOP) {
+                /* Retry once the job has been resumed */
+                op->ret = 0;
+                continue;
+            }
+            QSIMPLEQ_REMOVE_HEAD(&s->failed_ops, next);
+            if (error == 0) {
+                error = op->ret;
+            }
+            if (action == BLOCK_ERROR_ACTION_REPORT) {
+                g_free(op);
+                break;
+            }
+            job_progress_update(&s->common.job, op->bytes);
+            g_free(op);
+            continue;
+        }
+
+        if (s->in_flight >= s->max_in_flight) {
+            qemu_co_queue_wait(&s->in_flight_queue, NULL);
+            continue;
+        }
+
+        if (op) {
+            QSIMPLEQ_REMOVE_HEAD(&s->failed_ops, next);
+            stream_start_op(op);
+            continue;
+        }
+
+        if (offset >= len) {
+            qemu_co_queue_wait(&s->in_flight_queue, NULL);
+            continue;
+        }
+
+        ret = stream_check_chunk(s, unfiltered_bs, offset, len, &n, &copy);
+        if (ret < 0) {
+            BlockErrorAction action =
+                block_job_error_action(&s->common, s->on_error, true, -ret);
+            if (action == BLOCK_ERROR_ACTION_STOP) {
+                continue;
+            }
+            if (error == 0) {
+                error = ret;
+            }
+            if (action == BLOCK_ERROR_ACTION_REPORT) {
+                break;
+            }
+        }
+
+        if (copy) {
+            op = g_new(StreamOp, 1);
+            *op = (StreamOp) {
+                .s      = s,
+                .offset = offset,
+                .bytes  = n,
+            };
+            stream_start_op(op);
+            block_job_ratelimit_processed_bytes(&s->common, n);
+        } else {
+            job_progress_update(&s->common.job, n);
+        }
+        offset += n;
+    }
+
+    /* After an error or cancellation, wait for the chunks still in flight */
+    while (s->in_flight) {
+        qemu_co_queue_wait(&s->in_flight_queue, NULL);
+    }
+    while ((op = QSIMPLEQ_FIRST(&s->failed_ops))) {
+        QSIMPLEQ_REMOVE_HEAD(&s->failed_ops, next);
+        g_free(op);
+    }
+
+    return error;
+}
+
 static int coroutine_fn stream_run(Job *job, Error **errp)
 {
     StreamBlockJob *s = container_of(job, StreamBlockJob, common.job);
@@ -169,6 +362,10 @@ static int coroutine_fn stream_run(Job *job, Error **errp)
     }
     job_progress_set_remaining(&s->common.job, len);
 
+    if (s->common.nb_workers) {
+        return stream_run_workers(s, unfiltered_bs, len);
+    }
+
     for ( ; offset < len; offset += n) {
         bool copy;
         int ret;
@@ -181,29 +378,7 @@ static int coroutine_fn stream_run(Job *job, Error **errp)
             break;
         }
 
-        copy = false;
-
-        WITH_GRAPH_RDLOCK_GUARD() {
-            ret = bdrv_co_is_allocated(unfiltered_bs, offset, STREAM_CHUNK, &n);
-            if (ret == 1) {
-                /* Allocated in the top, no need to copy.  */
-            } else if (ret >= 0) {
-                /*
-                 * Copy if allocated in the intermediate images.  Limit to the
-                 * known-unallocated area [offset, offset+n*BDRV_SECTOR_SIZE).
-                 */
-                ret = bdrv_co_is_allocated_above(bdrv_cow_bs(unfiltered_bs),
-                                                 s->base_overlay, true,
-                                                 offset, n, &n);
-                /* Finish early if end of backing file has been reached */
-                if (ret == 0 && n == 0) {
-                    n = len - offset;
-                }
-
-                copy = (ret > 0);
-            }
-        }
-        trace_stream_one_iteration(s, offset, n, ret);
+        ret = stream_check_chunk(s, unfiltered_bs, offset, len, &n, &copy);
         if (copy) {
             ret = stream_populate(s->blk, offset, n);
         }
@@ -251,6 +426,7 @@ void stream_start(const char *job_id, BlockDriverState *bs,
                   int creation_flags, int64_t speed,
                   BlockdevOnError on_error,
                   const char *filter_node_name,
+                  strList *worker_iothreads,
                   Error **errp)
 {
     StreamBlockJob *s = NULL;
@@ -349,6 +525,13 @@ void stream_start(const char *job_id, BlockDriverState *bs,
         goto fail;
     }
 
+    if (!block_job_set_worker_iothreads(&s->common, worker_iothreads, errp)) {
+        goto fail;
+    }
+    s->max_in_flight = STREAM_WORKER_IN_FLIGHT * s->common.nb_workers;
+    qemu_co_queue_init(&s->in_flight_queue);
+    QSIMPLEQ_INIT(&s->failed_ops);
+
     s->blk = blk_new_with_bs(cor_filter_bs, BLK_PERM_CONSISTENT_READ,
                              basic_flags | BLK_PERM_WRITE, errp);
     if (!s->blk) {
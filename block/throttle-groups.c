@@ -62,6 +62,16 @@ static void timer_cb(ThrottleGroupMember *tgm, ThrottleDirection direction);
  * blk_set_aio_context()). Therefore in this file a thread will
  * access some other ThrottleGroupMember's timers only after verifying that
  * that ThrottleGroupMember has throttled requests in the queue.
+ *
+ * With many members in one group, taking the lock for every request
+ * makes the members contend for it even if none of them is throttled.
+ * So when a request goes through without waiting, its member also
+ * reserves a small batch of operations and bytes from the group's
+ * buckets (see throttle_group_reserve()).  Its next requests consume the
+ * reservation with atomic operations and only take the lock when it is
+ * used up.  Reservations are only made while nobody in the group waits,
+ * and never exceed a millisecond's worth of the limits, so the round
+ * robin order stays fair.
  */
 struct ThrottleGroup {
     Object parent_obj;
@@ -77,6 +87,12 @@ struct ThrottleGroup {
     bool any_timer_armed[THROTTLE_MAX];
     QEMUClockType clock_type;
 
+    /* Size of the reservations, 0 if they are disabled.  Written under the
+     * lock and read with atomic operations.  batch_bytes is 0 if there is
+     * no bps limit for the direction. */
+    int batch_ops[THROTTLE_MAX];
+    int batch_bytes[THROTTLE_MAX];
+
     /* This field is protected by the global QEMU mutex */
     QTAILQ_ENTRY(ThrottleGroup) list;
 };
@@ -85,6 +101,11 @@ struct ThrottleGroup {
 static QTAILQ_HEAD(, ThrottleGroup) throttle_groups =
     QTAILQ_HEAD_INITIALIZER(throttle_groups);
 
+/* Reservations last for at most 1/THROTTLE_GROUP_BATCH_PER_SEC seconds of
+ * the limits, and for at most THROTTLE_GROUP_BATCH_MAX_OPS requests */
+#define THROTTLE_GROUP_BATCH_PER_SEC 1000
+#define THROTTLE_GROUP_BATCH_MAX_OPS 32
+
 
 /* This function reads throttle_groups and must be called under the global
  * mutex.
@@ -350,6 +371,158 @@ static void coroutine_mixed_fn schedule_next_request(ThrottleGroupMember *tgm,
     }
 }
 
+/* Compute the size of the reservations from the group's configuration and
+ * drop all reservations that were made with the old one.
+ *
+ * This assumes that tg->lock is held.
+ *
+ * @tg: the ThrottleGroup
+ */
+static void throttle_group_update_batch(ThrottleGroup *tg)
+{
+    static const BucketType bucket_types_size[THROTTLE_MAX][2] = {
+        { THROTTLE_BPS_TOTAL, THROTTLE_BPS_READ },
+        { THROTTLE_BPS_TOTAL, THROTTLE_BPS_WRITE }
+    };
+    static const BucketType bucket_types_units[THROTTLE_MAX][2] = {
+        { THROTTLE_OPS_TOTAL, THROTTLE_OPS_READ },
+        { THROTTLE_OPS_TOTAL, THROTTLE_OPS_WRITE }
+    };
+    ThrottleConfig *cfg = &tg->ts.cfg;
+    ThrottleGroupMember *tgm;
+    ThrottleDirection dir;
+    unsigned i;
+
+    for (dir = THROTTLE_READ; dir < THROTTLE_MAX; dir++) {
+        uint64_t ops = THROTTLE_GROUP_BATCH_MAX_OPS;
+        uint64_t bytes = INT_MAX;
+        bool limit_bytes = false;
+
+        for (i = 0; i < ARRAY_SIZE(bucket_types_size[dir]); i++) {
+            LeakyBucket *bkt = &cfg->buckets[bucket_types_units[dir][i]];
+            if (bkt->avg) {
+                ops = MIN(ops, bkt->avg / THROTTLE_GROUP_BATCH_PER_SEC);
+            }
+
+            bkt = &cfg->buckets[bucket_types_size[dir][i]];
+            if (bkt->avg) {
+                bytes = MIN(bytes, bkt->avg / THROTTLE_GROUP_BATCH_PER_SEC);
+                limit_bytes = true;
+            }
+        }
+
+        /* Limits that are too low to reserve a whole request ahead do not
+         * need the fast path.  With iops-size, a request may count as
+         * several operations, so leave the accounting to the lock. */
+        if (!throttle_enabled(cfg) || cfg->op_size || !bytes) {
+            ops = 0;
+        }
+
+        qatomic_set(&tg->batch_ops[dir], ops);
+        qatomic_set(&tg->batch_bytes[dir], ops && limit_bytes ? bytes : 0);
+    }
+
+    QLIST_FOREACH(tgm, &tg->head, round_robin) {
+        for (dir = THROTTLE_READ; dir < THROTTLE_MAX; dir++) {
+            qatomic_set(&tgm->credit_ops[dir], 0);
+            qatomic_set(&tgm->credit_bytes[dir], 0);
+        }
+    }
+}
+
+/* Reserve operations and bytes from the group for the next requests of a
+ * ThrottleGroupMember, so that they can go through without taking the lock.
+ * The reservation is accounted right away, as if the requests were made
+ * now.  Nothing is reserved if other members are waiting, or if requests
+ * of this size would not fit in the reservation anyway.
+ *
+ * This assumes that tg->lock is held.
+ *
+ * @tgm:       the current ThrottleGroupMember
+ * @bytes:     the size of the current request
+ * @direction: the ThrottleDirection
+ */
+static void throttle_group_reserve(ThrottleGroupMember *tgm, int64_t bytes,
+                                   ThrottleDirection direction)
+{
+    ThrottleGroup *tg = container_of(tgm->throttle_state, ThrottleGroup, ts);
+    int batch_ops = tg->batch_ops[direction];
+    int batch_bytes = tg->batch_bytes[direction];
+    int ops, nbytes = 0;
+
+    if (!batch_ops || tg->any_timer_armed[direction] ||
+        qatomic_read(&tgm->io_limits_disabled) ||
+        (batch_bytes && bytes > batch_bytes)) {
+        return;
+    }
+
+    /* Only top up, so that a member never holds more than one batch. The
+     * credits can only shrink concurrently, which keeps this bound. */
+    ops = MAX(batch_ops - qatomic_read(&tgm->credit_ops[direction]), 0);
+    if (batch_bytes) {
+        nbytes = MAX(batch_bytes -
+                     qatomic_read(&tgm->credit_bytes[direction]), 0);
+    }
+    if (!ops && !nbytes) {
+        return;
+    }
+
+    throttle_account_batch(&tg->ts, direction, nbytes, ops);
+    qatomic_add(&tgm->credit_ops[direction], ops);
+    qatomic_add(&tgm->credit_bytes[direction], nbytes);
+}
+
+/* Atomically take @n from @credit if it holds at least that much.
+ *
+ * @credit: the credit to take from
+ * @n:      the amount to take
+ * @ret:    whether the amount could be taken
+ */
+static bool throttle_group_take_credit(int *credit, int n)
+{
+    int old, cur = qatomic_read(credit);
+
+    do {
+        if (cur < n) {
+            return false;
+        }
+        old = cur;
+        cur = qatomic_cmpxchg(credit, old, old - n);
+    } while (cur != old);
+
+    return true;
+}
+
+/* Let an I/O request go through on the reservation of its
+ * ThrottleGroupMember, without taking the group lock.
+ *
+ * @tgm:       the current ThrottleGroupMember
+ * @bytes:     the number of bytes for this I/O
+ * @direction: the ThrottleDirection
+ * @ret:       whether the reservation covered the request
+ */
+static bool throttle_group_use_credit(ThrottleGroupMember *tgm, int64_t bytes,
+                                      ThrottleDirection direction)
+{
+    ThrottleGroup *tg = container_of(tgm->throttle_state, ThrottleGroup, ts);
+
+    /* Throttled requests of this member go first */
+    if (qatomic_read(&tgm->pending_reqs[direction]) || bytes > INT_MAX) {
+        return false;
+    }
+
+    if (!throttle_group_take_credit(&tgm->credit_ops[direction], 1)) {
+        return false;
+    }
+    if (qatomic_read(&tg->batch_bytes[direction]) &&
+        !throttle_group_take_credit(&tgm->credit_bytes[direction], bytes)) {
+        qatomic_inc(&tgm->credit_ops[direction]);
+        return false;
+    }
+
+    return true;
+}
+
 /* Check if an I/O request needs to be throttled, wait and set a timer
  * if necessary, and schedule the next request using a round robin
  * algorithm.
@@ -369,6 +542,10 @@ void coroutine_fn throttle_group_co_io_limits_intercept(ThrottleGroupMember *tgm
     assert(bytes >= 0);
     assert(direction < THROTTLE_MAX);
 
+    if (throttle_group_use_credit(tgm, bytes, direction)) {
+        return;
+    }
+
     qemu_mutex_lock(&tg->lock);
 
     /* First we check if this I/O has to be throttled. */
@@ -377,18 +554,19 @@ void coroutine_fn throttle_group_co_io_limits_intercept(ThrottleGroupMember *tgm
 
     /* Wait if there's a timer set or queued requests of this type */
     if (must_wait || tgm->pending_reqs[direction]) {
-        tgm->pending_reqs[direction]++;
+        qatomic_inc(&tgm->pending_reqs[direction]);
         qemu_mutex_unlock(&tg->lock);
         qemu_co_mutex_lock(&tgm->throttled_reqs_lock);
         qemu_co_queue_wait(&tgm->throttled_reqs[direction],
                            &tgm->throttled_reqs_lock);
         qemu_co_mutex_unlock(&tgm->throttled_reqs_lock);
         qemu_mutex_lock(&tg->lock);
-        tgm->pending_reqs[direction]--;
+        qatomic_dec(&tgm->pending_reqs[direction]);
     }
 
     /* The I/O will be executed, so do the accounting */
     throttle_account(tgm->throttle_state, direction, bytes);
+    throttle_group_reserve(tgm, bytes, direction);
 
     /* Schedule the next request */
     schedule_next_request(tgm, direction);
@@ -478,6 +656,7 @@ void throttle_group_config(ThrottleGroupMember *tgm, ThrottleConfig *cfg)
     ThrottleGroup *tg = container_of(ts, ThrottleGroup, ts);
     qemu_mutex_lock(&tg->lock);
     throttle_config(ts, tg->clock_type, cfg);
+    throttle_group_update_batch(tg);
     qemu_mutex_unlock(&tg->lock);
 
     throttle_group_restart_tgm(tgm);
@@ -559,6 +738,8 @@ void throttle_group_register_tgm(ThrottleGroupMember *tgm,
             tg->tokens[dir] = tgm;
         }
         qemu_co_queue_init(&tgm->throttled_reqs[dir]);
+        qatomic_set(&tgm->credit_ops[dir], 0);
+        qatomic_set(&tgm->credit_bytes[dir], 0);
     }
 
     QLIST_INSERT_HEAD(&tg->head, tgm, round_robin);
@@ -792,6 +973,7 @@ static void throttle_group_obj_complete(UserCreatable *obj, Error **errp)
         return;
     }
     throttle_config(&tg->ts, tg->clock_type, &cfg);
+    throttle_group_update_batch(tg);
     QTAILQ_INSERT_TAIL(&throttle_groups, tg, list);
     tg->is_initialized = true;
 }
@@ -903,6 +1085,7 @@ static void throttle_group_set_limits(Object *obj, Visitor *v,
         goto unlock;
     }
     throttle_config(&tg->ts, tg->clock_type, &cfg);
+    throttle_group_update_batch(tg);
 
 unlock:
     qemu_mutex_unlock(&tg->lock);
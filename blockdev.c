@@ -2282,6 +2282,7 @@ void qmp_block_stream(const char *job_id, const char *device,
                       bool has_speed, int64_t speed,
                       bool has_on_error, BlockdevOnError on_error,
                       const char *filter_node_name,
+                      strList *worker_iothreads,
                       bool has_auto_finalize, bool auto_finalize,
                       bool has_auto_dismiss, bool auto_dismiss,
                       Error **errp)
@@ -2401,7 +2402,7 @@ void qmp_block_stream(const char *job_id, const char *device,
 
     stream_start(job_id, bs, base_bs, backing_file,
                  bottom_bs, job_flags, has_speed ? speed : 0, on_error,
-                 filter_node_name, &local_err);
+                 filter_node_name, worker_iothreads, &local_err);
     if (local_err) {
         error_propagate(errp, local_err);
         return;
@@ -2640,6 +2641,13 @@ static BlockJob *do_backup_common(BackupCommon *backup,
         if (backup->x_perf->has_max_chunk) {
             perf.max_chunk = backup->x_perf->max_chunk;
         }
+        if (backup->x_perf->has_adaptive) {
+            perf.adaptive = backup->x_perf->adaptive;
+            if (!backup->x_perf->has_use_copy_range) {
+                /* Offloading is tried first, it falls back by itself */
+                perf.use_copy_range = perf.adaptive;
+            }
+        }
     }
 
     if ((backup->sync == MIRROR_SYNC_MODE_BITMAP) ||
@@ -2775,6 +2783,7 @@ static void blockdev_mirror_common(const char *job_id, BlockDriverState *bs,
                                    bool has_unmap, bool unmap,
                                    const char *filter_node_name,
                                    bool has_copy_mode, MirrorCopyMode copy_mode,
+                                   strList *worker_iothreads,
                                    bool has_auto_finalize, bool auto_finalize,
                                    bool has_auto_dismiss, bool auto_dismiss,
                                    Error **errp)
@@ -2879,7 +2888,7 @@ static void blockdev_mirror_common(const char *job_id, BlockDriverState *bs,
                  replaces, job_flags,
                  speed, granularity, buf_size, sync, backing_mode, zero_target,
                  on_source_error, on_target_error, unmap, filter_node_name,
-                 copy_mode, errp);
+                 copy_mode, worker_iothreads, errp);
 }
 
 void qmp_drive_mirror(DriveMirror *arg, Error **errp)
@@ -3030,6 +3039,7 @@ void qmp_drive_mirror(DriveMirror *arg, Error **errp)
                            arg->has_unmap, arg->unmap,
                            NULL,
                            arg->has_copy_mode, arg->copy_mode,
+                           arg->worker_iothreads,
                            arg->has_auto_finalize, arg->auto_finalize,
                            arg->has_auto_dismiss, arg->auto_dismiss,
                            errp);
@@ -3049,6 +3059,7 @@ void qmp_blockdev_mirror(const char *job_id,
                          BlockdevOnError on_target_error,
                          const char *filter_node_name,
                          bool has_copy_mode, MirrorCopyMode copy_mode,
+                         strList *worker_iothreads,
                          bool has_auto_finalize, bool auto_finalize,
                          bool has_auto_dismiss, bool auto_dismiss,
                          Error **errp)
@@ -3087,7 +3098,7 @@ void qmp_blockdev_mirror(const char *job_id,
                            has_on_source_error, on_source_error,
                            has_on_target_error, on_target_error,
                            true, true, filter_node_name,
-                           has_copy_mode, copy_mode,
+                           has_copy_mode, copy_mode, worker_iothreads,
                            has_auto_finalize, auto_finalize,
                            has_auto_dismiss, auto_dismiss,
                            errp);
@@ -35,6 +35,7 @@
 #include "qapi/qmp/qerror.h"
 #include "qemu/main-loop.h"
 #include "qemu/timer.h"
+#include "sysemu/iothread.h"
 
 static bool is_block_job(Job *job)
 {
@@ -74,6 +75,49 @@ BlockJob *block_job_get(const char *id)
     return block_job_get_locked(id);
 }
 
+static void block_job_put_worker_iothreads(BlockJob *job)
+{
+    int i;
+
+    for (i = 0; i < job->nb_workers; i++) {
+        object_unref(job->worker_iothreads[i]);
+    }
+    g_free(job->worker_iothreads);
+    g_free(job->worker_ctxs);
+    job->worker_iothreads = NULL;
+    job->worker_ctxs = NULL;
+    job->nb_workers = 0;
+}
+
+bool block_job_set_worker_iothreads(BlockJob *job, strList *iothreads,
+                                    Error **errp)
+{
+    strList *e;
+    int n = 0;
+
+    GLOBAL_STATE_CODE();
+    assert(!job->nb_workers);
+
+    for (e = iothreads; e; e = e->next) {
+        if (!iothread_by_id(e->value)) {
+            error_setg(errp, "IOThread '%s' not found", e->value);
+            return false;
+        }
+        n++;
+    }
+
+    job->worker_iothreads = g_new(Object *, n);
+    job->worker_ctxs = g_new(AioContext *, n);
+    for (e = iothreads; e; e = e->next) {
+        IOThread *iothread = iothread_by_id(e->value);
+
+        job->worker_iothreads[job->nb_workers] = object_ref(OBJECT(iothread));
+        job->worker_ctxs[job->nb_workers] = iothread_get_aio_context(iothread);
+        job->nb_workers++;
+    }
+    return true;
+}
+
 void block_job_free(Job *job)
 {
     BlockJob *bjob = container_of(job, BlockJob, job);
@@ -82,6 +126,7 @@ void block_job_free(Job *job)
     block_job_remove_all_bdrv(bjob);
     ratelimit_destroy(&bjob->limit);
     error_free(bjob->blocker);
+    block_job_put_worker_iothreads(bjob);
 }
 
 static char *child_job_get_parent_desc(BdrvChild *c)
@@ -356,6 +401,19 @@ void block_job_ratelimit_sleep(BlockJob *job)
     } while (delay_ns && !job_is_cancelled(&job->job));
 }
 
+AioContext *block_job_next_worker_ctx(BlockJob *job)
+{
+    AioContext *ctx;
+
+    if (!job->nb_workers) {
+        return NULL;
+    }
+
+    ctx = job->worker_ctxs[job->next_worker];
+    job->next_worker = (job->next_worker + 1) % job->nb_workers;
+    return ctx;
+}
+
 BlockJobInfo *block_job_query_locked(BlockJob *job, Error **errp)
 {
     BlockJobInfo *info;
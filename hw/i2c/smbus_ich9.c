@@ -50,6 +50,11 @@ static const VMStateDescription vmstate_ich9_smbus = {
     .name = "ich9_smb",
     .version_id = 1,
     .minimum_version_id = 1,
+    /*
+     * The SMBus registers only change on vCPU accesses.  Loading the
+     * PCI config space updates BAR mappings, so it needs the BQL.
+     */
+    .threadsafe_save = true,
     .fields = (VMStateField[]) {
         VMSTATE_PCI_DEVICE(dev, ICH9SMBState),
         VMSTATE_BOOL_TEST(irq_enabled, ICH9SMBState, ich9_vmstate_need_smbus),
@@ -54,6 +54,9 @@ static const VMStateDescription vmstate_port92_isa = {
     .name = "port92",
     .version_id = 1,
     .minimum_version_id = 1,
+    /* A plain register that only vCPU accesses and reset look at */
+    .threadsafe_save = true,
+    .threadsafe_load = true,
     .fields = (VMStateField[]) {
         VMSTATE_UINT8(outport, Port92State),
         VMSTATE_END_OF_LIST()
@@ -680,6 +680,11 @@ static const VMStateDescription vmstate_fw_cfg = {
     .name = "fw_cfg",
     .version_id = 2,
     .minimum_version_id = 1,
+    /*
+     * Saving only reads the selector state and the ACPI blob sizes.
+     * Loading may resize the ACPI blob RAM regions, which needs the BQL.
+     */
+    .threadsafe_save = true,
     .fields = (VMStateField[]) {
         VMSTATE_UINT16(cur_entry, FWCfgState),
         VMSTATE_UINT16_HACK(cur_offset, FWCfgState, is_version_1),
@@ -519,6 +519,11 @@ static const VMStateDescription vmstate_mch = {
     .name = "mch",
     .version_id = 1,
     .minimum_version_id = 1,
+    /*
+     * Saving copies the config space as is, but mch_post_load() remaps
+     * PAM and SMRAM regions, so loading needs the BQL.
+     */
+    .threadsafe_save = true,
     .post_load = mch_post_load,
     .fields = (VMStateField[]) {
         VMSTATE_PCI_DEVICE(parent_obj, MCHPCIState),
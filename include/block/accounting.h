@@ -79,8 +79,7 @@ typedef struct BlockLatencyHistogram {
     uint64_t *bins;
 } BlockLatencyHistogram;
 
-struct BlockAcctStats {
-    QemuMutex lock;
+typedef struct BlockAcctCounters {
     uint64_t nr_bytes[BLOCK_MAX_IOTYPE];
     uint64_t nr_ops[BLOCK_MAX_IOTYPE];
     uint64_t invalid_ops[BLOCK_MAX_IOTYPE];
@@ -88,10 +87,34 @@ struct BlockAcctStats {
     uint64_t total_time_ns[BLOCK_MAX_IOTYPE];
     uint64_t merged[BLOCK_MAX_IOTYPE];
     int64_t last_access_time_ns;
+} BlockAcctCounters;
+
+/*
+ * Requests are accounted in the shard of the thread that completes them, so
+ * that threads completing requests for the same BlockBackend do not fight
+ * over the same lock and cache lines.  Each shard is only locked by the
+ * threads that map to it and by readers that sum up all shards.
+ */
+#define BLOCK_ACCT_SHARDS 8
+#define BLOCK_ACCT_SHARD_ALIGN 64
+
+typedef struct BlockAcctShard {
+    QemuSpin lock;
+    BlockAcctCounters counters;
+    BlockLatencyHistogram latency_histogram[BLOCK_MAX_IOTYPE];
+} QEMU_ALIGNED(BLOCK_ACCT_SHARD_ALIGN) BlockAcctShard;
+
+struct BlockAcctStats {
+    /*
+     * BLOCK_ACCT_SHARDS entries.  Allocated separately, because the
+     * structures that embed BlockAcctStats are not allocated with the
+     * alignment of BlockAcctShard.
+     */
+    BlockAcctShard *shards;
+    QemuMutex lock; /* protects the latencies in @intervals */
     QSLIST_HEAD(, BlockAcctTimedStats) intervals;
     bool account_invalid;
     bool account_failed;
-    BlockLatencyHistogram latency_histogram[BLOCK_MAX_IOTYPE];
 };
 
 typedef struct BlockAcctCookie {
@@ -114,11 +137,15 @@ void block_acct_failed(BlockAcctStats *stats, BlockAcctCookie *cookie);
 void block_acct_invalid(BlockAcctStats *stats, enum BlockAcctType type);
 void block_acct_merge_done(BlockAcctStats *stats, enum BlockAcctType type,
                            int num_requests);
+void block_acct_get_counters(BlockAcctStats *stats,
+                             BlockAcctCounters *counters);
 int64_t block_acct_idle_time_ns(BlockAcctStats *stats);
 double block_acct_queue_depth(BlockAcctTimedStats *stats,
                               enum BlockAcctType type);
 int block_latency_histogram_set(BlockAcctStats *stats, enum BlockAcctType type,
                                 uint64List *boundaries);
+bool block_latency_histogram_get(BlockAcctStats *stats, enum BlockAcctType type,
+                                 BlockLatencyHistogram *hist);
 void block_latency_histograms_clear(BlockAcctStats *stats);
 
 #endif
@@ -233,6 +233,13 @@ struct AioContext {
     int64_t poll_grow;      /* polling time growth factor */
     int64_t poll_shrink;    /* polling time shrink factor */
 
+    /*
+     * Number of event sources that only make progress when their ->io_poll()
+     * handler runs, see aio_context_busy_poll_begin().  Only accessed from
+     * the AioContext's home thread.
+     */
+    int busy_poll_cnt;
+
     /* AIO engine parameters */
     int64_t aio_max_batch;  /* maximum number of requests in a batch */
 
@@ -661,6 +668,16 @@ AioContext *qemu_get_current_aio_context(void);
 
 void qemu_set_current_aio_context(AioContext *ctx);
 
+/**
+ * in_aio_context_event_loop:
+ * @ctx: the aio context
+ *
+ * Return whether the current thread runs the event loop of @ctx.  Unlike
+ * qemu_get_current_aio_context(), this is false for threads that only hold
+ * the "big QEMU lock", such as vCPU threads.
+ */
+bool in_aio_context_event_loop(AioContext *ctx);
+
 /**
  * aio_context_setup:
  * @ctx: the aio context
@@ -693,6 +710,29 @@ void aio_context_set_poll_params(AioContext *ctx, int64_t max_ns,
                                  int64_t grow, int64_t shrink,
                                  Error **errp);
 
+/**
+ * aio_context_busy_poll_begin:
+ * @ctx: the aio context
+ *
+ * Start busy polling @ctx on behalf of an event source whose ->io_poll()
+ * handler has to run for it to make progress, for example an io_uring ring
+ * set up with IORING_SETUP_IOPOLL that has requests in flight.  Until the
+ * matching aio_context_busy_poll_end(), aio_poll() runs all ->io_poll()
+ * handlers on every iteration and never blocks.  Adaptive polling still
+ * applies on top, up to poll-max-ns per iteration.
+ *
+ * Must be called from the AioContext's home thread.
+ */
+void aio_context_busy_poll_begin(AioContext *ctx);
+
+/**
+ * aio_context_busy_poll_end:
+ * @ctx: the aio context
+ *
+ * Stop busy polling @ctx, see aio_context_busy_poll_begin().
+ */
+void aio_context_busy_poll_end(AioContext *ctx);
+
 /**
  * aio_context_set_aio_params:
  * @ctx: the aio context
@@ -56,10 +56,16 @@ int coroutine_fn block_copy(BlockCopyState *s, int64_t offset, int64_t bytes,
  * must be > 0.
  *
  * @max_chunk means maximum length for one IO operation. Zero means unlimited.
+ *
+ * If @adaptive is true, the number of parallel coroutines and the length of
+ * the IO operations start lower and are tuned while the copy runs, from the
+ * throughput and the latency of the completed operations.  @max_workers and
+ * @max_chunk are the upper bounds then.
  */
 BlockCopyCallState *block_copy_async(BlockCopyState *s,
                                      int64_t offset, int64_t bytes,
                                      int max_workers, int64_t max_chunk,
+                                     bool adaptive,
                                      BlockCopyAsyncCallbackFunc cb,
                                      void *cb_opaque);
 
@@ -98,4 +104,12 @@ BdrvDirtyBitmap *block_copy_dirty_bitmap(BlockCopyState *s);
 int64_t block_copy_cluster_size(BlockCopyState *s);
 void block_copy_set_skip_unallocated(BlockCopyState *s, bool skip);
 
+/*
+ * Report the IO operation length and the number of parallel coroutines that
+ * the last block_copy_async() call currently uses, and whether it copies
+ * with copy_range.
+ */
+void block_copy_get_tuning(BlockCopyState *s, int64_t *chunk_size,
+                           int *workers, bool *copy_offload);
+
 #endif /* BLOCK_COPY_H */
@@ -28,6 +28,7 @@
 #include "block/block-common.h"
 #include "block/block-global-state.h"
 #include "block/snapshot.h"
+#include "qemu/interval-tree.h"
 #include "qemu/iov.h"
 #include "qemu/rcu.h"
 #include "qemu/stats64.h"
@@ -1067,6 +1068,30 @@ typedef struct BdrvBlockStatusCache {
     int64_t data_end;
 } BdrvBlockStatusCache;
 
+/**
+ * Cache of the block status that the driver of a node with backing file
+ * support reported, so that walking a backing chain does not query the
+ * metadata of every layer again.  Unlike BdrvBlockStatusCache, the result
+ * may be anything, so writes to the node must invalidate it.
+ *
+ * @lock: Protects all fields
+ * @extents: Cached results that don't overlap, keyed by offset
+ * @nb_extents: Number of nodes in @extents
+ * @gen: Incremented on invalidation.  Results that were determined while it
+ *       changed may be stale and are not added.
+ * @hits: Number of queries answered from the cache
+ * @misses: Number of queries that had to ask the driver
+ */
+typedef struct BdrvExtentCache {
+    QemuMutex lock;
+    IntervalTreeRoot extents;
+    unsigned nb_extents;
+    int granularity; /* Cluster size, 0 until the first result is added */
+    uint64_t gen;
+    uint64_t hits;
+    uint64_t misses;
+} BdrvExtentCache;
+
 struct BlockDriverState {
     /*
      * Protected by big QEMU lock or read-only after opening.  No special
@@ -1253,6 +1278,8 @@ struct BlockDriverState {
     /* Always non-NULL, but must only be dereferenced under an RCU read guard */
     BdrvBlockStatusCache *block_status_cache;
 
+    BdrvExtentCache extent_cache;
+
     /* array of write pointers' location of each zone in the zoned device. */
     BlockZoneWps *wps;
 };
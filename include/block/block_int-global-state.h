@@ -53,6 +53,8 @@
  * @filter_node_name: The node name that should be assigned to the filter
  *                    driver that the stream job inserts into the graph above
  *                    @bs. NULL means that a node name should be autogenerated.
+ * @worker_iothreads: IOThreads in which copy-on-read requests are made, in
+ *                    addition to the AioContext of @bs.
  * @errp: Error object.
  *
  * Start a streaming operation on @bs.  Clusters that are unallocated
@@ -68,6 +70,7 @@ void stream_start(const char *job_id, BlockDriverState *bs,
                   int creation_flags, int64_t speed,
                   BlockdevOnError on_error,
                   const char *filter_node_name,
+                  strList *worker_iothreads,
                   Error **errp);
 
 /**
@@ -141,6 +144,8 @@ BlockJob *commit_active_start(const char *job_id, BlockDriverState *bs,
  * driver that the mirror job inserts into the graph above @bs. NULL means that
  * a node name should be autogenerated.
  * @copy_mode: When to trigger writes to the target.
+ * @worker_iothreads: IOThreads in which data is copied, in addition to the
+ *                    AioContext of @bs.
  * @errp: Error object.
  *
  * Start a mirroring operation on @bs.  Clusters that are allocated
@@ -157,7 +162,8 @@ void mirror_start(const char *job_id, BlockDriverState *bs,
                   BlockdevOnError on_source_error,
                   BlockdevOnError on_target_error,
                   bool unmap, const char *filter_node_name,
-                  MirrorCopyMode copy_mode, Error **errp);
+                  MirrorCopyMode copy_mode, strList *worker_iothreads,
+                  Error **errp);
 
 /*
  * backup_job_create:
@@ -191,4 +191,62 @@ void bdrv_bsc_invalidate_range(BlockDriverState *bs,
  */
 void bdrv_bsc_fill(BlockDriverState *bs, int64_t offset, int64_t bytes);
 
+/**
+ * Whether the driver block status of @bs is kept in the extent cache.
+ */
+bool bdrv_extent_cache_enabled(BlockDriverState *bs);
+
+/**
+ * Look up the cached driver block status at @offset.  Results that were
+ * determined without @want_zero are only returned if @want_zero is false.
+ *
+ * On a hit, return the status and set *pnum, *map and *file like the
+ * driver's .bdrv_co_block_status() would.  Return -ENOENT on a miss.
+ */
+int bdrv_extent_cache_lookup(BlockDriverState *bs, bool want_zero,
+                             int64_t offset, int64_t *pnum, int64_t *map,
+                             BlockDriverState **file);
+
+/**
+ * Return the generation to pass to bdrv_extent_cache_fill() for a result
+ * that the driver is about to determine.
+ */
+uint64_t bdrv_extent_cache_gen(BlockDriverState *bs);
+
+/**
+ * Set the granularity in which writes can change the metadata of @bs,
+ * usually its cluster size.  Must be called before the first
+ * bdrv_extent_cache_fill().
+ */
+void bdrv_extent_cache_set_granularity(BlockDriverState *bs, int granularity);
+
+/**
+ * Add a driver block status result for [offset, offset + bytes) to the
+ * cache, unless the cache was invalidated since @gen was taken.
+ */
+void bdrv_extent_cache_fill(BlockDriverState *bs, uint64_t gen,
+                            bool want_zero, int64_t offset, int64_t bytes,
+                            int status, int64_t map, BlockDriverState *file);
+
+/**
+ * Drop cached results for [offset, offset + bytes), extended to whole
+ * clusters.  A write may reallocate the whole cluster, e.g. for copy on
+ * write.  To be used when the node was written to, after the driver
+ * completed the write.
+ */
+void bdrv_extent_cache_invalidate(BlockDriverState *bs,
+                                  int64_t offset, int64_t bytes);
+
+/**
+ * Drop all cached results, e.g. after the image was truncated or its
+ * metadata changed in another way than by a write request.
+ */
+void bdrv_extent_cache_clear(BlockDriverState *bs);
+
+/**
+ * Return the hit and miss counters of the extent cache of @bs, or NULL if
+ * @bs does not use the cache.
+ */
+BlockStatusCacheStats *bdrv_extent_cache_query_stats(BlockDriverState *bs);
+
 #endif /* BLOCK_INT_IO_H */
@@ -92,6 +92,21 @@ typedef struct BlockJob {
      * Always modified and read under QEMU global mutex (GLOBAL_STATE_CODE).
      */
     GSList *nodes;
+
+    /**
+     * IOThreads in whose AioContexts the job may run its I/O requests, and
+     * their AioContexts.  Set before the job is started and never modified
+     * afterwards.
+     */
+    Object **worker_iothreads;
+    AioContext **worker_ctxs;
+    int nb_workers;
+
+    /**
+     * Index of the worker to use for the next request.  Only accessed in
+     * the AioContext of the job.
+     */
+    int next_worker;
 } BlockJob;
 
 /*
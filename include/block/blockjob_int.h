@@ -124,6 +124,21 @@ block_job_create(const char *job_id, const BlockJobDriver *driver,
  */
 void block_job_free(Job *job);
 
+/**
+ * block_job_set_worker_iothreads:
+ * @job: The job to configure.
+ * @iothreads: IDs of the IOThreads, or %NULL for none.
+ * @errp: Error object.
+ *
+ * Let @job run its I/O requests in the AioContexts of @iothreads in addition
+ * to its own, see block_job_next_worker_ctx().  The IOThreads are kept alive
+ * until the job is freed.  Must be called before the job is started.
+ *
+ * Return false and set @errp if one of the IOThreads does not exist.
+ */
+bool block_job_set_worker_iothreads(BlockJob *job, strList *iothreads,
+                                    Error **errp);
+
 /**
  * block_job_user_resume:
  * Callback to be used for JobDriver.user_resume in all block jobs. Resets the
@@ -152,6 +167,19 @@ void block_job_ratelimit_processed_bytes(BlockJob *job, uint64_t n);
  */
 void block_job_ratelimit_sleep(BlockJob *job);
 
+/**
+ * block_job_next_worker_ctx:
+ * @job: The job that is about to submit a request.
+ *
+ * Return the AioContext that the next request of @job should be submitted
+ * in, going round robin over the worker IOThreads, or %NULL if the job has
+ * none.  A coroutine of the job can move there with aio_co_reschedule_self()
+ * and must move back before it touches any state of the job.
+ *
+ * Must be called in the AioContext of the job.
+ */
+AioContext *block_job_next_worker_ctx(BlockJob *job);
+
 /**
  * block_job_error_action:
  * @job: The job to signal an error for.
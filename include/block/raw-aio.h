@@ -69,9 +69,54 @@ typedef struct LuringState LuringState;
 LuringState *luring_init(Error **errp);
 void luring_cleanup(LuringState *s);
 
+/* luring_init_private() flags */
+#define LURING_SQPOLL           0x1
+#define LURING_COOP_TASKRUN     0x2
+#define LURING_SINGLE_ISSUER    0x4
+#define LURING_IOPOLL           0x8
+
+/*
+ * luring_init_private: create a ring for a single file, which is registered
+ * with the ring.  With LURING_SINGLE_ISSUER, only the calling thread may submit
+ * requests to the ring or register buffers with it.  LURING_IOPOLL rings only
+ * accept reads and writes on O_DIRECT files, and make the AioContext busy poll
+ * while they have requests in flight.
+ */
+LuringState *luring_init_private(int fd, unsigned int flags, Error **errp);
+
+/*
+ * luring_retire: free a ring from luring_init_private() in its AioContext,
+ * once the requests that were already submitted to it have completed.
+ */
+void luring_retire(LuringState *s);
+
+/*
+ * luring_register_buffers: replace the buffers registered with @s.  Requests
+ * with a single iovec inside one of them use it as a fixed buffer.  Returns
+ * -EBUSY while requests that use the old buffers are queued or in flight;
+ * new requests don't use the old buffers anymore then, so try again later.
+ */
+int luring_register_buffers(LuringState *s, const struct iovec *iov,
+                            unsigned int nr);
+
 /* luring_co_submit: submit I/O requests in the thread's current AioContext. */
 int coroutine_fn luring_co_submit(BlockDriverState *bs, int fd, uint64_t offset,
                                   QEMUIOVector *qiov, int type);
+
+/* luring_co_submit_private: submit I/O requests for the file registered in @s */
+int coroutine_fn luring_co_submit_private(LuringState *s, BlockDriverState *bs,
+                                          uint64_t offset, QEMUIOVector *qiov,
+                                          int type);
+
+/*
+ * luring_co_fallocate: fallocate() @len bytes at @offset with @mode, for
+ * QEMU_AIO_DISCARD or QEMU_AIO_WRITE_ZEROES requests.  Uses the file that is
+ * registered in @s, or @fd and the ring of the current AioContext if @s is
+ * NULL.
+ */
+int coroutine_fn luring_co_fallocate(LuringState *s, BlockDriverState *bs,
+                                     int fd, int type, int mode,
+                                     uint64_t offset, uint64_t len);
 void luring_detach_aio_context(LuringState *s, AioContext *old_context);
 void luring_attach_aio_context(LuringState *s, AioContext *new_context);
 #endif
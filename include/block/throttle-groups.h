@@ -49,6 +49,13 @@ typedef struct ThrottleGroupMember {
      */
     unsigned int restart_pending;
 
+    /* Operations and bytes that were reserved from the group in advance
+     * and can be used without taking the ThrottleGroup lock.  Accessed
+     * with atomic operations.
+     */
+    int credit_ops[THROTTLE_MAX];
+    int credit_bytes[THROTTLE_MAX];
+
     /* The following fields are protected by the ThrottleGroup lock.
      * See the ThrottleGroup documentation for details.
      * throttle_state tells us if I/O limits are configured. */
@@ -826,6 +826,7 @@ struct MemoryRegion {
     unsigned ioeventfd_nb;
     MemoryRegionIoeventfd *ioeventfds;
     RamDiscardManager *rdm; /* Only for RAM */
+    unsigned update_gen; /* Last transaction that changed the rendering */
 
     /* For devices designed to perform re-entrant IO into their own IO MRs */
     bool disable_reentrancy_guard;
@@ -1139,6 +1140,8 @@ struct FlatView {
     unsigned nr_allocated;
     struct AddressSpaceDispatch *dispatch;
     MemoryRegion *root;
+    /* Memory transaction that rendered the view, reported by qtest */
+    unsigned gen;
 };
 
 static inline FlatView *address_space_to_flatview(AddressSpace *as)
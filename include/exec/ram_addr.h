@@ -149,6 +149,58 @@ static inline void qemu_ram_block_writeback(RAMBlock *block)
 #define DIRTY_CLIENTS_ALL     ((1 << DIRTY_MEMORY_NUM) - 1)
 #define DIRTY_CLIENTS_NOCODE  (DIRTY_CLIENTS_ALL & ~(1 << DIRTY_MEMORY_CODE))
 
+#define DIRTY_MEMORY_CHUNK_LONGS (DIRTY_MEMORY_CHUNK_SIZE / BITS_PER_LONG)
+
+/* Summary bitmap of a dirty memory block, see DIRTY_MEMORY_CHUNK_SIZE */
+static inline unsigned long *dirty_memory_block_summary(unsigned long *block)
+{
+    return block + BITS_TO_LONGS(DIRTY_MEMORY_BLOCK_SIZE);
+}
+
+/*
+ * Flag the chunks covering @num pages at @offset of dirty memory block
+ * @block as possibly dirty.  Must be called after the page bits have been
+ * set with an atomic operation.
+ */
+static inline void dirty_memory_block_mark_chunks(unsigned long *block,
+                                                  unsigned long offset,
+                                                  unsigned long num)
+{
+    unsigned long *summary = dirty_memory_block_summary(block);
+    unsigned long chunk = offset >> DIRTY_MEMORY_CHUNK_BITS;
+    unsigned long last = (offset + num - 1) >> DIRTY_MEMORY_CHUNK_BITS;
+
+    /*
+     * Order the page bits before reading the summary.  Pairs with the
+     * barrier in dirty_memory_block_clear_chunk(): either the harvester
+     * sees our page bits, or we see the cleared summary bit and set it
+     * again.
+     */
+    smp_mb__after_rmw();
+    for (; chunk <= last; chunk++) {
+        if (!test_bit(chunk, summary)) {
+            set_bit_atomic(chunk, summary);
+        }
+    }
+}
+
+/*
+ * Clear the summary bit of @chunk before harvesting its page bits.
+ * Returns false if the chunk is known to be clean.
+ */
+static inline bool dirty_memory_block_clear_chunk(unsigned long *block,
+                                                  unsigned long chunk)
+{
+    unsigned long *summary = dirty_memory_block_summary(block);
+
+    if (!test_bit(chunk, summary)) {
+        return false;
+    }
+    qatomic_and(&summary[BIT_WORD(chunk)], ~BIT_MASK(chunk));
+    smp_mb__after_rmw();
+    return true;
+}
+
 static inline bool cpu_physical_memory_get_dirty(ram_addr_t start,
                                                  ram_addr_t length,
                                                  unsigned client)
@@ -172,11 +224,20 @@ static inline bool cpu_physical_memory_get_dirty(ram_addr_t start,
         while (page < end) {
             unsigned long next = MIN(end, base + DIRTY_MEMORY_BLOCK_SIZE);
             unsigned long num = next - base;
-            unsigned long found = find_next_bit(blocks->blocks[idx],
-                                                num, offset);
-            if (found < num) {
-                dirty = true;
-                break;
+            unsigned long first_chunk = offset >> DIRTY_MEMORY_CHUNK_BITS;
+            unsigned long last_chunk = (num - 1) >> DIRTY_MEMORY_CHUNK_BITS;
+            unsigned long found;
+
+            /* Only look at the pages if some chunk may be dirty */
+            found = find_next_bit(dirty_memory_block_summary(
+                                      blocks->blocks[idx]),
+                                  last_chunk + 1, first_chunk);
+            if (found <= last_chunk) {
+                found = find_next_bit(blocks->blocks[idx], num, offset);
+                if (found < num) {
+                    dirty = true;
+                    break;
+                }
             }
 
             page = next;
@@ -281,6 +342,7 @@ static inline void cpu_physical_memory_set_dirty_flag(ram_addr_t addr,
     blocks = qatomic_rcu_read(&ram_list.dirty_memory[client]);
 
     set_bit_atomic(offset, blocks->blocks[idx]);
+    dirty_memory_block_mark_chunks(blocks->blocks[idx], offset, 1);
 }
 
 static inline void cpu_physical_memory_set_dirty_range(ram_addr_t start,
@@ -313,14 +375,23 @@ static inline void cpu_physical_memory_set_dirty_range(ram_addr_t start,
             if (likely(mask & (1 << DIRTY_MEMORY_MIGRATION))) {
                 bitmap_set_atomic(blocks[DIRTY_MEMORY_MIGRATION]->blocks[idx],
                                   offset, next - page);
+                dirty_memory_block_mark_chunks(
+                    blocks[DIRTY_MEMORY_MIGRATION]->blocks[idx],
+                    offset, next - page);
             }
             if (unlikely(mask & (1 << DIRTY_MEMORY_VGA))) {
                 bitmap_set_atomic(blocks[DIRTY_MEMORY_VGA]->blocks[idx],
                                   offset, next - page);
+                dirty_memory_block_mark_chunks(
+                    blocks[DIRTY_MEMORY_VGA]->blocks[idx],
+                    offset, next - page);
             }
             if (unlikely(mask & (1 << DIRTY_MEMORY_CODE))) {
                 bitmap_set_atomic(blocks[DIRTY_MEMORY_CODE]->blocks[idx],
                                   offset, next - page);
+                dirty_memory_block_mark_chunks(
+                    blocks[DIRTY_MEMORY_CODE]->blocks[idx],
+                    offset, next - page);
             }
 
             page = next;
@@ -380,11 +451,17 @@ uint64_t cpu_physical_memory_set_dirty_lebitmap(unsigned long *bitmap,
 
                     nbits = ctpopl(temp);
                     qatomic_or(&blocks[DIRTY_MEMORY_VGA][idx][offset], temp);
+                    dirty_memory_block_mark_chunks(
+                        blocks[DIRTY_MEMORY_VGA][idx],
+                        offset * BITS_PER_LONG, BITS_PER_LONG);
 
                     if (global_dirty_tracking) {
                         qatomic_or(
                                 &blocks[DIRTY_MEMORY_MIGRATION][idx][offset],
                                 temp);
+                        dirty_memory_block_mark_chunks(
+                            blocks[DIRTY_MEMORY_MIGRATION][idx],
+                            offset * BITS_PER_LONG, BITS_PER_LONG);
                         if (unlikely(
                             global_dirty_tracking & GLOBAL_DIRTY_DIRTY_RATE)) {
                             total_dirty_pages += nbits;
@@ -396,6 +473,9 @@ uint64_t cpu_physical_memory_set_dirty_lebitmap(unsigned long *bitmap,
                     if (tcg_enabled()) {
                         qatomic_or(&blocks[DIRTY_MEMORY_CODE][idx][offset],
                                    temp);
+                        dirty_memory_block_mark_chunks(
+                            blocks[DIRTY_MEMORY_CODE][idx],
+                            offset * BITS_PER_LONG, BITS_PER_LONG);
                     }
                 }
 
@@ -489,17 +569,39 @@ uint64_t cpu_physical_memory_sync_dirty_bitmap(RAMBlock *rb,
         src = qatomic_rcu_read(
                 &ram_list.dirty_memory[DIRTY_MEMORY_MIGRATION])->blocks;
 
-        for (k = page; k < page + nr; k++) {
-            if (src[idx][offset]) {
-                unsigned long bits = qatomic_xchg(&src[idx][offset], 0);
-                unsigned long new_dirty;
-                new_dirty = ~dest[k];
-                dest[k] |= bits;
-                new_dirty &= bits;
-                num_dirty += ctpopl(new_dirty);
+        k = page;
+        while (k < page + nr) {
+            unsigned long chunk = offset / DIRTY_MEMORY_CHUNK_LONGS;
+            unsigned long next = MIN(page + nr,
+                                     k + DIRTY_MEMORY_CHUNK_LONGS -
+                                     offset % DIRTY_MEMORY_CHUNK_LONGS);
+
+            /*
+             * Skip chunks whose summary bit is clear without touching
+             * their words.  The summary bit can only be cleared if the
+             * whole chunk is harvested here, otherwise dirty pages outside
+             * of the range would become invisible.
+             */
+            if (next - k == DIRTY_MEMORY_CHUNK_LONGS ?
+                dirty_memory_block_clear_chunk(src[idx], chunk) :
+                test_bit(chunk, dirty_memory_block_summary(src[idx]))) {
+                for (; k < next; k++, offset++) {
+                    if (src[idx][offset]) {
+                        unsigned long bits = qatomic_xchg(&src[idx][offset],
+                                                          0);
+                        unsigned long new_dirty;
+                        new_dirty = ~dest[k];
+                        dest[k] |= bits;
+                        new_dirty &= bits;
+                        num_dirty += ctpopl(new_dirty);
+                    }
+                }
+            } else {
+                offset += next - k;
+                k = next;
             }
 
-            if (++offset >= BITS_TO_LONGS(DIRTY_MEMORY_BLOCK_SIZE)) {
+            if (offset >= BITS_TO_LONGS(DIRTY_MEMORY_BLOCK_SIZE)) {
                 offset = 0;
                 idx++;
             }
@@ -39,6 +39,20 @@ typedef struct RAMBlockNotifier RAMBlockNotifier;
  * pointed to from the new DirtyMemoryBlocks).
  */
 #define DIRTY_MEMORY_BLOCK_SIZE ((ram_addr_t)256 * 1024 * 8)
+
+/*
+ * Each block of the dirty memory bitmap is followed by a summary bitmap
+ * with one bit per chunk of DIRTY_MEMORY_CHUNK_SIZE pages (2 MiB of guest
+ * memory with 4 KiB target pages).  A summary bit is set after any page
+ * of its chunk is marked dirty, and is only cleared right before the pages
+ * of the chunk are harvested.  A clear summary bit thus means the whole
+ * chunk is clean and its bits need not be looked at; a set summary bit
+ * only means that the chunk may be dirty.
+ */
+#define DIRTY_MEMORY_CHUNK_BITS 9
+#define DIRTY_MEMORY_CHUNK_SIZE ((ram_addr_t)1 << DIRTY_MEMORY_CHUNK_BITS)
+#define DIRTY_MEMORY_BLOCK_CHUNKS \
+    (DIRTY_MEMORY_BLOCK_SIZE / DIRTY_MEMORY_CHUNK_SIZE)
 typedef struct {
     struct rcu_head rcu;
     unsigned long *blocks[];
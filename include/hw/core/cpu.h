@@ -448,6 +448,9 @@ struct qemu_work_item;
  *    ring is enabled.
  * @kvm_fetch_index: Keeps the index that we last fetched from the per-vCPU
  *    dirty ring structure.
+ * @kvm_dirty_ring_fill: Number of entries collected from the KVM dirty ring
+ *    the last time it was reaped.
+ * @kvm_dirty_ring_fill_peak: Largest value seen in @kvm_dirty_ring_fill.
  *
  * State of one CPU core or thread.
  *
@@ -526,6 +529,8 @@ struct CPUState {
     struct kvm_run *kvm_run;
     struct kvm_dirty_gfn *kvm_dirty_gfns;
     uint32_t kvm_fetch_index;
+    uint32_t kvm_dirty_ring_fill;
+    uint32_t kvm_dirty_ring_fill_peak;
     uint64_t dirty_pages;
     int kvm_vcpu_stats_fd;
 
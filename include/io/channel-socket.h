@@ -49,6 +49,8 @@ struct QIOChannelSocket {
     socklen_t remoteAddrLen;
     ssize_t zero_copy_queued;
     ssize_t zero_copy_sent;
+    bool zero_copy_copied;
+    bool zero_copy_avoided;
 };
 
 
@@ -262,4 +264,38 @@ qio_channel_socket_accept(QIOChannelSocket *ioc,
                           Error **errp);
 
 
+/**
+ * qio_channel_socket_enable_zero_copy:
+ * @ioc: the socket channel object
+ *
+ * Enable SO_ZEROCOPY on a connected socket, so that it can be written
+ * with QIO_CHANNEL_WRITE_FLAG_ZERO_COPY.  Sockets created by
+ * qio_channel_socket_connect_sync() have it enabled already; accepted
+ * sockets only have it enabled if their user calls this.
+ *
+ * Returns: true if zero copy is available for the socket
+ */
+bool qio_channel_socket_enable_zero_copy(QIOChannelSocket *ioc);
+
+
+/**
+ * qio_channel_socket_zero_copy_poll:
+ * @ioc: the socket channel object
+ * @copied: set to true if the kernel copied the data of all zero copy
+ *          writes anyway
+ * @errp: pointer to a NULL-initialized error object
+ *
+ * Process the completion notifications of zero copy writes that are
+ * available, without waiting for more of them like qio_channel_flush()
+ * does.  @copied is only set when all zero copy writes have completed,
+ * and covers the writes since the last time it was set or the channel
+ * was flushed.
+ *
+ * Returns: the number of zero copy writes that have not completed yet,
+ * or -1 on error
+ */
+int qio_channel_socket_zero_copy_poll(QIOChannelSocket *ioc, bool *copied,
+                                      Error **errp);
+
+
 #endif /* QIO_CHANNEL_SOCKET_H */
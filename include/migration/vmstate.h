@@ -198,6 +198,22 @@ struct VMStateDescription {
      * a QEMU_VM_SECTION_START section.
      */
     bool early_setup;
+    /*
+     * The hooks and fields of this VMSD (including subsections) may be
+     * saved from a worker thread, concurrently with other devices, while
+     * the VM is stopped and the migration thread holds the BQL.  Sections
+     * marked this way are serialized in parallel when the
+     * x-parallel-device-state migration capability is enabled.
+     */
+    bool threadsafe_save;
+    /*
+     * Likewise for loading: the fields may be loaded and post_load may run
+     * on a worker thread, without the BQL, concurrently with devices of
+     * the same priority.  Only set this for state that nothing else looks
+     * at while the incoming migration runs, and whose post_load does not
+     * touch memory regions, IRQs, timers or other devices.
+     */
+    bool threadsafe_load;
     int version_id;
     int minimum_version_id;
     MigrationPriority priority;
@@ -350,4 +350,13 @@ bool hbitmap_status(const HBitmap *hb, int64_t start, int64_t count,
  */
 int64_t hbitmap_iter_next(HBitmapIter *hbi);
 
+/**
+ * test_hbitmap_next_accel:
+ *
+ * Switch the bulk operations to the next accelerated implementation that
+ * the host supports.  Returns false once all of them have been used.  Only
+ * meant for testing.
+ */
+bool test_hbitmap_next_accel(void);
+
 #endif
@@ -24,6 +24,8 @@ typedef struct VuFdWatch {
     int fd; /*kick fd*/
     void *pvt;
     vu_watch_cb cb;
+    int queue; /* index of the virtqueue that is kicked, or -1 */
+    AioContext *ctx; /* AioContext in which the fd is monitored */
     QTAILQ_ENTRY(VuFdWatch) next;
 } VuFdWatch;
 
@@ -31,7 +33,8 @@ typedef struct VuFdWatch {
  * VuServer:
  * A vhost-user server instance with user-defined VuDevIface callbacks.
  * Vhost-user device backends can be implemented using VuServer. VuDevIface
- * callbacks and virtqueue kicks run in the given AioContext.
+ * callbacks and virtqueue kicks run in the given AioContext, unless the
+ * kicks of a virtqueue are mapped to another AioContext in queue_ctx.
  */
 typedef struct {
     QIONetListener *listener;
@@ -40,11 +43,25 @@ typedef struct {
     int max_queues;
     const VuDevIface *vu_iface;
 
+    /*
+     * AioContext of each virtqueue, or NULL to use ctx.  NULL if all
+     * virtqueues are processed in ctx.  Owned by the caller.
+     */
+    AioContext **queue_ctx;
+
     unsigned int in_flight; /* atomic */
+    bool wait_idle; /* atomic */
+    unsigned int pending_barriers; /* atomic */
+
+    /*
+     * Protects vu_fd_watches and queues_paused, which are also accessed
+     * from the AioContexts in queue_ctx.
+     */
+    QemuMutex watch_lock;
+    bool queues_paused;
 
     /* Protected by ctx lock */
     bool in_qio_channel_yield;
-    bool wait_idle;
     bool quiescing;
     VuDev vu_dev;
     QIOChannel *ioc; /* The I/O channel with the client */
@@ -58,6 +75,7 @@ bool vhost_user_server_start(VuServer *server,
                              SocketAddress *unix_socket,
                              AioContext *ctx,
                              uint16_t max_queues,
+                             AioContext **queue_ctx,
                              const VuDevIface *vu_iface,
                              Error **errp);
 
@@ -65,6 +65,12 @@ struct KVMDirtyRingReaper {
     QemuThread reaper_thr;
     volatile uint64_t reaper_iteration; /* iteration number of reaper thr */
     volatile enum KVMDirtyRingReaperState reaper_state; /* reap thr state */
+    /*
+     * vCPUs whose rings this reaper collects when there is more than one
+     * reaper.  Protected by @lock, which nests outside kvm_slots_lock().
+     */
+    QemuMutex lock;
+    GPtrArray *vcpus;
 };
 struct KVMState
 {
@@ -113,7 +119,8 @@ struct KVMState
     uint32_t kvm_dirty_ring_size;   /* Number of dirty GFNs per ring */
     bool kvm_dirty_ring_with_bitmap;
     uint64_t kvm_eager_split_size;  /* Eager Page Splitting chunk size */
-    struct KVMDirtyRingReaper reaper;
+    uint32_t kvm_dirty_ring_reapers; /* Number of reaper threads */
+    struct KVMDirtyRingReaper *reapers;
     NotifyVmexitOption notify_vmexit;
     uint32_t notify_window;
     uint32_t xen_version;
@@ -37,6 +37,11 @@
 
 #define SOCKET_MAX_FDS 16
 
+#ifdef QEMU_MSG_ZEROCOPY
+static int qio_channel_socket_reap_zero_copy(QIOChannelSocket *sioc,
+                                             bool block, Error **errp);
+#endif
+
 SocketAddress *
 qio_channel_socket_get_local_address(QIOChannelSocket *ioc,
                                      Error **errp)
@@ -65,6 +70,8 @@ qio_channel_socket_new(void)
     sioc->fd = -1;
     sioc->zero_copy_queued = 0;
     sioc->zero_copy_sent = 0;
+    sioc->zero_copy_copied = false;
+    sioc->zero_copy_avoided = false;
 
     ioc = QIO_CHANNEL(sioc);
     qio_channel_set_feature(ioc, QIO_CHANNEL_FEATURE_SHUTDOWN);
@@ -144,6 +151,20 @@ qio_channel_socket_new_fd(int fd,
     return ioc;
 }
 
+bool qio_channel_socket_enable_zero_copy(QIOChannelSocket *ioc)
+{
+#ifdef QEMU_MSG_ZEROCOPY
+    int ret, v = 1;
+    ret = setsockopt(ioc->fd, SOL_SOCKET, SO_ZEROCOPY, &v, sizeof(v));
+    if (ret == 0) {
+        /* Zero copy available on host */
+        qio_channel_set_feature(QIO_CHANNEL(ioc),
+                                QIO_CHANNEL_FEATURE_WRITE_ZERO_COPY);
+        return true;
+    }
+#endif
+    return false;
+}
 
 int qio_channel_socket_connect_sync(QIOChannelSocket *ioc,
                                     SocketAddress *addr,
@@ -164,15 +185,7 @@ int qio_channel_socket_connect_sync(QIOChannelSocket *ioc,
         return -1;
     }
 
-#ifdef QEMU_MSG_ZEROCOPY
-    int ret, v = 1;
-    ret = setsockopt(fd, SOL_SOCKET, SO_ZEROCOPY, &v, sizeof(v));
-    if (ret == 0) {
-        /* Zero copy available on host */
-        qio_channel_set_feature(QIO_CHANNEL(ioc),
-                                QIO_CHANNEL_FEATURE_WRITE_ZERO_COPY);
-    }
-#endif
+    qio_channel_socket_enable_zero_copy(ioc);
 
     qio_channel_set_feature(QIO_CHANNEL(ioc),
                             QIO_CHANNEL_FEATURE_READ_MSG_PEEK);
@@ -533,6 +546,16 @@ static ssize_t qio_channel_socket_readv(QIOChannel *ioc,
     ret = recvmsg(sioc->fd, &msg, sflags);
     if (ret < 0) {
         if (errno == EAGAIN) {
+#ifdef QEMU_MSG_ZEROCOPY
+            /*
+             * Pending zero copy notifications make the socket report
+             * G_IO_ERR, which also wakes up readers.  Consume them, or the
+             * reader would be woken up again right away.
+             */
+            if (sioc->zero_copy_queued != sioc->zero_copy_sent) {
+                qio_channel_socket_reap_zero_copy(sioc, false, NULL);
+            }
+#endif
             return QIO_CHANNEL_ERR_BLOCK;
         }
         if (errno == EINTR) {
@@ -607,6 +630,12 @@ static ssize_t qio_channel_socket_writev(QIOChannel *ioc,
     if (ret <= 0) {
         switch (errno) {
         case EAGAIN:
+#ifdef QEMU_MSG_ZEROCOPY
+            /* See qio_channel_socket_readv() */
+            if (sioc->zero_copy_queued != sioc->zero_copy_sent) {
+                qio_channel_socket_reap_zero_copy(sioc, false, NULL);
+            }
+#endif
             return QIO_CHANNEL_ERR_BLOCK;
         case EINTR:
             goto retry;
@@ -725,34 +754,36 @@ static ssize_t qio_channel_socket_writev(QIOChannel *ioc,
 
 
 #ifdef QEMU_MSG_ZEROCOPY
-static int qio_channel_socket_flush(QIOChannel *ioc,
-                                    Error **errp)
+/*
+ * Process the zero copy notifications in the error queue of @sioc until
+ * all queued sends have completed.  If @block is false, return as soon as
+ * the error queue is empty instead of waiting for more notifications.
+ *
+ * Returns 0 on success, -1 on error.
+ */
+static int qio_channel_socket_reap_zero_copy(QIOChannelSocket *sioc,
+                                             bool block, Error **errp)
 {
-    QIOChannelSocket *sioc = QIO_CHANNEL_SOCKET(ioc);
     struct msghdr msg = {};
     struct sock_extended_err *serr;
     struct cmsghdr *cm;
     char control[CMSG_SPACE(sizeof(*serr))];
     int received;
-    int ret;
-
-    if (sioc->zero_copy_queued == sioc->zero_copy_sent) {
-        return 0;
-    }
 
     msg.msg_control = control;
     msg.msg_controllen = sizeof(control);
     memset(control, 0, sizeof(control));
 
-    ret = 1;
-
     while (sioc->zero_copy_sent < sioc->zero_copy_queued) {
         received = recvmsg(sioc->fd, &msg, MSG_ERRQUEUE);
         if (received < 0) {
             switch (errno) {
             case EAGAIN:
+                if (!block) {
+                    return 0;
+                }
                 /* Nothing on errqueue, wait until something is available */
-                qio_channel_wait(ioc, G_IO_ERR);
+                qio_channel_wait(QIO_CHANNEL(sioc), G_IO_ERR);
                 continue;
             case EINTR:
                 continue;
@@ -791,17 +822,59 @@ static int qio_channel_socket_flush(QIOChannel *ioc,
         /* No errors, count successfully finished sendmsg()*/
         sioc->zero_copy_sent += serr->ee_data - serr->ee_info + 1;
 
-        /* If any sendmsg() succeeded using zero copy, return 0 at the end */
-        if (serr->ee_code != SO_EE_CODE_ZEROCOPY_COPIED) {
-            ret = 0;
+        /* Remember whether the kernel had to copy the data */
+        if (serr->ee_code == SO_EE_CODE_ZEROCOPY_COPIED) {
+            sioc->zero_copy_copied = true;
+        } else {
+            sioc->zero_copy_avoided = true;
         }
     }
 
+    return 0;
+}
+
+static int qio_channel_socket_flush(QIOChannel *ioc,
+                                    Error **errp)
+{
+    QIOChannelSocket *sioc = QIO_CHANNEL_SOCKET(ioc);
+    int ret;
+
+    if (qio_channel_socket_reap_zero_copy(sioc, true, errp) < 0) {
+        return -1;
+    }
+
+    /*
+     * Return 1 if all sendmsg() calls completed since the last flush had
+     * to copy the data, 0 if any of them succeeded using zero copy or if
+     * there were none.
+     */
+    ret = sioc->zero_copy_copied && !sioc->zero_copy_avoided;
+    sioc->zero_copy_copied = false;
+    sioc->zero_copy_avoided = false;
     return ret;
 }
 
 #endif /* QEMU_MSG_ZEROCOPY */
 
+int qio_channel_socket_zero_copy_poll(QIOChannelSocket *ioc, bool *copied,
+                                      Error **errp)
+{
+    *copied = false;
+#ifdef QEMU_MSG_ZEROCOPY
+    if (qio_channel_socket_reap_zero_copy(ioc, false, errp) < 0) {
+        return -1;
+    }
+    if (ioc->zero_copy_queued == ioc->zero_copy_sent) {
+        *copied = ioc->zero_copy_copied && !ioc->zero_copy_avoided;
+        ioc->zero_copy_copied = false;
+        ioc->zero_copy_avoided = false;
+    }
+    return ioc->zero_copy_queued - ioc->zero_copy_sent;
+#else
+    return 0;
+#endif
+}
+
 static int
 qio_channel_socket_set_blocking(QIOChannel *ioc,
                                 bool enabled,
@@ -1055,6 +1055,8 @@ static void populate_time_info(MigrationInfo *info, MigrationState *s)
     if (migrate_show_downtime(s)) {
         info->has_downtime = true;
         info->downtime = s->downtime;
+        info->x_device_downtime = QAPI_CLONE(MigrationDeviceDowntimeList,
+                                             s->device_downtime);
     } else {
         info->has_expected_downtime = true;
         info->expected_downtime = s->expected_downtime;
@@ -1582,6 +1584,9 @@ int migrate_init(MigrationState *s, Error **errp)
     s->pages_per_second = 0.0;
     s->downtime = 0;
     s->expected_downtime = 0;
+    qapi_free_MigrationDeviceDowntimeList(s->device_downtime);
+    s->device_downtime = NULL;
+    s->device_downtime_tail = &s->device_downtime;
     s->setup_time = 0;
     s->start_postcopy = false;
     s->postcopy_after_devices = false;
@@ -3670,6 +3675,7 @@ static void migration_instance_finalize(Object *obj)
     qemu_sem_destroy(&ms->rp_state.rp_sem);
     qemu_sem_destroy(&ms->rp_state.rp_pong_acks);
     qemu_sem_destroy(&ms->postcopy_qemufile_src_sem);
+    qapi_free_MigrationDeviceDowntimeList(ms->device_downtime);
     error_free(ms->error);
 }
 
@@ -3680,6 +3686,7 @@ static void migration_instance_init(Object *obj)
     ms->state = MIGRATION_STATUS_NONE;
     ms->mbps = -1;
     ms->pages_per_second = -1;
+    ms->device_downtime_tail = &ms->device_downtime;
     qemu_sem_init(&ms->pause_sem, 0);
     qemu_mutex_init(&ms->error_mutex);
 
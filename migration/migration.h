@@ -463,6 +463,10 @@ struct MigrationState {
     /* QEMU_VM_VMDESCRIPTION content filled for all non-iterable devices. */
     JSONWriter *vmdesc;
 
+    /* Time spent saving each section while the VM was stopped */
+    MigrationDeviceDowntimeList *device_downtime;
+    MigrationDeviceDowntimeList **device_downtime_tail;
+
     /*
      * Indicates whether an ACK from the destination that it's OK to do
      * switchover has been received.
@@ -51,6 +51,13 @@ struct QEMUFile {
 
     int last_error;
     Error *last_error_obj;
+
+    /*
+     * Staging files count flushed bytes here instead of in mig_stats,
+     * see qemu_file_new_output_staging().
+     */
+    bool staging;
+    uint64_t staging_transferred;
 };
 
 /*
@@ -124,6 +131,21 @@ QEMUFile *qemu_file_new_output(QIOChannel *ioc)
     return qemu_file_new_impl(ioc, true);
 }
 
+/*
+ * Like qemu_file_new_output(), but for files whose contents are later
+ * copied into the real migration stream (e.g. by a worker thread that
+ * serializes a device into a QIOChannelBuffer).  Bytes written to such
+ * a file are accounted in the file itself, so they are not counted twice
+ * and qemu_file_transferred() is not affected by concurrent writers.
+ */
+QEMUFile *qemu_file_new_output_staging(QIOChannel *ioc)
+{
+    QEMUFile *f = qemu_file_new_impl(ioc, true);
+
+    f->staging = true;
+    return f;
+}
+
 QEMUFile *qemu_file_new_input(QIOChannel *ioc)
 {
     return qemu_file_new_impl(ioc, false);
@@ -279,7 +301,11 @@ int qemu_fflush(QEMUFile *f)
             qemu_file_set_error_obj(f, -EIO, local_error);
         } else {
             uint64_t size = iov_size(f->iov, f->iovcnt);
-            stat64_add(&mig_stats.qemu_file_transferred, size);
+            if (f->staging) {
+                f->staging_transferred += size;
+            } else {
+                stat64_add(&mig_stats.qemu_file_transferred, size);
+            }
         }
 
         qemu_iovec_release_ram(f);
@@ -611,11 +637,17 @@ int coroutine_mixed_fn qemu_get_byte(QEMUFile *f)
 
 uint64_t qemu_file_transferred(QEMUFile *f)
 {
-    uint64_t ret = stat64_get(&mig_stats.qemu_file_transferred);
+    uint64_t ret;
     int i;
 
     g_assert(qemu_file_is_writable(f));
 
+    if (f->staging) {
+        ret = f->staging_transferred;
+    } else {
+        ret = stat64_get(&mig_stats.qemu_file_transferred);
+    }
+
     for (i = 0; i < f->iovcnt; i++) {
         ret += f->iov[i].iov_len;
     }
@@ -31,6 +31,7 @@
 
 QEMUFile *qemu_file_new_input(QIOChannel *ioc);
 QEMUFile *qemu_file_new_output(QIOChannel *ioc);
+QEMUFile *qemu_file_new_output_staging(QIOChannel *ioc);
 int qemu_fclose(QEMUFile *f);
 
 /*
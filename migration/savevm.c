@@ -56,6 +56,7 @@
 #include "qemu/main-loop.h"
 #include "block/snapshot.h"
 #include "qemu/cutils.h"
+#include "qemu/units.h"
 #include "io/channel-buffer.h"
 #include "io/channel-file.h"
 #include "sysemu/replay.h"
@@ -1488,6 +1489,190 @@ void qemu_savevm_state_complete_postcopy(QEMUFile *f)
     qemu_fflush(f);
 }
 
+static void savevm_record_downtime(SaveStateEntry *se, bool iterable,
+                                   bool parallel, int64_t save_time)
+{
+    MigrationState *ms = migrate_get_current();
+    MigrationDeviceDowntime *dd = g_new0(MigrationDeviceDowntime, 1);
+
+    dd->idstr = g_strdup(se->idstr);
+    dd->instance_id = se->instance_id;
+    dd->iterable = iterable;
+    dd->parallel = parallel;
+    dd->save_time = save_time;
+    QAPI_LIST_APPEND(ms->device_downtime_tail, dd);
+}
+
+/* Upper bound of worker threads used by x-parallel-device-state */
+#define SAVEVM_DEVICE_STATE_THREADS 8
+
+/*
+ * Larger sections are sent without a QEMU_VM_SECTION_SIZED prefix and
+ * loaded serially on the destination.
+ */
+#define MAX_VM_SECTION_SIZED_SIZE (16 * MiB)
+
+/*
+ * A device section serialized by a worker thread into a private buffer,
+ * waiting to be copied into the migration stream in handler order.
+ */
+typedef struct DeviceStateJob {
+    SaveStateEntry *se;
+    QIOChannelBuffer *bioc;
+    QEMUFile *file;
+    JSONWriter *vmdesc;
+    int64_t save_time;
+    int ret;
+    QemuEvent done;
+} DeviceStateJob;
+
+typedef struct DeviceStatePipeline {
+    DeviceStateJob *jobs;
+    int n_jobs;
+    /* Index of the next job to be picked up by a worker */
+    int next;
+    bool abort;
+    QemuThread *threads;
+    int n_threads;
+} DeviceStatePipeline;
+
+static bool vmstate_save_threadsafe(SaveStateEntry *se)
+{
+    return se->vmsd && se->vmsd->threadsafe_save && !se->vmsd->early_setup;
+}
+
+static void *device_state_save_thread(void *opaque)
+{
+    DeviceStatePipeline *p = opaque;
+    int i;
+
+    rcu_register_thread();
+
+    while ((i = qatomic_fetch_inc(&p->next)) < p->n_jobs) {
+        DeviceStateJob *job = &p->jobs[i];
+        int64_t start_ts = qemu_clock_get_us(QEMU_CLOCK_REALTIME);
+
+        if (qatomic_read(&p->abort)) {
+            job->ret = -ECANCELED;
+        } else {
+            job->ret = vmstate_save(job->file, job->se, job->vmdesc);
+            if (!job->ret) {
+                job->ret = qemu_fflush(job->file);
+            }
+        }
+        job->save_time = qemu_clock_get_us(QEMU_CLOCK_REALTIME) - start_ts;
+        qemu_event_set(&job->done);
+    }
+
+    rcu_unregister_thread();
+    return NULL;
+}
+
+/*
+ * Start serializing all thread-safe device sections on worker threads.
+ * Returns NULL if there is nothing to parallelize.
+ */
+static DeviceStatePipeline *device_state_pipeline_start(bool want_vmdesc)
+{
+    DeviceStatePipeline *p;
+    SaveStateEntry *se;
+    int i = 0;
+
+    QTAILQ_FOREACH(se, &savevm_state.handlers, entry) {
+        if (vmstate_save_threadsafe(se)) {
+            i++;
+        }
+    }
+    if (!i) {
+        return NULL;
+    }
+
+    p = g_new0(DeviceStatePipeline, 1);
+    p->n_jobs = i;
+    p->jobs = g_new0(DeviceStateJob, p->n_jobs);
+
+    i = 0;
+    QTAILQ_FOREACH(se, &savevm_state.handlers, entry) {
+        DeviceStateJob *job;
+
+        if (!vmstate_save_threadsafe(se)) {
+            continue;
+        }
+        job = &p->jobs[i++];
+        job->se = se;
+        job->bioc = qio_channel_buffer_new(4096);
+        qio_channel_set_name(QIO_CHANNEL(job->bioc),
+                             "migration-device-state-buffer");
+        job->file = qemu_file_new_output_staging(QIO_CHANNEL(job->bioc));
+        if (want_vmdesc) {
+            job->vmdesc = json_writer_new(false);
+        }
+        qemu_event_init(&job->done, false);
+    }
+
+    p->n_threads = MIN(p->n_jobs, SAVEVM_DEVICE_STATE_THREADS);
+    p->threads = g_new0(QemuThread, p->n_threads);
+    for (i = 0; i < p->n_threads; i++) {
+        qemu_thread_create(&p->threads[i], "mig/src/devstate",
+                           device_state_save_thread, p,
+                           QEMU_THREAD_JOINABLE);
+    }
+    trace_savevm_device_state_pipeline_start(p->n_jobs, p->n_threads);
+
+    return p;
+}
+
+/*
+ * Wait for @job and copy its section into @f, and its description into
+ * @vmdesc.  The section is prefixed with its length, so that the
+ * destination can hand it to a worker thread without parsing it.
+ */
+static int device_state_pipeline_put(DeviceStateJob *job, QEMUFile *f,
+                                     JSONWriter *vmdesc)
+{
+    qemu_event_wait(&job->done);
+
+    if (job->ret) {
+        return job->ret;
+    }
+    if (job->bioc->usage) {
+        if (job->bioc->usage <= MAX_VM_SECTION_SIZED_SIZE) {
+            qemu_put_byte(f, QEMU_VM_SECTION_SIZED);
+            qemu_put_be32(f, job->bioc->usage);
+        }
+        qemu_put_buffer(f, (uint8_t *)job->bioc->data, job->bioc->usage);
+        if (vmdesc) {
+            json_writer_raw(vmdesc, NULL, json_writer_get(job->vmdesc));
+        }
+    }
+    return 0;
+}
+
+static void device_state_pipeline_finish(DeviceStatePipeline *p)
+{
+    int i;
+
+    if (!p) {
+        return;
+    }
+
+    qatomic_set(&p->abort, true);
+    for (i = 0; i < p->n_threads; i++) {
+        qemu_thread_join(&p->threads[i]);
+    }
+    for (i = 0; i < p->n_jobs; i++) {
+        DeviceStateJob *job = &p->jobs[i];
+
+        qemu_fclose(job->file);
+        object_unref(OBJECT(job->bioc));
+        json_writer_free(job->vmdesc);
+        qemu_event_destroy(&job->done);
+    }
+    g_free(p->threads);
+    g_free(p->jobs);
+    g_free(p);
+}
+
 static
 int qemu_savevm_state_complete_precopy_iterable(QEMUFile *f, bool in_postcopy)
 {
@@ -1524,6 +1709,7 @@ int qemu_savevm_state_complete_precopy_iterable(QEMUFile *f, bool in_postcopy)
         end_ts_each = qemu_clock_get_us(QEMU_CLOCK_REALTIME);
         trace_vmstate_downtime_save("iterable", se->idstr, se->instance_id,
                                     end_ts_each - start_ts_each);
+        savevm_record_downtime(se, true, false, end_ts_each - start_ts_each);
     }
 
     trace_vmstate_downtime_checkpoint("src-iterable-saved");
@@ -1536,12 +1722,19 @@ int qemu_savevm_state_complete_precopy_non_iterable(QEMUFile *f,
                                                     bool inactivate_disks)
 {
     MigrationState *ms = migrate_get_current();
-    int64_t start_ts_each, end_ts_each;
+    int64_t start_ts_each, end_ts_each, save_time = 0;
     JSONWriter *vmdesc = ms->vmdesc;
+    DeviceStatePipeline *pipeline = NULL;
+    int next_job = 0;
+    bool parallel;
     int vmdesc_len;
     SaveStateEntry *se;
     int ret;
 
+    if (migrate_parallel_device_state()) {
+        pipeline = device_state_pipeline_start(vmdesc != NULL);
+    }
+
     QTAILQ_FOREACH(se, &savevm_state.handlers, entry) {
         if (se->vmsd && se->vmsd->early_setup) {
             /* Already saved during qemu_savevm_state_setup(). */
@@ -1550,17 +1743,33 @@ int qemu_savevm_state_complete_precopy_non_iterable(QEMUFile *f,
 
         start_ts_each = qemu_clock_get_us(QEMU_CLOCK_REALTIME);
 
-        ret = vmstate_save(f, se, vmdesc);
+        parallel = pipeline && vmstate_save_threadsafe(se);
+        if (parallel) {
+            DeviceStateJob *job = &pipeline->jobs[next_job++];
+
+            assert(job->se == se);
+            ret = device_state_pipeline_put(job, f, vmdesc);
+            save_time = job->save_time;
+        } else {
+            ret = vmstate_save(f, se, vmdesc);
+        }
         if (ret) {
+            device_state_pipeline_finish(pipeline);
             qemu_file_set_error(f, ret);
             return ret;
         }
 
         end_ts_each = qemu_clock_get_us(QEMU_CLOCK_REALTIME);
+        if (!parallel) {
+            save_time = end_ts_each - start_ts_each;
+        }
         trace_vmstate_downtime_save("non-iterable", se->idstr, se->instance_id,
-                                    end_ts_each - start_ts_each);
+                                    save_time);
+        savevm_record_downtime(se, false, parallel, save_time);
     }
 
+    device_state_pipeline_finish(pipeline);
+
     if (inactivate_disks) {
         /* Inactivate before sending QEMU_VM_EOF so that the
          * bdrv_activate_all() on the other end won't fail. */
@@ -1612,6 +1821,14 @@ int qemu_savevm_state_complete_precopy(QEMUFile *f, bool iterable_only,
 
     trace_savevm_state_complete_precopy();
 
+    if (!iterable_only) {
+        MigrationState *ms = migrate_get_current();
+
+        qapi_free_MigrationDeviceDowntimeList(ms->device_downtime);
+        ms->device_downtime = NULL;
+        ms->device_downtime_tail = &ms->device_downtime;
+    }
+
     cpu_synchronize_all_states();
 
     if (!in_postcopy || iterable_only) {
@@ -2553,13 +2770,13 @@ static bool check_section_footer(QEMUFile *f, SaveStateEntry *se)
     return true;
 }
 
-static int
-qemu_loadvm_section_start_full(QEMUFile *f, MigrationIncomingState *mis,
-                               uint8_t type)
+/*
+ * Read the header of a QEMU_VM_SECTION_START or QEMU_VM_SECTION_FULL
+ * section, and find and validate its savevm handler
+ */
+static int qemu_loadvm_section_header(QEMUFile *f, SaveStateEntry **sep)
 {
-    bool trace_downtime = (type == QEMU_VM_SECTION_FULL);
     uint32_t instance_id, version_id, section_id;
-    int64_t start_ts, end_ts;
     SaveStateEntry *se;
     char idstr[256];
     int ret;
@@ -2608,6 +2825,24 @@ qemu_loadvm_section_start_full(QEMUFile *f, MigrationIncomingState *mis,
         return -EINVAL;
     }
 
+    *sep = se;
+    return 0;
+}
+
+static int
+qemu_loadvm_section_start_full(QEMUFile *f, MigrationIncomingState *mis,
+                               uint8_t type)
+{
+    bool trace_downtime = (type == QEMU_VM_SECTION_FULL);
+    int64_t start_ts, end_ts;
+    SaveStateEntry *se;
+    int ret;
+
+    ret = qemu_loadvm_section_header(f, &se);
+    if (ret < 0) {
+        return ret;
+    }
+
     if (trace_downtime) {
         start_ts = qemu_clock_get_us(QEMU_CLOCK_REALTIME);
     }
@@ -2615,7 +2850,7 @@ qemu_loadvm_section_start_full(QEMUFile *f, MigrationIncomingState *mis,
     ret = vmstate_load(f, se);
     if (ret < 0) {
         error_report("error while loading state for instance 0x%"PRIx32" of"
-                     " device '%s'", instance_id, idstr);
+                     " device '%s'", se->instance_id, se->idstr);
         return ret;
     }
 
@@ -2686,6 +2921,252 @@ qemu_loadvm_section_part_end(QEMUFile *f, MigrationIncomingState *mis,
     return 0;
 }
 
+/*
+ * A QEMU_VM_SECTION_SIZED section queued for loading on a worker thread.
+ * @file reads from a copy of the section and is positioned after its
+ * header.
+ */
+typedef struct DeviceLoadJob {
+    SaveStateEntry *se;
+    QEMUFile *file;
+    QSIMPLEQ_ENTRY(DeviceLoadJob) next;
+} DeviceLoadJob;
+
+typedef struct DeviceLoadPipeline {
+    QemuMutex lock;
+    /* Signalled when a job is queued or the pipeline is torn down */
+    QemuCond work_cond;
+    /* Signalled when the last pending job completes */
+    QemuCond done_cond;
+    QSIMPLEQ_HEAD(, DeviceLoadJob) jobs;
+    /* Number of jobs that are queued or being loaded */
+    int pending;
+    /* Priority of the pending jobs */
+    MigrationPriority priority;
+    /* First error returned by a job; later jobs are skipped */
+    int ret;
+    bool quit;
+    QemuThread threads[SAVEVM_DEVICE_STATE_THREADS];
+    int n_threads;
+} DeviceLoadPipeline;
+
+static int device_state_load(QEMUFile *f, SaveStateEntry *se)
+{
+    int64_t start_ts, end_ts;
+    int ret;
+
+    start_ts = qemu_clock_get_us(QEMU_CLOCK_REALTIME);
+
+    ret = vmstate_load(f, se);
+    if (ret < 0) {
+        error_report("error while loading state for instance 0x%"PRIx32" of"
+                     " device '%s'", se->instance_id, se->idstr);
+        return ret;
+    }
+
+    end_ts = qemu_clock_get_us(QEMU_CLOCK_REALTIME);
+    trace_vmstate_downtime_load("non-iterable", se->idstr,
+                                se->instance_id, end_ts - start_ts);
+
+    if (!check_section_footer(f, se)) {
+        return -EINVAL;
+    }
+    return 0;
+}
+
+static void *device_state_load_thread(void *opaque)
+{
+    DeviceLoadPipeline *p = opaque;
+    DeviceLoadJob *job;
+    int ret;
+
+    rcu_register_thread();
+
+    qemu_mutex_lock(&p->lock);
+    while (true) {
+        job = QSIMPLEQ_FIRST(&p->jobs);
+        if (!job) {
+            if (p->quit) {
+                break;
+            }
+            qemu_cond_wait(&p->work_cond, &p->lock);
+            continue;
+        }
+        QSIMPLEQ_REMOVE_HEAD(&p->jobs, next);
+        ret = p->ret;
+        qemu_mutex_unlock(&p->lock);
+
+        if (!ret) {
+            ret = device_state_load(job->file, job->se);
+        }
+        qemu_fclose(job->file);
+        g_free(job);
+
+        qemu_mutex_lock(&p->lock);
+        if (ret < 0 && !p->ret) {
+            p->ret = ret;
+        }
+        if (--p->pending == 0) {
+            qemu_cond_broadcast(&p->done_cond);
+        }
+    }
+    qemu_mutex_unlock(&p->lock);
+
+    rcu_unregister_thread();
+    return NULL;
+}
+
+/*
+ * Wait until all sections queued on @p are loaded.  Sections that come
+ * later in the stream may depend on them, and so may anything that runs
+ * after the device state has been loaded.
+ */
+static int device_load_pipeline_wait(DeviceLoadPipeline *p)
+{
+    int ret;
+
+    if (!p) {
+        return 0;
+    }
+
+    qemu_mutex_lock(&p->lock);
+    while (p->pending) {
+        qemu_cond_wait(&p->done_cond, &p->lock);
+    }
+    ret = p->ret;
+    qemu_mutex_unlock(&p->lock);
+
+    return ret;
+}
+
+static void device_load_pipeline_queue(DeviceLoadPipeline *p,
+                                       SaveStateEntry *se, QEMUFile *f)
+{
+    DeviceLoadJob *job = g_new0(DeviceLoadJob, 1);
+
+    job->se = se;
+    job->file = f;
+
+    qemu_mutex_lock(&p->lock);
+    QSIMPLEQ_INSERT_TAIL(&p->jobs, job, next);
+    p->pending++;
+    p->priority = save_state_priority(se);
+    if (p->pending > p->n_threads &&
+        p->n_threads < SAVEVM_DEVICE_STATE_THREADS) {
+        qemu_thread_create(&p->threads[p->n_threads++], "mig/dst/devstate",
+                           device_state_load_thread, p,
+                           QEMU_THREAD_JOINABLE);
+    }
+    qemu_cond_signal(&p->work_cond);
+    qemu_mutex_unlock(&p->lock);
+}
+
+static void device_load_pipeline_finish(DeviceLoadPipeline *p)
+{
+    int i;
+
+    if (!p) {
+        return;
+    }
+
+    device_load_pipeline_wait(p);
+
+    qemu_mutex_lock(&p->lock);
+    p->quit = true;
+    qemu_cond_broadcast(&p->work_cond);
+    qemu_mutex_unlock(&p->lock);
+
+    for (i = 0; i < p->n_threads; i++) {
+        qemu_thread_join(&p->threads[i]);
+    }
+    qemu_cond_destroy(&p->done_cond);
+    qemu_cond_destroy(&p->work_cond);
+    qemu_mutex_destroy(&p->lock);
+    g_free(p);
+}
+
+/*
+ * Load a QEMU_VM_SECTION_SIZED section: a QEMU_VM_SECTION_FULL section
+ * prefixed with its length.  If the capability is enabled and the device
+ * can be loaded without the BQL, the section is handed to a worker thread
+ * of *@pipeline, otherwise it is loaded right away.
+ *
+ * Handlers are saved in priority order, so sections of the same priority
+ * are loaded concurrently while a new priority waits for the previous
+ * ones to be complete.
+ */
+static int
+qemu_loadvm_section_sized(QEMUFile *f, MigrationIncomingState *mis,
+                          DeviceLoadPipeline **pipeline)
+{
+    DeviceLoadPipeline *p = *pipeline;
+    QIOChannelBuffer *bioc;
+    QEMUFile *section_file;
+    SaveStateEntry *se;
+    size_t length;
+    int ret;
+
+    length = qemu_get_be32(f);
+    trace_qemu_loadvm_state_section_sized(length);
+
+    if (length > MAX_VM_SECTION_SIZED_SIZE) {
+        error_report("Unreasonably large device section: %zu", length);
+        return -EINVAL;
+    }
+
+    bioc = qio_channel_buffer_new(length);
+    qio_channel_set_name(QIO_CHANNEL(bioc), "migration-device-state-buffer");
+    if (qemu_get_buffer(f, bioc->data, length) != length) {
+        object_unref(OBJECT(bioc));
+        error_report("%s: Failed to read device section of %zu bytes",
+                     __func__, length);
+        return qemu_file_get_error(f) ?: -EIO;
+    }
+    bioc->usage += length;
+
+    section_file = qemu_file_new_input(QIO_CHANNEL(bioc));
+    object_unref(OBJECT(bioc));
+
+    if (qemu_get_byte(section_file) != QEMU_VM_SECTION_FULL) {
+        error_report("Sized device section does not hold a full section");
+        ret = -EINVAL;
+        goto out;
+    }
+    ret = qemu_loadvm_section_header(section_file, &se);
+    if (ret < 0) {
+        goto out;
+    }
+
+    if (!migrate_parallel_device_state() ||
+        !se->vmsd || !se->vmsd->threadsafe_load) {
+        ret = device_load_pipeline_wait(p);
+        if (!ret) {
+            ret = device_state_load(section_file, se);
+        }
+        goto out;
+    }
+
+    if (!p) {
+        p = *pipeline = g_new0(DeviceLoadPipeline, 1);
+        qemu_mutex_init(&p->lock);
+        qemu_cond_init(&p->work_cond);
+        qemu_cond_init(&p->done_cond);
+        QSIMPLEQ_INIT(&p->jobs);
+    } else if (p->priority != save_state_priority(se)) {
+        ret = device_load_pipeline_wait(p);
+        if (ret < 0) {
+            goto out;
+        }
+    }
+
+    device_load_pipeline_queue(p, se, section_file);
+    return 0;
+
+out:
+    qemu_fclose(section_file);
+    return ret;
+}
+
 static int qemu_loadvm_state_header(QEMUFile *f)
 {
     unsigned int v;
@@ -2851,6 +3332,7 @@ static bool postcopy_pause_incoming(MigrationIncomingState *mis)
 
 int qemu_loadvm_state_main(QEMUFile *f, MigrationIncomingState *mis)
 {
+    DeviceLoadPipeline *pipeline = NULL;
     uint8_t section_type;
     int ret = 0;
 
@@ -2864,7 +3346,20 @@ retry:
         }
 
         trace_qemu_loadvm_state_section(section_type);
+        if (section_type != QEMU_VM_SECTION_SIZED) {
+            ret = device_load_pipeline_wait(pipeline);
+            if (ret < 0) {
+                goto out;
+            }
+        }
+
         switch (section_type) {
+        case QEMU_VM_SECTION_SIZED:
+            ret = qemu_loadvm_section_sized(f, mis, &pipeline);
+            if (ret < 0) {
+                goto out;
+            }
+            break;
         case QEMU_VM_SECTION_START:
         case QEMU_VM_SECTION_FULL:
             ret = qemu_loadvm_section_start_full(f, mis, section_type);
@@ -2897,6 +3392,9 @@ retry:
     }
 
 out:
+    device_load_pipeline_finish(pipeline);
+    pipeline = NULL;
+
     if (ret < 0) {
         qemu_file_set_error(f, ret);
 
@@ -18,6 +18,8 @@
 #include "qapi/qmp/json-writer.h"
 #include "qemu-file.h"
 #include "qemu/bitops.h"
+#include "qemu/bswap.h"
+#include "qemu/lockable.h"
 #include "qemu/error-report.h"
 #include "trace.h"
 
@@ -26,6 +28,11 @@ static int vmstate_subsection_save(QEMUFile *f, const VMStateDescription *vmsd,
 static int vmstate_subsection_load(QEMUFile *f, const VMStateDescription *vmsd,
                                    void *opaque);
 
+typedef struct VMStatePlan VMStatePlan;
+static const VMStatePlan *vmstate_plan_get(const VMStateDescription *vmsd);
+static int vmstate_plan_load(QEMUFile *f, const VMStateDescription *vmsd,
+                             const VMStatePlan *plan, void *opaque);
+
 /* Whether this field should exist for either save or load the VM? */
 static bool
 vmstate_field_exists(const VMStateDescription *vmsd, const VMStateField *field,
@@ -100,10 +107,66 @@ static void vmstate_handle_alloc(void *ptr, const VMStateField *field,
     }
 }
 
+static int vmstate_load_field(QEMUFile *f, const VMStateDescription *vmsd,
+                              const VMStateField *field, void *opaque,
+                              int version_id)
+{
+    int ret = 0;
+
+    trace_vmstate_load_state_field(vmsd->name, field->name);
+    if (vmstate_field_exists(vmsd, field, opaque, version_id)) {
+        void *first_elem = opaque + field->offset;
+        int i, n_elems = vmstate_n_elems(opaque, field);
+        int size = vmstate_size(opaque, field);
+
+        vmstate_handle_alloc(first_elem, field, opaque);
+        if (field->flags & VMS_POINTER) {
+            first_elem = *(void **)first_elem;
+            assert(first_elem || !n_elems || !size);
+        }
+        for (i = 0; i < n_elems; i++) {
+            void *curr_elem = first_elem + size * i;
+
+            if (field->flags & VMS_ARRAY_OF_POINTER) {
+                curr_elem = *(void **)curr_elem;
+            }
+            if (!curr_elem && size) {
+                /* if null pointer check placeholder and do not follow */
+                assert(field->flags & VMS_ARRAY_OF_POINTER);
+                ret = vmstate_info_nullptr.get(f, curr_elem, size, NULL);
+            } else if (field->flags & VMS_STRUCT) {
+                ret = vmstate_load_state(f, field->vmsd, curr_elem,
+                                         field->vmsd->version_id);
+            } else if (field->flags & VMS_VSTRUCT) {
+                ret = vmstate_load_state(f, field->vmsd, curr_elem,
+                                         field->struct_version_id);
+            } else {
+                ret = field->info->get(f, curr_elem, size, field);
+            }
+            if (ret >= 0) {
+                ret = qemu_file_get_error(f);
+            }
+            if (ret < 0) {
+                qemu_file_set_error(f, ret);
+                error_report("Failed to load %s:%s", vmsd->name,
+                             field->name);
+                trace_vmstate_load_field_error(field->name, ret);
+                return ret;
+            }
+        }
+    } else if (field->flags & VMS_MUST_EXIST) {
+        error_report("Input validation failed: %s/%s",
+                     vmsd->name, field->name);
+        return -1;
+    }
+    return 0;
+}
+
 int vmstate_load_state(QEMUFile *f, const VMStateDescription *vmsd,
                        void *opaque, int version_id)
 {
     const VMStateField *field = vmsd->fields;
+    const VMStatePlan *plan = NULL;
     int ret = 0;
 
     trace_vmstate_load_state(vmsd->name, version_id);
@@ -127,56 +190,24 @@ int vmstate_load_state(QEMUFile *f, const VMStateDescription *vmsd,
             return ret;
         }
     }
-    while (field->name) {
-        trace_vmstate_load_state_field(vmsd->name, field->name);
-        if (vmstate_field_exists(vmsd, field, opaque, version_id)) {
-            void *first_elem = opaque + field->offset;
-            int i, n_elems = vmstate_n_elems(opaque, field);
-            int size = vmstate_size(opaque, field);
-
-            vmstate_handle_alloc(first_elem, field, opaque);
-            if (field->flags & VMS_POINTER) {
-                first_elem = *(void **)first_elem;
-                assert(first_elem || !n_elems || !size);
-            }
-            for (i = 0; i < n_elems; i++) {
-                void *curr_elem = first_elem + size * i;
-
-                if (field->flags & VMS_ARRAY_OF_POINTER) {
-                    curr_elem = *(void **)curr_elem;
-                }
-                if (!curr_elem && size) {
-                    /* if null pointer check placeholder and do not follow */
-                    assert(field->flags & VMS_ARRAY_OF_POINTER);
-                    ret = vmstate_info_nullptr.get(f, curr_elem, size, NULL);
-                } else if (field->flags & VMS_STRUCT) {
-                    ret = vmstate_load_state(f, field->vmsd, curr_elem,
-                                             field->vmsd->version_id);
-                } else if (field->flags & VMS_VSTRUCT) {
-                    ret = vmstate_load_state(f, field->vmsd, curr_elem,
-                                             field->struct_version_id);
-                } else {
-                    ret = field->info->get(f, curr_elem, size, field);
-                }
-                if (ret >= 0) {
-                    ret = qemu_file_get_error(f);
-                }
-                if (ret < 0) {
-                    qemu_file_set_error(f, ret);
-                    error_report("Failed to load %s:%s", vmsd->name,
-                                 field->name);
-                    trace_vmstate_load_field_error(field->name, ret);
-                    return ret;
-                }
+    if (version_id == vmsd->version_id) {
+        plan = vmstate_plan_get(vmsd);
+    }
+    if (plan) {
+        ret = vmstate_plan_load(f, vmsd, plan, opaque);
+        if (ret) {
+            return ret;
+        }
+    } else {
+        while (field->name) {
+            ret = vmstate_load_field(f, vmsd, field, opaque, version_id);
+            if (ret) {
+                return ret;
             }
-        } else if (field->flags & VMS_MUST_EXIST) {
-            error_report("Input validation failed: %s/%s",
-                         vmsd->name, field->name);
-            return -1;
+            field++;
         }
-        field++;
+        assert(field->flags == VMS_END);
     }
-    assert(field->flags == VMS_END);
     ret = vmstate_subsection_load(f, vmsd, opaque);
     if (ret != 0) {
         qemu_file_set_error(f, ret);
@@ -325,6 +356,404 @@ static void vmsd_desc_field_end(const VMStateDescription *vmsd,
 }
 
 
+static int vmstate_save_field(QEMUFile *f, const VMStateDescription *vmsd,
+                              const VMStateField *field, void *opaque,
+                              JSONWriter *vmdesc, int version_id,
+                              Error **errp)
+{
+    int ret = 0;
+
+    if (vmstate_field_exists(vmsd, field, opaque, version_id)) {
+        void *first_elem = opaque + field->offset;
+        int i, n_elems = vmstate_n_elems(opaque, field);
+        int size = vmstate_size(opaque, field);
+        uint64_t old_offset, written_bytes;
+        JSONWriter *vmdesc_loop = vmdesc;
+
+        trace_vmstate_save_state_loop(vmsd->name, field->name, n_elems);
+        if (field->flags & VMS_POINTER) {
+            first_elem = *(void **)first_elem;
+            assert(first_elem || !n_elems || !size);
+        }
+        for (i = 0; i < n_elems; i++) {
+            void *curr_elem = first_elem + size * i;
+
+            vmsd_desc_field_start(vmsd, vmdesc_loop, field, i, n_elems);
+            old_offset = qemu_file_transferred(f);
+            if (field->flags & VMS_ARRAY_OF_POINTER) {
+                assert(curr_elem);
+                curr_elem = *(void **)curr_elem;
+            }
+            if (!curr_elem && size) {
+                /* if null pointer write placeholder and do not follow */
+                assert(field->flags & VMS_ARRAY_OF_POINTER);
+                ret = vmstate_info_nullptr.put(f, curr_elem, size, NULL,
+                                               NULL);
+            } else if (field->flags & VMS_STRUCT) {
+                ret = vmstate_save_state(f, field->vmsd, curr_elem,
+                                         vmdesc_loop);
+            } else if (field->flags & VMS_VSTRUCT) {
+                ret = vmstate_save_state_v(f, field->vmsd, curr_elem,
+                                           vmdesc_loop,
+                                           field->struct_version_id, errp);
+            } else {
+                ret = field->info->put(f, curr_elem, size, field,
+                                 vmdesc_loop);
+            }
+            if (ret) {
+                error_setg(errp, "Save of field %s/%s failed",
+                            vmsd->name, field->name);
+                return ret;
+            }
+
+            written_bytes = qemu_file_transferred(f) - old_offset;
+            vmsd_desc_field_end(vmsd, vmdesc_loop, field, written_bytes, i);
+
+            /* Compressed arrays only care about the first element */
+            if (vmdesc_loop && vmsd_can_compress(field)) {
+                vmdesc_loop = NULL;
+            }
+        }
+    } else {
+        if (field->flags & VMS_MUST_EXIST) {
+            error_report("Output state validation failed: %s/%s",
+                    vmsd->name, field->name);
+            assert(!(field->flags & VMS_MUST_EXIST));
+        }
+    }
+    return 0;
+}
+
+/*
+ * VMState plans
+ *
+ * Most fields are fixed-size integers or byte buffers at a fixed offset.
+ * For those, interpreting the field array on every save and load
+ * (field_exists, element counting, one info callback per element and
+ * rebuilding the same vmdesc entries) is pure overhead.  A plan is
+ * computed once per VMStateDescription: consecutive plain fields that
+ * are also contiguous in memory and have the same element width are
+ * coalesced into runs that go through one buffer copy, byte-swapped on
+ * little-endian hosts.  All other fields are still interpreted, in
+ * order, so the wire format is unchanged.
+ *
+ * Plans only describe the current version_id of a VMSD; loading an
+ * older version falls back to the interpreter.
+ */
+
+typedef struct VMStatePlanStep {
+    /* First field of the step */
+    const VMStateField *field;
+    /* Element width of a run; 0 if @field must be interpreted */
+    unsigned width;
+    /* Number of fields and elements in the run */
+    int n_fields;
+    size_t n_elems;
+    size_t offset;
+} VMStatePlanStep;
+
+struct VMStatePlan {
+    /* Field array the plan was computed from */
+    const VMStateField *fields;
+    VMStatePlanStep *steps;
+    int n_steps;
+    int n_runs;
+    /* Pre-rendered vmdesc entry of each plain field, indexed like @fields */
+    char **desc;
+};
+
+static QemuMutex vmstate_plans_lock;
+static GHashTable *vmstate_plans;
+
+static void __attribute__((constructor)) vmstate_plans_init(void)
+{
+    qemu_mutex_init(&vmstate_plans_lock);
+    vmstate_plans = g_hash_table_new(NULL, NULL);
+}
+
+/*
+ * Return the element width in bytes if @field can be part of a run and
+ * store its number of elements in @n_elems, or return 0.
+ */
+static unsigned vmstate_plain_width(const VMStateField *field,
+                                    size_t *n_elems)
+{
+    const VMStateInfo *info = field->info;
+    unsigned width;
+
+    if (field->field_exists) {
+        return 0;
+    }
+
+    if (info == &vmstate_info_buffer) {
+        if ((field->flags & ~VMS_MUST_EXIST) != VMS_BUFFER) {
+            return 0;
+        }
+        *n_elems = field->size;
+        return 1;
+    }
+
+    if (field->flags & ~(VMS_SINGLE | VMS_ARRAY | VMS_MUST_EXIST)) {
+        return 0;
+    }
+    if (info == &vmstate_info_int8 || info == &vmstate_info_uint8) {
+        width = 1;
+    } else if (info == &vmstate_info_int16 || info == &vmstate_info_uint16) {
+        width = 2;
+    } else if (info == &vmstate_info_int32 || info == &vmstate_info_uint32) {
+        width = 4;
+    } else if (info == &vmstate_info_int64 || info == &vmstate_info_uint64) {
+        width = 8;
+    } else {
+        return 0;
+    }
+    if (field->size != width) {
+        return 0;
+    }
+
+    *n_elems = field->flags & VMS_ARRAY ? field->num : 1;
+    return width;
+}
+
+/* Render the vmdesc entry that vmstate_save_state_v() would write */
+static char *vmstate_plan_render_desc(const VMStateDescription *vmsd,
+                                      const VMStateField *field)
+{
+    int max = field->flags & VMS_ARRAY ? field->num : 1;
+    JSONWriter *vmdesc;
+
+    if (!max) {
+        return NULL;
+    }
+
+    vmdesc = json_writer_new(false);
+    vmsd_desc_field_start(vmsd, vmdesc, field, 0, max);
+    vmsd_desc_field_end(vmsd, vmdesc, field, field->size, 0);
+    return g_string_free(json_writer_get_and_free(vmdesc), false);
+}
+
+static VMStatePlan *vmstate_plan_build(const VMStateDescription *vmsd)
+{
+    VMStatePlan *plan = g_new0(VMStatePlan, 1);
+    GArray *steps = g_array_new(false, true, sizeof(VMStatePlanStep));
+    VMStatePlanStep *run = NULL;
+    const VMStateField *field;
+    int n_fields = 0;
+
+    for (field = vmsd->fields; field->name; field++) {
+        n_fields++;
+    }
+    plan->fields = vmsd->fields;
+    plan->desc = g_new0(char *, n_fields);
+
+    for (field = vmsd->fields; field->name; field++) {
+        VMStatePlanStep step = { .field = field };
+        size_t n_elems = 0;
+
+        if (!field->field_exists && field->version_id > vmsd->version_id) {
+            /* Never sent at the current version */
+            run = NULL;
+            continue;
+        }
+
+        step.width = vmstate_plain_width(field, &n_elems);
+        if (!step.width) {
+            g_array_append_val(steps, step);
+            run = NULL;
+            continue;
+        }
+
+        plan->desc[field - vmsd->fields] = vmstate_plan_render_desc(vmsd,
+                                                                    field);
+        if (run && run->width == step.width &&
+            run->offset + run->n_elems * run->width == field->offset) {
+            run->n_fields++;
+            run->n_elems += n_elems;
+            continue;
+        }
+
+        step.n_fields = 1;
+        step.n_elems = n_elems;
+        step.offset = field->offset;
+        g_array_append_val(steps, step);
+        run = &g_array_index(steps, VMStatePlanStep, steps->len - 1);
+        plan->n_runs++;
+    }
+    assert(field->flags == VMS_END);
+
+    plan->n_steps = steps->len;
+    plan->steps = (VMStatePlanStep *)g_array_free(steps, false);
+    trace_vmstate_plan_build(vmsd->name, plan->n_steps, plan->n_runs);
+    return plan;
+}
+
+/*
+ * Return the plan for the current version of @vmsd, or NULL if it has no
+ * plain fields and interpreting it is just as fast.
+ */
+static const VMStatePlan *vmstate_plan_get(const VMStateDescription *vmsd)
+{
+    VMStatePlan *plan;
+
+    if (!vmsd->fields) {
+        return NULL;
+    }
+
+    QEMU_LOCK_GUARD(&vmstate_plans_lock);
+    plan = g_hash_table_lookup(vmstate_plans, vmsd);
+    if (plan && plan->fields != vmsd->fields) {
+        /*
+         * A different VMSD now lives at this address.  The stale plan may
+         * still be in use by a concurrent saver, so it is leaked.
+         */
+        plan = NULL;
+    }
+    if (!plan) {
+        plan = vmstate_plan_build(vmsd);
+        g_hash_table_insert(vmstate_plans, (gpointer)vmsd, plan);
+    }
+    return plan->n_runs ? plan : NULL;
+}
+
+static void vmstate_plan_put_run(QEMUFile *f, void *opaque,
+                                 const VMStatePlanStep *run)
+{
+    uint8_t *src = opaque + run->offset;
+    size_t len = run->n_elems * run->width;
+    uint8_t buf[256];
+
+    if (HOST_BIG_ENDIAN || run->width == 1) {
+        qemu_put_buffer(f, src, len);
+        return;
+    }
+
+    while (len) {
+        size_t chunk = MIN(len, sizeof(buf));
+        size_t i;
+
+        switch (run->width) {
+        case 2:
+            for (i = 0; i < chunk; i += 2) {
+                stw_be_p(buf + i, lduw_he_p(src + i));
+            }
+            break;
+        case 4:
+            for (i = 0; i < chunk; i += 4) {
+                stl_be_p(buf + i, ldl_he_p(src + i));
+            }
+            break;
+        case 8:
+            for (i = 0; i < chunk; i += 8) {
+                stq_be_p(buf + i, ldq_he_p(src + i));
+            }
+            break;
+        default:
+            g_assert_not_reached();
+        }
+        qemu_put_buffer(f, buf, chunk);
+        src += chunk;
+        len -= chunk;
+    }
+}
+
+static void vmstate_plan_get_run(QEMUFile *f, void *opaque,
+                                 const VMStatePlanStep *run)
+{
+    uint8_t *dst = opaque + run->offset;
+    size_t len = run->n_elems * run->width;
+    size_t i;
+
+    qemu_get_buffer(f, dst, len);
+    if (HOST_BIG_ENDIAN || run->width == 1) {
+        return;
+    }
+
+    switch (run->width) {
+    case 2:
+        for (i = 0; i < len; i += 2) {
+            stw_he_p(dst + i, lduw_be_p(dst + i));
+        }
+        break;
+    case 4:
+        for (i = 0; i < len; i += 4) {
+            stl_he_p(dst + i, ldl_be_p(dst + i));
+        }
+        break;
+    case 8:
+        for (i = 0; i < len; i += 8) {
+            stq_he_p(dst + i, ldq_be_p(dst + i));
+        }
+        break;
+    default:
+        g_assert_not_reached();
+    }
+}
+
+static int vmstate_plan_load(QEMUFile *f, const VMStateDescription *vmsd,
+                             const VMStatePlan *plan, void *opaque)
+{
+    int i, ret;
+
+    for (i = 0; i < plan->n_steps; i++) {
+        const VMStatePlanStep *step = &plan->steps[i];
+
+        if (!step->width) {
+            ret = vmstate_load_field(f, vmsd, step->field, opaque,
+                                     vmsd->version_id);
+            if (ret) {
+                return ret;
+            }
+            continue;
+        }
+
+        trace_vmstate_load_state_field(vmsd->name, step->field->name);
+        vmstate_plan_get_run(f, opaque, step);
+        ret = qemu_file_get_error(f);
+        if (ret < 0) {
+            error_report("Failed to load %s:%s", vmsd->name,
+                         step->field->name);
+            trace_vmstate_load_field_error(step->field->name, ret);
+            return ret;
+        }
+    }
+    return 0;
+}
+
+static int vmstate_plan_save(QEMUFile *f, const VMStateDescription *vmsd,
+                             const VMStatePlan *plan, void *opaque,
+                             JSONWriter *vmdesc, Error **errp)
+{
+    int i, j, ret;
+
+    for (i = 0; i < plan->n_steps; i++) {
+        const VMStatePlanStep *step = &plan->steps[i];
+
+        if (!step->width) {
+            ret = vmstate_save_field(f, vmsd, step->field, opaque, vmdesc,
+                                     vmsd->version_id, errp);
+            if (ret) {
+                return ret;
+            }
+            continue;
+        }
+
+        trace_vmstate_save_state_loop(vmsd->name, step->field->name,
+                                      step->n_elems);
+        vmstate_plan_put_run(f, opaque, step);
+        if (vmdesc) {
+            int first = step->field - plan->fields;
+
+            for (j = first; j < first + step->n_fields; j++) {
+                if (plan->desc[j]) {
+                    json_writer_raw(vmdesc, NULL, plan->desc[j]);
+                }
+            }
+        }
+    }
+    return 0;
+}
+
+
 bool vmstate_section_needed(const VMStateDescription *vmsd, void *opaque)
 {
     if (vmsd->needed && !vmsd->needed(opaque)) {
@@ -352,6 +781,7 @@ int vmstate_save_state_v(QEMUFile *f, const VMStateDescription *vmsd,
 {
     int ret = 0;
     const VMStateField *field = vmsd->fields;
+    const VMStatePlan *plan = NULL;
 
     trace_vmstate_save_state_top(vmsd->name);
 
@@ -370,71 +800,25 @@ int vmstate_save_state_v(QEMUFile *f, const VMStateDescription *vmsd,
         json_writer_start_array(vmdesc, "fields");
     }
 
-    while (field->name) {
-        if (vmstate_field_exists(vmsd, field, opaque, version_id)) {
-            void *first_elem = opaque + field->offset;
-            int i, n_elems = vmstate_n_elems(opaque, field);
-            int size = vmstate_size(opaque, field);
-            uint64_t old_offset, written_bytes;
-            JSONWriter *vmdesc_loop = vmdesc;
-
-            trace_vmstate_save_state_loop(vmsd->name, field->name, n_elems);
-            if (field->flags & VMS_POINTER) {
-                first_elem = *(void **)first_elem;
-                assert(first_elem || !n_elems || !size);
-            }
-            for (i = 0; i < n_elems; i++) {
-                void *curr_elem = first_elem + size * i;
-
-                vmsd_desc_field_start(vmsd, vmdesc_loop, field, i, n_elems);
-                old_offset = qemu_file_transferred(f);
-                if (field->flags & VMS_ARRAY_OF_POINTER) {
-                    assert(curr_elem);
-                    curr_elem = *(void **)curr_elem;
-                }
-                if (!curr_elem && size) {
-                    /* if null pointer write placeholder and do not follow */
-                    assert(field->flags & VMS_ARRAY_OF_POINTER);
-                    ret = vmstate_info_nullptr.put(f, curr_elem, size, NULL,
-                                                   NULL);
-                } else if (field->flags & VMS_STRUCT) {
-                    ret = vmstate_save_state(f, field->vmsd, curr_elem,
-                                             vmdesc_loop);
-                } else if (field->flags & VMS_VSTRUCT) {
-                    ret = vmstate_save_state_v(f, field->vmsd, curr_elem,
-                                               vmdesc_loop,
-                                               field->struct_version_id, errp);
-                } else {
-                    ret = field->info->put(f, curr_elem, size, field,
-                                     vmdesc_loop);
-                }
-                if (ret) {
-                    error_setg(errp, "Save of field %s/%s failed",
-                                vmsd->name, field->name);
-                    if (vmsd->post_save) {
-                        vmsd->post_save(opaque);
-                    }
-                    return ret;
-                }
-
-                written_bytes = qemu_file_transferred(f) - old_offset;
-                vmsd_desc_field_end(vmsd, vmdesc_loop, field, written_bytes, i);
-
-                /* Compressed arrays only care about the first element */
-                if (vmdesc_loop && vmsd_can_compress(field)) {
-                    vmdesc_loop = NULL;
-                }
-            }
-        } else {
-            if (field->flags & VMS_MUST_EXIST) {
-                error_report("Output state validation failed: %s/%s",
-                        vmsd->name, field->name);
-                assert(!(field->flags & VMS_MUST_EXIST));
-            }
+    if (version_id == vmsd->version_id) {
+        plan = vmstate_plan_get(vmsd);
+    }
+    if (plan) {
+        ret = vmstate_plan_save(f, vmsd, plan, opaque, vmdesc, errp);
+    } else {
+        while (field->name && !ret) {
+            ret = vmstate_save_field(f, vmsd, field, opaque, vmdesc,
+                                     version_id, errp);
+            field++;
         }
-        field++;
+        assert(ret || field->flags == VMS_END);
+    }
+    if (ret) {
+        if (vmsd->post_save) {
+            vmsd->post_save(opaque);
+        }
+        return ret;
     }
-    assert(field->flags == VMS_END);
 
     if (vmdesc) {
         json_writer_end_array(vmdesc);
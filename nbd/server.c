@@ -28,6 +28,9 @@
 #include "nbd-internal.h"
 #include "qemu/units.h"
 #include "qemu/memalign.h"
+#include "qemu/host-utils.h"
+#include "qemu/timer.h"
+#include "sysemu/iothread.h"
 
 #define NBD_META_ID_BASE_ALLOCATION 0
 #define NBD_META_ID_ALLOCATION_DEPTH 1
@@ -78,9 +81,31 @@ static int system_errno_to_nbd_errno(int err)
 /* Definitions for opaque data types */
 
 typedef struct NBDRequestData NBDRequestData;
+typedef struct NBDBuffer NBDBuffer;
+typedef struct NBDZeroCopyDeferred NBDZeroCopyDeferred;
+
+/* Data buffer of a READ or WRITE request, recycled through the client */
+struct NBDBuffer {
+    uint8_t *data;
+    size_t size;
+    bool zero_copy; /* data was sent with MSG_ZEROCOPY */
+    QSLIST_ENTRY(NBDBuffer) next;
+};
+
+/*
+ * Buffers of a closed client that the kernel may still send from, and the
+ * socket whose error queue reports when it is done with them
+ */
+struct NBDZeroCopyDeferred {
+    QIOChannelSocket *sioc;
+    QSLIST_HEAD(, NBDBuffer) bufs;
+    int64_t deadline_ms;
+    QSLIST_ENTRY(NBDZeroCopyDeferred) next;
+};
 
 struct NBDRequestData {
     NBDClient *client;
+    NBDBuffer *buf;
     uint8_t *data;
     bool complete;
 };
@@ -101,6 +126,19 @@ struct NBDExport {
     bool allocation_depth;
     BdrvDirtyBitmap **export_bitmaps;
     size_t nr_export_bitmaps;
+    bool zero_copy;
+
+    /* Buffers of closed clients, only accessed from the main loop thread */
+    QSLIST_HEAD(, NBDZeroCopyDeferred) zero_copy_deferred;
+    QEMUTimer *zero_copy_timer;
+
+    /*
+     * IOThreads that new clients are assigned to in round robin order.  Only
+     * accessed from the main loop thread, where negotiation happens.
+     */
+    IOThread **client_iothreads;
+    size_t nr_client_iothreads;
+    size_t next_client_iothread;
 };
 
 static QTAILQ_HEAD(, NBDExport) exports = QTAILQ_HEAD_INITIALIZER(exports);
@@ -128,6 +166,7 @@ struct NBDClient {
     QemuMutex lock;
 
     NBDExport *exp;
+    AioContext *ctx; /* Processes requests if non-NULL, else exp's context */
     QCryptoTLSCreds *tlscreds;
     char *tlsauthz;
     QIOChannelSocket *sioc; /* The underlying data channel */
@@ -153,10 +192,60 @@ struct NBDClient {
     uint32_t opt; /* Current option being negotiated */
     uint32_t optlen; /* remaining length of data in ioc for the option being
                         negotiated now */
+
+    /*
+     * Send NBD_CMD_READ data with MSG_ZEROCOPY.  Only cleared, under
+     * send_lock, when the kernel turns out to copy the data anyway or
+     * the completion notifications can't be read.
+     */
+    bool zero_copy;
+
+    /* Buffers of completed requests, protected by lock */
+    QSLIST_HEAD(, NBDBuffer) free_bufs;
+    unsigned nb_free_bufs;
+    /* Buffers that the socket may still reference, protected by lock */
+    QSLIST_HEAD(, NBDBuffer) zero_copy_bufs;
+    unsigned nb_zero_copy_bufs;
 };
 
 static void nbd_client_receive_next_request(NBDClient *client);
 
+/*
+ * Add @client to the client list of client->exp once negotiation picked the
+ * export, and choose the AioContext that will process its requests.
+ */
+static void nbd_client_attach_export(NBDClient *client)
+{
+    NBDExport *exp = client->exp;
+    IOThread *iothread;
+
+    assert(qemu_in_main_thread());
+
+    QTAILQ_INSERT_TAIL(&exp->clients, client, next);
+    blk_exp_ref(&exp->common);
+
+    if (exp->nr_client_iothreads) {
+        iothread = exp->client_iothreads[exp->next_client_iothread];
+        exp->next_client_iothread = (exp->next_client_iothread + 1) %
+                                    exp->nr_client_iothreads;
+        client->ctx = iothread_get_aio_context(iothread);
+    }
+
+    /*
+     * Only enable SO_ZEROCOPY on the socket if the export asks for it.  Not
+     * available for TLS channels and UNIX domain sockets.
+     */
+    client->zero_copy = exp->zero_copy &&
+        client->ioc == QIO_CHANNEL(client->sioc) &&
+        qio_channel_socket_enable_zero_copy(client->sioc);
+}
+
+/* The AioContext in which requests of @client are processed */
+static AioContext *nbd_client_aio_context(NBDClient *client)
+{
+    return client->ctx ?: client->exp->common.ctx;
+}
+
 /* Basic flow for negotiation
 
    Server         Client
@@ -527,8 +616,7 @@ static int nbd_negotiate_handle_export_name(NBDClient *client, bool no_zeroes,
         return ret;
     }
 
-    QTAILQ_INSERT_TAIL(&client->exp->clients, client, next);
-    blk_exp_ref(&client->exp->common);
+    nbd_client_attach_export(client);
 
     return 0;
 }
@@ -741,8 +829,7 @@ static int nbd_negotiate_handle_info(NBDClient *client, Error **errp)
     if (client->opt == NBD_OPT_GO) {
         client->exp = exp;
         client->check_align = check_align;
-        QTAILQ_INSERT_TAIL(&client->exp->clients, client, next);
-        blk_exp_ref(&client->exp->common);
+        nbd_client_attach_export(client);
         rc = 1;
     }
     return rc;
@@ -1510,6 +1597,321 @@ static int coroutine_fn nbd_receive_request(NBDClient *client, NBDRequest *reque
 
 #define MAX_NBD_REQUESTS 16
 
+/*
+ * Request buffers are allocated in power of two sizes between these limits
+ * and kept for later requests of the same client, up to one per request that
+ * can be in flight.  Larger buffers are freed when the request completes.
+ */
+#define NBD_BUF_POOL_MIN_SIZE (64 * KiB)
+#define NBD_BUF_POOL_MAX_SIZE (4 * MiB)
+
+/*
+ * Look for completed zero copy sends once this many buffers wait for them,
+ * and copy read data instead while there are more than the maximum
+ */
+#define NBD_ZERO_COPY_RECLAIM (MAX_NBD_REQUESTS / 2)
+#define NBD_ZERO_COPY_MAX_PENDING MAX_NBD_REQUESTS
+
+/*
+ * Buffers sent with MSG_ZEROCOPY stay pinned until the kernel reports that
+ * it is done with them, which for TCP needs the peer's acknowledgement.
+ * Copy read data instead once this many bytes are pinned by all clients
+ * together.
+ */
+#define NBD_ZERO_COPY_MAX_PINNED (256 * MiB)
+static size_t nbd_zero_copy_pinned; /* atomic */
+
+/*
+ * The buffers of a closed client are checked this often, and the
+ * connection is reset if the kernel still has not sent them after the
+ * timeout
+ */
+#define NBD_ZERO_COPY_DEFERRED_INTERVAL_MS 1000
+#define NBD_ZERO_COPY_DEFERRED_TIMEOUT_MS (30 * 1000)
+
+static void nbd_buffer_free(NBDBuffer *buf)
+{
+    qemu_vfree(buf->data);
+    g_free(buf);
+}
+
+/* Returns false if @buf can't be sent with MSG_ZEROCOPY */
+static bool nbd_buffer_pin(NBDBuffer *buf)
+{
+    if (qatomic_fetch_add(&nbd_zero_copy_pinned, buf->size) + buf->size >
+        NBD_ZERO_COPY_MAX_PINNED) {
+        qatomic_sub(&nbd_zero_copy_pinned, buf->size);
+        return false;
+    }
+    buf->zero_copy = true;
+    return true;
+}
+
+/* The kernel no longer references @buf */
+static void nbd_buffer_unpin(NBDBuffer *buf)
+{
+    assert(buf->zero_copy);
+    qatomic_sub(&nbd_zero_copy_pinned, buf->size);
+    buf->zero_copy = false;
+}
+
+/*
+ * Get a buffer for a request of @len bytes, from the pool of @client if
+ * possible.  Returns NULL if out of memory.
+ */
+static NBDBuffer *nbd_buffer_get(NBDClient *client, uint64_t len)
+{
+    NBDBuffer *buf;
+    size_t size = len;
+    uint8_t *data;
+
+    if (len <= NBD_BUF_POOL_MAX_SIZE) {
+        size = MAX(pow2ceil(len), NBD_BUF_POOL_MIN_SIZE);
+
+        WITH_QEMU_LOCK_GUARD(&client->lock) {
+            QSLIST_FOREACH(buf, &client->free_bufs, next) {
+                if (buf->size == size) {
+                    QSLIST_REMOVE(&client->free_bufs, buf, NBDBuffer, next);
+                    client->nb_free_bufs--;
+                    buf->zero_copy = false;
+                    return buf;
+                }
+            }
+        }
+    }
+
+    data = blk_try_blockalign(client->exp->common.blk, size);
+    if (!data) {
+        return NULL;
+    }
+
+    buf = g_new(NBDBuffer, 1);
+    *buf = (NBDBuffer) {
+        .data = data,
+        .size = size,
+    };
+    return buf;
+}
+
+/* Called with client->lock held */
+static void nbd_buffer_recycle(NBDClient *client, NBDBuffer *buf)
+{
+    NBDBuffer *old;
+
+    if (buf->size > NBD_BUF_POOL_MAX_SIZE) {
+        nbd_buffer_free(buf);
+        return;
+    }
+
+    /* Make room by dropping the least recently used buffer */
+    if (client->nb_free_bufs == MAX_NBD_REQUESTS) {
+        QSLIST_FOREACH(old, &client->free_bufs, next) {
+            if (!QSLIST_NEXT(old, next)) {
+                break;
+            }
+        }
+        QSLIST_REMOVE(&client->free_bufs, old, NBDBuffer, next);
+        nbd_buffer_free(old);
+        client->nb_free_bufs--;
+    }
+
+    QSLIST_INSERT_HEAD(&client->free_bufs, buf, next);
+    client->nb_free_bufs++;
+}
+
+/*
+ * Return a buffer to the pool of @client.  If its content was sent with
+ * MSG_ZEROCOPY, it is only reused after the kernel reported that the send
+ * completed.  Called with client->lock held.
+ */
+static void nbd_buffer_put(NBDClient *client, NBDBuffer *buf)
+{
+    if (buf->zero_copy) {
+        QSLIST_INSERT_HEAD(&client->zero_copy_bufs, buf, next);
+        client->nb_zero_copy_bufs++;
+    } else {
+        nbd_buffer_recycle(client, buf);
+    }
+}
+
+/*
+ * Process the zero copy completion notifications that the kernel queued for
+ * @client and make the buffers that waited for them available again.
+ *
+ * This never waits for notifications.  For TCP, they only arrive once the
+ * peer acknowledged the data, so waiting would let a slow or malicious
+ * client stall the whole AioContext.  Notifications make the socket report
+ * G_IO_ERR, which wakes up the coroutines of the channel; the socket
+ * channel consumes them then, see qio_channel_socket_readv().
+ *
+ * Returns true if read data may be sent with MSG_ZEROCOPY.  Called with
+ * client->send_lock held.
+ */
+static bool nbd_client_reclaim_zero_copy(NBDClient *client)
+{
+    QSLIST_HEAD(, NBDBuffer) bufs = QSLIST_HEAD_INITIALIZER(bufs);
+    NBDBuffer *buf;
+    Error *local_err = NULL;
+    bool copied;
+    int ret;
+
+    WITH_QEMU_LOCK_GUARD(&client->lock) {
+        if (client->nb_zero_copy_bufs < NBD_ZERO_COPY_RECLAIM) {
+            return true;
+        }
+    }
+
+    ret = qio_channel_socket_zero_copy_poll(client->sioc, &copied,
+                                            &local_err);
+    if (ret < 0) {
+        /*
+         * It is unknown when the kernel will be done with the buffers, so
+         * keep them until the client is closed
+         */
+        trace_nbd_client_zero_copy_poll_failed(client,
+                                               error_get_pretty(local_err));
+        error_free(local_err);
+        qatomic_set(&client->zero_copy, false);
+        return false;
+    }
+
+    if (copied) {
+        /* All of the data was copied, e.g. for a loopback connection */
+        trace_nbd_client_zero_copy_disabled(client);
+        qatomic_set(&client->zero_copy, false);
+    }
+
+    WITH_QEMU_LOCK_GUARD(&client->lock) {
+        /*
+         * Buffers are only put on the list after their data was sent, so
+         * if no send is pending, the kernel is done with all of them
+         */
+        if (ret == 0) {
+            QSLIST_MOVE_ATOMIC(&bufs, &client->zero_copy_bufs);
+            client->nb_zero_copy_bufs = 0;
+            while ((buf = QSLIST_FIRST(&bufs))) {
+                QSLIST_REMOVE_HEAD(&bufs, next);
+                nbd_buffer_unpin(buf);
+                nbd_buffer_recycle(client, buf);
+            }
+        }
+
+        /* Too many buffers are pinned by a slow peer, copy the data */
+        if (client->nb_zero_copy_bufs >= NBD_ZERO_COPY_MAX_PENDING) {
+            return false;
+        }
+    }
+
+    return qatomic_read(&client->zero_copy);
+}
+
+static void nbd_zero_copy_deferred_free(NBDZeroCopyDeferred *d)
+{
+    NBDBuffer *buf;
+
+    while ((buf = QSLIST_FIRST(&d->bufs))) {
+        QSLIST_REMOVE_HEAD(&d->bufs, next);
+        nbd_buffer_unpin(buf);
+        nbd_buffer_free(buf);
+    }
+    object_unref(OBJECT(d->sioc));
+    g_free(d);
+}
+
+/*
+ * Reset the connection of @d and free its buffers.  Closing a socket with
+ * a zero linger time makes the kernel drop all data that it did not send
+ * yet, so it won't send from the buffers anymore.
+ */
+static void nbd_zero_copy_deferred_abort(NBDZeroCopyDeferred *d)
+{
+    struct linger linger = { .l_onoff = 1, .l_linger = 0 };
+
+    trace_nbd_zero_copy_deferred_abort(d->sioc);
+    setsockopt(d->sioc->fd, SOL_SOCKET, SO_LINGER, &linger, sizeof(linger));
+    qio_channel_close(QIO_CHANNEL(d->sioc), NULL);
+    nbd_zero_copy_deferred_free(d);
+}
+
+/* Free the buffers of closed clients that the kernel is done with */
+static void nbd_export_reap_zero_copy(void *opaque)
+{
+    NBDExport *exp = opaque;
+    NBDZeroCopyDeferred *d, *next_d;
+    int64_t now = qemu_clock_get_ms(QEMU_CLOCK_REALTIME);
+    bool copied;
+    int ret;
+
+    QSLIST_FOREACH_SAFE(d, &exp->zero_copy_deferred, next, next_d) {
+        ret = qio_channel_socket_zero_copy_poll(d->sioc, &copied, NULL);
+        if (ret > 0 && now < d->deadline_ms) {
+            continue;
+        }
+
+        QSLIST_REMOVE(&exp->zero_copy_deferred, d, NBDZeroCopyDeferred, next);
+        if (ret == 0) {
+            nbd_zero_copy_deferred_free(d);
+        } else {
+            nbd_zero_copy_deferred_abort(d);
+        }
+    }
+
+    if (!QSLIST_EMPTY(&exp->zero_copy_deferred)) {
+        timer_mod(exp->zero_copy_timer,
+                  now + NBD_ZERO_COPY_DEFERRED_INTERVAL_MS);
+    }
+}
+
+/* Called when no requests are in flight, before the socket is closed */
+static void nbd_client_free_buffers(NBDClient *client)
+{
+    NBDExport *exp = client->exp;
+    NBDZeroCopyDeferred *d;
+    NBDBuffer *buf;
+    bool copied;
+
+    while ((buf = QSLIST_FIRST(&client->free_bufs))) {
+        QSLIST_REMOVE_HEAD(&client->free_bufs, next);
+        nbd_buffer_free(buf);
+    }
+
+    if (QSLIST_EMPTY(&client->zero_copy_bufs)) {
+        return;
+    }
+    if (qio_channel_socket_zero_copy_poll(client->sioc, &copied, NULL) == 0) {
+        while ((buf = QSLIST_FIRST(&client->zero_copy_bufs))) {
+            QSLIST_REMOVE_HEAD(&client->zero_copy_bufs, next);
+            nbd_buffer_unpin(buf);
+            nbd_buffer_free(buf);
+        }
+        return;
+    }
+
+    /*
+     * Sends may still be in flight.  Keep the socket open, so that its
+     * error queue still reports when the kernel is done with the buffers.
+     */
+    trace_nbd_zero_copy_deferred(client->sioc, client->nb_zero_copy_bufs);
+    d = g_new0(NBDZeroCopyDeferred, 1);
+    d->sioc = client->sioc;
+    object_ref(OBJECT(d->sioc));
+    QSLIST_MOVE_ATOMIC(&d->bufs, &client->zero_copy_bufs);
+    client->nb_zero_copy_bufs = 0;
+    d->deadline_ms = qemu_clock_get_ms(QEMU_CLOCK_REALTIME) +
+                     NBD_ZERO_COPY_DEFERRED_TIMEOUT_MS;
+    QSLIST_INSERT_HEAD(&exp->zero_copy_deferred, d, next);
+
+    if (!exp->zero_copy_timer) {
+        exp->zero_copy_timer = timer_new_ms(QEMU_CLOCK_REALTIME,
+                                            nbd_export_reap_zero_copy, exp);
+    }
+    if (!timer_pending(exp->zero_copy_timer)) {
+        timer_mod(exp->zero_copy_timer,
+                  qemu_clock_get_ms(QEMU_CLOCK_REALTIME) +
+                  NBD_ZERO_COPY_DEFERRED_INTERVAL_MS);
+    }
+}
+
 /* Runs in export AioContext and main loop thread */
 void nbd_client_get(NBDClient *client)
 {
@@ -1526,6 +1928,7 @@ void nbd_client_put(NBDClient *client)
          */
         assert(client->closing);
 
+        nbd_client_free_buffers(client);
         object_unref(OBJECT(client->sioc));
         object_unref(OBJECT(client->ioc));
         if (client->tlscreds) {
@@ -1609,8 +2012,8 @@ static void nbd_request_put(NBDRequestData *req)
 {
     NBDClient *client = req->client;
 
-    if (req->data) {
-        qemu_vfree(req->data);
+    if (req->buf) {
+        nbd_buffer_put(client, req->buf);
     }
     g_free(req);
 
@@ -1683,7 +2086,7 @@ static void nbd_drained_end(void *opaque)
     }
 }
 
-/* Runs in export AioContext */
+/* Runs in client AioContext */
 static void nbd_wake_read_bh(void *opaque)
 {
     NBDClient *client = opaque;
@@ -1704,12 +2107,12 @@ static bool nbd_drained_poll(void *opaque)
                  * If there's a coroutine waiting for a request on nbd_read_eof()
                  * enter it here so we don't depend on the client to wake it up.
                  *
-                 * Schedule a BH in the export AioContext to avoid missing the
+                 * Schedule a BH in the client AioContext to avoid missing the
                  * wake up due to the race between qio_channel_wake_read() and
                  * qio_channel_yield().
                  */
                 if (client->recv_coroutine != NULL && client->read_yielding) {
-                    aio_bh_schedule_oneshot(nbd_export_aio_context(client->exp),
+                    aio_bh_schedule_oneshot(nbd_client_aio_context(client),
                                             nbd_wake_read_bh, client);
                 }
 
@@ -1748,6 +2151,18 @@ static const BlockDevOps nbd_block_ops = {
     .drained_poll = nbd_drained_poll,
 };
 
+static void nbd_export_put_client_iothreads(NBDExport *exp)
+{
+    size_t i;
+
+    for (i = 0; i < exp->nr_client_iothreads; i++) {
+        object_unref(OBJECT(exp->client_iothreads[i]));
+    }
+    g_free(exp->client_iothreads);
+    exp->client_iothreads = NULL;
+    exp->nr_client_iothreads = 0;
+}
+
 static int nbd_export_create(BlockExport *blk_exp, BlockExportOptions *exp_args,
                              Error **errp)
 {
@@ -1759,6 +2174,7 @@ static int nbd_export_create(BlockExport *blk_exp, BlockExportOptions *exp_args,
     uint64_t perm, shared_perm;
     bool readonly = !exp_args->writable;
     BlockDirtyBitmapOrStrList *bitmaps;
+    strList *iothreads;
     size_t i;
     int ret;
 
@@ -1785,6 +2201,15 @@ static int nbd_export_create(BlockExport *blk_exp, BlockExportOptions *exp_args,
         return -EEXIST;
     }
 
+    for (iothreads = arg->client_iothreads; iothreads;
+         iothreads = iothreads->next)
+    {
+        if (!iothread_by_id(iothreads->value)) {
+            error_setg(errp, "IOThread '%s' not found", iothreads->value);
+            return -EINVAL;
+        }
+    }
+
     size = blk_getlength(blk);
     if (size < 0) {
         error_setg_errno(errp, -size,
@@ -1817,6 +2242,23 @@ static int nbd_export_create(BlockExport *blk_exp, BlockExportOptions *exp_args,
     }
     exp->size = QEMU_ALIGN_DOWN(size, BDRV_SECTOR_SIZE);
 
+    /*
+     * nbd_client_attach_export() hands out these IOThreads round robin to
+     * new clients, so hold a reference for as long as the export exists.
+     */
+    for (iothreads = arg->client_iothreads; iothreads;
+         iothreads = iothreads->next)
+    {
+        exp->nr_client_iothreads++;
+    }
+    exp->client_iothreads = g_new0(IOThread *, exp->nr_client_iothreads);
+    for (i = 0, iothreads = arg->client_iothreads; iothreads;
+         i++, iothreads = iothreads->next)
+    {
+        exp->client_iothreads[i] = iothread_by_id(iothreads->value);
+        object_ref(OBJECT(exp->client_iothreads[i]));
+    }
+
     bdrv_graph_rdlock_main_loop();
 
     for (bitmaps = arg->bitmaps; bitmaps; bitmaps = bitmaps->next) {
@@ -1887,6 +2329,7 @@ static int nbd_export_create(BlockExport *blk_exp, BlockExportOptions *exp_args,
     }
 
     exp->allocation_depth = arg->allocation_depth;
+    exp->zero_copy = arg->zero_copy;
 
     /*
      * We need to inhibit request queuing in the block layer to ensure we can
@@ -1907,6 +2350,7 @@ static int nbd_export_create(BlockExport *blk_exp, BlockExportOptions *exp_args,
 
 fail:
     bdrv_graph_rdunlock_main_loop();
+    nbd_export_put_client_iothreads(exp);
     g_free(exp->export_bitmaps);
     g_free(exp->name);
     g_free(exp->description);
@@ -1959,10 +2403,17 @@ static void nbd_export_delete(BlockExport *blk_exp)
 {
     size_t i;
     NBDExport *exp = container_of(blk_exp, NBDExport, common);
+    NBDZeroCopyDeferred *d;
 
     assert(exp->name == NULL);
     assert(QTAILQ_EMPTY(&exp->clients));
 
+    while ((d = QSLIST_FIRST(&exp->zero_copy_deferred))) {
+        QSLIST_REMOVE_HEAD(&exp->zero_copy_deferred, next);
+        nbd_zero_copy_deferred_abort(d);
+    }
+    g_clear_pointer(&exp->zero_copy_timer, timer_free);
+
     g_free(exp->description);
     exp->description = NULL;
 
@@ -1977,6 +2428,8 @@ static void nbd_export_delete(BlockExport *blk_exp)
     for (i = 0; i < exp->nr_export_bitmaps; i++) {
         bdrv_dirty_bitmap_set_busy(exp->export_bitmaps[i], false);
     }
+
+    nbd_export_put_client_iothreads(exp);
 }
 
 const BlockExportDriver blk_exp_nbd = {
@@ -1987,8 +2440,15 @@ const BlockExportDriver blk_exp_nbd = {
     .request_shutdown   = nbd_export_request_shutdown,
 };
 
-static int coroutine_fn nbd_co_send_iov(NBDClient *client, struct iovec *iov,
-                                        unsigned niov, Error **errp)
+/*
+ * Send @iov to the client.  If @buf is not NULL, the last element of @iov is
+ * the data of an NBD_CMD_READ reply in @buf, which is sent with MSG_ZEROCOPY
+ * if enabled for the client.  The headers in the other elements usually live
+ * on the stack, so they are always copied.
+ */
+static int coroutine_fn nbd_co_send_iov_full(NBDClient *client,
+                                             struct iovec *iov, unsigned niov,
+                                             NBDBuffer *buf, Error **errp)
 {
     int ret;
 
@@ -1996,7 +2456,23 @@ static int coroutine_fn nbd_co_send_iov(NBDClient *client, struct iovec *iov,
     qemu_co_mutex_lock(&client->send_lock);
     client->send_coroutine = qemu_coroutine_self();
 
-    ret = qio_channel_writev_all(client->ioc, iov, niov, errp) < 0 ? -EIO : 0;
+    if (buf && qatomic_read(&client->zero_copy) &&
+        nbd_client_reclaim_zero_copy(client) && nbd_buffer_pin(buf)) {
+        ret = qio_channel_writev_all(client->ioc, iov, niov - 1, errp);
+        if (ret == 0) {
+            /* From now on, the kernel may reference the buffer */
+            ret = qio_channel_writev_full_all(client->ioc, &iov[niov - 1], 1,
+                                              NULL, 0,
+                                              QIO_CHANNEL_WRITE_FLAG_ZERO_COPY,
+                                              errp);
+        } else {
+            nbd_buffer_unpin(buf);
+        }
+        ret = ret < 0 ? -EIO : 0;
+    } else {
+        ret = qio_channel_writev_all(client->ioc, iov, niov, errp) < 0 ?
+              -EIO : 0;
+    }
 
     client->send_coroutine = NULL;
     qemu_co_mutex_unlock(&client->send_lock);
@@ -2004,6 +2480,12 @@ static int coroutine_fn nbd_co_send_iov(NBDClient *client, struct iovec *iov,
     return ret;
 }
 
+static int coroutine_fn nbd_co_send_iov(NBDClient *client, struct iovec *iov,
+                                        unsigned niov, Error **errp)
+{
+    return nbd_co_send_iov_full(client, iov, niov, NULL, errp);
+}
+
 static inline void set_be_simple_reply(NBDSimpleReply *reply, uint64_t error,
                                        uint64_t cookie)
 {
@@ -2015,7 +2497,7 @@ static inline void set_be_simple_reply(NBDSimpleReply *reply, uint64_t error,
 static int coroutine_fn nbd_co_send_simple_reply(NBDClient *client,
                                                  NBDRequest *request,
                                                  uint32_t error,
-                                                 void *data,
+                                                 NBDBuffer *buf,
                                                  uint64_t len,
                                                  Error **errp)
 {
@@ -2023,7 +2505,7 @@ static int coroutine_fn nbd_co_send_simple_reply(NBDClient *client,
     int nbd_err = system_errno_to_nbd_errno(error);
     struct iovec iov[] = {
         {.iov_base = &reply, .iov_len = sizeof(reply)},
-        {.iov_base = data, .iov_len = len}
+        {.iov_base = buf ? buf->data : NULL, .iov_len = len}
     };
 
     assert(!len || !nbd_err);
@@ -2035,7 +2517,7 @@ static int coroutine_fn nbd_co_send_simple_reply(NBDClient *client,
                                    nbd_err_lookup(nbd_err), len);
     set_be_simple_reply(&reply, nbd_err, request->cookie);
 
-    return nbd_co_send_iov(client, iov, 2, errp);
+    return nbd_co_send_iov_full(client, iov, 2, len ? buf : NULL, errp);
 }
 
 /*
@@ -2097,13 +2579,15 @@ static int coroutine_fn nbd_co_send_chunk_done(NBDClient *client,
 static int coroutine_fn nbd_co_send_chunk_read(NBDClient *client,
                                                NBDRequest *request,
                                                uint64_t offset,
-                                               void *data,
+                                               NBDBuffer *buf,
+                                               size_t buf_offset,
                                                uint64_t size,
                                                bool final,
                                                Error **errp)
 {
     NBDReply hdr;
     NBDStructuredReadData chunk;
+    void *data = buf->data + buf_offset;
     struct iovec iov[] = {
         {.iov_base = &hdr},
         {.iov_base = &chunk, .iov_len = sizeof(chunk)},
@@ -2116,7 +2600,7 @@ static int coroutine_fn nbd_co_send_chunk_read(NBDClient *client,
                  NBD_REPLY_TYPE_OFFSET_DATA, request);
     stq_be_p(&chunk.offset, offset);
 
-    return nbd_co_send_iov(client, iov, 3, errp);
+    return nbd_co_send_iov_full(client, iov, 3, buf, errp);
 }
 
 static int coroutine_fn nbd_co_send_chunk_error(NBDClient *client,
@@ -2152,7 +2636,7 @@ static int coroutine_fn nbd_co_send_chunk_error(NBDClient *client,
 static int coroutine_fn nbd_co_send_sparse_read(NBDClient *client,
                                                 NBDRequest *request,
                                                 uint64_t offset,
-                                                uint8_t *data,
+                                                NBDBuffer *buf,
                                                 uint64_t size,
                                                 Error **errp)
 {
@@ -2197,13 +2681,13 @@ static int coroutine_fn nbd_co_send_sparse_read(NBDClient *client,
             ret = nbd_co_send_iov(client, iov, 2, errp);
         } else {
             ret = blk_co_pread(exp->common.blk, offset + progress, pnum,
-                               data + progress, 0);
+                               buf->data + progress, 0);
             if (ret < 0) {
                 error_setg_errno(errp, -ret, "reading from file failed");
                 break;
             }
             ret = nbd_co_send_chunk_read(client, request, offset + progress,
-                                         data + progress, pnum, final, errp);
+                                         buf, progress, pnum, final, errp);
         }
 
         if (ret < 0) {
@@ -2716,12 +3200,12 @@ static int coroutine_fn nbd_co_receive_request(NBDRequestData *req,
     }
     if (allocate_buffer) {
         /* READ, WRITE */
-        req->data = blk_try_blockalign(client->exp->common.blk,
-                                       request->len);
-        if (req->data == NULL) {
+        req->buf = nbd_buffer_get(client, request->len);
+        if (req->buf == NULL) {
             error_setg(errp, "No memory");
             return -ENOMEM;
         }
+        req->data = req->buf->data;
     }
     if (payload_len) {
         if (payload_okay) {
@@ -2798,7 +3282,7 @@ static coroutine_fn int nbd_send_generic_reply(NBDClient *client,
  * Return -errno if sending fails. Other errors are reported directly to the
  * client as an error reply. */
 static coroutine_fn int nbd_do_cmd_read(NBDClient *client, NBDRequest *request,
-                                        uint8_t *data, Error **errp)
+                                        NBDBuffer *buf, Error **errp)
 {
     int ret;
     NBDExport *exp = client->exp;
@@ -2819,10 +3303,11 @@ static coroutine_fn int nbd_do_cmd_read(NBDClient *client, NBDRequest *request,
         !(request->flags & NBD_CMD_FLAG_DF) && request->len)
     {
         return nbd_co_send_sparse_read(client, request, request->from,
-                                       data, request->len, errp);
+                                       buf, request->len, errp);
     }
 
-    ret = blk_co_pread(exp->common.blk, request->from, request->len, data, 0);
+    ret = blk_co_pread(exp->common.blk, request->from, request->len,
+                       buf->data, 0);
     if (ret < 0) {
         return nbd_send_generic_reply(client, request, ret,
                                       "reading from file failed", errp);
@@ -2830,14 +3315,14 @@ static coroutine_fn int nbd_do_cmd_read(NBDClient *client, NBDRequest *request,
 
     if (client->mode >= NBD_MODE_STRUCTURED) {
         if (request->len) {
-            return nbd_co_send_chunk_read(client, request, request->from, data,
-                                          request->len, true, errp);
+            return nbd_co_send_chunk_read(client, request, request->from, buf,
+                                          0, request->len, true, errp);
         } else {
             return nbd_co_send_chunk_done(client, request, errp);
         }
     } else {
         return nbd_co_send_simple_reply(client, request, 0,
-                                        data, request->len, errp);
+                                        buf, request->len, errp);
     }
 }
 
@@ -2869,7 +3354,7 @@ static coroutine_fn int nbd_do_cmd_cache(NBDClient *client, NBDRequest *request,
  * client as an error reply. */
 static coroutine_fn int nbd_handle_request(NBDClient *client,
                                            NBDRequest *request,
-                                           uint8_t *data, Error **errp)
+                                           NBDBuffer *buf, Error **errp)
 {
     int ret;
     int flags;
@@ -2882,7 +3367,7 @@ static coroutine_fn int nbd_handle_request(NBDClient *client,
         return nbd_do_cmd_cache(client, request, errp);
 
     case NBD_CMD_READ:
-        return nbd_do_cmd_read(client, request, data, errp);
+        return nbd_do_cmd_read(client, request, buf, errp);
 
     case NBD_CMD_WRITE:
         flags = 0;
@@ -2890,8 +3375,8 @@ static coroutine_fn int nbd_handle_request(NBDClient *client,
             flags |= BDRV_REQ_FUA;
         }
         assert(request->len <= NBD_MAX_BUFFER_SIZE);
-        ret = blk_co_pwrite(exp->common.blk, request->from, request->len, data,
-                            flags);
+        ret = blk_co_pwrite(exp->common.blk, request->from, request->len,
+                            buf->data, flags);
         return nbd_send_generic_reply(client, request, ret,
                                       "writing to file failed", errp);
 
@@ -3086,7 +3571,7 @@ static coroutine_fn void nbd_trip(void *opaque)
                                      error_get_pretty(export_err), &local_err);
         error_free(export_err);
     } else {
-        ret = nbd_handle_request(client, &request, req->data, &local_err);
+        ret = nbd_handle_request(client, &request, req->buf, &local_err);
     }
     if (request.contexts && request.contexts != &client->contexts) {
         assert(request.type == NBD_CMD_BLOCK_STATUS);
@@ -3138,7 +3623,7 @@ disconnect:
 }
 
 /*
- * Runs in export AioContext and main loop thread. Caller must hold
+ * Runs in client AioContext and main loop thread. Caller must hold
  * client->lock.
  */
 static void nbd_client_receive_next_request(NBDClient *client)
@@ -3147,7 +3632,7 @@ static void nbd_client_receive_next_request(NBDClient *client)
         !client->quiescing) {
         nbd_client_get(client);
         client->recv_coroutine = qemu_coroutine_create(nbd_trip, client);
-        aio_co_schedule(client->exp->common.ctx, client->recv_coroutine);
+        aio_co_schedule(nbd_client_aio_context(client), client->recv_coroutine);
     }
 }
 
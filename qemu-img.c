@@ -41,6 +41,7 @@
 #include "qemu/log.h"
 #include "qemu/main-loop.h"
 #include "qemu/module.h"
+#include "qemu/rcu.h"
 #include "qemu/sockets.h"
 #include "qemu/units.h"
 #include "qemu/memalign.h"
@@ -86,6 +87,7 @@ enum {
     OPTION_BITMAPS = 275,
     OPTION_FORCE = 276,
     OPTION_SKIP_BROKEN = 277,
+    OPTION_THREADS = 278,
 };
 
 typedef enum OutputFormat {
@@ -207,6 +209,8 @@ void help(void)
            "  '-m' specifies how many coroutines work in parallel during the convert\n"
            "       process (defaults to 8)\n"
            "  '-W' allow to write to the target out of order rather than sequential\n"
+           "  '--threads' specifies how many threads run the coroutines given by '-m'\n"
+           "       (requires '-W')\n"
            "\n"
            "Parameters to snapshot subcommand:\n"
            "  'snapshot' is the name of the snapshot to create, apply or delete\n"
@@ -1273,6 +1277,31 @@ static int is_allocated_sectors_min(const uint8_t *buf, int n, int *pnum,
     return 1;
 }
 
+/*
+ * Returns true if the first cluster of the buffer contains data and false if
+ * it is zeroed.  *pnum is set to the number of sectors up to the first
+ * cluster for which this is different.
+ */
+static bool is_allocated_clusters(const uint8_t *buf, int n, int *pnum,
+                                  int cluster_sectors)
+{
+    bool is_zero;
+    int i, len;
+
+    len = MIN(n, cluster_sectors);
+    is_zero = buffer_is_zero(buf, len * BDRV_SECTOR_SIZE);
+    for (i = len; i < n; i += len) {
+        len = MIN(n - i, cluster_sectors);
+        if (buffer_is_zero(buf + i * BDRV_SECTOR_SIZE,
+                           len * BDRV_SECTOR_SIZE) != is_zero) {
+            break;
+        }
+    }
+
+    *pnum = i;
+    return !is_zero;
+}
+
 /*
  * Compares two buffers chunk by chunk, where @chsize is the chunk size.
  * If @chsize is 0, default chunk size of BDRV_SECTOR_SIZE is used.
@@ -1667,6 +1696,20 @@ enum ImgConvertBlockStatus {
 #define MAX_COROUTINES 16
 #define CONVERT_THROTTLE_GROUP "img_convert"
 
+/* A range of the source with the same allocation status, in sectors */
+typedef struct ImgConvertExtent {
+    int64_t start;
+    int64_t end;
+    enum ImgConvertBlockStatus status;
+} ImgConvertExtent;
+
+/* A thread with its own AioContext that runs some of the copy coroutines */
+typedef struct ImgConvertWorker {
+    QemuThread thread;
+    AioContext *ctx;
+    bool stopping;
+} ImgConvertWorker;
+
 typedef struct ImgConvertState {
     BlockBackend **src;
     int64_t *src_sectors;
@@ -1679,6 +1722,7 @@ typedef struct ImgConvertState {
     int64_t wr_offs;
     enum ImgConvertBlockStatus status;
     int64_t sector_next_status;
+    GArray *extents; /* of ImgConvertExtent, filled by the first pass */
     BlockBackend *target;
     bool has_zero_init;
     bool compressed;
@@ -1694,6 +1738,8 @@ typedef struct ImgConvertState {
     size_t cluster_sectors;
     size_t buf_sectors;
     long num_coroutines;
+    int num_threads; /* 0 to run all coroutines in the main loop */
+    ImgConvertWorker *workers;
     int running_coroutines;
     Coroutine *co[MAX_COROUTINES];
     int64_t wait_sector_num[MAX_COROUTINES];
@@ -1713,6 +1759,58 @@ static void convert_select_part(ImgConvertState *s, int64_t sector_num,
     }
 }
 
+/*
+ * Record the status of [start, end) in the extent map.  The first pass walks
+ * the source in order, so the map stays sorted; ranges that are looked up
+ * again during the copy are not recorded a second time.
+ */
+static void convert_add_extent(ImgConvertState *s, int64_t start, int64_t end,
+                               enum ImgConvertBlockStatus status)
+{
+    ImgConvertExtent *last = NULL;
+    ImgConvertExtent e = {
+        .start  = start,
+        .end    = end,
+        .status = status,
+    };
+
+    if (s->extents->len) {
+        last = &g_array_index(s->extents, ImgConvertExtent,
+                              s->extents->len - 1);
+        if (start < last->end) {
+            return;
+        }
+    }
+
+    if (last && last->end == start && last->status == status) {
+        last->end = end;
+    } else {
+        g_array_append_val(s->extents, e);
+    }
+}
+
+static ImgConvertExtent *convert_find_extent(ImgConvertState *s,
+                                             int64_t sector_num)
+{
+    ImgConvertExtent *extents = (ImgConvertExtent *)s->extents->data;
+    guint lo = 0, hi = s->extents->len;
+
+    while (lo < hi) {
+        guint mid = lo + (hi - lo) / 2;
+
+        if (extents[mid].end <= sector_num) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+
+    if (lo < s->extents->len && extents[lo].start <= sector_num) {
+        return &extents[lo];
+    }
+    return NULL;
+}
+
 static int coroutine_mixed_fn GRAPH_RDLOCK
 convert_iteration_sectors(ImgConvertState *s, int64_t sector_num)
 {
@@ -1735,6 +1833,15 @@ convert_iteration_sectors(ImgConvertState *s, int64_t sector_num)
         }
     }
 
+    if (s->sector_next_status <= sector_num) {
+        ImgConvertExtent *e = convert_find_extent(s, sector_num);
+
+        if (e) {
+            s->status = e->status;
+            s->sector_next_status = e->end;
+        }
+    }
+
     if (s->sector_next_status <= sector_num) {
         uint64_t offset = (sector_num - src_cur_offset) * BDRV_SECTOR_SIZE;
         int64_t count;
@@ -1798,6 +1905,7 @@ convert_iteration_sectors(ImgConvertState *s, int64_t sector_num)
         }
 
         s->sector_next_status = sector_num + n;
+        convert_add_extent(s, sector_num, s->sector_next_status, s->status);
     }
 
     n = MIN(n, s->sector_next_status - sector_num);
@@ -1897,14 +2005,14 @@ static int coroutine_fn convert_co_write(ImgConvertState *s, int64_t sector_num,
              * is real non-zero data, we must write it. Otherwise we can treat
              * it as zero sectors.
              * Compressed clusters need to be written as a whole, so in that
-             * case we can only save the write if the buffer is completely
-             * zeroed. */
+             * case we can only save the write for clusters that are
+             * completely zeroed. */
             if (!s->min_sparse ||
                 (!s->compressed &&
                  is_allocated_sectors_min(buf, n, &n, s->min_sparse,
                                           sector_num, s->alignment)) ||
                 (s->compressed &&
-                 !buffer_is_zero(buf, n * BDRV_SECTOR_SIZE)))
+                 is_allocated_clusters(buf, n, &n, s->cluster_sectors)))
             {
                 ret = blk_co_pwrite(s->target, sector_num << BDRV_SECTOR_BITS,
                                     n << BDRV_SECTOR_BITS, buf, flags);
@@ -1984,7 +2092,6 @@ static void coroutine_fn convert_co_do_copy(void *opaque)
     }
     assert(index >= 0);
 
-    s->running_coroutines++;
     buf = blk_blockalign(s->target, s->buf_sectors * BDRV_SECTOR_SIZE);
 
     while (1) {
@@ -2015,16 +2122,15 @@ static void coroutine_fn convert_co_do_copy(void *opaque)
         /* increment global sector counter so that other coroutines can
          * already continue reading beyond this request */
         s->sector_num += n;
-        qemu_co_mutex_unlock(&s->lock);
-
         if (status == BLK_DATA || (!s->min_sparse && status == BLK_ZERO)) {
             s->allocated_done += n;
             qemu_progress_print(100.0 * s->allocated_done /
                                         s->allocated_sectors, 0);
         }
+        qemu_co_mutex_unlock(&s->lock);
 
 retry:
-        copy_range = s->copy_range && s->status == BLK_DATA;
+        copy_range = qatomic_read(&s->copy_range) && status == BLK_DATA;
         if (status == BLK_DATA && !copy_range) {
             ret = convert_co_read(s, sector_num, n, buf);
             if (ret < 0) {
@@ -2052,7 +2158,7 @@ retry:
                     ret = convert_co_copy_range(s, sector_num, n);
                 }
                 if (ret) {
-                    s->copy_range = false;
+                    qatomic_set(&s->copy_range, false);
                     goto retry;
                 }
             } else {
@@ -2085,13 +2191,74 @@ retry:
 
     qemu_vfree(buf);
     s->co[index] = NULL;
-    s->running_coroutines--;
-    if (!s->running_coroutines && s->ret == -EINPROGRESS) {
-        /* the convert job finished successfully */
-        s->ret = 0;
+    if (qatomic_fetch_dec(&s->running_coroutines) == 1) {
+        /* wake up convert_do_copy() if we ran in a worker thread */
+        qemu_notify_event();
     }
 }
 
+static void *convert_worker_run(void *opaque)
+{
+    ImgConvertWorker *w = opaque;
+
+    rcu_register_thread();
+    qemu_set_current_aio_context(w->ctx);
+
+    while (!qatomic_read(&w->stopping)) {
+        aio_poll(w->ctx, true);
+    }
+
+    rcu_unregister_thread();
+    return NULL;
+}
+
+static void convert_worker_stop_bh(void *opaque)
+{
+    ImgConvertWorker *w = opaque;
+
+    qatomic_set(&w->stopping, true);
+}
+
+static int convert_start_workers(ImgConvertState *s)
+{
+    Error *local_err = NULL;
+    int i;
+
+    s->workers = g_new0(ImgConvertWorker, s->num_threads);
+    for (i = 0; i < s->num_threads; i++) {
+        ImgConvertWorker *w = &s->workers[i];
+        g_autofree char *name = g_strdup_printf("convert-%d", i);
+
+        w->ctx = aio_context_new(&local_err);
+        if (!w->ctx) {
+            error_report_err(local_err);
+            return -EINVAL;
+        }
+        qemu_thread_create(&w->thread, name, convert_worker_run, w,
+                           QEMU_THREAD_JOINABLE);
+    }
+    return 0;
+}
+
+static void convert_stop_workers(ImgConvertState *s)
+{
+    int i;
+
+    if (!s->workers) {
+        return;
+    }
+
+    for (i = 0; i < s->num_threads && s->workers[i].ctx; i++) {
+        ImgConvertWorker *w = &s->workers[i];
+
+        aio_bh_schedule_oneshot(w->ctx, convert_worker_stop_bh, w);
+        qemu_thread_join(&w->thread);
+        aio_context_unref(w->ctx);
+    }
+    g_free(s->workers);
+    s->workers = NULL;
+}
+
 static int convert_do_copy(ImgConvertState *s)
 {
     int ret, i, n;
@@ -2105,22 +2272,30 @@ static int convert_do_copy(ImgConvertState *s)
         bdrv_graph_rdunlock_main_loop();
     }
 
-    /* Allocate buffer for copied data. For compressed images, only one cluster
-     * can be copied at a time. */
+    /* Allocate buffer for copied data. For compressed images, only whole
+     * clusters can be written; a request with several clusters lets the
+     * format driver compress them in parallel. */
     if (s->compressed) {
         if (s->cluster_sectors <= 0 || s->cluster_sectors > s->buf_sectors) {
             error_report("invalid cluster size");
             return -EINVAL;
         }
-        s->buf_sectors = s->cluster_sectors;
+        s->buf_sectors = QEMU_ALIGN_DOWN(s->buf_sectors, s->cluster_sectors);
     }
 
+    /*
+     * The first pass collects the allocation status of the whole source, so
+     * that the copy itself does not have to query it again.
+     */
+    s->extents = g_array_new(false, false, sizeof(ImgConvertExtent));
+
     while (sector_num < s->total_sectors) {
         bdrv_graph_rdlock_main_loop();
         n = convert_iteration_sectors(s, sector_num);
         bdrv_graph_rdunlock_main_loop();
         if (n < 0) {
-            return n;
+            ret = n;
+            goto out;
         }
         if (s->status == BLK_DATA || (!s->min_sparse && s->status == BLK_ZERO))
         {
@@ -2133,26 +2308,49 @@ static int convert_do_copy(ImgConvertState *s)
     s->sector_next_status = 0;
     s->ret = -EINPROGRESS;
 
+    if (s->num_threads) {
+        ret = convert_start_workers(s);
+        if (ret < 0) {
+            goto out;
+        }
+    }
+
     qemu_co_mutex_init(&s->lock);
+    s->running_coroutines = s->num_coroutines;
     for (i = 0; i < s->num_coroutines; i++) {
         s->co[i] = qemu_coroutine_create(convert_co_do_copy, s);
         s->wait_sector_num[i] = -1;
-        qemu_coroutine_enter(s->co[i]);
+        if (s->num_threads) {
+            aio_co_enter(s->workers[i % s->num_threads].ctx, s->co[i]);
+        } else {
+            qemu_coroutine_enter(s->co[i]);
+        }
     }
 
-    while (s->running_coroutines) {
+    while (qatomic_read(&s->running_coroutines)) {
         main_loop_wait(false);
     }
+    convert_stop_workers(s);
+
+    if (s->ret == -EINPROGRESS) {
+        /* the convert job finished successfully */
+        s->ret = 0;
+    }
 
     if (s->compressed && !s->ret) {
         /* signal EOF to align */
         ret = blk_pwrite_compressed(s->target, 0, 0, NULL);
         if (ret < 0) {
-            return ret;
+            goto out;
         }
     }
 
-    return s->ret;
+    ret = s->ret;
+out:
+    convert_stop_workers(s);
+    g_array_free(s->extents, true);
+    s->extents = NULL;
+    return ret;
 }
 
 /* Check that bitmaps can be copied, or output an error */
@@ -2220,6 +2418,33 @@ static int convert_copy_bitmaps(BlockDriverState *src, BlockDriverState *dst,
 
 #define MAX_BUF_SECTORS 32768
 
+/* Whether @blk is a host file or device, possibly with a raw format on top */
+static bool GRAPH_RDLOCK convert_is_file(BlockBackend *blk)
+{
+    BlockDriverState *bs = bdrv_skip_filters(blk_bs(blk));
+
+    if (bs && !strcmp(bs->drv->format_name, "raw")) {
+        bs = bdrv_primary_bs(bs);
+    }
+    return bs && (!strcmp(bs->drv->format_name, "file") ||
+                  !strcmp(bs->drv->format_name, "host_device"));
+}
+
+static bool convert_can_offload(ImgConvertState *s)
+{
+    bool ret;
+    int i;
+
+    bdrv_graph_rdlock_main_loop();
+    ret = convert_is_file(s->target);
+    for (i = 0; i < s->src_num && ret; i++) {
+        ret = convert_is_file(s->src[i]);
+    }
+    bdrv_graph_rdunlock_main_loop();
+
+    return ret;
+}
+
 static void set_rate_limit(BlockBackend *blk, int64_t rate_limit)
 {
     ThrottleConfig cfg;
@@ -2275,6 +2500,7 @@ static int img_convert(int argc, char **argv)
             {"target-is-zero", no_argument, 0, OPTION_TARGET_IS_ZERO},
             {"bitmaps", no_argument, 0, OPTION_BITMAPS},
             {"skip-broken-bitmaps", no_argument, 0, OPTION_SKIP_BROKEN},
+            {"threads", required_argument, 0, OPTION_THREADS},
             {0, 0, 0, 0}
         };
         c = getopt_long(argc, argv, ":hf:O:B:CcF:o:l:S:pt:T:qnm:WUr:",
@@ -2374,6 +2600,14 @@ static int img_convert(int argc, char **argv)
         case 'W':
             s.wr_in_order = false;
             break;
+        case OPTION_THREADS:
+            if (qemu_strtoi(optarg, NULL, 0, &s.num_threads) ||
+                s.num_threads < 1 || s.num_threads > MAX_COROUTINES) {
+                error_report("Invalid number of threads. Allowed number of"
+                             " threads is between 1 and %d", MAX_COROUTINES);
+                goto fail_getopt;
+            }
+            break;
         case 'U':
             force_share = true;
             break;
@@ -2426,7 +2660,7 @@ static int img_convert(int argc, char **argv)
         goto fail_getopt;
     }
 
-    if (explict_min_sparse && s.copy_range) {
+    if (explict_min_sparse && s.min_sparse && s.copy_range) {
         error_report("Cannot enable copy offloading when -S is used");
         goto fail_getopt;
     }
@@ -2436,6 +2670,21 @@ static int img_convert(int argc, char **argv)
         goto fail_getopt;
     }
 
+    if (s.num_threads && s.wr_in_order) {
+        error_report("--threads requires out-of-order writes (-W)");
+        goto fail_getopt;
+    }
+
+    if (s.num_threads > s.num_coroutines) {
+        error_report("Cannot use more threads than coroutines (-m)");
+        goto fail_getopt;
+    }
+
+    if (s.num_threads && rate_limit) {
+        error_report("Cannot use a rate limit together with --threads");
+        goto fail_getopt;
+    }
+
     if (tgt_image_opts && !skip_create) {
         error_report("--target-image-opts requires use of -n flag");
         goto fail_getopt;
@@ -2779,6 +3028,16 @@ static int img_convert(int argc, char **argv)
         s.cluster_sectors = bdi.cluster_size / BDRV_SECTOR_SIZE;
     }
 
+    /*
+     * Without sparse detection, copying through a bounce buffer gives the same
+     * result as offloading the copy, so let the host do it if both ends are
+     * plain files (e.g. with copy_file_range()).
+     */
+    if (!s.copy_range && !s.min_sparse && !s.compressed && !s.salvage &&
+        !rate_limit && convert_can_offload(&s)) {
+        s.copy_range = true;
+    }
+
     if (rate_limit) {
         set_rate_limit(s.target, rate_limit);
     }
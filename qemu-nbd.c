@@ -70,6 +70,7 @@
 #define QEMU_NBD_OPT_PID_FILE      265
 #define QEMU_NBD_OPT_SELINUX_LABEL 266
 #define QEMU_NBD_OPT_TLSHOSTNAME   267
+#define QEMU_NBD_OPT_CLIENT_IOTHREAD 268
 
 #define MBR_SIZE 512
 
@@ -101,6 +102,8 @@ static void usage(const char *name)
 "  -v, --verbose             display extra debugging information\n"
 "  -x, --export-name=NAME    expose export by name (default is empty string)\n"
 "  -D, --description=TEXT    export a human-readable description\n"
+"  --client-iothread=ID      process client requests in IOThread object ID,\n"
+"                            repeat to spread clients over several IOThreads\n"
 "\n"
 "Exposing part of the image:\n"
 "  -o, --offset=OFFSET       offset into the image\n"
@@ -575,6 +578,8 @@ int main(int argc, char **argv)
         { "pid-file", required_argument, NULL, QEMU_NBD_OPT_PID_FILE },
         { "selinux-label", required_argument, NULL,
           QEMU_NBD_OPT_SELINUX_LABEL },
+        { "client-iothread", required_argument, NULL,
+          QEMU_NBD_OPT_CLIENT_IOTHREAD },
         { NULL, 0, NULL, 0 }
     };
     int ch;
@@ -592,6 +597,8 @@ int main(int argc, char **argv)
     const char *export_name = NULL; /* defaults to "" later for server mode */
     const char *export_description = NULL;
     BlockDirtyBitmapOrStrList *bitmaps = NULL;
+    strList *client_iothreads = NULL;
+    strList **client_iothreads_tail = &client_iothreads;
     bool alloc_depth = false;
     const char *tlscredsid = NULL;
     const char *tlshostname = NULL;
@@ -811,6 +818,9 @@ int main(int argc, char **argv)
         case QEMU_NBD_OPT_SELINUX_LABEL:
             selinux_label = optarg;
             break;
+        case QEMU_NBD_OPT_CLIENT_IOTHREAD:
+            QAPI_LIST_APPEND(client_iothreads_tail, g_strdup(optarg));
+            break;
         }
     }
 
@@ -1166,6 +1176,7 @@ int main(int argc, char **argv)
             .bitmaps              = bitmaps,
             .has_allocation_depth = alloc_depth,
             .allocation_depth     = alloc_depth,
+            .client_iothreads     = client_iothreads,
         },
     };
     blk_exp_add(export_opts, &error_fatal);
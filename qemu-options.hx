@@ -186,6 +186,7 @@ DEF("accel", HAS_ARG, QEMU_OPTION_accel,
     "                split-wx=on|off (enable TCG split w^x mapping)\n"
     "                tb-size=n (TCG translation block cache size)\n"
     "                dirty-ring-size=n (KVM dirty ring GFN count, default 0)\n"
+    "                dirty-ring-reapers=n (KVM dirty ring reaper threads, default 1)\n"
     "                eager-split-size=n (KVM Eager Page Split chunk size, default 0, disabled. ARM only)\n"
     "                notify-vmexit=run|internal-error|disable,notify-window=n (enable notify VM exit and set notify window, x86 only)\n"
     "                thread=single|multi (enable multi-threaded TCG)\n", QEMU_ARCH_ALL)
@@ -245,6 +246,15 @@ SRST
         is disabled (dirty-ring-size=0).  When enabled, KVM will instead
         record dirty pages in a bitmap.
 
+    ``dirty-ring-reapers=n``
+        When the KVM dirty ring is enabled, it sets the number of threads
+        that collect dirty pages from the per-vCPU rings.  With more than
+        one reaper, the vCPUs are split among them by index and each reaper
+        collects its own share without taking the big QEMU lock; a vCPU
+        whose ring fills up also only collects the rings of its own share.
+        This helps guests with many vCPUs and a high dirty rate.  The
+        default is 1.
+
     ``eager-split-size=n``
         KVM implements dirty page logging at the PAGE_SIZE granularity and
         enabling dirty-logging on a huge-page requires breaking it into
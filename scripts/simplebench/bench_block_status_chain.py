@@ -0,0 +1,198 @@
+#!/usr/bin/env python3
+#
+# Compare block status queries over NBD on a deep qcow2 backing chain for two
+# qemu-nbd binaries
+#
+# Each of the ten layers has data in its own clusters, so that answering a
+# query for any part of the image needs to look at most layers.  The map of
+# the export is fetched several times from the same server, like a backup
+# tool polling for allocated areas does, so that results that were cached
+# for the first map can be reused by the following ones.
+#
+# This program is free software; you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation; either version 2 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program.  If not, see <http://www.gnu.org/licenses/>.
+#
+
+
+import sys
+import os
+import time
+import subprocess
+import tempfile
+import simplebench
+from results_to_text import results_to_text
+
+
+IMAGE_SIZE = 4 * 1024 * 1024 * 1024
+CLUSTER_SIZE = 64 * 1024
+CHAIN_LENGTH = 10
+MAP_RUNS = 5
+START_TIMEOUT = 10
+
+
+def qemu_img_pipe(*args):
+    '''Run qemu-img and return its exit code and output'''
+    subp = subprocess.run(list(args), stdout=subprocess.PIPE,
+                          stderr=subprocess.STDOUT,
+                          universal_newlines=True, check=False)
+    if subp.returncode < 0:
+        sys.stderr.write('qemu-img received signal %i: %s\n'
+                         % (-subp.returncode, ' '.join(list(args))))
+    return subp.returncode, subp.stdout
+
+
+def create_chain(qemu_img, image_dir, step):
+    """Create the backing chain and return the name of the top image
+
+    Layer i has data in every cluster whose index modulo @step is i, so for
+    @step == CHAIN_LENGTH every cluster is allocated in exactly one layer,
+    and larger values leave holes between them.
+    """
+    images = [os.path.join(image_dir, f'chain{i}.qcow2')
+              for i in range(CHAIN_LENGTH)]
+
+    for i, image in enumerate(images):
+        args_create = [qemu_img, 'create', '-f', 'qcow2',
+                       '-o', f'cluster_size={CLUSTER_SIZE}', image,
+                       str(IMAGE_SIZE)]
+        if i > 0:
+            args_create[4:4] = ['-F', 'qcow2', '-b', images[i - 1]]
+
+        args_fill = [qemu_img, 'bench', '-w', '-f', 'qcow2',
+                     '-c', str(IMAGE_SIZE // (CLUSTER_SIZE * step)),
+                     '-s', str(CLUSTER_SIZE), '-S', str(CLUSTER_SIZE * step),
+                     '-o', str(CLUSTER_SIZE * i), image]
+
+        for args in (args_create, args_fill):
+            ret, out = qemu_img_pipe(*args)
+            if ret != 0:
+                return None, out
+
+    return images, None
+
+
+def wait_for_socket(path, proc):
+    """Wait until qemu-nbd listens on @path"""
+    deadline = time.monotonic() + START_TIMEOUT
+    while not os.path.exists(path):
+        if proc.poll() is not None or time.monotonic() > deadline:
+            return False
+        time.sleep(0.1)
+    return True
+
+
+def bench_func(env, case):
+    """ Handle one "cell" of benchmarking table. """
+    return bench_map(env['qemu_img'], env['qemu_nbd'], env['image_dir'],
+                     case['step'])
+
+
+def bench_map(qemu_img, qemu_nbd, image_dir, step):
+    """Benchmark mapping a deep backing chain over NBD
+
+    qemu_img  -- path to qemu-img executable file, used to create the
+                 images and as the NBD client
+    qemu_nbd  -- path to qemu-nbd executable file to benchmark
+    image_dir -- directory for the images of the backing chain
+    step      -- number of clusters from one allocated cluster of a layer
+                 to the next one
+
+    Returns {'seconds': float} on success and {'error': str} on failure.
+    Return value is compatible with simplebench lib.
+    """
+
+    images, err = create_chain(qemu_img, image_dir, step)
+    if not images:
+        return {'error': 'creating backing chain failed: ' + err}
+
+    with tempfile.TemporaryDirectory() as tmpdir:
+        sock = os.path.join(tmpdir, 'nbd.sock')
+
+        args_server = [qemu_nbd, '--persistent', '--read-only',
+                       f'--socket={sock}', '-f', 'qcow2', images[-1]]
+        args_map = [qemu_img, 'map', '--output=json', '-f', 'raw',
+                    f'nbd+unix:///?socket={sock}']
+
+        try:
+            server = subprocess.Popen(args_server, stdout=subprocess.PIPE,
+                                      stderr=subprocess.STDOUT,
+                                      universal_newlines=True)
+        except OSError as e:
+            for image in images:
+                os.remove(image)
+            return {'error': 'qemu-nbd failed: ' + str(e)}
+
+        try:
+            if not wait_for_socket(sock, server):
+                server.kill()
+                return {'error': 'qemu-nbd failed: ' +
+                        server.communicate()[0]}
+
+            start = time.monotonic()
+            for _ in range(MAP_RUNS):
+                ret, out = qemu_img_pipe(*args_map)
+                if ret != 0:
+                    return {'error': 'qemu-img map failed: ' + out}
+            seconds = time.monotonic() - start
+        finally:
+            server.terminate()
+            server.wait()
+            for image in images:
+                os.remove(image)
+
+    return {'seconds': seconds}
+
+
+if __name__ == '__main__':
+
+    if len(sys.argv) < 5:
+        program = os.path.basename(sys.argv[0])
+        print(f'USAGE: {program} <path to qemu-img binary file> '
+              '<path to qemu-nbd binary file> '
+              '<path to another qemu-nbd to compare performance with> '
+              '<directory for the images of the backing chain>')
+        exit(1)
+
+    if not os.path.isdir(sys.argv[4]):
+        print(f'Path not found: {sys.argv[4]}')
+        exit(1)
+
+    test_cases = [
+        {
+            'id': '<every cluster allocated>',
+            'step': CHAIN_LENGTH
+        },
+        {
+            'id': '<1 in 4 clusters allocated>',
+            'step': CHAIN_LENGTH * 4
+        },
+    ]
+
+    test_envs = [
+        {
+            'id': '<qemu-nbd binary 1>',
+            'qemu_img': sys.argv[1],
+            'qemu_nbd': sys.argv[2],
+            'image_dir': sys.argv[4]
+        },
+        {
+            'id': '<qemu-nbd binary 2>',
+            'qemu_img': sys.argv[1],
+            'qemu_nbd': sys.argv[3],
+            'image_dir': sys.argv[4]
+        },
+    ]
+
+    result = simplebench.bench(bench_func, test_envs, test_cases, count=3,
+                               initial_run=False)
+    print(results_to_text(result))
@@ -0,0 +1,163 @@
+#!/usr/bin/env python3
+#
+# Benchmark a FUSE export of qemu-storage-daemon with and without IOThreads
+# reading requests from the FUSE device (iothreads)
+#
+# fio runs directly on the mount point.  Small random requests use O_DIRECT
+# with several jobs, so that many requests are in flight at once; large
+# sequential reads go through the page cache, so that they are limited by
+# readahead.  Every run mounts the export anew, so the page cache is cold.
+#
+# This program is free software; you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation; either version 2 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program.  If not, see <http://www.gnu.org/licenses/>.
+#
+
+
+import sys
+import os
+import time
+import json
+import subprocess
+import tempfile
+import simplebench
+from results_to_text import results_to_text
+
+
+EXPORT_SIZE = 4 * 1024 * 1024 * 1024
+START_TIMEOUT = 10
+FIO_RUNTIME = 20
+
+
+def wait_for_mount(path, proc):
+    """Wait until the export is mounted on @path"""
+    deadline = time.monotonic() + START_TIMEOUT
+    while os.stat(path).st_size != EXPORT_SIZE:
+        if proc.poll() is not None or time.monotonic() > deadline:
+            return False
+        time.sleep(0.1)
+    return True
+
+
+def bench_func(env, case):
+    """ Handle one "cell" of benchmarking table. """
+    return bench_fuse_export(env['qsd'], env['fio'], env['iothreads'],
+                             case['rw'], case['bs'], case['direct'],
+                             case['numjobs'])
+
+
+def bench_fuse_export(qsd, fio, iothreads, rw, bs, direct, numjobs):
+    """Benchmark fio on a FUSE export of a null-co node
+
+    qsd       -- path to qemu-storage-daemon executable file
+    fio       -- path to fio executable file
+    iothreads -- number of IOThreads for the export, 0 to process all
+                 requests in the export's AioContext
+    rw        -- fio --rw pattern
+    bs        -- fio block size
+    direct    -- whether fio uses O_DIRECT
+    numjobs   -- number of fio jobs
+
+    Returns {'iops': float} on success and {'error': str} on failure.
+    Return value is compatible with simplebench lib.
+    """
+
+    with tempfile.TemporaryDirectory() as tmpdir:
+        mountpoint = os.path.join(tmpdir, 'export')
+        open(mountpoint, 'w').close()
+
+        export = ('fuse,id=exp,node-name=null,writable=on,'
+                  f'mountpoint={mountpoint}')
+        args_server = [qsd]
+        for i in range(iothreads):
+            args_server += ['--object', f'iothread,id=iothread{i}']
+            export += f',iothreads.{i}=iothread{i}'
+        args_server += ['--blockdev',
+                        f'driver=null-co,node-name=null,size={EXPORT_SIZE}',
+                        '--export', export]
+
+        args_fio = [fio, '--name=bench', f'--filename={mountpoint}',
+                    '--ioengine=libaio', f'--direct={int(direct)}',
+                    f'--rw={rw}', f'--bs={bs}', '--iodepth=16',
+                    f'--numjobs={numjobs}', '--group_reporting',
+                    '--time_based', f'--runtime={FIO_RUNTIME}',
+                    '--output-format=json']
+
+        try:
+            server = subprocess.Popen(args_server, stdout=subprocess.PIPE,
+                                      stderr=subprocess.STDOUT,
+                                      universal_newlines=True)
+        except OSError as e:
+            return {'error': 'qemu-storage-daemon failed: ' + str(e)}
+
+        try:
+            if not wait_for_mount(mountpoint, server):
+                server.kill()
+                return {'error': 'qemu-storage-daemon failed: ' +
+                        server.communicate()[0]}
+
+            run = subprocess.run(args_fio, stdout=subprocess.PIPE,
+                                 stderr=subprocess.STDOUT,
+                                 universal_newlines=True, check=False)
+        except OSError as e:
+            return {'error': 'fio failed: ' + str(e)}
+        finally:
+            server.terminate()
+            server.wait()
+
+    if run.returncode != 0:
+        return {'error': 'fio failed: ' + run.stdout}
+
+    job = json.loads(run.stdout)['jobs'][0]
+    return {'iops': job['read']['iops'] + job['write']['iops']}
+
+
+if __name__ == '__main__':
+
+    if len(sys.argv) < 2:
+        program = os.path.basename(sys.argv[0])
+        print(f'USAGE: {program} <path to qemu-storage-daemon binary file> '
+              '[<path to fio binary file>]')
+        exit(1)
+
+    fio = sys.argv[2] if len(sys.argv) > 2 else 'fio'
+
+    test_cases = []
+    for rw in ('randread', 'randwrite'):
+        for numjobs in (1, 4, 8):
+            test_cases.append({
+                'id': f'{rw} 4k direct, {numjobs} jobs',
+                'rw': rw,
+                'bs': '4k',
+                'direct': True,
+                'numjobs': numjobs
+            })
+    test_cases.append({
+        'id': 'read 1M buffered, 1 job',
+        'rw': 'read',
+        'bs': '1M',
+        'direct': False,
+        'numjobs': 1
+    })
+
+    test_envs = [
+        {
+            'id': f'<{iothreads} iothreads>',
+            'qsd': sys.argv[1],
+            'fio': fio,
+            'iothreads': iothreads
+        } for iothreads in (0, 2, 4)
+    ]
+
+    result = simplebench.bench(bench_func, test_envs, test_cases, count=3,
+                               initial_run=False)
+    print(results_to_text(result))
@@ -0,0 +1,108 @@
+#!/usr/bin/env python3
+#
+# Compare qemu-img convert modes on a user supplied source image
+#
+# Every mode converts the same source to a new target image, so the results
+# show the throughput of the convert engine itself: out-of-order writes, more
+# coroutines, coroutines spread over several threads, and copy offloading.
+#
+# This program is free software; you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation; either version 2 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program.  If not, see <http://www.gnu.org/licenses/>.
+#
+
+
+import sys
+import os
+import time
+import subprocess
+import simplebench
+from results_to_text import results_to_text
+
+
+def bench_func(env, case):
+    """ Handle one "cell" of benchmarking table. """
+    return bench_convert(env['qemu_img'], env['source'], env['target'],
+                         case['out_fmt'], env['args'])
+
+
+def bench_convert(qemu_img, source, target, out_fmt, args):
+    """Benchmark one qemu-img convert run
+
+    qemu_img -- path to qemu_img executable file
+    source   -- image to convert, its format is probed
+    target   -- image to create, removed afterwards
+    out_fmt  -- format of the target
+    args     -- additional arguments for qemu-img convert
+
+    Returns {'seconds': float} on success and {'error': str} on failure.
+    Return value is compatible with simplebench lib.
+    """
+
+    if not os.path.isfile(qemu_img):
+        print(f'File not found: {qemu_img}')
+        sys.exit(1)
+
+    cmd = [qemu_img, 'convert', '-t', 'none', '-O', out_fmt, *args,
+           source, target]
+
+    start = time.time()
+    try:
+        p = subprocess.run(cmd, stdout=subprocess.PIPE,
+                           stderr=subprocess.STDOUT, universal_newlines=True)
+    except OSError as e:
+        return {'error': 'qemu_img convert failed: ' + str(e)}
+    res = time.time() - start
+
+    if os.path.exists(target):
+        os.remove(target)
+
+    if p.returncode != 0:
+        return {'error': 'qemu_img convert failed: ' + p.stdout}
+
+    return {'seconds': res}
+
+
+if __name__ == '__main__':
+
+    if len(sys.argv) < 4:
+        program = os.path.basename(sys.argv[0])
+        print(f'USAGE: {program} <path to qemu-img binary file> '
+              '<source image> '
+              '<full or relative name for target image to create>')
+        exit(1)
+
+    test_cases = [
+        {'id': 'to raw', 'out_fmt': 'raw'},
+        {'id': 'to qcow2', 'out_fmt': 'qcow2'},
+    ]
+
+    modes = (
+        ('<default>', []),
+        ('<-W -m 16>', ['-W', '-m', '16']),
+        ('<-W -m 16, 4 threads>', ['-W', '-m', '16', '--threads', '4']),
+        ('<-W -m 16, 8 threads>', ['-W', '-m', '16', '--threads', '8']),
+        ('<-W -m 16, -S 0>', ['-W', '-m', '16', '-S', '0']),
+    )
+    test_envs = [
+        {
+            'id': env_id,
+            'qemu_img': sys.argv[1],
+            'source': sys.argv[2],
+            'target': sys.argv[3],
+            'args': args
+        } for env_id, args in modes
+    ]
+
+    result = simplebench.bench(bench_func, test_envs, test_cases, count=3,
+                               initial_run=False)
+    print(results_to_text(result))
@@ -0,0 +1,201 @@
+#!/usr/bin/env python3
+#
+# Compare io_uring ring setups by running fio inside a guest
+#
+# The guest boots from a user supplied image that has fio and the QEMU guest
+# agent installed.  The disk under test is attached as a second virtio-blk
+# device in an iothread, and fio is started through the guest agent with
+# guest-exec, so that no network setup is needed in the guest.
+#
+# This program is free software; you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation; either version 2 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program.  If not, see <http://www.gnu.org/licenses/>.
+#
+
+
+import sys
+import os
+import time
+import json
+import base64
+import socket
+import tempfile
+import simplebench
+from results_to_text import results_to_text
+
+sys.path.append(os.path.join(os.path.dirname(__file__), '..', '..', 'python'))
+from qemu.machine import QEMUMachine
+from qemu.qmp import ConnectError
+from qemu.utils.qemu_ga_client import QemuGuestAgent
+
+
+BOOT_TIMEOUT = 300
+FIO_RUNTIME = 30
+
+# The disk under test, as seen by the guest
+GUEST_DEVICE = '/dev/vdb'
+
+
+def wait_for_agent(address):
+    """Connect to the guest agent once the guest has booted"""
+    deadline = time.monotonic() + BOOT_TIMEOUT
+    while True:
+        try:
+            qga = QemuGuestAgent(address)
+            qga.connect(negotiate=False)
+            qga.settimeout(5)
+            qga.ping()
+            qga.settimeout(None)
+            return qga
+        except (OSError, ConnectError, socket.timeout):
+            if time.monotonic() > deadline:
+                raise
+            time.sleep(1)
+
+
+def guest_run(qga, path, args):
+    """Run a program in the guest and return its exit code and stdout"""
+    pid = qga.exec(path=path, arg=args, **{'capture-output': True})['pid']
+    while True:
+        status = qga.exec_status(pid=pid)
+        if status['exited']:
+            break
+        time.sleep(1)
+    out = base64.b64decode(status.get('out-data', '')).decode()
+    return status.get('exitcode', -1), out
+
+
+def bench_func(env, case):
+    """ Handle one "cell" of benchmarking table. """
+    return bench_fio_in_guest(env['qemu_binary'], env['guest_image'],
+                              env['test_image'], env['file_opts'],
+                              case['rw'], case['bs'], case['iodepth'],
+                              case['numjobs'])
+
+
+def bench_fio_in_guest(qemu_binary, guest_image, test_image, file_opts,
+                       rw, bs, iodepth, numjobs):
+    """Benchmark fio on a virtio-blk disk with aio=io_uring
+
+    qemu_binary -- path to the QEMU system emulator
+    guest_image -- bootable image with fio and qemu-ga installed
+    test_image  -- raw image or block device to run fio against
+    file_opts   -- dict of additional options for the 'file' node
+    rw          -- fio --rw pattern
+    bs          -- fio block size
+    iodepth     -- fio queue depth per job
+    numjobs     -- number of fio jobs
+
+    Returns {'iops': float} on success and {'error': str} on failure.
+    Return value is compatible with simplebench lib.
+    """
+
+    with tempfile.TemporaryDirectory() as tmpdir:
+        qga_sock = os.path.join(tmpdir, 'qga.sock')
+
+        file_node = {
+            'driver': 'file',
+            'node-name': 'test-file',
+            'filename': test_image,
+            'aio': 'io_uring',
+            'cache': {'direct': True},
+            **file_opts
+        }
+        vm = QEMUMachine(qemu_binary, base_temp_dir=tmpdir)
+        vm.add_args('-machine', 'q35,accel=kvm', '-cpu', 'host',
+                    '-smp', str(max(2, numjobs)), '-m', '2G',
+                    '-nographic', '-nodefaults',
+                    '-object', 'iothread,id=iothread0',
+                    '-drive', f'file={guest_image},if=virtio,format=qcow2,'
+                    'snapshot=on',
+                    '-blockdev', json.dumps(file_node),
+                    '-blockdev', 'raw,node-name=test,file=test-file',
+                    '-device', 'virtio-blk-pci,drive=test,iothread=iothread0,'
+                    'num-queues=1',
+                    '-chardev', f'socket,path={qga_sock},server=on,wait=off,'
+                    'id=qga0',
+                    '-device', 'virtio-serial',
+                    '-device', 'virtserialport,chardev=qga0,'
+                    'name=org.qemu.guest_agent.0')
+
+        try:
+            vm.launch()
+        except OSError as e:
+            return {'error': 'popen failed: ' + str(e)}
+        except (ConnectError, socket.timeout):
+            return {'error': 'qemu failed: ' + str(vm.get_log())}
+
+        try:
+            qga = wait_for_agent(qga_sock)
+            ret, out = guest_run(qga, 'fio', [
+                '--name=bench', f'--filename={GUEST_DEVICE}', '--direct=1',
+                '--ioengine=libaio', f'--rw={rw}', f'--bs={bs}',
+                f'--iodepth={iodepth}', f'--numjobs={numjobs}',
+                '--group_reporting', '--time_based',
+                f'--runtime={FIO_RUNTIME}', '--output-format=json'])
+            qga.close()
+        except (OSError, ConnectError, socket.timeout) as e:
+            return {'error': 'guest agent failed: ' + str(e)}
+        finally:
+            vm.shutdown()
+
+    if ret != 0:
+        return {'error': 'fio failed: ' + out}
+
+    job = json.loads(out)['jobs'][0]
+    return {'iops': job['read']['iops'] + job['write']['iops']}
+
+
+if __name__ == '__main__':
+
+    if len(sys.argv) < 4:
+        program = os.path.basename(sys.argv[0])
+        print(f'USAGE: {program} <path to qemu system emulator> '
+              '<qcow2 guest image with fio and qemu-ga> '
+              '<raw image or block device to benchmark (will be overwritten)>')
+        exit(1)
+
+    test_cases = []
+    for rw, bs in (('randread', '4k'), ('randwrite', '4k'), ('read', '128k')):
+        for iodepth in (1, 32):
+            test_cases.append({
+                'id': f'{rw} {bs}, iodepth {iodepth}',
+                'rw': rw,
+                'bs': bs,
+                'iodepth': iodepth,
+                'numjobs': 1
+            })
+
+    setups = (
+        ('<shared ring>', {}),
+        ('<single issuer>', {'io-uring-single-issuer': True}),
+        ('<coop taskrun>', {'io-uring-single-issuer': True,
+                            'io-uring-coop-taskrun': True}),
+        ('<fixed buffers>', {'io-uring-single-issuer': True,
+                             'io-uring-coop-taskrun': True,
+                             'io-uring-fixed-buffers': True}),
+        ('<sqpoll>', {'io-uring-sqpoll': True,
+                      'io-uring-fixed-buffers': True}),
+    )
+    test_envs = [
+        {
+            'id': env_id,
+            'qemu_binary': sys.argv[1],
+            'guest_image': sys.argv[2],
+            'test_image': sys.argv[3],
+            'file_opts': file_opts
+        } for env_id, file_opts in setups
+    ]
+
+    result = simplebench.bench(bench_func, test_envs, test_cases, count=3,
+                               initial_run=False)
+    print(results_to_text(result))
@@ -0,0 +1,145 @@
+#!/usr/bin/env python3
+#
+# Compare mirror and stream throughput with different numbers of worker
+# IOThreads (worker-iothreads)
+#
+# The source is a preallocated local file, so that all of it is copied as
+# data.  Mirroring to null-co leaves only the cost of the job itself and of
+# reading the source, mirroring to a local file adds the writes, and the
+# stream case populates an empty qcow2 overlay from its backing file.
+#
+# This program is free software; you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation; either version 2 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program.  If not, see <http://www.gnu.org/licenses/>.
+#
+
+
+import sys
+import os
+import json
+import subprocess
+import simplebench
+from results_to_text import results_to_text
+from bench_block_job import bench_block_job, drv_file, drv_qcow2
+
+
+IMAGE_SIZE = 4 * 1024 * 1024 * 1024
+
+
+def qemu_img(*args):
+    subprocess.run(['qemu-img'] + list(args), stdout=subprocess.DEVNULL,
+                   stderr=subprocess.DEVNULL, check=True)
+
+
+def bench_func(env, case):
+    """ Handle one "cell" of benchmarking table. """
+    return bench_job_workers(env['qemu_binary'], env['workers'],
+                             case['cmd'], case['source'], case['target'],
+                             case.get('prepare'))
+
+
+def bench_job_workers(qemu_binary, workers, cmd, source, target, prepare):
+    """Benchmark a mirror or stream job with worker IOThreads
+
+    qemu_binary -- path to the QEMU system emulator
+    workers     -- number of worker IOThreads, 0 to run the job as before
+    cmd         -- 'blockdev-mirror' or 'block-stream'
+    source      -- blockdev options of the node to mirror or stream into
+    target      -- blockdev options of the mirror target, None for stream
+    prepare     -- function to call before the job, or None
+
+    Returns {'seconds': float} on success and {'error': str} on failure.
+    Return value is compatible with simplebench lib.
+    """
+
+    if prepare:
+        prepare()
+
+    qemu_args = [qemu_binary, '-blockdev', json.dumps(source)]
+    cmd_args = {'job-id': 'job0', 'device': source['node-name']}
+
+    if target:
+        qemu_args += ['-blockdev', json.dumps(target)]
+        cmd_args['target'] = target['node-name']
+        cmd_args['sync'] = 'full'
+
+    if workers:
+        for i in range(workers):
+            qemu_args += ['-object', f'iothread,id=worker{i}']
+        cmd_args['worker-iothreads'] = [f'worker{i}' for i in range(workers)]
+
+    return bench_block_job(cmd, cmd_args, qemu_args)
+
+
+if __name__ == '__main__':
+
+    if len(sys.argv) < 3:
+        program = os.path.basename(sys.argv[0])
+        print(f'USAGE: {program} <path to qemu system emulator> '
+              '<directory for the test images>')
+        exit(1)
+
+    qemu_binary = sys.argv[1]
+    image_dir = sys.argv[2]
+
+    src_img = os.path.join(image_dir, 'workers-source.raw')
+    dst_img = os.path.join(image_dir, 'workers-target.raw')
+    base_img = os.path.join(image_dir, 'workers-base.qcow2')
+    top_img = os.path.join(image_dir, 'workers-top.qcow2')
+
+    qemu_img('create', '-f', 'raw', '-o', 'preallocation=full', src_img,
+             str(IMAGE_SIZE))
+    qemu_img('create', '-f', 'raw', dst_img, str(IMAGE_SIZE))
+    qemu_img('convert', '-f', 'raw', '-O', 'qcow2', src_img, base_img)
+
+    def create_top():
+        qemu_img('create', '-f', 'qcow2', '-F', 'qcow2', '-b', base_img,
+                 top_img)
+
+    source = {**drv_file(src_img), 'node-name': 'source'}
+    test_cases = [
+        {
+            'id': '<mirror to null-co>',
+            'cmd': 'blockdev-mirror',
+            'source': source,
+            'target': {'driver': 'null-co', 'size': IMAGE_SIZE,
+                       'node-name': 'target'}
+        },
+        {
+            'id': '<mirror to file>',
+            'cmd': 'blockdev-mirror',
+            'source': source,
+            'target': {**drv_file(dst_img), 'node-name': 'target'}
+        },
+        {
+            'id': '<stream>',
+            'cmd': 'block-stream',
+            'source': {**drv_qcow2(drv_file(top_img)), 'node-name': 'top'},
+            'target': None,
+            'prepare': create_top
+        },
+    ]
+
+    test_envs = [
+        {
+            'id': f'<{workers} worker iothreads>',
+            'qemu_binary': qemu_binary,
+            'workers': workers
+        } for workers in (0, 1, 2, 4)
+    ]
+
+    result = simplebench.bench(bench_func, test_envs, test_cases, count=3,
+                               initial_run=False)
+    print(results_to_text(result))
+
+    for img in (src_img, dst_img, base_img, top_img):
+        os.remove(img)
@@ -0,0 +1,147 @@
+#!/usr/bin/env python3
+#
+# Compare NBD export throughput with client connections processed in the
+# export's AioContext and spread over several IOThreads (--client-iothread)
+#
+# The export is served by qemu-nbd from a null-co node, which stands in for
+# a fast local disk, and is read with nbdcopy using several connections, like
+# a backup server pulling a whole disk.  The data is discarded by the reader,
+# so the result shows how fast the server can serve requests.
+#
+# This program is free software; you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation; either version 2 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program.  If not, see <http://www.gnu.org/licenses/>.
+#
+
+
+import sys
+import os
+import time
+import subprocess
+import tempfile
+import simplebench
+from results_to_text import results_to_text
+
+
+EXPORT_SIZE = 16 * 1024 * 1024 * 1024
+START_TIMEOUT = 10
+
+
+def wait_for_socket(path, proc):
+    """Wait until qemu-nbd listens on @path"""
+    deadline = time.monotonic() + START_TIMEOUT
+    while not os.path.exists(path):
+        if proc.poll() is not None or time.monotonic() > deadline:
+            return False
+        time.sleep(0.1)
+    return True
+
+
+def bench_func(env, case):
+    """ Handle one "cell" of benchmarking table. """
+    return bench_nbd_read(env['qemu_nbd'], env['nbdcopy'],
+                          env['iothreads'], case['connections'],
+                          case['request_size'])
+
+
+def bench_nbd_read(qemu_nbd, nbdcopy, iothreads, connections,
+                   request_size):
+    """Benchmark reading a whole NBD export over several connections
+
+    qemu_nbd     -- path to qemu-nbd executable file
+    nbdcopy      -- path to nbdcopy executable file
+    iothreads    -- number of IOThreads for the client connections, 0 to
+                    process all of them in the export's AioContext
+    connections  -- number of connections used by nbdcopy
+    request_size -- size of each read request
+
+    Returns {'seconds': float} on success and {'error': str} on failure.
+    Return value is compatible with simplebench lib.
+    """
+
+    with tempfile.TemporaryDirectory() as tmpdir:
+        sock = os.path.join(tmpdir, 'nbd.sock')
+
+        args_server = [qemu_nbd, '--persistent', '--read-only',
+                       f'--shared={connections}', f'--socket={sock}']
+        for i in range(iothreads):
+            args_server += ['--object', f'iothread,id=iothread{i}',
+                            f'--client-iothread=iothread{i}']
+        args_server += ['--image-opts',
+                        f'driver=null-co,size={EXPORT_SIZE}']
+
+        args_read = [nbdcopy, '--synchronous=false',
+                     f'--connections={connections}', '--requests=16',
+                     f'--request-size={request_size}',
+                     f'nbd+unix:///?socket={sock}', 'null:']
+
+        try:
+            server = subprocess.Popen(args_server, stdout=subprocess.PIPE,
+                                      stderr=subprocess.STDOUT,
+                                      universal_newlines=True)
+        except OSError as e:
+            return {'error': 'qemu-nbd failed: ' + str(e)}
+
+        try:
+            if not wait_for_socket(sock, server):
+                server.kill()
+                return {'error': 'qemu-nbd failed: ' +
+                        server.communicate()[0]}
+
+            start = time.monotonic()
+            read = subprocess.run(args_read, stdout=subprocess.PIPE,
+                                  stderr=subprocess.STDOUT,
+                                  universal_newlines=True, check=False)
+            seconds = time.monotonic() - start
+        except OSError as e:
+            return {'error': 'nbdcopy failed: ' + str(e)}
+        finally:
+            server.terminate()
+            server.wait()
+
+    if read.returncode != 0:
+        return {'error': 'nbdcopy failed: ' + read.stdout}
+
+    return {'seconds': seconds}
+
+
+if __name__ == '__main__':
+
+    if len(sys.argv) < 2:
+        program = os.path.basename(sys.argv[0])
+        print(f'USAGE: {program} <path to qemu-nbd binary file> '
+              '[<path to nbdcopy binary file>]')
+        exit(1)
+
+    nbdcopy = sys.argv[2] if len(sys.argv) > 2 else 'nbdcopy'
+
+    test_cases = []
+    for request_size in (64 * 1024, 256 * 1024):
+        for connections in (1, 4, 8):
+            test_cases.append({
+                'id': f'{request_size // 1024}k, {connections} connections',
+                'connections': connections,
+                'request_size': request_size
+            })
+
+    test_envs = [
+        {
+            'id': f'<{iothreads} client iothreads>',
+            'qemu_nbd': sys.argv[1],
+            'nbdcopy': nbdcopy,
+            'iothreads': iothreads
+        } for iothreads in (0, 2, 4, 8)
+    ]
+
+    result = simplebench.bench(bench_func, test_envs, test_cases, count=3,
+                               initial_run=False)
+    print(results_to_text(result))
@@ -0,0 +1,179 @@
+#!/usr/bin/env python3
+#
+# Measure the CPU time an NBD export spends per GiB of data read
+#
+# qemu-storage-daemon exports a raw image over TCP and nbdcopy reads the
+# whole export, discarding the data.  The CPU time of the daemon is taken
+# from /proc before and after the copy.  The image should be in the page
+# cache, so that the cost of the disk doesn't hide the cost of serving the
+# data.
+#
+# Note that the kernel always copies MSG_ZEROCOPY data that is delivered to
+# a local socket, so with a local client the zero-copy export option falls
+# back to normal sends after the first requests, and the comparison shows
+# the cost of the request buffers.  Its benefit only shows with a client on
+# another host.
+#
+# This program is free software; you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation; either version 2 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program.  If not, see <http://www.gnu.org/licenses/>.
+#
+
+
+import sys
+import os
+import json
+import time
+import socket
+import subprocess
+import simplebench
+from results_to_text import results_to_text
+
+
+NBD_PORT = 10830
+START_TIMEOUT = 10
+
+
+def cpu_seconds(pid):
+    """Return the user and system CPU time of process @pid"""
+    with open(f'/proc/{pid}/stat', encoding='ascii') as f:
+        # The command name may contain spaces, skip past it
+        fields = f.read().rsplit(')', 1)[1].split()
+    return (int(fields[11]) + int(fields[12])) / os.sysconf('SC_CLK_TCK')
+
+
+def wait_for_server(host, port, proc):
+    """Wait until the NBD server accepts connections"""
+    deadline = time.monotonic() + START_TIMEOUT
+    while True:
+        try:
+            socket.create_connection((host, port), timeout=1).close()
+            return True
+        except OSError:
+            if proc.poll() is not None or time.monotonic() > deadline:
+                return False
+            time.sleep(0.1)
+
+
+def bench_func(env, case):
+    """ Handle one "cell" of benchmarking table. """
+    return bench_nbd_read_cpu(env['qsd'], env['nbdcopy'], env['image'],
+                              env['host'], env['zero_copy'],
+                              case['connections'], case['request_size'])
+
+
+def bench_nbd_read_cpu(qsd, nbdcopy, image, host, zero_copy, connections,
+                       request_size):
+    """Benchmark the server CPU time for reading a whole raw image
+
+    qsd          -- path to qemu-storage-daemon executable file
+    nbdcopy      -- path to nbdcopy executable file
+    image        -- raw image to export
+    host         -- address to listen on
+    zero_copy    -- value of the zero-copy export option
+    connections  -- number of connections used by nbdcopy
+    request_size -- size of each read request
+
+    Returns {'seconds': float} with the CPU seconds per GiB on success and
+    {'error': str} on failure.
+    Return value is compatible with simplebench lib.
+    """
+
+    if not os.path.isfile(image):
+        print(f'File not found: {image}')
+        sys.exit(1)
+
+    node = {
+        'driver': 'raw',
+        'node-name': 'disk',
+        'read-only': True,
+        'file': {'driver': 'file', 'filename': image}
+    }
+    args_server = [qsd, '--blockdev', json.dumps(node),
+                   '--nbd-server',
+                   f'addr.type=inet,addr.host={host},addr.port={NBD_PORT}',
+                   '--export', 'type=nbd,id=exp0,node-name=disk,name=disk,'
+                   f'zero-copy={"on" if zero_copy else "off"}']
+
+    args_read = [nbdcopy, f'--connections={connections}', '--requests=16',
+                 f'--request-size={request_size}',
+                 f'nbd://{host}:{NBD_PORT}/disk', 'null:']
+
+    try:
+        server = subprocess.Popen(args_server, stdout=subprocess.PIPE,
+                                  stderr=subprocess.STDOUT,
+                                  universal_newlines=True)
+    except OSError as e:
+        return {'error': 'qemu-storage-daemon failed: ' + str(e)}
+
+    try:
+        if not wait_for_server(host, NBD_PORT, server):
+            server.kill()
+            return {'error': 'qemu-storage-daemon failed: ' +
+                    server.communicate()[0]}
+
+        cpu_start = cpu_seconds(server.pid)
+        read = subprocess.run(args_read, stdout=subprocess.PIPE,
+                              stderr=subprocess.STDOUT,
+                              universal_newlines=True, check=False)
+        cpu = cpu_seconds(server.pid) - cpu_start
+    except OSError as e:
+        return {'error': 'nbdcopy failed: ' + str(e)}
+    finally:
+        server.terminate()
+        server.wait()
+
+    if read.returncode != 0:
+        return {'error': 'nbdcopy failed: ' + read.stdout}
+
+    return {'seconds': cpu * (1 << 30) / os.path.getsize(image)}
+
+
+if __name__ == '__main__':
+
+    if len(sys.argv) < 4:
+        program = os.path.basename(sys.argv[0])
+        print(f'USAGE: {program} <path to qemu-storage-daemon binary file> '
+              '<path to another qemu-storage-daemon to compare with> '
+              '<raw image to export> [<address to listen on>]')
+        exit(1)
+
+    host = sys.argv[4] if len(sys.argv) > 4 else '127.0.0.1'
+
+    test_cases = []
+    for request_size in (64 * 1024, 1024 * 1024):
+        for connections in (1, 4):
+            test_cases.append({
+                'id': f'{request_size // 1024}k, {connections} connections',
+                'connections': connections,
+                'request_size': request_size
+            })
+
+    setups = (
+        ('<binary 1>', sys.argv[1], False),
+        ('<binary 2>', sys.argv[2], False),
+        ('<binary 2, zero copy>', sys.argv[2], True),
+    )
+    test_envs = [
+        {
+            'id': env_id,
+            'qsd': qsd,
+            'nbdcopy': 'nbdcopy',
+            'image': sys.argv[3],
+            'host': host,
+            'zero_copy': zero_copy
+        } for env_id, qsd, zero_copy in setups
+    ]
+
+    result = simplebench.bench(bench_func, test_envs, test_cases, count=3,
+                               initial_run=False)
+    print(results_to_text(result))
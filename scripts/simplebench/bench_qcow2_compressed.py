@@ -0,0 +1,162 @@
+#!/usr/bin/env python3
+#
+# Compare reads from and conversion to compressed qcow2 images for two
+# qemu-img binaries
+#
+# The source image should contain data that is typical for the images to be
+# compressed, e.g. a guest installation.  It is first converted to a
+# compressed qcow2 image, which measures the compression throughput.  Then
+# the compressed image is read sequentially with a single request in flight
+# and small requests, like a booting guest does, which measures the read
+# latency.
+#
+# This program is free software; you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation; either version 2 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program.  If not, see <http://www.gnu.org/licenses/>.
+#
+
+
+import sys
+import os
+import time
+import subprocess
+import simplebench
+from results_to_text import results_to_text
+
+
+READ_SIZE = 256 * 1024 * 1024
+
+
+def qemu_img_pipe(*args):
+    '''Run qemu-img and return its exit code and output'''
+    subp = subprocess.Popen(list(args),
+                            stdout=subprocess.PIPE,
+                            stderr=subprocess.STDOUT,
+                            universal_newlines=True)
+    exitcode = subp.wait()
+    if exitcode < 0:
+        sys.stderr.write('qemu-img received signal %i: %s\n'
+                         % (-exitcode, ' '.join(list(args))))
+    return exitcode, subp.communicate()[0]
+
+
+def bench_func(env, case):
+    """ Handle one "cell" of benchmarking table. """
+    if case['block_size']:
+        return bench_read(env['qemu_img'], env['source'], env['image_name'],
+                          case['block_size'])
+    return bench_convert(env['qemu_img'], env['source'], env['image_name'])
+
+
+def convert(qemu_img, source, image_name):
+    return qemu_img_pipe(qemu_img, 'convert', '-c', '-O', 'qcow2',
+                         source, image_name)
+
+
+def bench_convert(qemu_img, source, image_name):
+    """Benchmark qemu-img convert -c
+
+    qemu_img   -- path to qemu_img executable file
+    source     -- image to compress
+    image_name -- compressed QCOW2 image to create
+
+    Returns {'seconds': float} on success and {'error': str} on failure.
+    Return value is compatible with simplebench lib.
+    """
+
+    start = time.time()
+    try:
+        exitcode, out = convert(qemu_img, source, image_name)
+    except OSError as e:
+        return {'error': 'qemu_img convert failed: ' + str(e)}
+    res = time.time() - start
+
+    os.remove(image_name)
+    if exitcode != 0:
+        return {'error': 'qemu_img convert failed: ' + out}
+
+    return {'seconds': res}
+
+
+def bench_read(qemu_img, source, image_name, block_size):
+    """Benchmark sequential reads from a compressed image, one at a time
+
+    qemu_img   -- path to qemu_img executable file
+    source     -- image to compress
+    image_name -- compressed QCOW2 image to create
+    block_size -- size of each read request
+
+    Returns {'seconds': float} on success and {'error': str} on failure.
+    Return value is compatible with simplebench lib.
+    """
+
+    try:
+        exitcode, out = convert(qemu_img, source, image_name)
+    except OSError as e:
+        return {'error': 'qemu_img convert failed: ' + str(e)}
+    if exitcode != 0:
+        os.remove(image_name)
+        return {'error': 'qemu_img convert failed: ' + out}
+
+    args_bench = [qemu_img, 'bench', '-t', 'none', '-d', '1',
+                  '-c', str(READ_SIZE // block_size), '-s', str(block_size),
+                  '-f', 'qcow2', image_name]
+    try:
+        exitcode, ret = qemu_img_pipe(*args_bench)
+    except OSError as e:
+        os.remove(image_name)
+        return {'error': 'qemu_img bench failed: ' + str(e)}
+
+    os.remove(image_name)
+
+    if 'seconds' in ret:
+        ret_list = ret.split()
+        index = ret_list.index('seconds.')
+        return {'seconds': float(ret_list[index-1])}
+    else:
+        return {'error': 'qemu_img bench failed: ' + ret}
+
+
+if __name__ == '__main__':
+
+    if len(sys.argv) < 5:
+        program = os.path.basename(sys.argv[0])
+        print(f'USAGE: {program} <path to qemu-img binary file> '
+              '<path to another qemu-img to compare performance with> '
+              f'<source image of at least {READ_SIZE >> 20}M to compress> '
+              '<full or relative name for QCOW2 image to create>')
+        exit(1)
+
+    test_cases = [
+        {'id': 'convert -c', 'block_size': 0},
+        {'id': 'read 4k, 1 queued', 'block_size': 4096},
+        {'id': 'read 16k, 1 queued', 'block_size': 16384},
+    ]
+
+    test_envs = [
+        {
+            'id': '<qemu-img binary 1>',
+            'qemu_img': f'{sys.argv[1]}',
+            'source': f'{sys.argv[3]}',
+            'image_name': f'{sys.argv[4]}'
+        },
+        {
+            'id': '<qemu-img binary 2>',
+            'qemu_img': f'{sys.argv[2]}',
+            'source': f'{sys.argv[3]}',
+            'image_name': f'{sys.argv[4]}'
+        },
+    ]
+
+    result = simplebench.bench(bench_func, test_envs, test_cases, count=3,
+                               initial_run=False)
+    print(results_to_text(result))
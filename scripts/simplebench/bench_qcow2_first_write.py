@@ -0,0 +1,169 @@
+#!/usr/bin/env python3
+#
+# Compare first-write throughput on thin qcow2 images with and without
+# reserving space for data clusters in extents (alloc-extent-size)
+#
+# Every write goes to an unallocated cluster, so each request needs a new
+# cluster.  Without a reservation, every allocation updates the refcounts,
+# and with periodic flushes these updates have to be written out before the
+# L2 tables that depend on them.
+#
+# This program is free software; you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation; either version 2 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program.  If not, see <http://www.gnu.org/licenses/>.
+#
+
+
+import sys
+import os
+import subprocess
+import simplebench
+from results_to_text import results_to_text
+
+
+IMAGE_SIZE = 4 * 1024 * 1024 * 1024
+CLUSTER_SIZE = 64 * 1024
+
+
+def qemu_img_pipe(*args):
+    '''Run qemu-img and return its output'''
+    subp = subprocess.Popen(list(args),
+                            stdout=subprocess.PIPE,
+                            stderr=subprocess.STDOUT,
+                            universal_newlines=True)
+    exitcode = subp.wait()
+    if exitcode < 0:
+        sys.stderr.write('qemu-img received signal %i: %s\n'
+                         % (-exitcode, ' '.join(list(args))))
+    return subp.communicate()[0]
+
+
+def bench_func(env, case):
+    """ Handle one "cell" of benchmarking table. """
+    return bench_first_write(env['qemu_img'], env['image_name'],
+                             env['alloc_extent_size'], case['block_size'],
+                             case['step'], case['flush_interval'])
+
+
+def bench_first_write(qemu_img, image_name, alloc_extent_size, block_size,
+                      step, flush_interval):
+    """Benchmark writes to unallocated clusters
+
+    qemu_img          -- path to qemu_img executable file
+    image_name        -- QCOW2 image name to create
+    alloc_extent_size -- value of the alloc-extent-size runtime option
+    block_size        -- size of each write request
+    step              -- distance between the starts of two requests
+    flush_interval    -- number of requests between two flushes, 0 for none
+
+    Returns {'seconds': float} on success and {'error': str} on failure.
+    Return value is compatible with simplebench lib.
+    """
+
+    if not os.path.isfile(qemu_img):
+        print(f'File not found: {qemu_img}')
+        sys.exit(1)
+
+    image_dir = os.path.dirname(os.path.abspath(image_name))
+    if not os.path.isdir(image_dir):
+        print(f'Path not found: {image_name}')
+        sys.exit(1)
+
+    args_create = [qemu_img, 'create', '-f', 'qcow2',
+                   '-o', f'cluster_size={CLUSTER_SIZE}',
+                   image_name, str(IMAGE_SIZE)]
+
+    # Touch every cluster exactly once
+    count = IMAGE_SIZE // CLUSTER_SIZE
+    image_opts = (f'driver=qcow2,alloc-extent-size={alloc_extent_size},'
+                  f'file.driver=file,file.filename={image_name}')
+    args_bench = [qemu_img, 'bench', '-w', '-n', '-t', 'none', '-d', '16',
+                  '-c', str(count), '-s', str(block_size), '-S', str(step),
+                  '--image-opts', image_opts]
+    if flush_interval:
+        args_bench.insert(2, f'--flush-interval={flush_interval}')
+
+    try:
+        qemu_img_pipe(*args_create)
+    except OSError as e:
+        return {'error': 'qemu_img create failed: ' + str(e)}
+
+    try:
+        ret = qemu_img_pipe(*args_bench)
+    except OSError as e:
+        os.remove(image_name)
+        return {'error': 'qemu_img bench failed: ' + str(e)}
+
+    os.remove(image_name)
+
+    if 'seconds' in ret:
+        ret_list = ret.split()
+        index = ret_list.index('seconds.')
+        return {'seconds': float(ret_list[index-1])}
+    else:
+        return {'error': 'qemu_img bench failed: ' + ret}
+
+
+if __name__ == '__main__':
+
+    if len(sys.argv) < 3:
+        program = os.path.basename(sys.argv[0])
+        print(f'USAGE: {program} <path to qemu-img binary file> '
+              '<full or relative name for QCOW2 image to create>')
+        exit(1)
+
+    # Stepping by a prime number of clusters visits every cluster once, in an
+    # order that looks random to the qcow2 driver
+    random_step = 7919 * CLUSTER_SIZE
+
+    test_cases = []
+    for flush_interval in (0, 16):
+        suffix = f', flush every {flush_interval}' if flush_interval else ''
+        test_cases += [
+            {
+                'id': '<sequential 64k' + suffix + '>',
+                'block_size': CLUSTER_SIZE,
+                'step': CLUSTER_SIZE,
+                'flush_interval': flush_interval
+            },
+            {
+                'id': '<random 4k' + suffix + '>',
+                'block_size': 4096,
+                'step': random_step,
+                'flush_interval': flush_interval
+            },
+        ]
+
+    test_envs = [
+        {
+            'id': '<per request>',
+            'qemu_img': f'{sys.argv[1]}',
+            'image_name': f'{sys.argv[2]}',
+            'alloc_extent_size': 0
+        },
+        {
+            'id': '<1M extents>',
+            'qemu_img': f'{sys.argv[1]}',
+            'image_name': f'{sys.argv[2]}',
+            'alloc_extent_size': 1024 * 1024
+        },
+        {
+            'id': '<32M extents>',
+            'qemu_img': f'{sys.argv[1]}',
+            'image_name': f'{sys.argv[2]}',
+            'alloc_extent_size': 32 * 1024 * 1024
+        },
+    ]
+
+    result = simplebench.bench(bench_func, test_envs, test_cases, count=3,
+                               initial_run=False)
+    print(results_to_text(result))
@@ -0,0 +1,144 @@
+#!/usr/bin/env python3
+#
+# Compare 4k random I/O on allocated qcow2 clusters for two qemu-img binaries
+#
+# The image is fully preallocated, so every request maps to an existing
+# cluster and no metadata needs to be written.  This measures how well the
+# lookup of allocated clusters scales with the queue depth.
+#
+# This program is free software; you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation; either version 2 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program.  If not, see <http://www.gnu.org/licenses/>.
+#
+
+
+import sys
+import os
+import subprocess
+import simplebench
+from results_to_text import results_to_text
+
+
+IMAGE_SIZE = 1024 * 1024 * 1024
+BLOCK_SIZE = 4096
+
+# Stepping by a prime number of blocks visits every block of the image once,
+# in an order that looks random to the qcow2 driver
+STEP = 104729 * BLOCK_SIZE
+COUNT = 200000
+
+
+def qemu_img_pipe(*args):
+    '''Run qemu-img and return its output'''
+    subp = subprocess.Popen(list(args),
+                            stdout=subprocess.PIPE,
+                            stderr=subprocess.STDOUT,
+                            universal_newlines=True)
+    exitcode = subp.wait()
+    if exitcode < 0:
+        sys.stderr.write('qemu-img received signal %i: %s\n'
+                         % (-exitcode, ' '.join(list(args))))
+    return subp.communicate()[0]
+
+
+def bench_func(env, case):
+    """ Handle one "cell" of benchmarking table. """
+    return bench_randio(env['qemu_img'], env['image_name'],
+                        case['depth'], case['write'])
+
+
+def bench_randio(qemu_img, image_name, depth, write):
+    """Benchmark 4k random requests to allocated clusters
+
+    qemu_img   -- path to qemu_img executable file
+    image_name -- QCOW2 image name to create
+    depth      -- number of requests in flight
+    write      -- rewrite the clusters instead of reading them
+
+    Returns {'seconds': float} on success and {'error': str} on failure.
+    Return value is compatible with simplebench lib.
+    """
+
+    if not os.path.isfile(qemu_img):
+        print(f'File not found: {qemu_img}')
+        sys.exit(1)
+
+    image_dir = os.path.dirname(os.path.abspath(image_name))
+    if not os.path.isdir(image_dir):
+        print(f'Path not found: {image_name}')
+        sys.exit(1)
+
+    args_create = [qemu_img, 'create', '-f', 'qcow2',
+                   '-o', 'preallocation=metadata',
+                   image_name, str(IMAGE_SIZE)]
+
+    args_bench = [qemu_img, 'bench', '-n', '-t', 'none', '-i', 'native',
+                  '-d', str(depth), '-c', str(COUNT), '-s', str(BLOCK_SIZE),
+                  '-S', str(STEP), '-f', 'qcow2', image_name]
+    if write:
+        args_bench.insert(2, '-w')
+
+    try:
+        qemu_img_pipe(*args_create)
+    except OSError as e:
+        return {'error': 'qemu_img create failed: ' + str(e)}
+
+    try:
+        ret = qemu_img_pipe(*args_bench)
+    except OSError as e:
+        os.remove(image_name)
+        return {'error': 'qemu_img bench failed: ' + str(e)}
+
+    os.remove(image_name)
+
+    if 'seconds' in ret:
+        ret_list = ret.split()
+        index = ret_list.index('seconds.')
+        return {'seconds': float(ret_list[index-1])}
+    else:
+        return {'error': 'qemu_img bench failed: ' + ret}
+
+
+if __name__ == '__main__':
+
+    if len(sys.argv) < 4:
+        program = os.path.basename(sys.argv[0])
+        print(f'USAGE: {program} <path to qemu-img binary file> '
+              '<path to another qemu-img to compare performance with> '
+              '<full or relative name for QCOW2 image to create>')
+        exit(1)
+
+    test_cases = []
+    for write in (False, True):
+        for depth in (1, 4, 16):
+            test_cases.append({
+                'id': f'{"write" if write else "read"}, {depth} queued',
+                'depth': depth,
+                'write': write
+            })
+
+    test_envs = [
+        {
+            'id': '<qemu-img binary 1>',
+            'qemu_img': f'{sys.argv[1]}',
+            'image_name': f'{sys.argv[3]}'
+        },
+        {
+            'id': '<qemu-img binary 2>',
+            'qemu_img': f'{sys.argv[2]}',
+            'image_name': f'{sys.argv[3]}'
+        },
+    ]
+
+    result = simplebench.bench(bench_func, test_envs, test_cases, count=3,
+                               initial_run=False)
+    print(results_to_text(result))
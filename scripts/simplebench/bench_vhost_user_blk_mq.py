@@ -0,0 +1,153 @@
+#!/usr/bin/env python3
+#
+# Benchmark a multiqueue vhost-user-blk export of qemu-storage-daemon with
+# and without mapping its virtqueues to IOThreads (iothread-vq-mapping)
+#
+# The client is fio with the libblkio engine, which connects to the export
+# as a local vhost-user client.  fio shares one libblkio instance between
+# its jobs and gives each job its own virtqueue, so every job becomes one
+# queue of the export.
+#
+# This program is free software; you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation; either version 2 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program.  If not, see <http://www.gnu.org/licenses/>.
+#
+
+
+import sys
+import os
+import time
+import json
+import subprocess
+import tempfile
+import simplebench
+from results_to_text import results_to_text
+
+
+EXPORT_SIZE = 16 * 1024 * 1024 * 1024
+START_TIMEOUT = 10
+FIO_RUNTIME = 20
+
+
+def wait_for_socket(path, proc):
+    """Wait until qemu-storage-daemon listens on @path"""
+    deadline = time.monotonic() + START_TIMEOUT
+    while not os.path.exists(path):
+        if proc.poll() is not None or time.monotonic() > deadline:
+            return False
+        time.sleep(0.1)
+    return True
+
+
+def bench_func(env, case):
+    """ Handle one "cell" of benchmarking table. """
+    return bench_vhost_user_blk(env['qsd'], env['fio'], env['iothreads'],
+                                case['rw'], case['queues'], case['iodepth'])
+
+
+def bench_vhost_user_blk(qsd, fio, iothreads, rw, queues, iodepth):
+    """Benchmark 4k requests on a null-co vhost-user-blk export
+
+    qsd       -- path to qemu-storage-daemon executable file
+    fio       -- path to fio executable file, built with libblkio
+    iothreads -- number of IOThreads for the virtqueues, 0 to process all
+                 of them in the export's AioContext
+    rw        -- fio --rw pattern
+    queues    -- number of virtqueues, one fio job per virtqueue
+    iodepth   -- fio queue depth per job
+
+    Returns {'iops': float} on success and {'error': str} on failure.
+    Return value is compatible with simplebench lib.
+    """
+
+    with tempfile.TemporaryDirectory() as tmpdir:
+        sock = os.path.join(tmpdir, 'vhost-user-blk.sock')
+
+        export = ('vhost-user-blk,id=exp,node-name=null,writable=on,'
+                  f'addr.type=unix,addr.path={sock},num-queues={queues}')
+        args_server = [qsd]
+        for i in range(iothreads):
+            args_server += ['--object', f'iothread,id=iothread{i}']
+            export += f',iothread-vq-mapping.{i}.iothread=iothread{i}'
+        args_server += ['--blockdev',
+                        f'driver=null-co,node-name=null,size={EXPORT_SIZE}',
+                        '--export', export]
+
+        args_fio = [fio, '--name=bench', '--ioengine=libblkio',
+                    '--libblkio_driver=virtio-blk-vhost-user',
+                    f'--libblkio_path={sock}', '--thread',
+                    f'--rw={rw}', '--bs=4k', f'--iodepth={iodepth}',
+                    f'--numjobs={queues}', '--group_reporting',
+                    '--time_based', f'--runtime={FIO_RUNTIME}',
+                    f'--size={EXPORT_SIZE}', '--output-format=json']
+
+        try:
+            server = subprocess.Popen(args_server, stdout=subprocess.PIPE,
+                                      stderr=subprocess.STDOUT,
+                                      universal_newlines=True)
+        except OSError as e:
+            return {'error': 'qemu-storage-daemon failed: ' + str(e)}
+
+        try:
+            if not wait_for_socket(sock, server):
+                server.kill()
+                return {'error': 'qemu-storage-daemon failed: ' +
+                        server.communicate()[0]}
+
+            run = subprocess.run(args_fio, stdout=subprocess.PIPE,
+                                 stderr=subprocess.STDOUT,
+                                 universal_newlines=True, check=False)
+        except OSError as e:
+            return {'error': 'fio failed: ' + str(e)}
+        finally:
+            server.terminate()
+            server.wait()
+
+    if run.returncode != 0:
+        return {'error': 'fio failed: ' + run.stdout}
+
+    job = json.loads(run.stdout)['jobs'][0]
+    return {'iops': job['read']['iops'] + job['write']['iops']}
+
+
+if __name__ == '__main__':
+
+    if len(sys.argv) < 2:
+        program = os.path.basename(sys.argv[0])
+        print(f'USAGE: {program} <path to qemu-storage-daemon binary file> '
+              '[<path to fio binary file with libblkio support>]')
+        exit(1)
+
+    fio = sys.argv[2] if len(sys.argv) > 2 else 'fio'
+
+    test_cases = []
+    for rw in ('randread', 'randwrite'):
+        for queues in (1, 4, 8, 16):
+            test_cases.append({
+                'id': f'{rw} 4k, {queues} queues',
+                'rw': rw,
+                'queues': queues,
+                'iodepth': 32
+            })
+
+    test_envs = [
+        {
+            'id': f'<{iothreads} iothreads>',
+            'qsd': sys.argv[1],
+            'fio': fio,
+            'iothreads': iothreads
+        } for iothreads in (0, 2, 4, 8)
+    ]
+
+    result = simplebench.bench(bench_func, test_envs, test_cases, count=3,
+                               initial_run=False)
+    print(results_to_text(result))
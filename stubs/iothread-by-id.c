@@ -0,0 +1,8 @@
+#include "qemu/osdep.h"
+#include "sysemu/iothread.h"
+
+/* Programs without iothread.c cannot create IOThread objects */
+IOThread *iothread_by_id(const char *id)
+{
+    return NULL;
+}
@@ -0,0 +1,8 @@
+#include "qemu/osdep.h"
+#include "sysemu/iothread.h"
+
+/* Unreachable, iothread_by_id() never finds an IOThread to pass here */
+AioContext *iothread_get_aio_context(IOThread *iothread)
+{
+    abort();
+}
@@ -39,6 +39,13 @@
 
 static unsigned memory_region_transaction_depth;
 static bool memory_region_update_pending;
+/*
+ * Regions whose MemoryRegion::update_gen matches this value were changed
+ * in the pending transaction.  Set memory_region_update_all instead when
+ * every FlatView has to be regenerated.
+ */
+static unsigned memory_region_update_gen = 1;
+static bool memory_region_update_all;
 static bool ioeventfd_update_pending;
 unsigned int global_dirty_tracking;
 
@@ -756,6 +763,7 @@ static FlatView *generate_memory_topology(MemoryRegion *mr)
     FlatView *view;
 
     view = flatview_new(mr);
+    view->gen = memory_region_update_gen;
 
     if (mr) {
         render_memory_region(view, mr, int128_zero(),
@@ -1030,26 +1038,71 @@ static void flatviews_init(void)
     }
 }
 
+static void memory_region_mark_updated(MemoryRegion *mr)
+{
+    mr->update_gen = memory_region_update_gen;
+}
+
+/*
+ * Whether rendering @mr can give a different result than in the last
+ * commit, i.e. whether any region reachable from it was changed.
+ */
+static bool memory_region_tree_updated(MemoryRegion *mr)
+{
+    MemoryRegion *subregion;
+
+    if (mr->update_gen == memory_region_update_gen) {
+        return true;
+    }
+    if (!mr->enabled) {
+        return false;
+    }
+    if (mr->alias) {
+        return memory_region_tree_updated(mr->alias);
+    }
+    QTAILQ_FOREACH(subregion, &mr->subregions, subregions_link) {
+        if (memory_region_tree_updated(subregion)) {
+            return true;
+        }
+    }
+    return false;
+}
+
 static void flatviews_reset(void)
 {
+    GHashTable *old_views = flat_views;
     AddressSpace *as;
 
-    if (flat_views) {
-        g_hash_table_unref(flat_views);
-        flat_views = NULL;
-    }
+    flat_views = NULL;
     flatviews_init();
 
-    /* Render unique FVs */
+    /*
+     * Render unique FVs.  A FlatView only depends on the regions below its
+     * root, so the ones whose regions were not touched by the transaction
+     * are carried over together with their dispatch tree.
+     */
     QTAILQ_FOREACH(as, &address_spaces, address_spaces_link) {
         MemoryRegion *physmr = memory_region_get_flatview_root(as->root);
+        FlatView *view;
 
         if (g_hash_table_lookup(flat_views, physmr)) {
             continue;
         }
 
+        view = old_views && !memory_region_update_all ?
+            g_hash_table_lookup(old_views, physmr) : NULL;
+        if (view && !memory_region_tree_updated(physmr)) {
+            flatview_ref(view);
+            g_hash_table_replace(flat_views, physmr, view);
+            continue;
+        }
+
         generate_memory_topology(physmr);
     }
+
+    if (old_views) {
+        g_hash_table_unref(old_views);
+    }
 }
 
 static void address_space_set_flatview(AddressSpace *as)
@@ -1129,10 +1182,17 @@ void memory_region_transaction_commit(void)
             MEMORY_LISTENER_CALL_GLOBAL(begin, Forward);
 
             QTAILQ_FOREACH(as, &address_spaces, address_spaces_link) {
+                FlatView *old_view = address_space_to_flatview(as);
+
                 address_space_set_flatview(as);
-                address_space_update_ioeventfds(as);
+                if (ioeventfd_update_pending ||
+                    address_space_to_flatview(as) != old_view) {
+                    address_space_update_ioeventfds(as);
+                }
             }
             memory_region_update_pending = false;
+            memory_region_update_all = false;
+            memory_region_update_gen++;
             ioeventfd_update_pending = false;
             MEMORY_LISTENER_CALL_GLOBAL(commit, Forward);
         } else if (ioeventfd_update_pending) {
@@ -2240,6 +2300,7 @@ void memory_region_set_log(MemoryRegion *mr, bool log, unsigned client)
 
     memory_region_transaction_begin();
     mr->dirty_log_mask = (mr->dirty_log_mask & ~mask) | (log * mask);
+    memory_region_mark_updated(mr);
     memory_region_update_pending |= mr->enabled;
     memory_region_transaction_commit();
 }
@@ -2370,6 +2431,7 @@ void memory_region_set_readonly(MemoryRegion *mr, bool readonly)
     if (mr->readonly != readonly) {
         memory_region_transaction_begin();
         mr->readonly = readonly;
+        memory_region_mark_updated(mr);
         memory_region_update_pending |= mr->enabled;
         memory_region_transaction_commit();
     }
@@ -2380,6 +2442,7 @@ void memory_region_set_nonvolatile(MemoryRegion *mr, bool nonvolatile)
     if (mr->nonvolatile != nonvolatile) {
         memory_region_transaction_begin();
         mr->nonvolatile = nonvolatile;
+        memory_region_mark_updated(mr);
         memory_region_update_pending |= mr->enabled;
         memory_region_transaction_commit();
     }
@@ -2390,6 +2453,7 @@ void memory_region_rom_device_set_romd(MemoryRegion *mr, bool romd_mode)
     if (mr->romd_mode != romd_mode) {
         memory_region_transaction_begin();
         mr->romd_mode = romd_mode;
+        memory_region_mark_updated(mr);
         memory_region_update_pending |= mr->enabled;
         memory_region_transaction_commit();
     }
@@ -2626,6 +2690,7 @@ static void memory_region_update_container_subregions(MemoryRegion *subregion)
     }
     QTAILQ_INSERT_TAIL(&mr->subregions, subregion, subregions_link);
 done:
+    memory_region_mark_updated(mr);
     memory_region_update_pending |= mr->enabled && subregion->enabled;
     memory_region_transaction_commit();
 }
@@ -2676,6 +2741,7 @@ void memory_region_del_subregion(MemoryRegion *mr,
     }
     QTAILQ_REMOVE(&mr->subregions, subregion, subregions_link);
     memory_region_unref(subregion);
+    memory_region_mark_updated(mr);
     memory_region_update_pending |= mr->enabled && subregion->enabled;
     memory_region_transaction_commit();
 }
@@ -2687,6 +2753,7 @@ void memory_region_set_enabled(MemoryRegion *mr, bool enabled)
     }
     memory_region_transaction_begin();
     mr->enabled = enabled;
+    memory_region_mark_updated(mr);
     memory_region_update_pending = true;
     memory_region_transaction_commit();
 }
@@ -2703,6 +2770,7 @@ void memory_region_set_size(MemoryRegion *mr, uint64_t size)
     }
     memory_region_transaction_begin();
     mr->size = s;
+    memory_region_mark_updated(mr);
     memory_region_update_pending = true;
     memory_region_transaction_commit();
 }
@@ -2739,6 +2807,7 @@ void memory_region_set_alias_offset(MemoryRegion *mr, hwaddr offset)
 
     memory_region_transaction_begin();
     mr->alias_offset = offset;
+    memory_region_mark_updated(mr);
     memory_region_update_pending |= mr->enabled;
     memory_region_transaction_commit();
 }
@@ -2751,6 +2820,7 @@ void memory_region_set_unmergeable(MemoryRegion *mr, bool unmergeable)
 
     memory_region_transaction_begin();
     mr->unmergeable = unmergeable;
+    memory_region_mark_updated(mr);
     memory_region_update_pending |= mr->enabled;
     memory_region_transaction_commit();
 }
@@ -2922,6 +2992,7 @@ void memory_global_dirty_log_start(unsigned int flags)
     if (!old_flags) {
         MEMORY_LISTENER_CALL_GLOBAL(log_global_start, Forward);
         memory_region_transaction_begin();
+        memory_region_update_all = true;
         memory_region_update_pending = true;
         memory_region_transaction_commit();
     }
@@ -2937,6 +3008,7 @@ static void memory_global_dirty_log_do_stop(unsigned int flags)
 
     if (!global_dirty_tracking) {
         memory_region_transaction_begin();
+        memory_region_update_all = true;
         memory_region_update_pending = true;
         memory_region_transaction_commit();
         MEMORY_LISTENER_CALL_GLOBAL(log_global_stop, Reverse);
@@ -1792,7 +1792,9 @@ static void dirty_memory_extend(ram_addr_t old_ram_size,
         }
 
         for (j = old_num_blocks; j < new_num_blocks; j++) {
-            new_blocks->blocks[j] = bitmap_new(DIRTY_MEMORY_BLOCK_SIZE);
+            /* The summary bitmap lives right after the page bits */
+            new_blocks->blocks[j] = bitmap_new(DIRTY_MEMORY_BLOCK_SIZE +
+                                               DIRTY_MEMORY_BLOCK_CHUNKS);
         }
 
         qatomic_rcu_set(&ram_list.dirty_memory[i], new_blocks);
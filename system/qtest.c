@@ -16,6 +16,7 @@
 #include "sysemu/qtest.h"
 #include "sysemu/runstate.h"
 #include "chardev/char-fe.h"
+#include "exec/address-spaces.h"
 #include "exec/ioport.h"
 #include "exec/memory.h"
 #include "exec/tswap.h"
@@ -100,6 +101,17 @@ static void *qtest_server_send_opaque;
  *
  * Advance the clock to NS nanoseconds (do nothing if it's already past).
  *
+ * FlatView inspection:
+ * """"""""""""""""""""
+ *
+ * .. code-block:: none
+ *
+ *  > flatview_gen memory|io
+ *  < OK VALUE
+ *
+ * Return the memory transaction that rendered the current FlatView of the
+ * system memory or I/O address space.
+ *
  * PIO and memory access:
  * """"""""""""""""""""""
  *
@@ -785,6 +797,25 @@ static void qtest_process_command(CharBackend *chr, gchar **words)
         qtest_send_prefix(chr);
         qtest_sendf(chr, "OK %"PRIi64"\n",
                     (int64_t)qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL));
+    } else if (qtest_enabled() && strcmp(words[0], "flatview_gen") == 0) {
+        AddressSpace *as;
+        unsigned gen;
+
+        g_assert(words[1]);
+        if (strcmp(words[1], "memory") == 0) {
+            as = &address_space_memory;
+        } else if (strcmp(words[1], "io") == 0) {
+            as = &address_space_io;
+        } else {
+            qtest_send_prefix(chr);
+            qtest_sendf(chr, "FAIL Unknown address space '%s'\n", words[1]);
+            return;
+        }
+        WITH_RCU_READ_LOCK_GUARD() {
+            gen = address_space_to_flatview(as)->gen;
+        }
+        qtest_send_prefix(chr);
+        qtest_sendf(chr, "OK %u\n", gen);
     } else if (process_command_cb && process_command_cb(chr, words)) {
         /* Command got consumed by the callback handler */
     } else {
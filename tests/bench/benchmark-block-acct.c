@@ -0,0 +1,120 @@
+/*
+ * Block accounting completion cost benchmark
+ *
+ * Several threads complete requests for the same BlockAcctStats, like
+ * iothreads serving the queues of one multiqueue device do.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or
+ * (at your option) any later version.  See the COPYING file in the
+ * top-level directory.
+ */
+#include "qemu/osdep.h"
+#include "qemu/thread.h"
+#include "block/accounting.h"
+
+#define BENCH_REQUESTS 2000000
+
+typedef enum {
+    BENCH_ACCT_OFF,
+    BENCH_ACCT_ON,
+    BENCH_ACCT_HISTOGRAM,
+} BenchAcctMode;
+
+typedef struct BenchAcctParams {
+    BenchAcctMode mode;
+    int threads;
+} BenchAcctParams;
+
+typedef struct BenchAcctThread {
+    QemuThread thread;
+    BlockAcctStats *stats;
+    BenchAcctMode mode;
+} BenchAcctThread;
+
+static void *bench_acct_thread(void *opaque)
+{
+    BenchAcctThread *t = opaque;
+    BlockAcctCookie cookie;
+    int i;
+
+    for (i = 0; i < BENCH_REQUESTS; i++) {
+        if (t->mode != BENCH_ACCT_OFF) {
+            block_acct_start(t->stats, &cookie, 4096, BLOCK_ACCT_READ);
+            block_acct_done(t->stats, &cookie);
+        }
+    }
+    return NULL;
+}
+
+static void test_block_acct_speed(const void *opaque)
+{
+    const BenchAcctParams *params = opaque;
+    g_autofree BenchAcctThread *threads = g_new0(BenchAcctThread,
+                                                 params->threads);
+    BlockAcctStats *stats = g_new0(BlockAcctStats, 1);
+    BlockAcctCounters counters;
+    int i;
+
+    block_acct_init(stats);
+    if (params->mode == BENCH_ACCT_HISTOGRAM) {
+        uint64List b3 = { .value = 1000000 };
+        uint64List b2 = { .value = 100000, .next = &b3 };
+        uint64List b1 = { .value = 10000, .next = &b2 };
+
+        g_assert(!block_latency_histogram_set(stats, BLOCK_ACCT_READ, &b1));
+    }
+
+    g_test_timer_start();
+    for (i = 0; i < params->threads; i++) {
+        threads[i].stats = stats;
+        threads[i].mode = params->mode;
+        qemu_thread_create(&threads[i].thread, "bench-acct",
+                           bench_acct_thread, &threads[i],
+                           QEMU_THREAD_JOINABLE);
+    }
+    for (i = 0; i < params->threads; i++) {
+        qemu_thread_join(&threads[i].thread);
+    }
+    g_test_timer_elapsed();
+
+    block_acct_get_counters(stats, &counters);
+    g_assert_cmpuint(counters.nr_ops[BLOCK_ACCT_READ], ==,
+                     params->mode == BENCH_ACCT_OFF ? 0 :
+                     (uint64_t)params->threads * BENCH_REQUESTS);
+
+    g_test_message("%d threads: %.1f ns per completion",
+                   params->threads,
+                   g_test_timer_last() * 1e9 / BENCH_REQUESTS);
+
+    block_acct_cleanup(stats);
+    g_free(stats);
+}
+
+int main(int argc, char **argv)
+{
+    static const char *const mode_names[] = {
+        [BENCH_ACCT_OFF] = "off",
+        [BENCH_ACCT_ON] = "on",
+        [BENCH_ACCT_HISTOGRAM] = "histogram",
+    };
+    static const int nthreads[] = { 1, 4, 16 };
+    int mode, i;
+
+    g_test_init(&argc, &argv, NULL);
+
+    for (mode = 0; mode < ARRAY_SIZE(mode_names); mode++) {
+        for (i = 0; i < ARRAY_SIZE(nthreads); i++) {
+            BenchAcctParams *params = g_new(BenchAcctParams, 1);
+            g_autofree char *path = NULL;
+
+            params->mode = mode;
+            params->threads = nthreads[i];
+            path = g_strdup_printf("/block-acct/benchmark/%s/%d",
+                                   mode_names[mode], nthreads[i]);
+            g_test_add_data_func_full(path, params, test_block_acct_speed,
+                                      g_free);
+        }
+    }
+
+    return g_test_run();
+}
@@ -0,0 +1,171 @@
+/*
+ * HBitmap bulk operation benchmark
+ *
+ * Scans for dirty areas, merges and (de)serializes bitmaps with dense,
+ * sparse and clustered patterns of dirty bits, like the bitmaps of
+ * incremental backups and of block-dirty-bitmap migration.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or
+ * (at your option) any later version.  See the COPYING file in the
+ * top-level directory.
+ */
+#include "qemu/osdep.h"
+#include "qemu/hbitmap.h"
+
+/* 10 TiB with 64 KiB granularity */
+#define BENCH_BITS (160ULL * 1024 * 1024)
+#define BENCH_RUNS 5
+
+typedef enum {
+    BENCH_PATTERN_DENSE,
+    BENCH_PATTERN_SPARSE,
+    BENCH_PATTERN_CLUSTERED,
+    BENCH_PATTERN__MAX,
+} BenchHBitmapPattern;
+
+typedef enum {
+    BENCH_OP_SCAN,
+    BENCH_OP_MERGE,
+    BENCH_OP_SERIALIZE,
+    BENCH_OP__MAX,
+} BenchHBitmapOp;
+
+typedef struct BenchHBitmapParams {
+    BenchHBitmapPattern pattern;
+    BenchHBitmapOp op;
+} BenchHBitmapParams;
+
+static const char *const pattern_names[] = {
+    [BENCH_PATTERN_DENSE] = "dense",
+    [BENCH_PATTERN_SPARSE] = "sparse",
+    [BENCH_PATTERN_CLUSTERED] = "clustered",
+};
+
+static const char *const op_names[] = {
+    [BENCH_OP_SCAN] = "scan",
+    [BENCH_OP_MERGE] = "merge",
+    [BENCH_OP_SERIALIZE] = "serialize",
+};
+
+/* @seed shifts the pattern, so that two bitmaps differ for merging */
+static HBitmap *bench_hbitmap_new(BenchHBitmapPattern pattern, int seed)
+{
+    HBitmap *hb = hbitmap_alloc(BENCH_BITS, 0);
+    GRand *rand = g_rand_new_with_seed(seed);
+    uint64_t pos;
+
+    switch (pattern) {
+    case BENCH_PATTERN_DENSE:
+        /* Almost everything dirty, with short clean gaps */
+        for (pos = 0; pos < BENCH_BITS; pos += 4096) {
+            hbitmap_set(hb, pos + g_rand_int_range(rand, 0, 64),
+                        4096 - 64);
+        }
+        break;
+    case BENCH_PATTERN_SPARSE:
+        /* Single bits, a few hundred kilobytes of data apart */
+        for (pos = g_rand_int_range(rand, 0, 4096); pos < BENCH_BITS;
+             pos += g_rand_int_range(rand, 1, 8192)) {
+            hbitmap_set(hb, pos, 1);
+        }
+        break;
+    case BENCH_PATTERN_CLUSTERED:
+        /* Runs of a few hundred bits in hot areas */
+        for (pos = 0; pos < BENCH_BITS; pos += 65536) {
+            uint64_t end = MIN(pos + 65536, BENCH_BITS);
+            uint64_t i;
+
+            for (i = pos + g_rand_int_range(rand, 0, 4096); i < end;
+                 i += g_rand_int_range(rand, 1024, 8192)) {
+                hbitmap_set(hb, i, MIN(g_rand_int_range(rand, 64, 512),
+                                       end - i));
+            }
+        }
+        break;
+    default:
+        abort();
+    }
+
+    g_rand_free(rand);
+    return hb;
+}
+
+static void test_hbitmap_speed(const void *opaque)
+{
+    const BenchHBitmapParams *params = opaque;
+    HBitmap *hb = bench_hbitmap_new(params->pattern, 1);
+    HBitmap *other = bench_hbitmap_new(params->pattern, 2);
+    HBitmap *result = hbitmap_alloc(BENCH_BITS, 0);
+    uint64_t buf_size = hbitmap_serialization_size(hb, 0, BENCH_BITS);
+    g_autofree uint8_t *buf = g_malloc(buf_size);
+    g_autofree char *extra = NULL;
+    uint64_t areas = 0;
+    int i;
+
+    g_test_timer_start();
+    for (i = 0; i < BENCH_RUNS; i++) {
+        int64_t offset, bytes;
+
+        switch (params->op) {
+        case BENCH_OP_SCAN:
+            for (offset = 0;
+                 hbitmap_next_dirty_area(hb, offset, BENCH_BITS, INT64_MAX,
+                                         &offset, &bytes);
+                 offset += bytes) {
+                areas++;
+            }
+            break;
+        case BENCH_OP_MERGE:
+            hbitmap_merge(hb, other, result);
+            break;
+        case BENCH_OP_SERIALIZE:
+            hbitmap_serialize_part(hb, buf, 0, BENCH_BITS);
+            hbitmap_deserialize_part(result, buf, 0, BENCH_BITS, true);
+            break;
+        default:
+            abort();
+        }
+    }
+    g_test_timer_elapsed();
+
+    if (params->op == BENCH_OP_SERIALIZE) {
+        g_assert_cmpuint(hbitmap_count(result), ==, hbitmap_count(hb));
+    }
+    if (areas) {
+        extra = g_strdup_printf(", %" PRIu64 " dirty areas",
+                                areas / BENCH_RUNS);
+    }
+
+    g_test_message("%s %s: %.2f ms per run (%.1f GB/s of bitmap)%s",
+                   pattern_names[params->pattern], op_names[params->op],
+                   g_test_timer_last() * 1e3 / BENCH_RUNS,
+                   (double)buf_size * BENCH_RUNS / g_test_timer_last() / 1e9,
+                   extra ?: "");
+
+    hbitmap_free(hb);
+    hbitmap_free(other);
+    hbitmap_free(result);
+}
+
+int main(int argc, char **argv)
+{
+    int pattern, op;
+
+    g_test_init(&argc, &argv, NULL);
+
+    for (pattern = 0; pattern < BENCH_PATTERN__MAX; pattern++) {
+        for (op = 0; op < BENCH_OP__MAX; op++) {
+            BenchHBitmapParams *params = g_new(BenchHBitmapParams, 1);
+            g_autofree char *path = NULL;
+
+            params->pattern = pattern;
+            params->op = op;
+            path = g_strdup_printf("/hbitmap/benchmark/%s/%s",
+                                   pattern_names[pattern], op_names[op]);
+            g_test_add_data_func_full(path, params, test_hbitmap_speed,
+                                      g_free);
+        }
+    }
+
+    return g_test_run();
+}
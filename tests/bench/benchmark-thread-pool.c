@@ -0,0 +1,125 @@
+/*
+ * Thread pool submission benchmark
+ *
+ * Several threads, each with its own AioContext like iothreads, submit
+ * bursts of small jobs to their thread pools and wait for the completions,
+ * like file-posix does for fsync, fallocate or preadv without Linux AIO.
+ * The jobs do almost nothing, so what is measured is the overhead of queuing
+ * requests, waking up workers and completing requests.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or
+ * (at your option) any later version.  See the COPYING file in the
+ * top-level directory.
+ */
+#include "qemu/osdep.h"
+#include "qapi/error.h"
+#include "qemu/main-loop.h"
+#include "qemu/thread.h"
+#include "block/aio.h"
+#include "block/thread-pool.h"
+
+#define BENCH_JOBS 200000
+
+typedef struct BenchPoolParams {
+    int threads;
+    int burst;
+} BenchPoolParams;
+
+typedef struct BenchPoolThread {
+    QemuThread thread;
+    AioContext *ctx;
+    int burst;
+    int in_flight;
+} BenchPoolThread;
+
+static int bench_pool_job(void *opaque)
+{
+    return 0;
+}
+
+static void bench_pool_job_done(void *opaque, int ret)
+{
+    BenchPoolThread *t = opaque;
+
+    g_assert_cmpint(ret, ==, 0);
+    t->in_flight--;
+}
+
+static void *bench_pool_thread(void *opaque)
+{
+    BenchPoolThread *t = opaque;
+    int i, j;
+
+    qemu_set_current_aio_context(t->ctx);
+
+    for (i = 0; i < BENCH_JOBS / t->burst; i++) {
+        for (j = 0; j < t->burst; j++) {
+            t->in_flight++;
+            thread_pool_submit_aio(bench_pool_job, NULL,
+                                   bench_pool_job_done, t);
+        }
+        while (t->in_flight) {
+            aio_poll(t->ctx, true);
+        }
+    }
+
+    return NULL;
+}
+
+static void test_thread_pool_speed(const void *opaque)
+{
+    const BenchPoolParams *params = opaque;
+    g_autofree BenchPoolThread *threads =
+        g_new0(BenchPoolThread, params->threads);
+    int i;
+
+    for (i = 0; i < params->threads; i++) {
+        threads[i].ctx = aio_context_new(&error_abort);
+        threads[i].burst = params->burst;
+    }
+
+    g_test_timer_start();
+    for (i = 0; i < params->threads; i++) {
+        qemu_thread_create(&threads[i].thread, "bench-pool",
+                           bench_pool_thread, &threads[i],
+                           QEMU_THREAD_JOINABLE);
+    }
+    for (i = 0; i < params->threads; i++) {
+        qemu_thread_join(&threads[i].thread);
+    }
+    g_test_timer_elapsed();
+
+    g_test_message("%d threads, bursts of %d: %.1f ns per job",
+                   params->threads, params->burst,
+                   g_test_timer_last() * 1e9 /
+                   ((double)params->threads * BENCH_JOBS));
+
+    for (i = 0; i < params->threads; i++) {
+        aio_context_unref(threads[i].ctx);
+    }
+}
+
+int main(int argc, char **argv)
+{
+    static const BenchPoolParams params[] = {
+        { .threads = 1, .burst = 1 },
+        { .threads = 1, .burst = 32 },
+        { .threads = 4, .burst = 1 },
+        { .threads = 4, .burst = 32 },
+        { .threads = 8, .burst = 32 },
+        { .threads = 8, .burst = 128 },
+    };
+    int i;
+
+    qemu_init_main_loop(&error_fatal);
+    g_test_init(&argc, &argv, NULL);
+
+    for (i = 0; i < ARRAY_SIZE(params); i++) {
+        g_autofree char *path =
+            g_strdup_printf("/thread-pool/benchmark/%d-threads/burst-%d",
+                            params[i].threads, params[i].burst);
+        g_test_add_data_func(path, &params[i], test_thread_pool_speed);
+    }
+
+    return g_test_run();
+}
@@ -0,0 +1,146 @@
+/*
+ * Throttle group request cost benchmark
+ *
+ * Many members of one throttle group submit requests from several threads,
+ * each with its own AioContext, like BlockBackends in iothreads do.  The
+ * limits are set high enough that requests are only accounted and never
+ * delayed, so what is measured is the overhead of the group itself.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or
+ * (at your option) any later version.  See the COPYING file in the
+ * top-level directory.
+ */
+#include "qemu/osdep.h"
+#include "qapi/error.h"
+#include "qemu/coroutine.h"
+#include "qemu/main-loop.h"
+#include "qemu/module.h"
+#include "qemu/thread.h"
+#include "block/aio.h"
+#include "block/throttle-groups.h"
+
+#define BENCH_REQUESTS 200000
+
+typedef struct BenchThrottleParams {
+    int threads;
+    int members;
+} BenchThrottleParams;
+
+typedef struct BenchThrottleThread {
+    QemuThread thread;
+    AioContext *ctx;
+    ThrottleGroupMember *members;
+    int nb_members;
+    int running;
+} BenchThrottleThread;
+
+typedef struct BenchThrottleMember {
+    BenchThrottleThread *thread;
+    ThrottleGroupMember *tgm;
+} BenchThrottleMember;
+
+static void coroutine_fn bench_throttle_co(void *opaque)
+{
+    BenchThrottleMember *m = opaque;
+    int i;
+
+    for (i = 0; i < BENCH_REQUESTS; i++) {
+        throttle_group_co_io_limits_intercept(m->tgm, 4096, THROTTLE_READ);
+    }
+    m->thread->running--;
+}
+
+static void *bench_throttle_thread(void *opaque)
+{
+    BenchThrottleThread *t = opaque;
+    g_autofree BenchThrottleMember *m = g_new(BenchThrottleMember,
+                                              t->nb_members);
+    int i;
+
+    qemu_set_current_aio_context(t->ctx);
+
+    t->running = t->nb_members;
+    for (i = 0; i < t->nb_members; i++) {
+        m[i].thread = t;
+        m[i].tgm = &t->members[i];
+        qemu_coroutine_enter(qemu_coroutine_create(bench_throttle_co, &m[i]));
+    }
+    while (t->running) {
+        aio_poll(t->ctx, true);
+    }
+
+    return NULL;
+}
+
+static void test_throttle_group_speed(const void *opaque)
+{
+    const BenchThrottleParams *params = opaque;
+    int members_per_thread = params->members / params->threads;
+    g_autofree BenchThrottleThread *threads =
+        g_new0(BenchThrottleThread, params->threads);
+    ThrottleConfig cfg;
+    int i, j;
+
+    throttle_config_init(&cfg);
+    cfg.buckets[THROTTLE_OPS_TOTAL].avg = 1000000000;
+    cfg.buckets[THROTTLE_BPS_TOTAL].avg = 1000000000000LL;
+
+    for (i = 0; i < params->threads; i++) {
+        threads[i].ctx = aio_context_new(&error_abort);
+        threads[i].nb_members = members_per_thread;
+        threads[i].members = g_new0(ThrottleGroupMember, members_per_thread);
+        for (j = 0; j < members_per_thread; j++) {
+            throttle_group_register_tgm(&threads[i].members[j], "bench",
+                                        threads[i].ctx);
+        }
+    }
+    throttle_group_config(&threads[0].members[0], &cfg);
+
+    g_test_timer_start();
+    for (i = 0; i < params->threads; i++) {
+        qemu_thread_create(&threads[i].thread, "bench-throttle",
+                           bench_throttle_thread, &threads[i],
+                           QEMU_THREAD_JOINABLE);
+    }
+    for (i = 0; i < params->threads; i++) {
+        qemu_thread_join(&threads[i].thread);
+    }
+    g_test_timer_elapsed();
+
+    g_test_message("%d members on %d threads: %.1f ns per request",
+                   params->members, params->threads,
+                   g_test_timer_last() * 1e9 /
+                   ((double)params->members * BENCH_REQUESTS));
+
+    for (i = 0; i < params->threads; i++) {
+        for (j = 0; j < members_per_thread; j++) {
+            throttle_group_unregister_tgm(&threads[i].members[j]);
+        }
+        g_free(threads[i].members);
+        aio_context_unref(threads[i].ctx);
+    }
+}
+
+int main(int argc, char **argv)
+{
+    static const BenchThrottleParams params[] = {
+        { .threads = 1, .members = 1 },
+        { .threads = 1, .members = 8 },
+        { .threads = 8, .members = 8 },
+        { .threads = 8, .members = 64 },
+    };
+    int i;
+
+    qemu_init_main_loop(&error_fatal);
+    module_call_init(MODULE_INIT_QOM);
+    g_test_init(&argc, &argv, NULL);
+
+    for (i = 0; i < ARRAY_SIZE(params); i++) {
+        g_autofree char *path =
+            g_strdup_printf("/throttle-group/benchmark/%d-threads/%d-members",
+                            params[i].threads, params[i].members);
+        g_test_add_data_func(path, &params[i], test_throttle_group_speed);
+    }
+
+    return g_test_run();
+}
@@ -1014,6 +1014,18 @@ int64_t qtest_clock_set(QTestState *s, int64_t val)
     return qtest_clock_rsp(s);
 }
 
+unsigned qtest_flatview_gen(QTestState *s, const char *as)
+{
+    gchar **words;
+    unsigned gen;
+
+    qtest_sendf(s, "flatview_gen %s\n", as);
+    words = qtest_rsp_args(s, 2);
+    gen = g_ascii_strtoull(words[1], NULL, 0);
+    g_strfreev(words);
+    return gen;
+}
+
 void qtest_irq_intercept_out(QTestState *s, const char *qom_path)
 {
     qtest_sendf(s, "irq_intercept_out %s\n", qom_path);
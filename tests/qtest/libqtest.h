@@ -652,6 +652,16 @@ int64_t qtest_clock_step(QTestState *s, int64_t step);
  */
 int64_t qtest_clock_set(QTestState *s, int64_t val);
 
+/**
+ * qtest_flatview_gen:
+ * @s: QTestState instance to operate on.
+ * @as: Address space to inspect, either "memory" or "io".
+ *
+ * Returns: The memory transaction that rendered the current FlatView of
+ * the system memory or I/O address space.
+ */
+unsigned qtest_flatview_gen(QTestState *s, const char *as);
+
 /**
  * qtest_big_endian:
  * @s: QTestState instance to operate on.
@@ -0,0 +1,132 @@
+/*
+ * QTest testcase for memory transaction commits
+ *
+ * Checks that a commit only renders the FlatViews whose regions changed,
+ * and measures the commit latency: it toggles the memory decoding of one
+ * PCI device among a varying number of others, so that every toggle commits
+ * a memory transaction, and reports how long the commits take as the number
+ * of regions grows.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include "libqtest.h"
+#include "libqos/pci.h"
+#include "libqos/pci-pc.h"
+#include "hw/pci/pci_regs.h"
+
+#define FIRST_SLOT  4
+#define TOGGLES     256
+
+static void test_commit_reuse(void)
+{
+    QTestState *qts;
+    QPCIBus *pcibus;
+    QPCIDevice *dev;
+    unsigned mem_gen, io_gen;
+    uint16_t cmd;
+
+    qts = qtest_init("-machine pc "
+                     "-device pci-testdev,addr=" stringify(FIRST_SLOT) ".0");
+    pcibus = qpci_new_pc(qts, NULL);
+    dev = qpci_device_find(pcibus, QPCI_DEVFN(FIRST_SLOT, 0));
+    g_assert(dev);
+    qpci_device_enable(dev);
+    qpci_iomap(dev, 0, NULL);
+    qpci_iomap(dev, 1, NULL);
+    cmd = qpci_config_readw(dev, PCI_COMMAND);
+    g_assert(cmd & PCI_COMMAND_MEMORY);
+    g_assert(cmd & PCI_COMMAND_IO);
+
+    /* Moving the MMIO BAR re-renders the memory address space only */
+    mem_gen = qtest_flatview_gen(qts, "memory");
+    io_gen = qtest_flatview_gen(qts, "io");
+    qpci_config_writew(dev, PCI_COMMAND, cmd & ~PCI_COMMAND_MEMORY);
+    qpci_config_writew(dev, PCI_COMMAND, cmd);
+    g_assert_cmpuint(qtest_flatview_gen(qts, "memory"), >, mem_gen);
+    g_assert_cmpuint(qtest_flatview_gen(qts, "io"), ==, io_gen);
+
+    /* And the other way round for the PIO BAR */
+    mem_gen = qtest_flatview_gen(qts, "memory");
+    qpci_config_writew(dev, PCI_COMMAND, cmd & ~PCI_COMMAND_IO);
+    qpci_config_writew(dev, PCI_COMMAND, cmd);
+    g_assert_cmpuint(qtest_flatview_gen(qts, "memory"), ==, mem_gen);
+    g_assert_cmpuint(qtest_flatview_gen(qts, "io"), >, io_gen);
+
+    g_free(dev);
+    qpci_free_pc(pcibus);
+    qtest_quit(qts);
+}
+
+static void test_commit_latency(const void *data)
+{
+    int ndevs = GPOINTER_TO_INT(data);
+    g_autoptr(GString) cmdline = g_string_new("-machine pc");
+    QTestState *qts;
+    QPCIBus *pcibus;
+    QPCIDevice *devs[32];
+    uint16_t cmd;
+    double elapsed;
+    int i;
+
+    for (i = 0; i < ndevs; i++) {
+        g_string_append_printf(cmdline, " -device pci-testdev,addr=%02x.0",
+                               FIRST_SLOT + i);
+    }
+
+    qts = qtest_init(cmdline->str);
+    pcibus = qpci_new_pc(qts, NULL);
+
+    for (i = 0; i < ndevs; i++) {
+        devs[i] = qpci_device_find(pcibus, QPCI_DEVFN(FIRST_SLOT + i, 0));
+        g_assert(devs[i]);
+        qpci_device_enable(devs[i]);
+        qpci_iomap(devs[i], 0, NULL);
+    }
+
+    cmd = qpci_config_readw(devs[0], PCI_COMMAND);
+    g_assert(cmd & PCI_COMMAND_MEMORY);
+
+    g_test_timer_start();
+    for (i = 0; i < TOGGLES; i++) {
+        qpci_config_writew(devs[0], PCI_COMMAND, cmd & ~PCI_COMMAND_MEMORY);
+        qpci_config_writew(devs[0], PCI_COMMAND, cmd);
+    }
+    elapsed = g_test_timer_elapsed();
+
+    g_assert_cmpuint(qpci_config_readw(devs[0], PCI_COMMAND), ==, cmd);
+    g_test_message("%d devices: %d commits in %.3f s, %.1f us per commit",
+                   ndevs, TOGGLES * 2, elapsed,
+                   elapsed * 1e6 / (TOGGLES * 2));
+
+    for (i = 0; i < ndevs; i++) {
+        g_free(devs[i]);
+    }
+    qpci_free_pc(pcibus);
+    qtest_quit(qts);
+}
+
+int main(int argc, char **argv)
+{
+    static const int ndevs[] = { 1, 8, 24 };
+    int i;
+
+    g_test_init(&argc, &argv, NULL);
+
+    qtest_add_func("/memory/commit-reuse", test_commit_reuse);
+
+    for (i = 0; i < ARRAY_SIZE(ndevs); i++) {
+        g_autofree char *path = NULL;
+
+        if (ndevs[i] > 1 && !g_test_slow()) {
+            continue;
+        }
+        path = g_strdup_printf("/memory/commit-latency/%d", ndevs[i]);
+        qtest_add_data_func(path, GINT_TO_POINTER(ndevs[i]),
+                            test_commit_latency);
+    }
+
+    return g_test_run();
+}
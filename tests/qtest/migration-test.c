@@ -1895,6 +1895,97 @@ static void test_precopy_unix_dirty_ring(void)
     test_precopy_common(&args);
 }
 
+/*
+ * The dirty memory bitmap keeps one summary bit per 2 MiB of guest memory
+ * (with 4 KiB pages).  Write at the edges of such chunks and across them,
+ * above the area touched by the guest workload.
+ */
+#define DIRTY_CHUNK_SIZE (2 * 1024 * 1024)
+
+static const struct {
+    uint64_t offset;
+    uint64_t len;
+} dirty_chunk_ranges[] = {
+    /* Last page of a chunk */
+    { 2 * DIRTY_CHUNK_SIZE - 8, 8 },
+    /* First page of a chunk */
+    { 3 * DIRTY_CHUNK_SIZE, 8 },
+    /* Two pages in neighbouring chunks */
+    { 5 * DIRTY_CHUNK_SIZE - 4096, 8192 },
+    /* A whole chunk and a page of each neighbour */
+    { 7 * DIRTY_CHUNK_SIZE - 4096, DIRTY_CHUNK_SIZE + 8192 },
+};
+
+static void dirty_chunk_ranges_write(QTestState *who, uint8_t pattern)
+{
+    int i;
+
+    for (i = 0; i < ARRAY_SIZE(dirty_chunk_ranges); i++) {
+        qtest_memset(who, end_address + dirty_chunk_ranges[i].offset,
+                     pattern, dirty_chunk_ranges[i].len);
+    }
+}
+
+static void dirty_chunk_ranges_check(QTestState *who, uint8_t pattern)
+{
+    int i;
+
+    for (i = 0; i < ARRAY_SIZE(dirty_chunk_ranges); i++) {
+        g_autofree uint8_t *buf = g_malloc(dirty_chunk_ranges[i].len);
+        uint64_t j;
+
+        qtest_memread(who, end_address + dirty_chunk_ranges[i].offset,
+                      buf, dirty_chunk_ranges[i].len);
+        for (j = 0; j < dirty_chunk_ranges[i].len; j++) {
+            g_assert_cmphex(buf[j], ==, pattern);
+        }
+    }
+}
+
+static void test_precopy_unix_dirty_chunks(void)
+{
+    g_autofree char *uri = g_strdup_printf("unix:%s/migsocket", tmpfs);
+    MigrateStart args = {};
+    QTestState *from, *to;
+
+    if (test_migrate_start(&from, &to, uri, &args)) {
+        return;
+    }
+
+    /*
+     * Keep iterating, but make each pass quick: the guest workload
+     * dirties much more than 1ms worth of data between two passes.
+     */
+    migrate_ensure_non_converge(from);
+    migrate_set_parameter_int(from, "max-bandwidth", 1 * 1000 * 1000 * 1000);
+
+    dirty_chunk_ranges_write(from, 1);
+    wait_for_serial("src_serial");
+    migrate_qmp(from, uri, "{}");
+
+    /*
+     * Dirty the chunks again after they have been harvested once, and
+     * then once more so that the last sync has to pick the pages up.
+     */
+    wait_for_migration_pass(from);
+    dirty_chunk_ranges_write(from, 2);
+    wait_for_migration_pass(from);
+    dirty_chunk_ranges_write(from, 3);
+
+    migrate_ensure_converge(from);
+    wait_for_migration_complete(from);
+    if (!got_src_stop) {
+        qtest_qmp_eventwait(from, "STOP");
+    }
+    if (!got_dst_resume) {
+        qtest_qmp_eventwait(to, "RESUME");
+    }
+    wait_for_serial("dest_serial");
+
+    dirty_chunk_ranges_check(to, 3);
+    test_migrate_end(from, to, true);
+}
+
 #ifdef CONFIG_GNUTLS
 static void test_precopy_unix_tls_psk(void)
 {
@@ -2012,6 +2103,60 @@ static void test_precopy_unix_xbzrle(void)
     test_precopy_common(&args);
 }
 
+static void *
+test_migrate_parallel_device_state_start(QTestState *from,
+                                         QTestState *to)
+{
+    migrate_set_capability(from, "x-parallel-device-state", true);
+    migrate_set_capability(to, "x-parallel-device-state", true);
+
+    return NULL;
+}
+
+static void
+test_migrate_parallel_device_state_finish(QTestState *from,
+                                          QTestState *to,
+                                          void *opaque)
+{
+    const char *arch = qtest_get_arch();
+    g_autoptr(QDict) rsp = migrate_query(from);
+    QListEntry *entry;
+    QList *list;
+    bool port92 = false;
+
+    /* port92 is saved and loaded on worker threads; it exists on x86 only */
+    if (strcmp(arch, "i386") && strcmp(arch, "x86_64")) {
+        return;
+    }
+
+    list = qdict_get_qlist(rsp, "x-device-downtime");
+    g_assert(list);
+    QLIST_FOREACH_ENTRY(list, entry) {
+        QDict *dd = qobject_to(QDict, qlist_entry_obj(entry));
+
+        if (g_str_equal(qdict_get_str(dd, "idstr"), "port92")) {
+            g_assert(qdict_get_bool(dd, "parallel"));
+            port92 = true;
+        } else if (g_str_equal(qdict_get_str(dd, "idstr"), "ram")) {
+            g_assert(!qdict_get_bool(dd, "parallel"));
+        }
+    }
+    g_assert(port92);
+}
+
+static void test_precopy_unix_parallel_device_state(void)
+{
+    g_autofree char *uri = g_strdup_printf("unix:%s/migsocket", tmpfs);
+    MigrateCommon args = {
+        .connect_uri = uri,
+        .listen_uri = uri,
+        .start_hook = test_migrate_parallel_device_state_start,
+        .finish_hook = test_migrate_parallel_device_state_finish,
+    };
+
+    test_precopy_common(&args);
+}
+
 static void test_precopy_unix_compress(void)
 {
     g_autofree char *uri = g_strdup_printf("unix:%s/migsocket", tmpfs);
@@ -3363,7 +3508,11 @@ int main(int argc, char **argv)
     qtest_add_func("/migration/analyze-script", test_analyze_script);
 #endif
     qtest_add_func("/migration/precopy/unix/plain", test_precopy_unix_plain);
+    qtest_add_func("/migration/precopy/unix/dirty-chunks",
+                   test_precopy_unix_dirty_chunks);
     qtest_add_func("/migration/precopy/unix/xbzrle", test_precopy_unix_xbzrle);
+    qtest_add_func("/migration/precopy/unix/parallel-device-state",
+                   test_precopy_unix_parallel_device_state);
     /*
      * Compression fails from time to time.
      * Put test here but don't enable it until everything is fixed.
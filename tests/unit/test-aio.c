@@ -98,6 +98,36 @@ static void event_ready_cb(EventNotifier *e)
     }
 }
 
+#ifndef _WIN32
+typedef struct {
+    EventNotifier e;
+    int polls;
+    int n;
+} BusyPollTestData;
+
+/*
+ * Pretend that something completes after a number of polls, without the
+ * event notifier ever being set, like requests on an IOPOLL ring.
+ */
+static bool busy_poll_cb(void *opaque)
+{
+    BusyPollTestData *data = container_of(opaque, BusyPollTestData, e);
+
+    if (data->polls > 0) {
+        data->polls--;
+        return data->polls == 0;
+    }
+    return false;
+}
+
+static void busy_poll_ready_cb(EventNotifier *e)
+{
+    BusyPollTestData *data = container_of(e, BusyPollTestData, e);
+
+    data->n++;
+}
+#endif
+
 /* Tests using aio_*.  */
 
 static void set_event_notifier(AioContext *nctx, EventNotifier *notifier,
@@ -294,6 +324,35 @@ static void test_wait_event_notifier(void)
     event_notifier_cleanup(&data.e);
 }
 
+#ifndef _WIN32
+static void test_busy_poll(void)
+{
+    BusyPollTestData data = { .polls = 5 };
+    int i;
+
+    event_notifier_init(&data.e, false);
+    aio_set_event_notifier(ctx, &data.e, dummy_io_handler_read,
+                           busy_poll_cb, busy_poll_ready_cb);
+
+    /* Polling is disabled in this AioContext */
+    g_assert(!aio_poll(ctx, false));
+    g_assert_cmpint(data.polls, ==, 5);
+
+    /* Blocking aio_poll() must not block while busy polling */
+    aio_context_busy_poll_begin(ctx);
+    for (i = 0; i < 5; i++) {
+        aio_poll(ctx, true);
+    }
+    aio_context_busy_poll_end(ctx);
+    g_assert_cmpint(data.polls, ==, 0);
+    g_assert_cmpint(data.n, ==, 1);
+
+    aio_set_event_notifier(ctx, &data.e, NULL, NULL, NULL);
+    g_assert(!aio_poll(ctx, false));
+    event_notifier_cleanup(&data.e);
+}
+#endif
+
 static void test_flush_event_notifier(void)
 {
     EventNotifierTestData data = { .n = 0, .active = 10, .auto_set = true };
@@ -625,6 +684,32 @@ static void test_source_wait_event_notifier(void)
     event_notifier_cleanup(&data.e);
 }
 
+#ifndef _WIN32
+static void test_source_busy_poll(void)
+{
+    BusyPollTestData data = { .polls = 5 };
+    int i;
+
+    event_notifier_init(&data.e, false);
+    aio_set_event_notifier(ctx, &data.e, dummy_io_handler_read,
+                           busy_poll_cb, busy_poll_ready_cb);
+    while (g_main_context_iteration(NULL, false));
+    g_assert_cmpint(data.polls, ==, 5);
+
+    aio_context_busy_poll_begin(ctx);
+    for (i = 0; i < 5; i++) {
+        g_assert(g_main_context_iteration(NULL, true));
+    }
+    aio_context_busy_poll_end(ctx);
+    g_assert_cmpint(data.polls, ==, 0);
+    g_assert_cmpint(data.n, ==, 1);
+
+    aio_set_event_notifier(ctx, &data.e, NULL, NULL, NULL);
+    while (g_main_context_iteration(NULL, false));
+    event_notifier_cleanup(&data.e);
+}
+#endif
+
 static void test_source_flush_event_notifier(void)
 {
     EventNotifierTestData data = { .n = 0, .active = 10, .auto_set = true };
@@ -846,6 +931,9 @@ int main(int argc, char **argv)
     g_test_add_func("/aio/event/wait",              test_wait_event_notifier);
     g_test_add_func("/aio/event/wait/no-flush-cb",  test_wait_event_notifier_noflush);
     g_test_add_func("/aio/event/flush",             test_flush_event_notifier);
+#ifndef _WIN32
+    g_test_add_func("/aio/event/busy-poll",         test_busy_poll);
+#endif
     g_test_add_func("/aio/timer/schedule",          test_timer_schedule);
 
     g_test_add_func("/aio/coroutine/queue-chaining", test_queue_chaining);
@@ -863,6 +951,9 @@ int main(int argc, char **argv)
     g_test_add_func("/aio-gsource/event/wait",              test_source_wait_event_notifier);
     g_test_add_func("/aio-gsource/event/wait/no-flush-cb",  test_source_wait_event_notifier_noflush);
     g_test_add_func("/aio-gsource/event/flush",             test_source_flush_event_notifier);
+#ifndef _WIN32
+    g_test_add_func("/aio-gsource/event/busy-poll",         test_source_busy_poll);
+#endif
     g_test_add_func("/aio-gsource/timer/schedule",          test_source_timer_schedule);
     return g_test_run();
 }
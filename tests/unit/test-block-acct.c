@@ -0,0 +1,122 @@
+/*
+ * Block accounting tests
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or
+ * (at your option) any later version.  See the COPYING file in the
+ * top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/thread.h"
+#include "block/accounting.h"
+
+/* More threads than shards, so that some of them share a shard */
+#define ACCT_THREADS (2 * BLOCK_ACCT_SHARDS + 1)
+#define ACCT_REQUESTS 10000
+
+typedef struct AcctThread {
+    QemuThread thread;
+    BlockAcctStats *stats;
+    int id;
+} AcctThread;
+
+/* Thread @id submits @i + @id + 1 sectors with its @i-th request */
+static uint64_t acct_bytes(int id, int i)
+{
+    return (uint64_t)(i + id + 1) * 512;
+}
+
+static void *acct_thread(void *opaque)
+{
+    AcctThread *t = opaque;
+    BlockAcctCookie cookie;
+    int i;
+
+    for (i = 0; i < ACCT_REQUESTS; i++) {
+        block_acct_start(t->stats, &cookie, acct_bytes(t->id, i),
+                         BLOCK_ACCT_READ);
+        block_acct_done(t->stats, &cookie);
+
+        /* Every tenth write fails */
+        block_acct_start(t->stats, &cookie, acct_bytes(t->id, i),
+                         BLOCK_ACCT_WRITE);
+        if (i % 10) {
+            block_acct_done(t->stats, &cookie);
+        } else {
+            block_acct_failed(t->stats, &cookie);
+        }
+
+        block_acct_invalid(t->stats, BLOCK_ACCT_FLUSH);
+        block_acct_merge_done(t->stats, BLOCK_ACCT_WRITE, 2);
+    }
+    return NULL;
+}
+
+static void test_acct_shards_sum(void)
+{
+    AcctThread threads[ACCT_THREADS];
+    BlockAcctStats *stats = g_new0(BlockAcctStats, 1);
+    BlockAcctCounters counters;
+    BlockLatencyHistogram hist;
+    uint64List b2 = { .value = 1000000 };
+    uint64List b1 = { .value = 1000, .next = &b2 };
+    uint64_t bytes = 0, write_bytes = 0, hist_ops = 0;
+    uint64_t nr_ops = (uint64_t)ACCT_THREADS * ACCT_REQUESTS;
+    uint64_t nr_failed = (uint64_t)ACCT_THREADS * (ACCT_REQUESTS / 10);
+    int i, j;
+
+    block_acct_init(stats);
+    g_assert(QEMU_PTR_IS_ALIGNED(stats->shards, BLOCK_ACCT_SHARD_ALIGN));
+    g_assert(!block_latency_histogram_set(stats, BLOCK_ACCT_READ, &b1));
+
+    for (i = 0; i < ACCT_THREADS; i++) {
+        threads[i].stats = stats;
+        threads[i].id = i;
+        qemu_thread_create(&threads[i].thread, "acct", acct_thread,
+                           &threads[i], QEMU_THREAD_JOINABLE);
+    }
+    for (i = 0; i < ACCT_THREADS; i++) {
+        qemu_thread_join(&threads[i].thread);
+        for (j = 0; j < ACCT_REQUESTS; j++) {
+            bytes += acct_bytes(i, j);
+            if (j % 10) {
+                write_bytes += acct_bytes(i, j);
+            }
+        }
+    }
+
+    block_acct_get_counters(stats, &counters);
+    g_assert_cmpuint(counters.nr_ops[BLOCK_ACCT_READ], ==, nr_ops);
+    g_assert_cmpuint(counters.nr_bytes[BLOCK_ACCT_READ], ==, bytes);
+    g_assert_cmpuint(counters.failed_ops[BLOCK_ACCT_READ], ==, 0);
+
+    /* Failed requests are neither operations nor transferred bytes */
+    g_assert_cmpuint(counters.nr_ops[BLOCK_ACCT_WRITE], ==,
+                     nr_ops - nr_failed);
+    g_assert_cmpuint(counters.failed_ops[BLOCK_ACCT_WRITE], ==, nr_failed);
+    g_assert_cmpuint(counters.nr_bytes[BLOCK_ACCT_WRITE], ==, write_bytes);
+    g_assert_cmpuint(counters.merged[BLOCK_ACCT_WRITE], ==, 2 * nr_ops);
+
+    g_assert_cmpuint(counters.invalid_ops[BLOCK_ACCT_FLUSH], ==, nr_ops);
+    g_assert_cmpuint(counters.nr_ops[BLOCK_ACCT_FLUSH], ==, 0);
+
+    g_assert(block_latency_histogram_get(stats, BLOCK_ACCT_READ, &hist));
+    g_assert_cmpint(hist.nbins, ==, 3);
+    for (i = 0; i < hist.nbins; i++) {
+        hist_ops += hist.bins[i];
+    }
+    g_assert_cmpuint(hist_ops, ==, nr_ops);
+    g_free(hist.boundaries);
+    g_free(hist.bins);
+
+    block_acct_cleanup(stats);
+    g_free(stats);
+}
+
+int main(int argc, char **argv)
+{
+    g_test_init(&argc, &argv, NULL);
+    g_test_add_func("/block-acct/shards-sum", test_acct_shards_sum);
+
+    return g_test_run();
+}
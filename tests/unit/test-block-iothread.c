@@ -758,7 +758,7 @@ static void test_propagate_mirror(void)
                  MIRROR_SYNC_MODE_NONE, MIRROR_OPEN_BACKING_CHAIN, false,
                  BLOCKDEV_ON_ERROR_REPORT, BLOCKDEV_ON_ERROR_REPORT,
                  false, "filter_node", MIRROR_COPY_MODE_BACKGROUND,
-                 &error_abort);
+                 NULL, &error_abort);
 
     WITH_JOB_LOCK_GUARD() {
         job = job_get_locked("job0");
@@ -0,0 +1,229 @@
+/*
+ * Tests for the file protocol driver
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or
+ * (at your option) any later version.  See the COPYING file in the
+ * top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include "block/block.h"
+#include "block/block-io.h"
+#include "sysemu/block-backend.h"
+#include "qapi/error.h"
+#include "qapi/qapi-types-block-core.h"
+#include "qapi/qmp/qdict.h"
+#include "qemu/defer-call.h"
+#include "qemu/main-loop.h"
+#include "qemu/units.h"
+
+#define IMG_SIZE (1 * MiB)
+
+typedef enum {
+    REQ_DISCARD,
+    REQ_WRITE_ZEROES,
+    REQ_WRITE,
+} ReqType;
+
+typedef struct TestReq {
+    BlockBackend *blk;
+    ReqType type;
+    int64_t offset;
+    int64_t bytes;
+    bool done;
+} TestReq;
+
+static void coroutine_fn test_req_co(void *opaque)
+{
+    TestReq *req = opaque;
+    g_autofree void *buf = NULL;
+    int ret;
+
+    switch (req->type) {
+    case REQ_DISCARD:
+        ret = blk_co_pdiscard(req->blk, req->offset, req->bytes);
+        /* Not all file systems can punch holes */
+        g_assert(ret == 0 || ret == -ENOTSUP);
+        break;
+    case REQ_WRITE_ZEROES:
+        ret = blk_co_pwrite_zeroes(req->blk, req->offset, req->bytes, 0);
+        g_assert_cmpint(ret, ==, 0);
+        break;
+    case REQ_WRITE:
+        buf = g_malloc(req->bytes);
+        memset(buf, 0x55, req->bytes);
+        ret = blk_co_pwrite(req->blk, req->offset, req->bytes, buf, 0);
+        g_assert_cmpint(ret, ==, 0);
+        break;
+    default:
+        g_assert_not_reached();
+    }
+    req->done = true;
+}
+
+/*
+ * Submits @reqs in one defer_call_begin()/defer_call_end() section, like
+ * virtio-blk does for the requests it finds in a virtqueue, and waits for
+ * their completion.
+ */
+static void run_reqs(TestReq *reqs, int nr)
+{
+    int i;
+
+    defer_call_begin();
+    for (i = 0; i < nr; i++) {
+        qemu_coroutine_enter(qemu_coroutine_create(test_req_co, &reqs[i]));
+    }
+    defer_call_end();
+
+    for (i = 0; i < nr; i++) {
+        while (!reqs[i].done) {
+            aio_poll(qemu_get_aio_context(), true);
+        }
+    }
+}
+
+static BlockBackend *open_image(char **path, bool coalesce)
+{
+    g_autofree void *buf = g_malloc(IMG_SIZE);
+    QDict *options = qdict_new();
+    BlockBackend *blk;
+    int fd;
+
+    fd = g_file_open_tmp("qemu-tst-file-posix.XXXXXX", path, NULL);
+    g_assert(fd >= 0);
+    close(fd);
+
+    qdict_put_str(options, "driver", "file");
+    qdict_put_bool(options, "coalesce-zeroes", coalesce);
+    blk = blk_new_open(*path, NULL, options, BDRV_O_RDWR | BDRV_O_UNMAP,
+                       &error_abort);
+
+    memset(buf, 0xaa, IMG_SIZE);
+    g_assert_cmpint(blk_pwrite(blk, 0, IMG_SIZE, buf, 0), ==, 0);
+
+    return blk;
+}
+
+static void close_image(BlockBackend *blk, char *path)
+{
+    blk_unref(blk);
+    unlink(path);
+    g_free(path);
+}
+
+static BlockStatsSpecificFile get_stats(BlockBackend *blk)
+{
+    BlockStatsSpecific *stats = bdrv_get_specific_stats(blk_bs(blk));
+    BlockStatsSpecificFile ret;
+
+    g_assert(stats);
+    ret = stats->u.file;
+    qapi_free_BlockStatsSpecific(stats);
+    return ret;
+}
+
+static void check_pattern(BlockBackend *blk, int64_t offset, int64_t bytes,
+                          uint8_t pattern)
+{
+    g_autofree uint8_t *buf = g_malloc(bytes);
+    int64_t i;
+
+    g_assert_cmpint(blk_pread(blk, offset, bytes, buf, 0), ==, 0);
+    for (i = 0; i < bytes; i++) {
+        g_assert_cmphex(buf[i], ==, pattern);
+    }
+}
+
+static void test_coalesce(ReqType type, bool coalesce)
+{
+    char *path;
+    BlockBackend *blk = open_image(&path, coalesce);
+    BlockStatsSpecificFile stats;
+    TestReq reqs[] = {
+        /* Adjacent to the first one, then adjacent and overlapping */
+        { blk, type, 4 * KiB, 4 * KiB },
+        { blk, type, 0, 4 * KiB },
+        { blk, type, 8 * KiB, 4 * KiB },
+        { blk, type, 10 * KiB, 8 * KiB },
+        /* Not adjacent to the others */
+        { blk, type, 64 * KiB, 4 * KiB },
+    };
+    uint64_t merged = coalesce ? 3 : 0;
+
+    run_reqs(reqs, ARRAY_SIZE(reqs));
+
+    stats = get_stats(blk);
+    if (type == REQ_DISCARD) {
+        g_assert_cmpuint(stats.discard_nb_merged, ==, merged);
+        g_assert_cmpuint(stats.write_zeroes_nb_merged, ==, 0);
+        /* Accounting still counts the requests of the guest */
+        g_assert_cmpuint(stats.discard_nb_ok + stats.discard_nb_failed, ==,
+                         ARRAY_SIZE(reqs));
+    } else {
+        g_assert_cmpuint(stats.discard_nb_merged, ==, 0);
+        g_assert_cmpuint(stats.write_zeroes_nb_merged, ==, merged);
+        check_pattern(blk, 0, 18 * KiB, 0);
+        check_pattern(blk, 18 * KiB, 46 * KiB, 0xaa);
+        check_pattern(blk, 64 * KiB, 4 * KiB, 0);
+    }
+
+    close_image(blk, path);
+}
+
+static void test_coalesce_discard(void)
+{
+    test_coalesce(REQ_DISCARD, true);
+}
+
+static void test_coalesce_write_zeroes(void)
+{
+    test_coalesce(REQ_WRITE_ZEROES, true);
+}
+
+static void test_coalesce_off(void)
+{
+    test_coalesce(REQ_WRITE_ZEROES, false);
+}
+
+/*
+ * A write that overlaps with a write zeroes request that is still waiting for
+ * others to merge must not overtake it
+ */
+static void test_coalesce_write_order(void)
+{
+    char *path;
+    BlockBackend *blk = open_image(&path, true);
+    TestReq reqs[] = {
+        { blk, REQ_WRITE_ZEROES, 0, 8 * KiB },
+        { blk, REQ_WRITE, 4 * KiB, 4 * KiB },
+        { blk, REQ_WRITE_ZEROES, 8 * KiB, 8 * KiB },
+    };
+
+    run_reqs(reqs, ARRAY_SIZE(reqs));
+
+    /* The write submitted the first request, so the second one can't join */
+    g_assert_cmpuint(get_stats(blk).write_zeroes_nb_merged, ==, 0);
+    check_pattern(blk, 0, 4 * KiB, 0);
+    check_pattern(blk, 4 * KiB, 4 * KiB, 0x55);
+    check_pattern(blk, 8 * KiB, 8 * KiB, 0);
+
+    close_image(blk, path);
+}
+
+int main(int argc, char **argv)
+{
+    bdrv_init();
+    qemu_init_main_loop(&error_abort);
+
+    g_test_init(&argc, &argv, NULL);
+
+    g_test_add_func("/file-posix/coalesce/discard", test_coalesce_discard);
+    g_test_add_func("/file-posix/coalesce/write-zeroes",
+                    test_coalesce_write_zeroes);
+    g_test_add_func("/file-posix/coalesce/off", test_coalesce_off);
+    g_test_add_func("/file-posix/coalesce/write-order",
+                    test_coalesce_write_order);
+
+    return g_test_run();
+}
@@ -1042,6 +1042,69 @@ static void test_hbitmap_next_dirty_area_after_truncate(TestHBitmapData *data,
     test_hbitmap_next_dirty_area_check(data, 0, INT64_MAX);
 }
 
+/* Set bits in the shadow bitmap only */
+static void hbitmap_test_set_shadow(TestHBitmapData *data,
+                                    uint64_t first, uint64_t count)
+{
+    while (count-- != 0) {
+        size_t pos = first >> LOG_BITS_PER_LONG;
+        int bit = first & (BITS_PER_LONG - 1);
+        first++;
+
+        data->bits[pos] |= 1UL << bit;
+    }
+}
+
+/* Exercise the bulk operations with each accelerated implementation */
+static void test_hbitmap_accel(TestHBitmapData *data,
+                               const void *unused)
+{
+    do {
+        HBitmap *other;
+        size_t buf_size;
+        uint8_t *buf;
+        int i;
+
+        hbitmap_test_init(data, L3 - 3, 0);
+
+        /* A dense run, scattered bits and clustered runs */
+        hbitmap_test_set(data, 5, L2 + 7);
+        for (i = 0; i < 32; i++) {
+            hbitmap_test_set(data, L2 * 3 + i * (L1 * 5 + 3), 1);
+            hbitmap_test_set(data, L3 / 2 + i * L1 * 3, L1 * 2 + 1);
+        }
+        hbitmap_test_reset(data, L2 / 2, L1 + 3);
+        hbitmap_test_check_get(data);
+
+        test_hbitmap_next_x_check(data, 0);
+        test_hbitmap_next_x_check(data, 6);
+        test_hbitmap_next_x_check(data, L2 / 2 + L1 + 3);
+        test_hbitmap_next_x_check(data, L3 / 2 + L1 * 2);
+
+        /* Merge in another bitmap */
+        other = hbitmap_alloc(data->size, 0);
+        hbitmap_set(other, L1 * 7 + 1, L2 * 2);
+        hbitmap_set(other, L3 - L1 - 9, L1 + 6);
+        hbitmap_test_set_shadow(data, L1 * 7 + 1, L2 * 2);
+        hbitmap_test_set_shadow(data, L3 - L1 - 9, L1 + 6);
+        hbitmap_merge(data->hb, other, data->hb);
+        hbitmap_free(other);
+        hbitmap_test_check(data, 0);
+
+        /* Serialize, and deserialize into an empty bitmap */
+        buf_size = hbitmap_serialization_size(data->hb, 0, data->size);
+        buf = g_malloc0(buf_size);
+        hbitmap_serialize_part(data->hb, buf, 0, data->size);
+        hbitmap_reset_all(data->hb);
+        hbitmap_deserialize_part(data->hb, buf, 0, data->size, true);
+        g_free(buf);
+        hbitmap_test_check(data, 0);
+        hbitmap_test_check_get(data);
+
+        hbitmap_test_teardown(data, NULL);
+    } while (test_hbitmap_next_accel());
+}
+
 int main(int argc, char **argv)
 {
     g_test_init(&argc, &argv, NULL);
@@ -1113,6 +1176,8 @@ int main(int argc, char **argv)
     hbitmap_test_add("/hbitmap/next_dirty_area/next_dirty_area_after_truncate",
                      test_hbitmap_next_dirty_area_after_truncate);
 
+    hbitmap_test_add("/hbitmap/accel", test_hbitmap_accel);
+
     g_test_run();
 
     return 0;
@@ -220,6 +220,72 @@ static void do_test_cancel(bool sync)
     }
 }
 
+typedef struct ContextTestData {
+    QemuThread thread;
+    AioContext *ctx;
+    WorkerTestData data[100];
+    int active;
+} ContextTestData;
+
+/* Unlike worker_cb(), every run returns 0, not the number of earlier runs */
+static int context_worker_cb(void *opaque)
+{
+    WorkerTestData *data = opaque;
+
+    qatomic_inc(&data->n);
+    return 0;
+}
+
+static void context_done_cb(void *opaque, int ret)
+{
+    ContextTestData *c = opaque;
+
+    g_assert_cmpint(ret, ==, 0);
+    c->active--;
+}
+
+static void *context_thread(void *opaque)
+{
+    ContextTestData *c = opaque;
+    int i, j;
+
+    qemu_set_current_aio_context(c->ctx);
+
+    /* Bursts of requests make idle workers of the other pools help out */
+    for (i = 0; i < 10; i++) {
+        for (j = 0; j < 100; j++) {
+            c->active++;
+            thread_pool_submit_aio(context_worker_cb, &c->data[j],
+                                   context_done_cb, c);
+        }
+        while (c->active > 0) {
+            aio_poll(c->ctx, true);
+        }
+    }
+    return NULL;
+}
+
+static void test_multi_context(void)
+{
+    ContextTestData c[4] = {};
+    int i, j;
+
+    for (i = 0; i < ARRAY_SIZE(c); i++) {
+        c[i].ctx = aio_context_new(&error_abort);
+        /* Small pools, so that the others have to run some requests */
+        aio_context_set_thread_pool_params(c[i].ctx, 0, i + 1, &error_abort);
+        qemu_thread_create(&c[i].thread, "test-pool", context_thread, &c[i],
+                           QEMU_THREAD_JOINABLE);
+    }
+    for (i = 0; i < ARRAY_SIZE(c); i++) {
+        qemu_thread_join(&c[i].thread);
+        for (j = 0; j < ARRAY_SIZE(c[i].data); j++) {
+            g_assert_cmpint(c[i].data[j].n, ==, 10);
+        }
+        aio_context_unref(c[i].ctx);
+    }
+}
+
 static void test_cancel(void)
 {
     do_test_cancel(true);
@@ -242,6 +308,7 @@ int main(int argc, char **argv)
     g_test_add_func("/thread-pool/submit-many", test_submit_many);
     g_test_add_func("/thread-pool/cancel", test_cancel);
     g_test_add_func("/thread-pool/cancel-async", test_cancel_async);
+    g_test_add_func("/thread-pool/multi-context", test_multi_context);
 
     return g_test_run();
 }
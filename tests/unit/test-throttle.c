@@ -801,6 +801,61 @@ static void test_groups(void)
     g_assert(tgm3->throttle_state == NULL);
 }
 
+static void coroutine_fn test_groups_read_entry(void *opaque)
+{
+    ThrottleGroupMember *tgm = opaque;
+
+    throttle_group_co_io_limits_intercept(tgm, 4096, THROTTLE_READ);
+}
+
+static void test_groups_read(ThrottleGroupMember *tgm)
+{
+    Coroutine *co = qemu_coroutine_create(test_groups_read_entry, tgm);
+    qemu_coroutine_enter(co);
+}
+
+static void test_groups_reservation(void)
+{
+    ThrottleConfig cfg1;
+    BlockBackend *blk;
+    ThrottleGroupMember *tgm1;
+
+    blk = blk_new(qemu_get_aio_context(), 0, BLK_PERM_ALL);
+    tgm1 = &blk_get_public(blk)->throttle_group_member;
+    throttle_group_register_tgm(tgm1, "reserve", blk_get_aio_context(blk));
+
+    /* High limits: a request that goes through reserves a batch */
+    throttle_config_init(&cfg1);
+    cfg1.buckets[THROTTLE_OPS_READ].avg = 1000000;
+    cfg1.buckets[THROTTLE_BPS_READ].avg = 1000000000;
+    throttle_group_config(tgm1, &cfg1);
+    g_assert_cmpint(tgm1->credit_ops[THROTTLE_READ], ==, 0);
+
+    test_groups_read(tgm1);
+    g_assert_cmpint(tgm1->credit_ops[THROTTLE_READ], ==, 32);
+    g_assert_cmpint(tgm1->credit_bytes[THROTTLE_READ], ==, 1000000);
+    g_assert_cmpint(tgm1->credit_ops[THROTTLE_WRITE], ==, 0);
+
+    /* The next requests consume it */
+    test_groups_read(tgm1);
+    test_groups_read(tgm1);
+    g_assert_cmpint(tgm1->credit_ops[THROTTLE_READ], ==, 30);
+    g_assert_cmpint(tgm1->credit_bytes[THROTTLE_READ], ==, 1000000 - 8192);
+
+    /* A new configuration drops it */
+    cfg1.buckets[THROTTLE_OPS_READ].avg = 100;
+    throttle_group_config(tgm1, &cfg1);
+    g_assert_cmpint(tgm1->credit_ops[THROTTLE_READ], ==, 0);
+    g_assert_cmpint(tgm1->credit_bytes[THROTTLE_READ], ==, 0);
+
+    /* Low limits never reserve anything */
+    test_groups_read(tgm1);
+    g_assert_cmpint(tgm1->credit_ops[THROTTLE_READ], ==, 0);
+
+    throttle_group_unregister_tgm(tgm1);
+    blk_unref(blk);
+}
+
 int main(int argc, char **argv)
 {
     qemu_init_main_loop(&error_fatal);
@@ -830,6 +885,8 @@ int main(int argc, char **argv)
     g_test_add_func("/throttle/config_functions",   test_config_functions);
     g_test_add_func("/throttle/accounting",         test_accounting);
     g_test_add_func("/throttle/groups",             test_groups);
+    g_test_add_func("/throttle/groups/reservation",
+                    test_groups_reservation);
     return g_test_run();
 }
 
@@ -331,6 +331,88 @@ static void test_simple_array(void)
                          sizeof(wire_simple_arr)));
 }
 
+typedef struct TestPlan {
+    uint32_t a[2];
+    uint32_t b;
+    uint16_t c;
+    uint8_t  buf[3];
+    uint64_t d, e;
+    uint32_t never_sent;
+    uint32_t f;
+} TestPlan;
+
+/*
+ * Plain fields that are contiguous in memory are transferred as one run;
+ * changes of width, padding and fields newer than the VMSD split runs.
+ */
+static const VMStateDescription vmstate_plan = {
+    .name = "plan",
+    .version_id = 1,
+    .minimum_version_id = 1,
+    .fields = (VMStateField[]) {
+        VMSTATE_UINT32_ARRAY(a, TestPlan, 2),
+        VMSTATE_UINT32(b, TestPlan),
+        VMSTATE_UINT16(c, TestPlan),
+        VMSTATE_BUFFER(buf, TestPlan),
+        VMSTATE_UINT64(d, TestPlan),
+        VMSTATE_UINT64(e, TestPlan),
+        VMSTATE_UINT32_V(never_sent, TestPlan, 2),
+        VMSTATE_UINT32(f, TestPlan),
+        VMSTATE_END_OF_LIST()
+    }
+};
+
+TestPlan obj_plan = {
+    .a = { 0x01020304, 0x05060708 },
+    .b = 0x090a0b0c,
+    .c = 0x0d0e,
+    .buf = { 0x0f, 0x10, 0x11 },
+    .d = 0x1213141516171819ULL,
+    .e = 0x1a1b1c1d1e1f2021ULL,
+    .never_sent = 0xdeadbeef,
+    .f = 0x22232425,
+};
+
+uint8_t wire_plan[] = {
+    /* a */   0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08,
+    /* b */   0x09, 0x0a, 0x0b, 0x0c,
+    /* c */   0x0d, 0x0e,
+    /* buf */ 0x0f, 0x10, 0x11,
+    /* d */   0x12, 0x13, 0x14, 0x15, 0x16, 0x17, 0x18, 0x19,
+    /* e */   0x1a, 0x1b, 0x1c, 0x1d, 0x1e, 0x1f, 0x20, 0x21,
+    /* f */   0x22, 0x23, 0x24, 0x25,
+    QEMU_VM_EOF, /* just to ensure we won't get EOF reported prematurely */
+};
+
+static void obj_plan_copy(void *target, void *source)
+{
+    memcpy(target, source, sizeof(TestPlan));
+}
+
+static void test_plan(void)
+{
+    TestPlan obj, obj_clone;
+
+    save_vmstate(&vmstate_plan, &obj_plan);
+
+    compare_vmstate(wire_plan, sizeof(wire_plan));
+
+    memset(&obj, 0, sizeof(obj));
+    SUCCESS(load_vmstate(&vmstate_plan, &obj, &obj_clone, obj_plan_copy, 1,
+                         wire_plan, sizeof(wire_plan)));
+
+    g_assert_cmpint(obj.a[0], ==, obj_plan.a[0]);
+    g_assert_cmpint(obj.a[1], ==, obj_plan.a[1]);
+    g_assert_cmpint(obj.b, ==, obj_plan.b);
+    g_assert_cmpint(obj.c, ==, obj_plan.c);
+    g_assert_cmpmem(obj.buf, sizeof(obj.buf), obj_plan.buf,
+                    sizeof(obj_plan.buf));
+    g_assert_cmpint(obj.d, ==, obj_plan.d);
+    g_assert_cmpint(obj.e, ==, obj_plan.e);
+    g_assert_cmpint(obj.never_sent, ==, 0);
+    g_assert_cmpint(obj.f, ==, obj_plan.f);
+}
+
 typedef struct TestStruct {
     uint32_t a, b, c, e;
     uint64_t d, f;
@@ -1493,6 +1575,7 @@ int main(int argc, char **argv)
     g_test_init(&argc, &argv, NULL);
     g_test_add_func("/vmstate/simple/primitive", test_simple_primitive);
     g_test_add_func("/vmstate/simple/array", test_simple_array);
+    g_test_add_func("/vmstate/simple/plan", test_plan);
     g_test_add_func("/vmstate/versioned/load/v1", test_load_v1);
     g_test_add_func("/vmstate/versioned/load/v2", test_load_v2);
     g_test_add_func("/vmstate/field_exists/load/noskip", test_load_noskip);
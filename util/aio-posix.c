@@ -263,7 +263,8 @@ bool aio_prepare(AioContext *ctx)
     poll_set_started(ctx, &ready_list, false);
     /* TODO what to do with this list? */
 
-    return false;
+    /* Busy polling happens in aio_dispatch(), don't block until then */
+    return ctx->busy_poll_cnt > 0;
 }
 
 bool aio_pending(AioContext *ctx)
@@ -271,6 +272,10 @@ bool aio_pending(AioContext *ctx)
     AioHandler *node;
     bool result = false;
 
+    if (ctx->busy_poll_cnt) {
+        return true;
+    }
+
     /*
      * We have to walk very carefully in case aio_set_fd_handler is
      * called while we're walking.
@@ -417,10 +422,43 @@ static bool aio_dispatch_handlers(AioContext *ctx)
     return progress;
 }
 
+/*
+ * Run all ->io_poll() handlers once, including those that
+ * remove_idle_poll_handlers() took off ctx->poll_aio_handlers, for
+ * aio_context_busy_poll_begin().
+ *
+ * Note that the caller must have incremented ctx->list_lock.
+ */
+static bool run_busy_poll_handlers(AioContext *ctx, AioHandlerList *ready_list)
+{
+    bool progress = false;
+    AioHandler *node;
+
+    QLIST_FOREACH_RCU(node, &ctx->aio_handlers, node) {
+        if (QLIST_IS_INSERTED(node, node_deleted) || !node->io_poll) {
+            continue;
+        }
+        if (node->io_poll(node->opaque)) {
+            aio_add_poll_ready_handler(ready_list, node);
+            if (node->opaque != &ctx->notifier) {
+                progress = true;
+            }
+        }
+    }
+
+    return progress;
+}
+
 void aio_dispatch(AioContext *ctx)
 {
     qemu_lockcnt_inc(&ctx->list_lock);
     aio_bh_poll(ctx);
+    if (ctx->busy_poll_cnt) {
+        AioHandlerList ready_list = QLIST_HEAD_INITIALIZER(ready_list);
+
+        run_busy_poll_handlers(ctx, &ready_list);
+        aio_dispatch_ready_handlers(ctx, &ready_list);
+    }
     aio_dispatch_handlers(ctx);
     aio_free_deleted_handlers(ctx);
     qemu_lockcnt_dec(&ctx->list_lock);
@@ -629,6 +667,15 @@ bool aio_poll(AioContext *ctx, bool blocking)
     progress = try_poll_mode(ctx, &ready_list, &timeout);
     assert(!(timeout && progress));
 
+    /*
+     * Some event sources only make progress while they are polled.  Poll them
+     * even if adaptive polling did not run, and do not block.
+     */
+    if (ctx->busy_poll_cnt && !progress) {
+        progress = run_busy_poll_handlers(ctx, &ready_list);
+        timeout = 0;
+    }
+
     /*
      * aio_notify can avoid the expensive event_notifier_set if
      * everything (file descriptors, bottom halves, timers) will
@@ -610,6 +610,7 @@ AioContext *aio_context_new(Error **errp)
     ctx->poll_max_ns = 0;
     ctx->poll_grow = 0;
     ctx->poll_shrink = 0;
+    ctx->busy_poll_cnt = 0;
 
     ctx->aio_max_batch = 0;
 
@@ -734,12 +735,28 @@ AioContext *qemu_get_current_aio_context(void)
     return NULL;
 }
 
+bool in_aio_context_event_loop(AioContext *ctx)
+{
+    return get_my_aiocontext() == ctx;
+}
+
 void qemu_set_current_aio_context(AioContext *ctx)
 {
     assert(!get_my_aiocontext());
     set_my_aiocontext(ctx);
 }
 
+void aio_context_busy_poll_begin(AioContext *ctx)
+{
+    ctx->busy_poll_cnt++;
+}
+
+void aio_context_busy_poll_end(AioContext *ctx)
+{
+    assert(ctx->busy_poll_cnt > 0);
+    ctx->busy_poll_cnt--;
+}
+
 void aio_context_set_thread_pool_params(AioContext *ctx, int64_t min,
                                         int64_t max, Error **errp)
 {
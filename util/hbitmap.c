@@ -14,6 +14,10 @@
 #include "qemu/host-utils.h"
 #include "trace.h"
 #include "crypto/hash.h"
+#if defined(CONFIG_AVX2_OPT) && HOST_LONG_BITS == 64
+#include <immintrin.h>
+#include "host/cpuinfo.h"
+#endif
 
 /* HBitmaps provides an array of bits.  The bits are stored as usual in an
  * array of unsigned longs, but HBitmap is also optimized to provide fast
@@ -101,6 +105,221 @@ struct HBitmap {
     uint64_t sizes[HBITMAP_LEVELS];
 };
 
+/*
+ * Bulk operations on arrays of words.  These are used wherever a range of
+ * a level is processed as a whole: counting set bits, merging, rebuilding
+ * the upper levels after deserialization and skipping runs of set bits.
+ * Iteration still walks the levels one word at a time; it skips empty
+ * ranges through the upper levels and does not benefit from this.
+ */
+typedef struct HBitmapAccel {
+    /* Return the number of set bits in @n words */
+    uint64_t (*count)(const unsigned long *p, size_t n);
+    /* Store @a | @b into @dst, which may alias them; return its count */
+    uint64_t (*merge)(unsigned long *dst, const unsigned long *a,
+                   const unsigned long *b, size_t n);
+    /* Return the first index from @pos on that is not all ones, or @n */
+    size_t (*find_not_ones)(const unsigned long *p, size_t pos, size_t n);
+    /* Return a word with bit i set iff p[i] is nonzero, @n <= BITS_PER_LONG */
+    unsigned long (*nonzero_mask)(const unsigned long *p, size_t n);
+} HBitmapAccel;
+
+static uint64_t hb_count_int(const unsigned long *p, size_t n)
+{
+    uint64_t count = 0;
+    size_t i;
+
+    for (i = 0; i < n; i++) {
+        count += ctpopl(p[i]);
+    }
+    return count;
+}
+
+static uint64_t hb_or_int(unsigned long *dst, const unsigned long *a,
+                          const unsigned long *b, size_t n)
+{
+    uint64_t count = 0;
+    size_t i;
+
+    for (i = 0; i < n; i++) {
+        dst[i] = a[i] | b[i];
+        count += ctpopl(dst[i]);
+    }
+    return count;
+}
+
+static size_t hb_find_not_ones_int(const unsigned long *p, size_t pos,
+                                   size_t n)
+{
+    while (pos < n && p[pos] == (unsigned long)-1) {
+        pos++;
+    }
+    return pos;
+}
+
+static unsigned long hb_nonzero_mask_int(const unsigned long *p, size_t n)
+{
+    unsigned long mask = 0;
+    size_t i;
+
+    for (i = 0; i < n; i++) {
+        if (p[i]) {
+            mask |= 1UL << i;
+        }
+    }
+    return mask;
+}
+
+static const HBitmapAccel hb_accel_int = {
+    .count = hb_count_int,
+    .merge = hb_or_int,
+    .find_not_ones = hb_find_not_ones_int,
+    .nonzero_mask = hb_nonzero_mask_int,
+};
+
+#if defined(CONFIG_AVX2_OPT) && HOST_LONG_BITS == 64
+/*
+ * Population count of each 64-bit lane: look up the count of every nibble
+ * with a byte shuffle, then add up the bytes of each lane with SAD.
+ */
+static inline __m256i __attribute__((target("avx2")))
+hb_popcnt_avx2(__m256i v)
+{
+    const __m256i lookup = _mm256_setr_epi8(0, 1, 1, 2, 1, 2, 2, 3,
+                                            1, 2, 2, 3, 2, 3, 3, 4,
+                                            0, 1, 1, 2, 1, 2, 2, 3,
+                                            1, 2, 2, 3, 2, 3, 3, 4);
+    const __m256i low_mask = _mm256_set1_epi8(0x0f);
+    __m256i lo = _mm256_and_si256(v, low_mask);
+    __m256i hi = _mm256_and_si256(_mm256_srli_epi16(v, 4), low_mask);
+    __m256i cnt = _mm256_add_epi8(_mm256_shuffle_epi8(lookup, lo),
+                                  _mm256_shuffle_epi8(lookup, hi));
+
+    return _mm256_sad_epu8(cnt, _mm256_setzero_si256());
+}
+
+static inline uint64_t __attribute__((target("avx2")))
+hb_sum_avx2(__m256i acc)
+{
+    return _mm256_extract_epi64(acc, 0) + _mm256_extract_epi64(acc, 1) +
+           _mm256_extract_epi64(acc, 2) + _mm256_extract_epi64(acc, 3);
+}
+
+static uint64_t __attribute__((target("avx2")))
+hb_count_avx2(const unsigned long *p, size_t n)
+{
+    __m256i acc = _mm256_setzero_si256();
+    size_t i;
+
+    for (i = 0; i + 4 <= n; i += 4) {
+        __m256i v = _mm256_loadu_si256((const __m256i *)(p + i));
+        acc = _mm256_add_epi64(acc, hb_popcnt_avx2(v));
+    }
+    return hb_sum_avx2(acc) + hb_count_int(p + i, n - i);
+}
+
+static uint64_t __attribute__((target("avx2")))
+hb_or_avx2(unsigned long *dst, const unsigned long *a,
+           const unsigned long *b, size_t n)
+{
+    __m256i acc = _mm256_setzero_si256();
+    size_t i;
+
+    for (i = 0; i + 4 <= n; i += 4) {
+        __m256i v = _mm256_or_si256(
+            _mm256_loadu_si256((const __m256i *)(a + i)),
+            _mm256_loadu_si256((const __m256i *)(b + i)));
+        _mm256_storeu_si256((__m256i *)(dst + i), v);
+        acc = _mm256_add_epi64(acc, hb_popcnt_avx2(v));
+    }
+    return hb_sum_avx2(acc) + hb_or_int(dst + i, a + i, b + i, n - i);
+}
+
+static size_t __attribute__((target("avx2")))
+hb_find_not_ones_avx2(const unsigned long *p, size_t pos, size_t n)
+{
+    const __m256i ones = _mm256_set1_epi64x(-1);
+
+    /* Check 8 words at a time, and find the exact one only at the end */
+    for (; pos + 8 <= n; pos += 8) {
+        __m256i v = _mm256_and_si256(
+            _mm256_loadu_si256((const __m256i *)(p + pos)),
+            _mm256_loadu_si256((const __m256i *)(p + pos + 4)));
+        if (!_mm256_testc_si256(v, ones)) {
+            break;
+        }
+    }
+    return hb_find_not_ones_int(p, pos, n);
+}
+
+static unsigned long __attribute__((target("avx2")))
+hb_nonzero_mask_avx2(const unsigned long *p, size_t n)
+{
+    const __m256i zero = _mm256_setzero_si256();
+    unsigned long mask = 0;
+    size_t i;
+
+    for (i = 0; i + 4 <= n; i += 4) {
+        __m256i v = _mm256_loadu_si256((const __m256i *)(p + i));
+        int zeroes = _mm256_movemask_pd(
+            _mm256_castsi256_pd(_mm256_cmpeq_epi64(v, zero)));
+        mask |= (unsigned long)(~zeroes & 0xf) << i;
+    }
+    return mask | (i < n ? hb_nonzero_mask_int(p + i, n - i) << i : 0);
+}
+
+static const HBitmapAccel hb_accel_avx2 = {
+    .count = hb_count_avx2,
+    .merge = hb_or_avx2,
+    .find_not_ones = hb_find_not_ones_avx2,
+    .nonzero_mask = hb_nonzero_mask_avx2,
+};
+
+static unsigned used_accel;
+static const HBitmapAccel *hb_accel = &hb_accel_int;
+
+static unsigned __attribute__((noinline))
+select_accel_cpuinfo(unsigned info)
+{
+    /* Array is sorted in order of algorithm preference. */
+    static const struct {
+        unsigned bit;
+        const HBitmapAccel *accel;
+    } all[] = {
+        { CPUINFO_AVX2,   &hb_accel_avx2 },
+        { CPUINFO_ALWAYS, &hb_accel_int },
+    };
+
+    for (unsigned i = 0; i < ARRAY_SIZE(all); ++i) {
+        if (info & all[i].bit) {
+            hb_accel = all[i].accel;
+            return all[i].bit;
+        }
+    }
+    return 0;
+}
+
+static void __attribute__((constructor)) init_accel(void)
+{
+    used_accel = select_accel_cpuinfo(cpuinfo_init());
+}
+
+bool test_hbitmap_next_accel(void)
+{
+    /* Same as test_buffer_is_zero_next_accel() */
+    unsigned used = select_accel_cpuinfo(cpuinfo & ~used_accel);
+    used_accel |= used;
+    return used;
+}
+#else
+static const HBitmapAccel *hb_accel = &hb_accel_int;
+
+bool test_hbitmap_next_accel(void)
+{
+    return false;
+}
+#endif
+
 /* Advance hbi to the next nonzero word and return it.  hbi->pos
  * is updated.  Returns zero if we reach the end of the bitmap.
  */
@@ -245,10 +464,7 @@ int64_t hbitmap_next_zero(const HBitmap *hb, int64_t start, int64_t count)
     assert((start >> hb->granularity) < hb->size);
 
     if (cur == (unsigned long)-1) {
-        do {
-            pos++;
-        } while (pos < sz && last_lev[pos] == (unsigned long)-1);
-
+        pos = hb_accel->find_not_ones(last_lev, pos + 1, sz);
         if (pos >= sz) {
             return -1;
         }
@@ -349,63 +565,25 @@ uint64_t hbitmap_count(const HBitmap *hb)
     return hb->count << hb->granularity;
 }
 
-/**
- * hbitmap_iter_next_word:
- * @hbi: HBitmapIter to operate on.
- * @p_cur: Location where to store the next non-zero word.
- *
- * Return the index of the next nonzero word that is set in @hbi's
- * associated HBitmap, and set *p_cur to the content of that word
- * (bits before the index that was passed to hbitmap_iter_init are
- * trimmed on the first call).  Return -1, and set *p_cur to zero,
- * if all remaining words are zero.
- */
-static size_t hbitmap_iter_next_word(HBitmapIter *hbi, unsigned long *p_cur)
-{
-    unsigned long cur = hbi->cur[HBITMAP_LEVELS - 1];
-
-    if (cur == 0) {
-        cur = hbitmap_iter_skip_words(hbi);
-        if (cur == 0) {
-            *p_cur = 0;
-            return -1;
-        }
-    }
-
-    /* The next call will resume work from the next word.  */
-    hbi->cur[HBITMAP_LEVELS - 1] = 0;
-    *p_cur = cur;
-    return hbi->pos;
-}
-
-/* Count the number of set bits between start and end, not accounting for
- * the granularity.  Also an example of how to use hbitmap_iter_next_word.
+/* Count the number of set bits between start and last, not accounting for
+ * the granularity.
  */
 static uint64_t hb_count_between(HBitmap *hb, uint64_t start, uint64_t last)
 {
-    HBitmapIter hbi;
-    uint64_t count = 0;
-    uint64_t end = last + 1;
-    unsigned long cur;
-    size_t pos;
-
-    hbitmap_iter_init(&hbi, hb, start << hb->granularity);
-    for (;;) {
-        pos = hbitmap_iter_next_word(&hbi, &cur);
-        if (pos >= (end >> BITS_PER_LEVEL)) {
-            break;
-        }
-        count += ctpopl(cur);
-    }
+    const unsigned long *lev = hb->levels[HBITMAP_LEVELS - 1];
+    size_t pos = start >> BITS_PER_LEVEL;
+    size_t last_pos = last >> BITS_PER_LEVEL;
+    unsigned long first_mask = ~0UL << (start & (BITS_PER_LONG - 1));
+    unsigned long last_mask =
+        ~0UL >> (BITS_PER_LONG - 1 - (last & (BITS_PER_LONG - 1)));
 
-    if (pos == (end >> BITS_PER_LEVEL)) {
-        /* Drop bits representing the END-th and subsequent items.  */
-        int bit = end & (BITS_PER_LONG - 1);
-        cur &= (1UL << bit) - 1;
-        count += ctpopl(cur);
+    if (pos == last_pos) {
+        return ctpopl(lev[pos] & first_mask & last_mask);
     }
 
-    return count;
+    return ctpopl(lev[pos] & first_mask) +
+           hb_accel->count(lev + pos + 1, last_pos - pos - 1) +
+           ctpopl(lev[last_pos] & last_mask);
 }
 
 /* Setting starts at the last layer and propagates up if an element
@@ -682,6 +860,12 @@ void hbitmap_serialize_part(const HBitmap *hb, uint8_t *buf,
     serialization_chunk(hb, start, count, &cur, &el_count);
     end = cur + el_count;
 
+    if (!HOST_BIG_ENDIAN) {
+        /* The serialized format is the in-memory one */
+        memcpy(buf, cur, el_count * sizeof(unsigned long));
+        return;
+    }
+
     while (cur != end) {
         unsigned long el =
             (BITS_PER_LONG == 32 ? cpu_to_le32(*cur) : cpu_to_le64(*cur));
@@ -705,17 +889,22 @@ void hbitmap_deserialize_part(HBitmap *hb, uint8_t *buf,
     serialization_chunk(hb, start, count, &cur, &el_count);
     end = cur + el_count;
 
-    while (cur != end) {
-        memcpy(cur, buf, sizeof(*cur));
+    if (!HOST_BIG_ENDIAN) {
+        /* The serialized format is the in-memory one */
+        memcpy(cur, buf, el_count * sizeof(unsigned long));
+    } else {
+        while (cur != end) {
+            memcpy(cur, buf, sizeof(*cur));
 
-        if (BITS_PER_LONG == 32) {
-            le32_to_cpus((uint32_t *)cur);
-        } else {
-            le64_to_cpus((uint64_t *)cur);
-        }
+            if (BITS_PER_LONG == 32) {
+                le32_to_cpus((uint32_t *)cur);
+            } else {
+                le64_to_cpus((uint64_t *)cur);
+            }
 
-        buf += sizeof(unsigned long);
-        cur++;
+            buf += sizeof(unsigned long);
+            cur++;
+        }
     }
     if (finish) {
         hbitmap_deserialize_finish(hb);
@@ -767,13 +956,13 @@ void hbitmap_deserialize_finish(HBitmap *bitmap)
     for (lev = HBITMAP_LEVELS - 1; lev-- > 0; ) {
         prev_size = size;
         size = MAX((size + BITS_PER_LONG - 1) >> BITS_PER_LEVEL, 1);
-        memset(bitmap->levels[lev], 0, size * sizeof(unsigned long));
 
-        for (i = 0; i < prev_size; ++i) {
-            if (bitmap->levels[lev + 1][i]) {
-                bitmap->levels[lev][i >> BITS_PER_LEVEL] |=
-                    1UL << (i & (BITS_PER_LONG - 1));
-            }
+        for (i = 0; i < size; ++i) {
+            int64_t first = i << BITS_PER_LEVEL;
+
+            bitmap->levels[lev][i] = first >= prev_size ? 0 :
+                hb_accel->nonzero_mask(&bitmap->levels[lev + 1][first],
+                                       MIN(BITS_PER_LONG, prev_size - first));
         }
     }
 
@@ -901,7 +1090,7 @@ static void hbitmap_sparse_merge(HBitmap *dst, const HBitmap *src)
 void hbitmap_merge(const HBitmap *a, const HBitmap *b, HBitmap *result)
 {
     int i;
-    uint64_t j;
+    uint64_t count;
 
     assert(a->orig_size == result->orig_size);
     assert(b->orig_size == result->orig_size);
@@ -932,16 +1121,16 @@ void hbitmap_merge(const HBitmap *a, const HBitmap *b, HBitmap *result)
     /* This merge is O(size), as BITS_PER_LONG and HBITMAP_LEVELS are constant.
      * It may be possible to improve running times for sparsely populated maps
      * by using hbitmap_iter_next, but this is suboptimal for dense maps.
+     * The dirty count is recomputed in the same pass over the last level.
      */
     assert(a->size == b->size);
     for (i = HBITMAP_LEVELS - 1; i >= 0; i--) {
-        for (j = 0; j < a->sizes[i]; j++) {
-            result->levels[i][j] = a->levels[i][j] | b->levels[i][j];
+        count = hb_accel->merge(result->levels[i], a->levels[i],
+                                b->levels[i], a->sizes[i]);
+        if (i == HBITMAP_LEVELS - 1) {
+            result->count = count;
         }
     }
-
-    /* Recompute the dirty count */
-    result->count = hb_count_between(result, 0, result->size - 1);
 }
 
 char *hbitmap_sha256(const HBitmap *bitmap, Error **errp)
@@ -19,13 +19,22 @@
 #include "qemu/queue.h"
 #include "qemu/thread.h"
 #include "qemu/coroutine.h"
+#include "qemu/timer.h"
 #include "trace.h"
 #include "block/thread-pool.h"
 #include "qemu/main-loop.h"
 
 static void do_spawn_thread(ThreadPool *pool);
 
+/*
+ * Minimum interval between two kicks of idle workers of other pools.  A
+ * kicked worker keeps stealing until there is nothing left, so one kick is
+ * enough for a burst of submissions.
+ */
+#define THREAD_POOL_KICK_INTERVAL_NS (100 * SCALE_US)
+
 typedef struct ThreadPoolElement ThreadPoolElement;
+typedef struct ThreadPoolWorker ThreadPoolWorker;
 
 enum ThreadState {
     THREAD_QUEUED,
@@ -39,100 +48,402 @@ struct ThreadPoolElement {
     ThreadPoolFunc *func;
     void *arg;
 
-    /* Moving state out of THREAD_QUEUED is protected by lock.  After
-     * that, only the worker thread can write to it.  Reads and writes
-     * of state and ret are ordered with memory barriers.
+    /* Moving state out of THREAD_QUEUED is protected by the lock of the
+     * worker that the request is queued on.  After that, only the thread
+     * running the request can write to it.  Reads and writes of state and
+     * ret are ordered with memory barriers.
      */
     enum ThreadState state;
     int ret;
 
-    /* Access to this list is protected by lock.  */
+    /* The worker whose deque holds the request, NULL once it is taken.
+     * Written under the worker's lock.
+     */
+    ThreadPoolWorker *worker;
+
+    /* Access to this list is protected by the worker's lock.  */
     QTAILQ_ENTRY(ThreadPoolElement) reqs;
 
     /* This list is only written by the thread pool's mother thread.  */
     QLIST_ENTRY(ThreadPoolElement) all;
 };
 
+/*
+ * Each worker thread has its own deque of requests, so that workers don't
+ * contend on a lock of the pool.  A worker takes requests from the head of
+ * its deque.  When it runs out of work, it steals requests from the tail of
+ * the deques of the other workers in the pool.  Idle workers can also be
+ * kicked to steal requests from the pools of other AioContexts, which saves
+ * a busy pool from waiting until a new thread is spawned.
+ */
+struct ThreadPoolWorker {
+    ThreadPool *pool;
+    QemuMutex lock;
+    QemuCond request_cond;
+
+    /* The following variables are protected by lock.  */
+    QTAILQ_HEAD(, ThreadPoolElement) request_list;
+    bool idle;           /* also read without the lock */
+    bool kicked;         /* steal from other pools after waking up */
+
+    /* NUMA node that the thread ran on when it last went idle, or -1 */
+    int node;
+
+    /* The following variables are protected by pool->lock.  */
+    bool started;
+    QTAILQ_ENTRY(ThreadPoolWorker) next;
+};
+
 struct ThreadPool {
     AioContext *ctx;
     QEMUBH *completion_bh;
     QemuMutex lock;
     QemuCond worker_stopped;
-    QemuCond request_cond;
     QEMUBH *new_thread_bh;
 
     /* The following variables are only accessed from one AioContext. */
     QLIST_HEAD(, ThreadPoolElement) head;
+    int64_t next_kick_ns; /* see thread_pool_kick_idle() */
 
     /* The following variables are protected by lock.  */
-    QTAILQ_HEAD(, ThreadPoolElement) request_list;
+    QTAILQ_HEAD(, ThreadPoolWorker) workers;
+    ThreadPoolWorker *last_worker; /* for round robin submission */
     int cur_threads;
-    int idle_threads;
     int new_threads;     /* backlog of threads we need to create */
     int pending_threads; /* threads created but not running yet */
+    int stolen_requests; /* requests run by workers of other pools */
     int min_threads;
     int max_threads;
+
+    /* Updated atomically by workers going idle.  */
+    int idle_threads;
+
+    /* Protected by thread_pools_lock.  */
+    QLIST_ENTRY(ThreadPool) next;
 };
 
-static void *worker_thread(void *opaque)
+/* All pools, for workers that steal from other AioContexts */
+static QemuMutex thread_pools_lock;
+static QLIST_HEAD(, ThreadPool) thread_pools =
+    QLIST_HEAD_INITIALIZER(thread_pools);
+static int thread_pools_idle;
+
+static void __attribute__((__constructor__)) thread_pools_init(void)
 {
-    ThreadPool *pool = opaque;
+    qemu_mutex_init(&thread_pools_lock);
+}
+
+/*
+ * Returns the NUMA node that the calling thread runs on, or -1.  Workers are
+ * spawned by the pool's home thread and inherit its CPU affinity, so this is
+ * usually the node of the AioContext that the worker belongs to.
+ */
+static int thread_pool_current_node(void)
+{
+#if defined(CONFIG_LINUX) && defined(CONFIG_GETCPU)
+    unsigned cpu, node;
+
+    if (getcpu(&cpu, &node) == 0) {
+        return node;
+    }
+#endif
+    return -1;
+}
+
+static void thread_pool_run(ThreadPoolElement *req)
+{
+    ThreadPool *pool = req->pool;
+    int ret;
+
+    ret = req->func(req->arg);
+
+    req->ret = ret;
+    /* Write ret before state.  */
+    smp_wmb();
+    req->state = THREAD_DONE;
+
+    qemu_bh_schedule(pool->completion_bh);
+}
+
+/* Called with w->lock held */
+static ThreadPoolElement *thread_pool_take(ThreadPoolWorker *w,
+                                           ThreadPoolElement *req)
+{
+    if (req) {
+        QTAILQ_REMOVE(&w->request_list, req, reqs);
+        qatomic_set(&req->worker, NULL);
+        req->state = THREAD_ACTIVE;
+    }
+    return req;
+}
+
+/*
+ * Takes a request from the tail of the deque of a worker of @pool other than
+ * @self, preferring workers on @node unless it is -1.  Called with pool->lock
+ * held.
+ */
+static ThreadPoolElement *thread_pool_steal_from(ThreadPool *pool,
+                                                 ThreadPoolWorker *self,
+                                                 int node)
+{
+    ThreadPoolWorker *w;
+    ThreadPoolElement *req = NULL;
+
+    QTAILQ_FOREACH(w, &pool->workers, next) {
+        if (w == self || (node >= 0 && qatomic_read(&w->node) != node)) {
+            continue;
+        }
+        qemu_mutex_lock(&w->lock);
+        req = thread_pool_take(w, QTAILQ_LAST(&w->request_list));
+        qemu_mutex_unlock(&w->lock);
+        if (req) {
+            trace_thread_pool_steal(self, req, pool);
+            break;
+        }
+    }
+    return req;
+}
+
+/* Runs a request of another AioContext's pool, returns false if none */
+static bool thread_pool_steal_other(ThreadPoolWorker *self)
+{
+    ThreadPool *pool;
+    ThreadPoolElement *req = NULL;
+    int node = qatomic_read(&self->node);
+
+    qemu_mutex_lock(&thread_pools_lock);
+    QLIST_FOREACH(pool, &thread_pools, next) {
+        if (pool == self->pool) {
+            continue;
+        }
+        qemu_mutex_lock(&pool->lock);
+        req = thread_pool_steal_from(pool, NULL, node);
+        if (!req && node >= 0) {
+            req = thread_pool_steal_from(pool, NULL, -1);
+        }
+        if (req) {
+            /* Keeps the pool alive until the request is done */
+            pool->stolen_requests++;
+        }
+        qemu_mutex_unlock(&pool->lock);
+        if (req) {
+            break;
+        }
+    }
+    qemu_mutex_unlock(&thread_pools_lock);
+
+    if (!req) {
+        return false;
+    }
+
+    thread_pool_run(req);
 
     qemu_mutex_lock(&pool->lock);
-    pool->pending_threads--;
-    do_spawn_thread(pool);
+    if (--pool->stolen_requests == 0) {
+        qemu_cond_signal(&pool->worker_stopped);
+    }
+    qemu_mutex_unlock(&pool->lock);
+    return true;
+}
 
-    while (pool->cur_threads <= pool->max_threads) {
-        ThreadPoolElement *req;
-        int ret;
-
-        if (QTAILQ_EMPTY(&pool->request_list)) {
-            pool->idle_threads++;
-            ret = qemu_cond_timedwait(&pool->request_cond, &pool->lock, 10000);
-            pool->idle_threads--;
-            if (ret == 0 &&
-                QTAILQ_EMPTY(&pool->request_list) &&
-                pool->cur_threads > pool->min_threads) {
-                /* Timed out + no work to do + no need for warm threads = exit.  */
+/*
+ * Kicks an idle worker of @pool that last ran on @node, or on any node if it
+ * is -1.  Called with pool->lock held.
+ */
+static bool thread_pool_kick_one(ThreadPool *pool, int node)
+{
+    ThreadPoolWorker *w;
+    bool kicked;
+
+    QTAILQ_FOREACH(w, &pool->workers, next) {
+        if (!qatomic_read(&w->idle) ||
+            (node >= 0 && qatomic_read(&w->node) != node)) {
+            continue;
+        }
+        qemu_mutex_lock(&w->lock);
+        kicked = w->idle;
+        if (kicked) {
+            w->kicked = true;
+            qemu_cond_signal(&w->request_cond);
+        }
+        qemu_mutex_unlock(&w->lock);
+        if (kicked) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/*
+ * Wakes up an idle worker of another pool, preferably one on the same NUMA
+ * node as the caller, to steal requests from @pool.  This is best effort:
+ * it gives up instead of waiting for thread_pools_lock, and it does nothing
+ * if it was called less than THREAD_POOL_KICK_INTERVAL_NS ago.  Called from
+ * the pool's AioContext.
+ */
+static void thread_pool_kick_idle(ThreadPool *pool)
+{
+    ThreadPool *other;
+    bool kicked = false;
+    int64_t now;
+    int node;
+
+    if (!qatomic_read(&thread_pools_idle)) {
+        return;
+    }
+
+    now = get_clock();
+    if (now < pool->next_kick_ns) {
+        return;
+    }
+    pool->next_kick_ns = now + THREAD_POOL_KICK_INTERVAL_NS;
+
+    if (qemu_mutex_trylock(&thread_pools_lock)) {
+        return;
+    }
+
+    node = thread_pool_current_node();
+    for (; !kicked; node = -1) {
+        QLIST_FOREACH(other, &thread_pools, next) {
+            if (other == pool || !qatomic_read(&other->idle_threads)) {
+                continue;
+            }
+            qemu_mutex_lock(&other->lock);
+            kicked = thread_pool_kick_one(other, node);
+            qemu_mutex_unlock(&other->lock);
+            if (kicked) {
                 break;
             }
-            /*
-             * Even if there was some work to do, check if there aren't
-             * too many worker threads before picking it up.
-             */
-            continue;
         }
+        if (node < 0) {
+            break;
+        }
+    }
+    qemu_mutex_unlock(&thread_pools_lock);
+}
 
-        req = QTAILQ_FIRST(&pool->request_list);
-        QTAILQ_REMOVE(&pool->request_list, req, reqs);
-        req->state = THREAD_ACTIVE;
+/*
+ * Waits for work.  Returns false if the worker has left the pool and must
+ * exit.  Otherwise, *req is a request taken from another worker of the pool
+ * or NULL, and *kicked is set if another pool asked for help.
+ */
+static bool thread_pool_worker_wait(ThreadPoolWorker *w,
+                                    ThreadPoolElement **req, bool *kicked)
+{
+    ThreadPool *pool = w->pool;
+    bool woken = true;
+
+    qemu_mutex_lock(&pool->lock);
+
+    /*
+     * Submitters pick a worker under pool->lock.  Until we are marked idle
+     * below, they may queue requests on busy siblings, so look there again
+     * while holding the lock.
+     */
+    *req = thread_pool_steal_from(pool, w, -1);
+    if (*req) {
         qemu_mutex_unlock(&pool->lock);
+        return true;
+    }
 
-        ret = req->func(req->arg);
+    qemu_mutex_lock(&w->lock);
+    if (QTAILQ_EMPTY(&w->request_list) &&
+        pool->cur_threads > pool->max_threads) {
+        goto exit;
+    }
 
-        req->ret = ret;
-        /* Write ret before state.  */
-        smp_wmb();
-        req->state = THREAD_DONE;
+    if (QTAILQ_EMPTY(&w->request_list) && !w->kicked) {
+        qatomic_set(&w->node, thread_pool_current_node());
+        qatomic_set(&w->idle, true);
+        qatomic_inc(&pool->idle_threads);
+        qatomic_inc(&thread_pools_idle);
+        qemu_mutex_unlock(&pool->lock);
+        woken = qemu_cond_timedwait(&w->request_cond, &w->lock, 10000);
+        qatomic_dec(&thread_pools_idle);
+        qatomic_dec(&pool->idle_threads);
+        qatomic_set(&w->idle, false);
+    } else {
+        qemu_mutex_unlock(&pool->lock);
+    }
+    *kicked = w->kicked;
+    w->kicked = false;
+    qemu_mutex_unlock(&w->lock);
 
-        qemu_bh_schedule(pool->completion_bh);
-        qemu_mutex_lock(&pool->lock);
+    if (woken) {
+        /* There may be work now, or too many worker threads */
+        return true;
+    }
+
+    /* Timed out + no work to do + no need for warm threads = exit.  */
+    qemu_mutex_lock(&pool->lock);
+    qemu_mutex_lock(&w->lock);
+    if (!QTAILQ_EMPTY(&w->request_list) ||
+        pool->cur_threads <= pool->min_threads) {
+        qemu_mutex_unlock(&w->lock);
+        qemu_mutex_unlock(&pool->lock);
+        return true;
     }
 
+exit:
+    QTAILQ_REMOVE(&pool->workers, w, next);
+    if (pool->last_worker == w) {
+        pool->last_worker = NULL;
+    }
     pool->cur_threads--;
     qemu_cond_signal(&pool->worker_stopped);
+    qemu_mutex_unlock(&w->lock);
+    qemu_mutex_unlock(&pool->lock);
+    return false;
+}
 
-    /*
-     * Wake up another thread, in case we got a wakeup but decided
-     * to exit due to pool->cur_threads > pool->max_threads.
-     */
-    qemu_cond_signal(&pool->request_cond);
+static void *worker_thread(void *opaque)
+{
+    ThreadPoolWorker *w = opaque;
+    ThreadPool *pool = w->pool;
+    bool kicked = false;
+
+    qemu_mutex_lock(&pool->lock);
+    pool->pending_threads--;
+    do_spawn_thread(pool);
     qemu_mutex_unlock(&pool->lock);
+
+    for (;;) {
+        ThreadPoolElement *req;
+
+        qemu_mutex_lock(&w->lock);
+        req = thread_pool_take(w, QTAILQ_FIRST(&w->request_list));
+        qemu_mutex_unlock(&w->lock);
+
+        if (!req) {
+            qemu_mutex_lock(&pool->lock);
+            req = thread_pool_steal_from(pool, w, -1);
+            qemu_mutex_unlock(&pool->lock);
+        }
+        if (req) {
+            thread_pool_run(req);
+            continue;
+        }
+
+        if (kicked && thread_pool_steal_other(w)) {
+            continue;
+        }
+        if (!thread_pool_worker_wait(w, &req, &kicked)) {
+            break;
+        }
+        if (req) {
+            thread_pool_run(req);
+        }
+    }
+
+    qemu_cond_destroy(&w->request_cond);
+    qemu_mutex_destroy(&w->lock);
+    g_free(w);
     return NULL;
 }
 
 static void do_spawn_thread(ThreadPool *pool)
 {
+    ThreadPoolWorker *w;
     QemuThread t;
 
     /* Runs with lock taken.  */
@@ -140,10 +451,18 @@ static void do_spawn_thread(ThreadPool *pool)
         return;
     }
 
+    QTAILQ_FOREACH(w, &pool->workers, next) {
+        if (!w->started) {
+            break;
+        }
+    }
+    assert(w);
+
+    w->started = true;
     pool->new_threads--;
     pool->pending_threads++;
 
-    qemu_thread_create(&t, "worker", worker_thread, pool, QEMU_THREAD_DETACHED);
+    qemu_thread_create(&t, "worker", worker_thread, w, QEMU_THREAD_DETACHED);
 }
 
 static void spawn_thread_bh_fn(void *opaque)
@@ -155,8 +474,21 @@ static void spawn_thread_bh_fn(void *opaque)
     qemu_mutex_unlock(&pool->lock);
 }
 
-static void spawn_thread(ThreadPool *pool)
+/*
+ * Adds a worker to the pool.  Requests can be queued on it right away, other
+ * workers steal them if the thread takes a while to start.
+ */
+static ThreadPoolWorker *spawn_thread(ThreadPool *pool)
 {
+    ThreadPoolWorker *w = g_new0(ThreadPoolWorker, 1);
+
+    w->pool = pool;
+    w->node = -1;
+    qemu_mutex_init(&w->lock);
+    qemu_cond_init(&w->request_cond);
+    QTAILQ_INIT(&w->request_list);
+    QTAILQ_INSERT_TAIL(&pool->workers, w, next);
+
     pool->cur_threads++;
     pool->new_threads++;
     /* If there are threads being created, they will spawn new workers, so
@@ -169,6 +501,19 @@ static void spawn_thread(ThreadPool *pool)
     if (!pool->pending_threads) {
         qemu_bh_schedule(pool->new_thread_bh);
     }
+    return w;
+}
+
+/* Wakes up all workers of the pool, called with pool->lock held */
+static void thread_pool_wake_all(ThreadPool *pool)
+{
+    ThreadPoolWorker *w;
+
+    QTAILQ_FOREACH(w, &pool->workers, next) {
+        qemu_mutex_lock(&w->lock);
+        qemu_cond_signal(&w->request_cond);
+        qemu_mutex_unlock(&w->lock);
+    }
 }
 
 static void thread_pool_completion_bh(void *opaque)
@@ -219,12 +564,21 @@ static void thread_pool_cancel(BlockAIOCB *acb)
 {
     ThreadPoolElement *elem = (ThreadPoolElement *)acb;
     ThreadPool *pool = elem->pool;
+    ThreadPoolWorker *w;
 
     trace_thread_pool_cancel(elem, elem->common.opaque);
 
+    /* pool->lock keeps the worker from exiting and other pools from stealing */
     QEMU_LOCK_GUARD(&pool->lock);
+    w = qatomic_read(&elem->worker);
+    if (!w) {
+        return;
+    }
+
+    QEMU_LOCK_GUARD(&w->lock);
     if (elem->state == THREAD_QUEUED) {
-        QTAILQ_REMOVE(&pool->request_list, elem, reqs);
+        QTAILQ_REMOVE(&w->request_list, elem, reqs);
+        qatomic_set(&elem->worker, NULL);
         qemu_bh_schedule(pool->completion_bh);
 
         elem->state = THREAD_DONE;
@@ -238,12 +592,43 @@ static const AIOCBInfo thread_pool_aiocb_info = {
     .cancel_async       = thread_pool_cancel,
 };
 
+/*
+ * Picks the worker for a new request: an idle one if there is any, else a
+ * new one if the pool may still grow, else the next one in turn.  Called with
+ * pool->lock held.
+ */
+static ThreadPoolWorker *thread_pool_pick_worker(ThreadPool *pool)
+{
+    ThreadPoolWorker *w;
+
+    if (qatomic_read(&pool->idle_threads)) {
+        QTAILQ_FOREACH(w, &pool->workers, next) {
+            if (qatomic_read(&w->idle)) {
+                return w;
+            }
+        }
+    }
+
+    if (pool->cur_threads < pool->max_threads) {
+        return spawn_thread(pool);
+    }
+
+    w = pool->last_worker ? QTAILQ_NEXT(pool->last_worker, next) : NULL;
+    if (!w) {
+        w = QTAILQ_FIRST(&pool->workers);
+    }
+    pool->last_worker = w;
+    return w;
+}
+
 BlockAIOCB *thread_pool_submit_aio(ThreadPoolFunc *func, void *arg,
                                    BlockCompletionFunc *cb, void *opaque)
 {
     ThreadPoolElement *req;
+    ThreadPoolWorker *w;
     AioContext *ctx = qemu_get_current_aio_context();
     ThreadPool *pool = aio_get_thread_pool(ctx);
+    bool idle;
 
     /* Assert that the thread submitting work is the same running the pool */
     assert(pool->ctx == qemu_get_current_aio_context());
@@ -259,12 +644,20 @@ BlockAIOCB *thread_pool_submit_aio(ThreadPoolFunc *func, void *arg,
     trace_thread_pool_submit(pool, req, arg);
 
     qemu_mutex_lock(&pool->lock);
-    if (pool->idle_threads == 0 && pool->cur_threads < pool->max_threads) {
-        spawn_thread(pool);
+    w = thread_pool_pick_worker(pool);
+    qemu_mutex_lock(&w->lock);
+    QTAILQ_INSERT_TAIL(&w->request_list, req, reqs);
+    qatomic_set(&req->worker, w);
+    idle = w->idle;
+    if (idle) {
+        qemu_cond_signal(&w->request_cond);
     }
-    QTAILQ_INSERT_TAIL(&pool->request_list, req, reqs);
+    qemu_mutex_unlock(&w->lock);
     qemu_mutex_unlock(&pool->lock);
-    qemu_cond_signal(&pool->request_cond);
+
+    if (!idle) {
+        thread_pool_kick_idle(pool);
+    }
     return &req->common;
 }
 
@@ -315,8 +708,8 @@ void thread_pool_update_params(ThreadPool *pool, AioContext *ctx)
         spawn_thread(pool);
     }
 
-    for (int i = pool->cur_threads; i > pool->max_threads; i--) {
-        qemu_cond_signal(&pool->request_cond);
+    if (pool->cur_threads > pool->max_threads) {
+        thread_pool_wake_all(pool);
     }
 
     qemu_mutex_unlock(&pool->lock);
@@ -333,13 +726,16 @@ static void thread_pool_init_one(ThreadPool *pool, AioContext *ctx)
     pool->completion_bh = aio_bh_new(ctx, thread_pool_completion_bh, pool);
     qemu_mutex_init(&pool->lock);
     qemu_cond_init(&pool->worker_stopped);
-    qemu_cond_init(&pool->request_cond);
     pool->new_thread_bh = aio_bh_new(ctx, spawn_thread_bh_fn, pool);
 
     QLIST_INIT(&pool->head);
-    QTAILQ_INIT(&pool->request_list);
+    QTAILQ_INIT(&pool->workers);
 
     thread_pool_update_params(pool, ctx);
+
+    qemu_mutex_lock(&thread_pools_lock);
+    QLIST_INSERT_HEAD(&thread_pools, pool, next);
+    qemu_mutex_unlock(&thread_pools_lock);
 }
 
 ThreadPool *thread_pool_new(AioContext *ctx)
@@ -351,30 +747,44 @@ ThreadPool *thread_pool_new(AioContext *ctx)
 
 void thread_pool_free(ThreadPool *pool)
 {
+    ThreadPoolWorker *w, *next_w;
+
     if (!pool) {
         return;
     }
 
     assert(QLIST_EMPTY(&pool->head));
 
+    /* Stop workers of other pools from stealing */
+    qemu_mutex_lock(&thread_pools_lock);
+    QLIST_REMOVE(pool, next);
+    qemu_mutex_unlock(&thread_pools_lock);
+
     qemu_mutex_lock(&pool->lock);
 
     /* Stop new threads from spawning */
     qemu_bh_delete(pool->new_thread_bh);
+    QTAILQ_FOREACH_SAFE(w, &pool->workers, next, next_w) {
+        if (!w->started) {
+            QTAILQ_REMOVE(&pool->workers, w, next);
+            qemu_cond_destroy(&w->request_cond);
+            qemu_mutex_destroy(&w->lock);
+            g_free(w);
+        }
+    }
     pool->cur_threads -= pool->new_threads;
     pool->new_threads = 0;
 
     /* Wait for worker threads to terminate */
     pool->max_threads = 0;
-    qemu_cond_broadcast(&pool->request_cond);
-    while (pool->cur_threads > 0) {
+    thread_pool_wake_all(pool);
+    while (pool->cur_threads > 0 || pool->stolen_requests > 0) {
         qemu_cond_wait(&pool->worker_stopped, &pool->lock);
     }
 
     qemu_mutex_unlock(&pool->lock);
 
     qemu_bh_delete(pool->completion_bh);
-    qemu_cond_destroy(&pool->request_cond);
     qemu_cond_destroy(&pool->worker_stopped);
     qemu_mutex_destroy(&pool->lock);
     g_free(pool);
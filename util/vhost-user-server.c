@@ -9,6 +9,7 @@
  */
 #include "qemu/osdep.h"
 #include "qemu/error-report.h"
+#include "qemu/lockable.h"
 #include "qemu/main-loop.h"
 #include "qemu/vhost-user-server.h"
 #include "block/aio-wait.h"
@@ -52,6 +53,15 @@
  * possible by QIOChannel's support for spurious coroutine re-entry in
  * qio_channel_yield(). The coroutine will restart I/O when re-entered from the
  * new AioContext.
+ *
+ * The kick fds of virtqueues can be mapped to other AioContexts with
+ * queue_ctx, so that the virtqueues of one device are processed by several
+ * threads.  Each virtqueue is still only processed in one thread at a time,
+ * so libvhost-user needs no locking for it.  Changes to the device state,
+ * however, must not race with the virtqueues.  Before such a server handles
+ * a vhost-user message, vu_client_trip() therefore stops monitoring the kick
+ * fds and waits for in-flight requests to complete.  The kick fds are
+ * monitored again when the message has been handled.
  */
 
 static void vmsg_close_fds(VhostUserMsg *vmsg)
@@ -77,16 +87,18 @@ static void panic_cb(VuDev *vu_dev, const char *buf)
 
 void vhost_user_server_inc_in_flight(VuServer *server)
 {
-    assert(!server->wait_idle);
+    assert(!qatomic_read(&server->wait_idle));
     qatomic_inc(&server->in_flight);
 }
 
+/* May be called from any of the virtqueue AioContexts */
 void vhost_user_server_dec_in_flight(VuServer *server)
 {
     if (qatomic_fetch_dec(&server->in_flight) == 1) {
-        if (server->wait_idle) {
+        if (qatomic_xchg(&server->wait_idle, false)) {
             aio_co_wake(server->co_trip);
         }
+        aio_wait_kick();
     }
 }
 
@@ -95,6 +107,117 @@ bool vhost_user_server_has_in_flight(VuServer *server)
     return qatomic_load_acquire(&server->in_flight) > 0;
 }
 
+/* Wait for in-flight requests to complete, runs in vu_client_trip() */
+static void coroutine_fn vu_wait_idle(VuServer *server)
+{
+    if (!vhost_user_server_has_in_flight(server)) {
+        return;
+    }
+
+    qatomic_set(&server->wait_idle, true);
+    smp_mb();
+
+    /*
+     * Requests in other threads may have completed before they could see
+     * wait_idle.  Whoever clears wait_idle first decides whether we are woken
+     * up.
+     */
+    if (vhost_user_server_has_in_flight(server) ||
+        !qatomic_xchg(&server->wait_idle, false)) {
+        qemu_coroutine_yield();
+    }
+    assert(!vhost_user_server_has_in_flight(server));
+}
+
+/* The AioContext in which @vu_fd_watch is monitored, called with watch_lock */
+static AioContext *vu_fd_watch_aio_context(VuServer *server,
+                                           VuFdWatch *vu_fd_watch)
+{
+    if (server->queue_ctx && vu_fd_watch->queue >= 0 &&
+        server->queue_ctx[vu_fd_watch->queue]) {
+        return server->queue_ctx[vu_fd_watch->queue];
+    }
+    return server->ctx;
+}
+
+static void kick_handler(void *opaque);
+
+/* Start monitoring all kick fds, called with watch_lock */
+static void vu_attach_fd_watches(VuServer *server)
+{
+    VuFdWatch *vu_fd_watch;
+
+    QTAILQ_FOREACH(vu_fd_watch, &server->vu_fd_watches, next) {
+        vu_fd_watch->ctx = vu_fd_watch_aio_context(server, vu_fd_watch);
+        aio_set_fd_handler(vu_fd_watch->ctx, vu_fd_watch->fd, kick_handler,
+                           NULL, NULL, NULL, vu_fd_watch);
+    }
+}
+
+/* Stop monitoring all kick fds, called with watch_lock */
+static void vu_detach_fd_watches(VuServer *server)
+{
+    VuFdWatch *vu_fd_watch;
+
+    QTAILQ_FOREACH(vu_fd_watch, &server->vu_fd_watches, next) {
+        aio_set_fd_handler(vu_fd_watch->ctx, vu_fd_watch->fd,
+                           NULL, NULL, NULL, NULL, vu_fd_watch);
+    }
+}
+
+static void vu_queue_barrier_bh(void *opaque)
+{
+    VuServer *server = opaque;
+
+    if (qatomic_fetch_dec(&server->pending_barriers) == 1) {
+        aio_co_wake(server->co_trip);
+    }
+}
+
+/*
+ * Stop processing the virtqueues that are mapped to other AioContexts and
+ * wait until all of their requests have completed.  Runs in vu_client_trip().
+ */
+static void coroutine_fn vu_pause_queues(VuServer *server)
+{
+    int i;
+
+    WITH_QEMU_LOCK_GUARD(&server->watch_lock) {
+        vu_detach_fd_watches(server);
+        server->queues_paused = true;
+    }
+
+    /*
+     * A kick handler may still be running in another thread.  Once a BH
+     * has run in each of the AioContexts, none of them can be.
+     */
+    qatomic_set(&server->pending_barriers, 1);
+    for (i = 0; i < server->max_queues; i++) {
+        if (server->queue_ctx[i]) {
+            qatomic_inc(&server->pending_barriers);
+            aio_bh_schedule_oneshot(server->queue_ctx[i], vu_queue_barrier_bh,
+                                    server);
+        }
+    }
+    if (qatomic_fetch_dec(&server->pending_barriers) != 1) {
+        qemu_coroutine_yield();
+    }
+
+    vu_wait_idle(server);
+}
+
+static void vu_resume_queues(VuServer *server)
+{
+    QEMU_LOCK_GUARD(&server->watch_lock);
+
+    server->queues_paused = false;
+
+    /* If detached, vhost_user_server_attach_aio_context() will do this */
+    if (server->ctx) {
+        vu_attach_fd_watches(server);
+    }
+}
+
 static bool coroutine_fn
 vu_message_read(VuDev *vu_dev, int conn_fd, VhostUserMsg *vmsg)
 {
@@ -187,6 +310,10 @@ vu_message_read(VuDev *vu_dev, int conn_fd, VhostUserMsg *vmsg)
         }
     }
 
+    if (server->queue_ctx) {
+        vu_pause_queues(server);
+    }
+
     return true;
 
 fail:
@@ -210,21 +337,28 @@ static coroutine_fn void vu_client_trip(void *opaque)
         if (!vu_dispatch(vu_dev) && server->ctx) {
             break;
         }
+        if (server->queues_paused) {
+            vu_resume_queues(server);
+        }
     }
 
-    if (vhost_user_server_has_in_flight(server)) {
-        /* Wait for requests to complete before we can unmap the memory */
-        server->wait_idle = true;
-        qemu_coroutine_yield();
-        server->wait_idle = false;
+    /* Wait for requests to complete before we can unmap the memory */
+    if (server->queue_ctx && !server->queues_paused) {
+        vu_pause_queues(server);
+    } else {
+        vu_wait_idle(server);
     }
-    assert(!vhost_user_server_has_in_flight(server));
 
     vu_deinit(vu_dev);
 
     /* vu_deinit() should have called remove_watch() */
     assert(QTAILQ_EMPTY(&server->vu_fd_watches));
 
+    /* The next client starts with running queues */
+    WITH_QEMU_LOCK_GUARD(&server->watch_lock) {
+        server->queues_paused = false;
+    }
+
     object_unref(OBJECT(server->sioc));
     server->sioc = NULL;
 
@@ -260,6 +394,7 @@ static void kick_handler(void *opaque)
     }
 }
 
+/* Called with watch_lock */
 static VuFdWatch *find_vu_fd_watch(VuServer *server, int fd)
 {
 
@@ -278,24 +413,40 @@ set_watch(VuDev *vu_dev, int fd, int vu_evt,
 {
 
     VuServer *server = container_of(vu_dev, VuServer, vu_dev);
+    int i;
+
     g_assert(vu_dev);
     g_assert(fd >= 0);
     g_assert(cb);
 
+    QEMU_LOCK_GUARD(&server->watch_lock);
+
     VuFdWatch *vu_fd_watch = find_vu_fd_watch(server, fd);
 
     if (!vu_fd_watch) {
         vu_fd_watch = g_new0(VuFdWatch, 1);
 
-        QTAILQ_INSERT_TAIL(&server->vu_fd_watches, vu_fd_watch, next);
-
         vu_fd_watch->fd = fd;
         vu_fd_watch->cb = cb;
-        qemu_socket_set_nonblock(fd);
-        aio_set_fd_handler(server->ctx, fd, kick_handler,
-                           NULL, NULL, NULL, vu_fd_watch);
         vu_fd_watch->vu_dev = vu_dev;
         vu_fd_watch->pvt = pvt;
+        vu_fd_watch->queue = -1;
+        for (i = 0; i < vu_dev->max_queues; i++) {
+            if (vu_dev->vq[i].kick_fd == fd) {
+                vu_fd_watch->queue = i;
+                break;
+            }
+        }
+        vu_fd_watch->ctx = vu_fd_watch_aio_context(server, vu_fd_watch);
+        qemu_socket_set_nonblock(fd);
+
+        QTAILQ_INSERT_TAIL(&server->vu_fd_watches, vu_fd_watch, next);
+
+        /* vu_resume_queues() starts monitoring the fd */
+        if (!server->queues_paused) {
+            aio_set_fd_handler(vu_fd_watch->ctx, fd, kick_handler,
+                               NULL, NULL, NULL, vu_fd_watch);
+        }
     }
 }
 
@@ -308,12 +459,20 @@ static void remove_watch(VuDev *vu_dev, int fd)
 
     server = container_of(vu_dev, VuServer, vu_dev);
 
+    /*
+     * The watch can be freed right away: remove_watch() is either called
+     * from the kick handler itself, or while handling a vhost-user message.
+     * In the latter case, no kick handler runs in other threads because the
+     * queues are paused if there are any.
+     */
+    QEMU_LOCK_GUARD(&server->watch_lock);
+
     VuFdWatch *vu_fd_watch = find_vu_fd_watch(server, fd);
 
     if (!vu_fd_watch) {
         return;
     }
-    aio_set_fd_handler(server->ctx, fd, NULL, NULL, NULL, NULL, NULL);
+    aio_set_fd_handler(vu_fd_watch->ctx, fd, NULL, NULL, NULL, NULL, NULL);
 
     QTAILQ_REMOVE(&server->vu_fd_watches, vu_fd_watch, next);
     g_free(vu_fd_watch);
@@ -370,11 +529,8 @@ void vhost_user_server_stop(VuServer *server)
     server->restart_listener_bh = NULL;
 
     if (server->sioc) {
-        VuFdWatch *vu_fd_watch;
-
-        QTAILQ_FOREACH(vu_fd_watch, &server->vu_fd_watches, next) {
-            aio_set_fd_handler(server->ctx, vu_fd_watch->fd,
-                               NULL, NULL, NULL, NULL, vu_fd_watch);
+        WITH_QEMU_LOCK_GUARD(&server->watch_lock) {
+            vu_detach_fd_watches(server);
         }
 
         qio_channel_shutdown(server->ioc, QIO_CHANNEL_SHUTDOWN_BOTH, NULL);
@@ -386,6 +542,8 @@ void vhost_user_server_stop(VuServer *server)
         qio_net_listener_disconnect(server->listener);
         object_unref(OBJECT(server->listener));
     }
+
+    qemu_mutex_destroy(&server->watch_lock);
 }
 
 /*
@@ -403,17 +561,17 @@ static void restart_listener_bh(void *opaque)
 /* Called with ctx acquired */
 void vhost_user_server_attach_aio_context(VuServer *server, AioContext *ctx)
 {
-    VuFdWatch *vu_fd_watch;
-
     server->ctx = ctx;
 
     if (!server->sioc) {
         return;
     }
 
-    QTAILQ_FOREACH(vu_fd_watch, &server->vu_fd_watches, next) {
-        aio_set_fd_handler(ctx, vu_fd_watch->fd, kick_handler, NULL,
-                           NULL, NULL, vu_fd_watch);
+    WITH_QEMU_LOCK_GUARD(&server->watch_lock) {
+        /* vu_resume_queues() will do this if a message is being handled */
+        if (!server->queues_paused) {
+            vu_attach_fd_watches(server);
+        }
     }
 
     if (server->co_trip) {
@@ -441,11 +599,8 @@ void vhost_user_server_attach_aio_context(VuServer *server, AioContext *ctx)
 void vhost_user_server_detach_aio_context(VuServer *server)
 {
     if (server->sioc) {
-        VuFdWatch *vu_fd_watch;
-
-        QTAILQ_FOREACH(vu_fd_watch, &server->vu_fd_watches, next) {
-            aio_set_fd_handler(server->ctx, vu_fd_watch->fd,
-                               NULL, NULL, NULL, NULL, vu_fd_watch);
+        WITH_QEMU_LOCK_GUARD(&server->watch_lock) {
+            vu_detach_fd_watches(server);
         }
     }
 
@@ -463,6 +618,7 @@ bool vhost_user_server_start(VuServer *server,
                              SocketAddress *socket_addr,
                              AioContext *ctx,
                              uint16_t max_queues,
+                             AioContext **queue_ctx,
                              const VuDevIface *vu_iface,
                              Error **errp)
 {
@@ -490,9 +646,12 @@ bool vhost_user_server_start(VuServer *server,
         .restart_listener_bh   = bh,
         .vu_iface              = vu_iface,
         .max_queues            = max_queues,
+        .queue_ctx             = queue_ctx,
         .ctx                   = ctx,
     };
 
+    qemu_mutex_init(&server->watch_lock);
+
     qio_net_listener_set_name(server->listener, "vhost-user-backend-listener");
 
     qio_net_listener_set_client_func(server->listener,